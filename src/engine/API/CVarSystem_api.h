@@ -143,6 +143,8 @@ public:
     virtual void Register( vmCvar_t* vmCvar, StringEntry varName, StringEntry defaultValue, S32 flags ) = 0;
     virtual void Update( vmCvar_t* vmCvar ) = 0;
     virtual void Init( void ) = 0;
+    // the handles changed since *sequence, -1 if the caller has to Update everything
+    virtual S32 Changes( S32* sequence, cvarHandle_t* handles, S32 maxHandles ) = 0;
 };
 
 extern idCVarSystem* cvarSystem;
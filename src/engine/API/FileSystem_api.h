@@ -41,14 +41,28 @@
 // INFO: Little crapy, but its working
 // Basically PAK3 files are ZIP files with BZ2 compression
 
+// idle handles a pack keeps for readers that need their own
+#define MAX_PACK_HANDLES 8
+
 typedef struct fileInPack_s
 {
     UTF8* name; // name of the file
     U64 pos; // file info position in zip
     U64	len;// uncompress file size
+    U64 dataPos; // file data position in zip, 0 until the file was opened once
     struct fileInPack_s* next; // next file in the hash
 } fileInPack_t;
 
+// the files of a pack that share a directory
+typedef struct
+{
+    UTF8* name; // the first file, the directory is its first nameLen characters
+    S32 nameLen;
+    S32 depth; // path separators in the names of the files
+    S32 firstFile; // into pack_t::dirFiles
+    S32 numFiles;
+} packDir_t;
+
 typedef struct
 {
     UTF8 pakFilename[MAX_OSPATH]; // c:\quake3\baseq3\pak0.pk3
@@ -63,10 +77,23 @@ typedef struct
     S32 hashSize; // hash table size (power of 2)
     fileInPack_t** hashTable; // hash table
     fileInPack_t* buildBuffer; // buffer with the filenames etc.
+    void* pooledHandles[MAX_PACK_HANDLES]; // idle handles for unique readers
+    S32 numPooledHandles;
+    S32 poolLock; // SDL spinlock guarding the pool
+    S32 numDirs;
+    packDir_t* dirs; // sorted by name, so a path prefix is a contiguous range
+    S32* dirFiles; // buildBuffer indices grouped by directory
+    void* bundle; // the bundleEntry_t directory of a .owb bundle, NULL for a pk3
+    bool bundleHasPk3; // the pk3 the bundle was made from is in a search path, clients download that
 } pack_t;
 
 #define MAX_FOUND_FILES 0x1000
 
+// called from RunAsyncCallbacks with a file read by ReadFileAsync, buffer is
+// zero terminated and only valid until the callback returns, it is NULL and
+// len -1 if the read failed
+typedef void ( *fileAsyncCallback_t )( StringEntry qpath, void* buffer, S32 len, void* userData );
+
 // idFileSystem
 class idFileSystem
 {
@@ -117,6 +144,8 @@ public:
     virtual S32 FileIsInPAK( StringEntry filename, S32* pChecksum ) = 0;
     virtual S32 ReadFile( StringEntry qpath, void** buffer ) = 0;
     virtual void FreeFile( void* buffer ) = 0;
+    virtual S32 ReadFileAsync( StringEntry qpath, fileAsyncCallback_t callback, void* userData ) = 0;
+    virtual void RunAsyncCallbacks( void ) = 0;
     virtual void WriteFile( StringEntry qpath, const void* buffer, S32 size ) = 0;
     virtual pack_t* LoadZipFile( StringEntry zipfile, StringEntry basename ) = 0;
     virtual S32 ReturnPath( StringEntry zname, UTF8* zpath, S32* depth ) = 0;
@@ -142,6 +142,9 @@ public:
     virtual void        TransformedBoxTrace( trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, clipHandle_t model, S32 brushmask, const vec3_t origin, const vec3_t angles, traceType_t type ) = 0;
     virtual void        BiSphereTrace( trace_t* results, const vec3_t start, const vec3_t end, F32 startRad, F32 endRad, clipHandle_t model, S32 mask ) = 0;
     virtual void        TransformedBiSphereTrace( trace_t* results, const vec3_t start, const vec3_t end, F32 startRad, F32 endRad, clipHandle_t model, S32 mask, const vec3_t origin ) = 0;
+    // sweeps a capsule against many unrotated capsules given by world space bounds,
+    // hitNum is the index of the one that stopped the trace or -1
+    virtual void        CapsuleTraceBatch( trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, const vec3_t* capsuleMins, const vec3_t* capsuleMaxs, S32 numCapsules, S32* hitNum ) = 0;
     
     virtual U8*       ClusterPVS( S32 cluster ) = 0;
     
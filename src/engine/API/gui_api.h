@@ -92,6 +92,7 @@ void trap_Print( StringEntry string );
 S32 trap_Milliseconds( void );
 void trap_Cvar_Register( vmCvar_t* cvar, StringEntry var_name, StringEntry value, S32 flags );
 void trap_Cvar_Update( vmCvar_t* cvar );
+S32 trap_Cvar_Changes( S32* sequence, cvarHandle_t* handles, S32 maxHandles );
 void trap_Cvar_Set( StringEntry var_name, StringEntry value );
 F32 trap_Cvar_VariableValue( StringEntry var_name );
 void trap_Cvar_VariableStringBuffer( StringEntry var_name, UTF8* buffer, S32 bufsize );
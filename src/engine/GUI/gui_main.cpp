@@ -4689,11 +4689,30 @@ UI_UpdateCvars
 */
 void UI_UpdateCvars( void )
 {
-    S32     i;
+    static S32 sequence;
+    cvarHandle_t handles[64];
+    S32     i, j, count;
     cvarTable_t* cv;
     
-    for( i = 0, cv = cvarTable ; i < cvarTableSize ; i++, cv++ )
-        trap_Cvar_Update( cv->vmCvar );
+    // only look at what changed since last time, almost always nothing
+    count = trap_Cvar_Changes( &sequence, handles, ARRAY_LEN( handles ) );
+    if( count < 0 )
+    {
+        for( i = 0, cv = cvarTable ; i < cvarTableSize ; i++, cv++ )
+            trap_Cvar_Update( cv->vmCvar );
+        return;
+    }
+    
+    for( j = 0; j < count; j++ )
+    {
+        for( i = 0, cv = cvarTable ; i < cvarTableSize ; i++, cv++ )
+        {
+            if( cv->vmCvar->handle == handles[j] )
+            {
+                trap_Cvar_Update( cv->vmCvar );
+            }
+        }
+    }
 }
 
 bool idUserInterfaceManagerLocal::WantsBindKeys( void )
@@ -1057,6 +1057,11 @@ void trap_Cvar_Update( vmCvar_t* cvar )
     cvarSystem->Update( cvar );
 }
 
+S32 trap_Cvar_Changes( S32* sequence, cvarHandle_t* handles, S32 maxHandles )
+{
+    return cvarSystem->Changes( sequence, handles, maxHandles );
+}
+
 void trap_Cvar_Set( StringEntry var_name, StringEntry value )
 {
     cvarSystem->Set( var_name, value );
@@ -0,0 +1,474 @@
+////////////////////////////////////////////////////////////////////////////////////////
+// Copyright(C) 1999 - 2010 id Software LLC, a ZeniMax Media company.
+// Copyright(C) 2011 - 2018 Dusan Jocic <dusanjocic@msn.com>
+//
+// This file is part of the OpenWolf GPL Source Code.
+// OpenWolf Source Code is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenWolf Source Code is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenWolf Source Code.  If not, see <http://www.gnu.org/licenses/>.
+//
+// In addition, the OpenWolf Source Code is also subject to certain additional terms.
+// You should have received a copy of these additional terms immediately following the
+// terms and conditions of the GNU General Public License which accompanied the
+// OpenWolf Source Code. If not, please request a copy in writing from id Software
+// at the address below.
+//
+// If you have questions concerning this license or the applicable additional terms,
+// you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+// Suite 120, Rockville, Maryland 20850 USA.
+//
+// -------------------------------------------------------------------------------------
+// File name:   cm_benchmark.cpp
+// Version:     v1.01
+// Created:
+// Compilers:   Visual Studio 2017, gcc 7.3.0
+// Description: Capture and timed replay of collision queries
+// -------------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef DEDICATED
+#include <null/null_precompiled.h>
+#else
+#include <OWLib/precompiled.h>
+#endif
+
+/*
+
+cm_record writes every public collision query made against the loaded map to
+a file, together with the temporary box model it was made against.
+cm_benchmark loads that map again and replays the file, timing each query on
+its own so a change to the collision code can be compared on the exact load a
+real server produced.  A dedicated server can run it without a game:
+
+    +cm_benchmark queries.cmq 10 +quit
+
+*/
+
+#define CMQ_IDENT       ( ( 'R' << 24 ) + ( 'Q' << 16 ) + ( 'M' << 8 ) + 'C' )
+#define CMQ_VERSION     1
+
+typedef struct
+{
+    S32             ident;
+    S32             version;
+    UTF8            mapname[MAX_QPATH];
+} cmQueryHeader_t;
+
+typedef struct
+{
+    S32             op;
+    S32             model;
+    S32             mask;
+    S32             type;
+    vec3_t          start;
+    vec3_t          end;
+    vec3_t          mins;
+    vec3_t          maxs;
+    vec3_t          origin;
+    vec3_t          angles;
+    F32             startRad;
+    F32             endRad;
+    
+    // temporary box model state, only for BOX_MODEL_HANDLE and CAPSULE_MODEL_HANDLE
+    vec3_t          boxMins;
+    vec3_t          boxMaxs;
+    S32             boxContents;
+} cmQuery_t;
+
+static StringEntry cm_queryNames[CMQ_NUM_TYPES] =
+{
+    "boxtrace",
+    "transformedboxtrace",
+    "bispheretrace",
+    "pointcontents"
+};
+
+extern cmodel_t box_model;
+extern cbrush_t* box_brush;
+
+fileHandle_t    cm_recordFile;
+static S32      cm_recordCount;
+static bool     cm_replaying;
+
+/*
+==================
+CM_RecordQuery
+==================
+*/
+void CM_RecordQuery( cmQueryType_t op, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, clipHandle_t model, S32 mask, S32 type,
+                     const vec3_t origin, const vec3_t angles, F32 startRad, F32 endRad )
+{
+    cmQuery_t       q;
+    
+    if( !cm_recordFile || cm_replaying )
+    {
+        return;
+    }
+    
+    ::memset( &q, 0, sizeof( q ) );
+    q.op = op;
+    q.model = model;
+    q.mask = mask;
+    q.type = type;
+    q.startRad = startRad;
+    q.endRad = endRad;
+    
+    if( start )
+    {
+        VectorCopy( start, q.start );
+    }
+    if( end )
+    {
+        VectorCopy( end, q.end );
+    }
+    if( mins )
+    {
+        VectorCopy( mins, q.mins );
+    }
+    if( maxs )
+    {
+        VectorCopy( maxs, q.maxs );
+    }
+    if( origin )
+    {
+        VectorCopy( origin, q.origin );
+    }
+    if( angles )
+    {
+        VectorCopy( angles, q.angles );
+    }
+    
+    if( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE )
+    {
+        VectorCopy( box_model.mins, q.boxMins );
+        VectorCopy( box_model.maxs, q.boxMaxs );
+        q.boxContents = box_brush->contents;
+    }
+    
+    fileSystem->Write( &q, sizeof( q ), cm_recordFile );
+    cm_recordCount++;
+}
+
+/*
+==================
+CM_StopRecording
+==================
+*/
+void CM_StopRecording( void )
+{
+    if( !cm_recordFile )
+    {
+        return;
+    }
+    
+    fileSystem->FCloseFile( cm_recordFile );
+    cm_recordFile = 0;
+    
+    Com_Printf( "Stopped recording, %i collision queries written\n", cm_recordCount );
+}
+
+/*
+==================
+CM_Record_f
+==================
+*/
+void CM_Record_f( void )
+{
+    cmQueryHeader_t header;
+    UTF8            filename[MAX_QPATH];
+    
+    if( Cmd_Argc() != 2 )
+    {
+        Com_Printf( "usage: cm_record <filename>\n" );
+        return;
+    }
+    
+    if( !cm.name[0] )
+    {
+        Com_Printf( "cm_record: no map loaded\n" );
+        return;
+    }
+    
+    CM_StopRecording();
+    
+    Q_strncpyz( filename, Cmd_Argv( 1 ), sizeof( filename ) );
+    COM_DefaultExtension( filename, sizeof( filename ), ".cmq" );
+    
+    cm_recordFile = fileSystem->FOpenFileWrite( filename );
+    if( !cm_recordFile )
+    {
+        Com_Printf( "cm_record: couldn't open %s\n", filename );
+        return;
+    }
+    
+    ::memset( &header, 0, sizeof( header ) );
+    header.ident = CMQ_IDENT;
+    header.version = CMQ_VERSION;
+    Q_strncpyz( header.mapname, cm.name, sizeof( header.mapname ) );
+    
+    fileSystem->Write( &header, sizeof( header ), cm_recordFile );
+    cm_recordCount = 0;
+    
+    Com_Printf( "Recording collision queries on %s to %s\n", cm.name, filename );
+}
+
+/*
+==================
+CM_StopRecord_f
+==================
+*/
+void CM_StopRecord_f( void )
+{
+    if( !cm_recordFile )
+    {
+        Com_Printf( "Not recording collision queries\n" );
+        return;
+    }
+    
+    CM_StopRecording();
+}
+
+/*
+==================
+CM_RunQuery
+==================
+*/
+static void CM_RunQuery( const cmQuery_t* q )
+{
+    trace_t         trace;
+    
+    switch( q->op )
+    {
+        case CMQ_BOXTRACE:
+            collisionModelManagerLocal.BoxTrace( &trace, q->start, q->end, q->mins, q->maxs, q->model, q->mask, ( traceType_t )q->type );
+            break;
+        case CMQ_TRANSFORMEDBOXTRACE:
+            collisionModelManagerLocal.TransformedBoxTrace( &trace, q->start, q->end, q->mins, q->maxs, q->model, q->mask, q->origin, q->angles, ( traceType_t )q->type );
+            break;
+        case CMQ_BISPHERETRACE:
+            collisionModelManagerLocal.BiSphereTrace( &trace, q->start, q->end, q->startRad, q->endRad, q->model, q->mask );
+            break;
+        case CMQ_POINTCONTENTS:
+            collisionModelManagerLocal.PointContents( q->start, q->model );
+            break;
+    }
+}
+
+/*
+==================
+CM_CompareTimes
+==================
+*/
+static S32 CM_CompareTimes( const void* a, const void* b )
+{
+    F32 ta = *( const F32* )a;
+    F32 tb = *( const F32* )b;
+    
+    if( ta < tb )
+    {
+        return -1;
+    }
+    if( ta > tb )
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/*
+==================
+CM_Benchmark_f
+
+Replays a file written by cm_record, reporting the mean time of each query
+type and the percentiles of the per query times
+==================
+*/
+void CM_Benchmark_f( void )
+{
+    cmQueryHeader_t header;
+    cmQuery_t*      queries;
+    cmQuery_t*      q;
+    F32*            times;
+    F32*            sorted;
+    UTF8            filename[MAX_QPATH];
+    UTF8            traceCache[MAX_CVAR_VALUE_STRING];
+    fileHandle_t    f;
+    S32             length, numQueries, numSkipped, iterations, checksum;
+    S32             i, j, n, op;
+    S64             start, total, wall;
+    F64             sum;
+    
+    if( Cmd_Argc() < 2 )
+    {
+        Com_Printf( "usage: cm_benchmark <filename> [iterations]\n" );
+        return;
+    }
+    
+    if( cm_recordFile )
+    {
+        Com_Printf( "cm_benchmark: stop recording first\n" );
+        return;
+    }
+    
+    iterations = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 1;
+    if( iterations < 1 )
+    {
+        iterations = 1;
+    }
+    
+    Q_strncpyz( filename, Cmd_Argv( 1 ), sizeof( filename ) );
+    COM_DefaultExtension( filename, sizeof( filename ), ".cmq" );
+    
+    length = fileSystem->FOpenFileRead( filename, &f, true );
+    if( !f )
+    {
+        Com_Printf( "cm_benchmark: couldn't open %s\n", filename );
+        return;
+    }
+    
+    if( length < ( S32 )sizeof( header ) || fileSystem->Read( &header, sizeof( header ), f ) != sizeof( header ) ||
+            header.ident != CMQ_IDENT || header.version != CMQ_VERSION )
+    {
+        Com_Printf( "cm_benchmark: %s is not a collision query file\n", filename );
+        fileSystem->FCloseFile( f );
+        return;
+    }
+    header.mapname[sizeof( header.mapname ) - 1] = '\0';
+    
+    numQueries = ( length - sizeof( header ) ) / sizeof( cmQuery_t );
+    if( !numQueries )
+    {
+        Com_Printf( "cm_benchmark: %s holds no queries\n", filename );
+        fileSystem->FCloseFile( f );
+        return;
+    }
+    
+    // the queries are only meaningful against the map they were recorded on,
+    // and a clip map in use by the server or a connected client must not be
+    // swapped out underneath it.  cm.name is only set for server loads, so a
+    // map the client loaded shows by its nodes and models alone.
+    if( Q_stricmp( cm.name, header.mapname ) )
+    {
+        if( cm.name[0] || cm.numNodes || cm.numSubModels )
+        {
+            Com_Printf( "cm_benchmark: %s was recorded on %s, but %s is loaded\n", filename, header.mapname, cm.name[0] ? cm.name : "another map" );
+            fileSystem->FCloseFile( f );
+            return;
+        }
+        
+        collisionModelManagerLocal.LoadMap( header.mapname, false, &checksum );
+    }
+    
+    queries = ( cmQuery_t* )Z_Malloc( numQueries * sizeof( cmQuery_t ) );
+    times = ( F32* )Z_Malloc( numQueries * sizeof( F32 ) * 2 );
+    sorted = times + numQueries;
+    
+    fileSystem->Read( queries, numQueries * sizeof( cmQuery_t ), f );
+    fileSystem->FCloseFile( f );
+    
+    // drop anything the current map can't resolve rather than erroring out half way
+    for( i = 0, numSkipped = 0; i < numQueries; i++ )
+    {
+        q = &queries[i];
+        
+        if( q->op < 0 || q->op >= CMQ_NUM_TYPES ||
+                ( q->model != BOX_MODEL_HANDLE && q->model != CAPSULE_MODEL_HANDLE && ( q->model < 0 || q->model >= cm.numSubModels ) ) )
+        {
+            q->op = -1;
+            numSkipped++;
+        }
+    }
+    
+    Com_Printf( "Replaying %i collision queries from %s on %s, %i iterations\n", numQueries - numSkipped, filename, header.mapname, iterations );
+    
+    cm_replaying = true;
+    
+    // with the world trace cache on every pass after the first would time cache hits
+    Q_strncpyz( traceCache, cm_traceCache->string, sizeof( traceCache ) );
+    if( cm_traceCache->integer )
+    {
+        cvarSystem->Set( "cm_traceCache", "0" );
+    }
+    
+    ::memset( times, 0, numQueries * sizeof( F32 ) );
+    wall = Sys_Microseconds();
+    
+    for( j = 0; j < iterations; j++ )
+    {
+        for( i = 0, q = queries; i < numQueries; i++, q++ )
+        {
+            if( q->op < 0 )
+            {
+                continue;
+            }
+            
+            // restoring the temporary box is not part of the query
+            if( q->model == BOX_MODEL_HANDLE || q->model == CAPSULE_MODEL_HANDLE )
+            {
+                collisionModelManagerLocal.TempBoxModel( q->boxMins, q->boxMaxs, q->model == CAPSULE_MODEL_HANDLE );
+                collisionModelManagerLocal.SetTempBoxModelContents( q->boxContents );
+            }
+            
+            start = Sys_Microseconds();
+            CM_RunQuery( q );
+            times[i] += ( F32 )( Sys_Microseconds() - start );
+        }
+    }
+    
+    wall = Sys_Microseconds() - wall;
+    cm_replaying = false;
+    
+    if( strcmp( cm_traceCache->string, traceCache ) )
+    {
+        cvarSystem->Set( "cm_traceCache", traceCache );
+    }
+    
+    Com_Printf( "%-20s %8s %10s %12s %9s %9s %9s %9s\n", "query", "count", "total ms", "queries/s", "p50 us", "p90 us", "p99 us", "max us" );
+    
+    total = 0;
+    for( op = 0; op < CMQ_NUM_TYPES; op++ )
+    {
+        sum = 0;
+        for( i = 0, n = 0; i < numQueries; i++ )
+        {
+            if( queries[i].op != op )
+            {
+                continue;
+            }
+            
+            sorted[n] = times[i] / iterations;
+            sum += times[i];
+            n++;
+        }
+        
+        if( !n )
+        {
+            continue;
+        }
+        
+        qsort( sorted, n, sizeof( F32 ), CM_CompareTimes );
+        total += n;
+        
+        Com_Printf( "%-20s %8i %10.2f %12.0f %9.2f %9.2f %9.2f %9.2f\n", cm_queryNames[op], n, sum / 1000.0, sum > 0 ? ( F64 )n * iterations * 1000000.0 / sum : 0.0,
+                    sorted[n / 2], sorted[( n * 90 ) / 100], sorted[( n * 99 ) / 100], sorted[n - 1] );
+    }
+    
+    Com_Printf( "%i queries in %.2f ms wall clock, %.0f queries/s\n", ( S32 )total * iterations, wall / 1000.0,
+                wall > 0 ? ( F64 )total * iterations * 1000000.0 / wall : 0.0 );
+    if( numSkipped )
+    {
+        Com_Printf( "%i queries skipped, their models don't exist on this map\n", numSkipped );
+    }
+    
+    Z_Free( times );
+    Z_Free( queries );
+}
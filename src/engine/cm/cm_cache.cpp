@@ -0,0 +1,436 @@
+////////////////////////////////////////////////////////////////////////////////////////
+// Copyright(C) 1999 - 2010 id Software LLC, a ZeniMax Media company.
+// Copyright(C) 2011 - 2018 Dusan Jocic <dusanjocic@msn.com>
+//
+// This file is part of the OpenWolf GPL Source Code.
+// OpenWolf Source Code is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenWolf Source Code is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenWolf Source Code.  If not, see <http://www.gnu.org/licenses/>.
+//
+// In addition, the OpenWolf Source Code is also subject to certain additional terms.
+// You should have received a copy of these additional terms immediately following the
+// terms and conditions of the GNU General Public License which accompanied the
+// OpenWolf Source Code. If not, please request a copy in writing from id Software
+// at the address below.
+//
+// If you have questions concerning this license or the applicable additional terms,
+// you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+// Suite 120, Rockville, Maryland 20850 USA.
+//
+// -------------------------------------------------------------------------------------
+// File name:   cm_cache.cpp
+// Version:     v1.01
+// Created:
+// Compilers:   Visual Studio 2017, gcc 7.3.0
+// Description: Precomputed collision cache (.cmcache) stored alongside the BSP
+// -------------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef DEDICATED
+#include <null/null_precompiled.h>
+#else
+#include <OWLib/precompiled.h>
+#endif
+
+/*
+
+The collision cache holds everything idCollisionModelManagerLocal::LoadMap derives
+from the BSP lumps that is expensive to rebuild: the brush edges produced by
+CMod_CreateBrushSideWindings and the facet/plane structures generated for patches
+and triangle soups.
+
+The file is a single relocatable block.  Every pointer inside it is stored as a
+byte offset from the start of the block, so loading is a validation pass, one
+hunk allocation and a pointer fix-up.  The layout is host native; a cache written
+by a different build (struct sizes, byte order) simply fails validation and is
+regenerated.
+
+*/
+
+#define CMCACHE_IDENT           ( ( 'H' << 24 ) + ( 'C' << 16 ) + ( 'M' << 8 ) + 'C' )
+#define CMCACHE_VERSION         1
+
+#define CMCACHE_PERPOLY         1
+#define CMCACHE_FORCETRIANGLES  2
+
+#define CMCACHE_ALIGN( x )      ( ( ( x ) + 15 ) & ~15 )
+
+typedef struct
+{
+    S32             ident;
+    S32             version;
+    U32             checksum;           // CM_Checksum of the source BSP
+    U32             indexChecksum;      // trisoup collision also depends on the index lump
+    S32             flags;
+    S32             structSizes[5];     // guards against layouts written by a different build
+    S32             numBrushes;
+    S32             numSurfaces;
+    S32             totalEdges;
+    S32             edgeCountsOfs;      // S32[numBrushes]
+    S32             edgesOfs;           // cbrushedge_t[totalEdges]
+    S32             surfacesOfs;        // S32[numSurfaces], offset of a cSurface_t or 0
+    S32             dataSize;           // total length of the block
+} cmCacheHeader_t;
+
+cvar_t*         cm_cache;
+
+/*
+==================
+CM_CacheFlags
+==================
+*/
+static S32 CM_CacheFlags( void )
+{
+    S32 flags = 0;
+    
+    if( cm.perPolyCollision )
+    {
+        flags |= CMCACHE_PERPOLY;
+    }
+    if( cm_forceTriangles->integer )
+    {
+        flags |= CMCACHE_FORCETRIANGLES;
+    }
+    
+    return flags;
+}
+
+/*
+==================
+CM_CacheSetStructSizes
+==================
+*/
+static void CM_CacheSetStructSizes( S32* sizes )
+{
+    sizes[0] = sizeof( cbrushedge_t );
+    sizes[1] = sizeof( cSurface_t );
+    sizes[2] = sizeof( cSurfaceCollide_t );
+    sizes[3] = sizeof( cPlane_t );
+    sizes[4] = sizeof( cFacet_t );
+}
+
+/*
+==================
+CM_CachePath
+==================
+*/
+static void CM_CachePath( StringEntry name, UTF8* path, S32 size )
+{
+    UTF8 stripped[MAX_QPATH];
+    
+    COM_StripExtension( name, stripped );
+    Com_sprintf( path, size, "%s.cmcache", stripped );
+}
+
+/*
+==================
+CM_CacheOffsetValid
+==================
+*/
+static bool CM_CacheOffsetValid( intptr_t ofs, intptr_t length, S32 dataSize )
+{
+    return ofs >= ( intptr_t )sizeof( cmCacheHeader_t ) && length >= 0 && ofs + length <= dataSize;
+}
+
+/*
+==================
+CM_CacheTablesValid
+
+Checks every count and offset in the edge and surface tables of a cache that
+passed the header checks, before anything is allocated or assigned
+==================
+*/
+static bool CM_CacheTablesValid( const U8* base, S32 length )
+{
+    const cmCacheHeader_t*      cache;
+    const cSurface_t*           surface;
+    const cSurfaceCollide_t*    sc;
+    const S32*                  edgeCounts, *surfaceOfs;
+    S32                         i, edgeOfs;
+    intptr_t                    end;
+    
+    cache = ( const cmCacheHeader_t* )base;
+    
+    edgeCounts = ( const S32* )( base + cache->edgeCountsOfs );
+    edgeOfs = 0;
+    for( i = 0; i < cache->numBrushes; i++ )
+    {
+        if( edgeCounts[i] < 0 || edgeOfs + edgeCounts[i] > cache->totalEdges )
+        {
+            return false;
+        }
+        edgeOfs += edgeCounts[i];
+    }
+    
+    surfaceOfs = ( const S32* )( base + cache->surfacesOfs );
+    end = cache->surfacesOfs + ( intptr_t )cache->numSurfaces * sizeof( S32 );
+    for( i = 0; i < cache->numSurfaces; i++ )
+    {
+        if( !surfaceOfs[i] )
+        {
+            continue;
+        }
+        
+        // each surface, its collide, planes and facets follow the previous ones,
+        // so nothing can overlap and be fixed up twice
+        if( surfaceOfs[i] < end || !CM_CacheOffsetValid( surfaceOfs[i], sizeof( cSurface_t ), length ) )
+        {
+            return false;
+        }
+        
+        surface = ( const cSurface_t* )( base + surfaceOfs[i] );
+        if( ( intptr_t )surface->sc < surfaceOfs[i] + ( intptr_t )sizeof( cSurface_t ) ||
+                !CM_CacheOffsetValid( ( intptr_t )surface->sc, sizeof( cSurfaceCollide_t ), length ) )
+        {
+            return false;
+        }
+        
+        sc = ( const cSurfaceCollide_t* )( base + ( intptr_t )surface->sc );
+        if( sc->numPlanes < 0 || sc->numFacets < 0 ||
+                ( intptr_t )sc->planes < ( intptr_t )surface->sc + ( intptr_t )sizeof( cSurfaceCollide_t ) ||
+                !CM_CacheOffsetValid( ( intptr_t )sc->planes, ( intptr_t )sc->numPlanes * sizeof( cPlane_t ), length ) ||
+                ( intptr_t )sc->facets < ( intptr_t )sc->planes + ( intptr_t )sc->numPlanes * ( intptr_t )sizeof( cPlane_t ) ||
+                !CM_CacheOffsetValid( ( intptr_t )sc->facets, ( intptr_t )sc->numFacets * sizeof( cFacet_t ), length ) )
+        {
+            return false;
+        }
+        
+        end = ( intptr_t )sc->facets + ( intptr_t )sc->numFacets * sizeof( cFacet_t );
+    }
+    
+    return true;
+}
+
+/*
+==================
+CM_LoadCollisionCache
+
+Replaces CMod_LoadSurfaces and CMod_CreateBrushSideWindings when a valid
+cache exists.  Must be called after the brushes and entity string are loaded.
+==================
+*/
+bool CM_LoadCollisionCache( StringEntry name, dheader_t* header )
+{
+    UTF8                path[MAX_QPATH];
+    cmCacheHeader_t*    cache;
+    U8*                 base;
+    S32                 i, length, structSizes[5], *edgeCounts, *surfaceOfs, edgeOfs;
+    cSurface_t*         surface;
+    cSurfaceCollide_t*  sc;
+    void*               buffer;
+    
+    if( !cm_cache->integer )
+    {
+        return false;
+    }
+    
+    CM_CachePath( name, path, sizeof( path ) );
+    
+    length = fileSystem->ReadFile( path, &buffer );
+    if( length <= 0 || !buffer )
+    {
+        return false;
+    }
+    
+    cache = ( cmCacheHeader_t* )buffer;
+    CM_CacheSetStructSizes( structSizes );
+    
+    if( length < ( S32 )sizeof( *cache ) || cache->ident != CMCACHE_IDENT || cache->version != CMCACHE_VERSION ||
+            cache->dataSize != length || ::memcmp( cache->structSizes, structSizes, sizeof( structSizes ) ) ||
+            cache->checksum != CM_Checksum( header ) || cache->indexChecksum != CM_LumpChecksum( &header->lumps[LUMP_DRAWINDEXES] ) ||
+            cache->flags != CM_CacheFlags() || cache->numBrushes != cm.numBrushes ||
+            cache->numSurfaces != ( S32 )( header->lumps[LUMP_SURFACES].filelen / sizeof( dsurface_t ) ) || cache->totalEdges < 0 ||
+            !CM_CacheOffsetValid( cache->edgeCountsOfs, ( intptr_t )cache->numBrushes * sizeof( S32 ), length ) ||
+            !CM_CacheOffsetValid( cache->edgesOfs, ( intptr_t )cache->totalEdges * sizeof( cbrushedge_t ), length ) ||
+            !CM_CacheOffsetValid( cache->surfacesOfs, ( intptr_t )cache->numSurfaces * sizeof( S32 ), length ) )
+    {
+        Com_DPrintf( "CM_LoadCollisionCache: %s is stale, rebuilding\n", path );
+        fileSystem->FreeFile( buffer );
+        return false;
+    }
+    
+    // a corrupt table must not cost hunk space or leave brushes half assigned
+    if( !CM_CacheTablesValid( ( const U8* )buffer, length ) )
+    {
+        Com_Printf( S_COLOR_YELLOW "WARNING: %s is corrupt, rebuilding\n", path );
+        fileSystem->FreeFile( buffer );
+        return false;
+    }
+    
+    // the block lives as long as the rest of the clip map
+    base = ( U8* )Hunk_Alloc( length, h_high );
+    ::memcpy( base, buffer, length );
+    fileSystem->FreeFile( buffer );
+    
+    cache = ( cmCacheHeader_t* )base;
+    
+    // brush edges
+    edgeCounts = ( S32* )( base + cache->edgeCountsOfs );
+    edgeOfs = 0;
+    for( i = 0; i < cm.numBrushes; i++ )
+    {
+        cm.brushes[i].edges = ( cbrushedge_t* )( base + cache->edgesOfs ) + edgeOfs;
+        cm.brushes[i].numEdges = edgeCounts[i];
+        edgeOfs += edgeCounts[i];
+    }
+    
+    // surfaces, fix up the offsets stored in place of the pointers
+    cm.numSurfaces = cache->numSurfaces;
+    cm.surfaces = ( cSurface_t** )Hunk_Alloc( cm.numSurfaces * sizeof( cm.surfaces[0] ), h_high );
+    
+    surfaceOfs = ( S32* )( base + cache->surfacesOfs );
+    for( i = 0; i < cm.numSurfaces; i++ )
+    {
+        if( !surfaceOfs[i] )
+        {
+            continue;
+        }
+        
+        surface = ( cSurface_t* )( base + surfaceOfs[i] );
+        sc = ( cSurfaceCollide_t* )( base + ( intptr_t )surface->sc );
+        sc->planes = ( cPlane_t* )( base + ( intptr_t )sc->planes );
+        sc->facets = ( cFacet_t* )( base + ( intptr_t )sc->facets );
+        surface->sc = sc;
+        surface->checkcount = 0;
+        
+        cm.surfaces[i] = surface;
+    }
+    
+    Com_Printf( "Loaded collision cache %s\n", path );
+    
+    return true;
+}
+
+/*
+==================
+CM_WriteCollisionCache
+
+Flattens the derived collision data of the freshly loaded map into a cache
+file in the home path.
+==================
+*/
+void CM_WriteCollisionCache( StringEntry name, dheader_t* header )
+{
+    UTF8                path[MAX_QPATH];
+    cmCacheHeader_t*    cache;
+    U8*                 base;
+    S32                 i, j, size, ofs, totalEdges, *edgeCounts, *surfaceOfs;
+    cSurface_t*         surface;
+    cSurfaceCollide_t*  sc;
+    cPlane_t*           planes;
+    
+    if( !cm_cache->integer )
+    {
+        return;
+    }
+    
+    // measure
+    totalEdges = 0;
+    for( i = 0; i < cm.numBrushes; i++ )
+    {
+        totalEdges += cm.brushes[i].numEdges;
+    }
+    
+    size = CMCACHE_ALIGN( sizeof( cmCacheHeader_t ) );
+    size += CMCACHE_ALIGN( cm.numBrushes * sizeof( S32 ) );
+    size += CMCACHE_ALIGN( totalEdges * sizeof( cbrushedge_t ) );
+    size += CMCACHE_ALIGN( cm.numSurfaces * sizeof( S32 ) );
+    
+    for( i = 0; i < cm.numSurfaces; i++ )
+    {
+        surface = cm.surfaces[i];
+        if( !surface || !surface->sc )
+        {
+            continue;
+        }
+        
+        size += CMCACHE_ALIGN( sizeof( cSurface_t ) );
+        size += CMCACHE_ALIGN( sizeof( cSurfaceCollide_t ) );
+        size += CMCACHE_ALIGN( surface->sc->numPlanes * sizeof( cPlane_t ) );
+        size += CMCACHE_ALIGN( surface->sc->numFacets * sizeof( cFacet_t ) );
+    }
+    
+    base = ( U8* )Z_Malloc( size );
+    ::memset( base, 0, size );
+    
+    cache = ( cmCacheHeader_t* )base;
+    cache->ident = CMCACHE_IDENT;
+    cache->version = CMCACHE_VERSION;
+    cache->checksum = CM_Checksum( header );
+    cache->indexChecksum = CM_LumpChecksum( &header->lumps[LUMP_DRAWINDEXES] );
+    cache->flags = CM_CacheFlags();
+    CM_CacheSetStructSizes( cache->structSizes );
+    cache->numBrushes = cm.numBrushes;
+    cache->numSurfaces = cm.numSurfaces;
+    cache->totalEdges = totalEdges;
+    cache->dataSize = size;
+    
+    ofs = CMCACHE_ALIGN( sizeof( cmCacheHeader_t ) );
+    
+    // brush edges
+    cache->edgeCountsOfs = ofs;
+    edgeCounts = ( S32* )( base + ofs );
+    ofs += CMCACHE_ALIGN( cm.numBrushes * sizeof( S32 ) );
+    
+    cache->edgesOfs = ofs;
+    for( i = 0; i < cm.numBrushes; i++ )
+    {
+        edgeCounts[i] = cm.brushes[i].numEdges;
+        ::memcpy( base + ofs, cm.brushes[i].edges, cm.brushes[i].numEdges * sizeof( cbrushedge_t ) );
+        ofs += cm.brushes[i].numEdges * sizeof( cbrushedge_t );
+    }
+    ofs = cache->edgesOfs + CMCACHE_ALIGN( totalEdges * sizeof( cbrushedge_t ) );
+    
+    // surfaces, pointers are replaced with offsets from the start of the block
+    cache->surfacesOfs = ofs;
+    surfaceOfs = ( S32* )( base + ofs );
+    ofs += CMCACHE_ALIGN( cm.numSurfaces * sizeof( S32 ) );
+    
+    for( i = 0; i < cm.numSurfaces; i++ )
+    {
+        if( !cm.surfaces[i] || !cm.surfaces[i]->sc )
+        {
+            continue;
+        }
+        
+        surfaceOfs[i] = ofs;
+        surface = ( cSurface_t* )( base + ofs );
+        *surface = *cm.surfaces[i];
+        surface->checkcount = 0;
+        ofs += CMCACHE_ALIGN( sizeof( cSurface_t ) );
+        
+        surface->sc = ( cSurfaceCollide_t* )( intptr_t )ofs;
+        sc = ( cSurfaceCollide_t* )( base + ofs );
+        *sc = *cm.surfaces[i]->sc;
+        ofs += CMCACHE_ALIGN( sizeof( cSurfaceCollide_t ) );
+        
+        planes = ( cPlane_t* )( base + ofs );
+        ::memcpy( planes, cm.surfaces[i]->sc->planes, sc->numPlanes * sizeof( cPlane_t ) );
+        for( j = 0; j < sc->numPlanes; j++ )
+        {
+            planes[j].hashChain = NULL;
+        }
+        sc->planes = ( cPlane_t* )( intptr_t )ofs;
+        ofs += CMCACHE_ALIGN( sc->numPlanes * sizeof( cPlane_t ) );
+        
+        ::memcpy( base + ofs, cm.surfaces[i]->sc->facets, sc->numFacets * sizeof( cFacet_t ) );
+        sc->facets = ( cFacet_t* )( intptr_t )ofs;
+        ofs += CMCACHE_ALIGN( sc->numFacets * sizeof( cFacet_t ) );
+    }
+    
+    CM_CachePath( name, path, sizeof( path ) );
+    fileSystem->WriteFile( path, base, size );
+    
+    Z_Free( base );
+    
+    Com_DPrintf( "Wrote collision cache %s (%i bytes)\n", path, size );
+}
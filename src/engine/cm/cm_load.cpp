@@ -95,8 +95,11 @@ cvar_t*         cm_playerCurveClip;
 cvar_t*         cm_optimize;
 cvar_t*         cm_showCurves;
 cvar_t*         cm_showTriangles;
+cvar_t*         cm_traceCache;
 #endif
 
+traceCache_t    cm_worldTraceCache;
+
 cmodel_t        box_model;
 cplane_t*       box_planes;
 cbrush_t*       box_brush;
@@ -1177,6 +1180,8 @@ void idCollisionModelManagerLocal::LoadMap( StringEntry name, bool clientload, S
     cm_optimize = cvarSystem->Get( "cm_optimize", "1", CVAR_CHEAT );
     cm_showCurves = cvarSystem->Get( "cm_showCurves", "0", CVAR_CHEAT );
     cm_showTriangles = cvarSystem->Get( "cm_showTriangles", "0", CVAR_CHEAT );
+    cm_cache = cvarSystem->Get( "cm_cache", "1", CVAR_ARCHIVE );
+    cm_traceCache = cvarSystem->Get( "cm_traceCache", "0", CVAR_ARCHIVE );
 #endif
     Com_DPrintf( "CM_LoadMap( %s, %i )\n", name, clientload );
     
@@ -1187,8 +1192,12 @@ void idCollisionModelManagerLocal::LoadMap( StringEntry name, bool clientload, S
     }
     
     // free old stuff
+#ifndef BSPC
+    CM_StopRecording();
+#endif
     ::memset( &cm, 0, sizeof( cm ) );
     CM_ClearLevelPatches();
+    CM_TraceCacheClear( &cm_worldTraceCache );
     
     if( !name[0] )
     {
@@ -1242,9 +1251,20 @@ void idCollisionModelManagerLocal::LoadMap( StringEntry name, bool clientload, S
     CMod_LoadNodes( &header.lumps[LUMP_NODES] );
     CMod_LoadEntityString( &header.lumps[LUMP_ENTITIES] );
     CMod_LoadVisibility( &header.lumps[LUMP_VISIBILITY] );
-    CMod_LoadSurfaces( &header.lumps[LUMP_SURFACES], &header.lumps[LUMP_DRAWVERTS], &header.lumps[LUMP_DRAWINDEXES] );
     
-    CMod_CreateBrushSideWindings();
+#ifndef BSPC
+    // the brush edges and surface facets are the slow part, try the precomputed cache first
+    if( !CM_LoadCollisionCache( name, &header ) )
+#endif
+    {
+        CMod_LoadSurfaces( &header.lumps[LUMP_SURFACES], &header.lumps[LUMP_DRAWVERTS], &header.lumps[LUMP_DRAWINDEXES] );
+        
+        CMod_CreateBrushSideWindings();
+
+#ifndef BSPC
+        CM_WriteCollisionCache( name, &header );
+#endif
+    }
     
     // we are NOT freeing the file, because it is cached for the ref
     fileSystem->FreeFile( buf );
@@ -1307,6 +1327,7 @@ void idCollisionModelManagerLocal::ClearMap( void )
 {
     ::memset( &cm, 0, sizeof( cm ) );
     CM_ClearLevelPatches();
+    CM_TraceCacheClear( &cm_worldTraceCache );
 }
 
 /*
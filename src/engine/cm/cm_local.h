@@ -55,6 +55,9 @@
 #ifndef __CM_PATCH_H__
 #include <cm/cm_patch.h>
 #endif
+#ifndef __CM_SIMD_H__
+#include <cm/cm_simd.h>
+#endif
 
 #define MAX_SUBMODELS           512
 #define BOX_MODEL_HANDLE        511
@@ -163,6 +166,7 @@ typedef struct
     S32             numSurfaces;
     cSurface_t**     surfaces;					// non-patches will be NULL
     S32             floodvalid;
+    S32             floodnum;					// last flood number handed out
     S32             checkcount;					// incremented on each trace
     bool        perPolyCollision;
 } clipMap_t;
@@ -183,6 +187,8 @@ extern cvar_t*  cm_forceTriangles;
 extern cvar_t*  cm_optimize;
 extern cvar_t*  cm_showCurves;
 extern cvar_t*  cm_showTriangles;
+extern cvar_t*  cm_cache;
+extern cvar_t*  cm_traceCache;
 #endif
 // cm_test.c
 
@@ -273,6 +279,72 @@ void            CM_BoxLeafnums_r( leafList_t* ll, S32 nodenum );
 cmodel_t*       CM_ClipHandleToModel( clipHandle_t handle );
 bool        CM_BoundsIntersect( const vec3_t mins, const vec3_t maxs, const vec3_t mins2, const vec3_t maxs2 );
 bool        CM_BoundsIntersectPoint( const vec3_t mins, const vec3_t maxs, const vec3_t point );
+void            CM_AreaPortalTest_f( void );
+
+// cm_load.c
+U32             CM_LumpChecksum( lump_t* lump );
+U32             CM_Checksum( dheader_t* header );
+
+// cm_tracecache.c
+
+#define TRACE_CACHE_SIZE    1024    // must be a power of two
+
+typedef struct
+{
+    S32             generation;
+    U32             hash;
+    vec3_t          start;
+    vec3_t          end;
+    vec3_t          mins;
+    vec3_t          maxs;
+    S32             owner;                  // model or pass entity the trace was run for
+    S32             mask;
+    S32             type;
+    vec3_t          absmins;                // everything the trace could have touched
+    vec3_t          absmaxs;
+    trace_t         trace;
+} traceCacheEntry_t;
+
+typedef struct
+{
+    S32             generation;             // entries from other generations are stale
+    S32             numLive;
+    vec3_t          liveMins;               // union of the live entries bounds
+    vec3_t          liveMaxs;
+    S32             lookups, hits, stores, invalidations;
+    traceCacheEntry_t entries[TRACE_CACHE_SIZE];
+} traceCache_t;
+
+void            CM_TraceCacheClear( traceCache_t* cache );
+bool            CM_TraceCacheLookup( traceCache_t* cache, trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, S32 owner, S32 mask, S32 type );
+void            CM_TraceCacheStore( traceCache_t* cache, const trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, S32 owner, S32 mask, S32 type, const vec3_t absmins, const vec3_t absmaxs );
+void            CM_TraceCacheInvalidateBounds( traceCache_t* cache, const vec3_t mins, const vec3_t maxs );
+void            CM_TraceCachePrint( const traceCache_t* cache, StringEntry name );
+
+extern traceCache_t cm_worldTraceCache;
+
+// cm_cache.c
+bool            CM_LoadCollisionCache( StringEntry name, dheader_t* header );
+void            CM_WriteCollisionCache( StringEntry name, dheader_t* header );
+
+// cm_benchmark.c
+typedef enum
+{
+    CMQ_BOXTRACE,
+    CMQ_TRANSFORMEDBOXTRACE,
+    CMQ_BISPHERETRACE,
+    CMQ_POINTCONTENTS,
+    CMQ_NUM_TYPES
+} cmQueryType_t;
+
+extern fileHandle_t cm_recordFile;
+
+void            CM_RecordQuery( cmQueryType_t op, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, clipHandle_t model, S32 mask, S32 type,
+                                const vec3_t origin, const vec3_t angles, F32 startRad, F32 endRad );
+void            CM_StopRecording( void );
+void            CM_Record_f( void );
+void            CM_StopRecord_f( void );
+void            CM_Benchmark_f( void );
 
 //
 // idCollisionModelManagerLocal
@@ -299,6 +371,7 @@ public:
     virtual void        TransformedBoxTrace( trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, clipHandle_t model, S32 brushmask, const vec3_t origin, const vec3_t angles, traceType_t type );
     virtual void        BiSphereTrace( trace_t* results, const vec3_t start, const vec3_t end, F32 startRad, F32 endRad, clipHandle_t model, S32 mask );
     virtual void        TransformedBiSphereTrace( trace_t* results, const vec3_t start, const vec3_t end, F32 startRad, F32 endRad, clipHandle_t model, S32 mask, const vec3_t origin );
+    virtual void        CapsuleTraceBatch( trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, const vec3_t* capsuleMins, const vec3_t* capsuleMaxs, S32 numCapsules, S32* hitNum );
     virtual idTraceModel* GetTraceModelForEntity( S32 entityNum );
     virtual U8*       ClusterPVS( S32 cluster );
     
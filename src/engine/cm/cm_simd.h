@@ -0,0 +1,320 @@
+////////////////////////////////////////////////////////////////////////////////////////
+// Copyright(C) 1999 - 2010 id Software LLC, a ZeniMax Media company.
+// Copyright(C) 2011 - 2018 Dusan Jocic <dusanjocic@msn.com>
+//
+// This file is part of the OpenWolf GPL Source Code.
+// OpenWolf Source Code is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenWolf Source Code is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenWolf Source Code.  If not, see <http://www.gnu.org/licenses/>.
+//
+// In addition, the OpenWolf Source Code is also subject to certain additional terms.
+// You should have received a copy of these additional terms immediately following the
+// terms and conditions of the GNU General Public License which accompanied the
+// OpenWolf Source Code. If not, please request a copy in writing from id Software
+// at the address below.
+//
+// If you have questions concerning this license or the applicable additional terms,
+// you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+// Suite 120, Rockville, Maryland 20850 USA.
+//
+// -------------------------------------------------------------------------------------
+// File name:   cm_simd.h
+// Version:     v1.01
+// Created:
+// Compilers:   Visual Studio 2017, gcc 7.3.0
+// Description: vec3 primitives for the sphere and cylinder sweep kernels
+// -------------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __CM_SIMD_H__
+#define __CM_SIMD_H__
+
+// every x86 target we build for has SSE, anything else gets the plain C versions
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#define CM_SIMD_SSE
+#include <xmmintrin.h>
+#endif
+
+#ifdef CM_SIMD_SSE
+typedef __m128 cmVec_t;
+#else
+typedef struct
+{
+    F32             v[4];
+} cmVec_t;
+#endif
+
+// four boxes in structure of arrays layout, for testing one box against all four at once
+typedef struct
+{
+    cmVec_t         mins[3];
+    cmVec_t         maxs[3];
+} cmBounds4_t;
+
+#ifdef CM_SIMD_SSE
+
+static ID_INLINE cmVec_t CM_VecLoad3( const F32* v )
+{
+    return _mm_setr_ps( v[0], v[1], v[2], 0.0f );
+}
+
+// drops the z component, for the 2d cylinder tests
+static ID_INLINE cmVec_t CM_VecLoad2( const F32* v )
+{
+    return _mm_setr_ps( v[0], v[1], 0.0f, 0.0f );
+}
+
+static ID_INLINE cmVec_t CM_VecSplat( F32 f )
+{
+    return _mm_set1_ps( f );
+}
+
+static ID_INLINE void CM_VecStore3( cmVec_t a, F32* out )
+{
+    F32             tmp[4];
+    
+    _mm_storeu_ps( tmp, a );
+    out[0] = tmp[0];
+    out[1] = tmp[1];
+    out[2] = tmp[2];
+}
+
+static ID_INLINE cmVec_t CM_VecAdd( cmVec_t a, cmVec_t b )
+{
+    return _mm_add_ps( a, b );
+}
+
+static ID_INLINE cmVec_t CM_VecSub( cmVec_t a, cmVec_t b )
+{
+    return _mm_sub_ps( a, b );
+}
+
+static ID_INLINE cmVec_t CM_VecScale( cmVec_t a, F32 s )
+{
+    return _mm_mul_ps( a, _mm_set1_ps( s ) );
+}
+
+// a + b * s
+static ID_INLINE cmVec_t CM_VecMA( cmVec_t a, F32 s, cmVec_t b )
+{
+    return _mm_add_ps( a, _mm_mul_ps( b, _mm_set1_ps( s ) ) );
+}
+
+static ID_INLINE cmVec_t CM_VecMin( cmVec_t a, cmVec_t b )
+{
+    return _mm_min_ps( a, b );
+}
+
+static ID_INLINE cmVec_t CM_VecMax( cmVec_t a, cmVec_t b )
+{
+    return _mm_max_ps( a, b );
+}
+
+static ID_INLINE F32 CM_VecDot( cmVec_t a, cmVec_t b )
+{
+    cmVec_t m = _mm_mul_ps( a, b );
+    
+    // the w lanes are zero, so summing all four is the 3d dot product
+    m = _mm_add_ps( m, _mm_movehl_ps( m, m ) );
+    m = _mm_add_ss( m, _mm_shuffle_ps( m, m, _MM_SHUFFLE( 1, 1, 1, 1 ) ) );
+    return _mm_cvtss_f32( m );
+}
+
+static ID_INLINE F32 CM_Sqrt( F32 f )
+{
+    return _mm_cvtss_f32( _mm_sqrt_ss( _mm_set_ss( f ) ) );
+}
+
+/*
+================
+CM_BoundsIntersect4
+
+Returns a bit for each of the four boxes the given box overlaps
+================
+*/
+static ID_INLINE S32 CM_BoundsIntersect4( const cmBounds4_t* b, const vec3_t mins, const vec3_t maxs )
+{
+    cmVec_t         out;
+    S32             i;
+    
+    out = _mm_setzero_ps();
+    for( i = 0; i < 3; i++ )
+    {
+        out = _mm_or_ps( out, _mm_cmpgt_ps( _mm_set1_ps( mins[i] ), b->maxs[i] ) );
+        out = _mm_or_ps( out, _mm_cmplt_ps( _mm_set1_ps( maxs[i] ), b->mins[i] ) );
+    }
+    
+    return ~_mm_movemask_ps( out ) & 15;
+}
+
+/*
+================
+CM_SetBounds4
+
+Fills slot of a four box set
+================
+*/
+static ID_INLINE void CM_SetBounds4( cmBounds4_t* b, S32 slot, const vec3_t mins, const vec3_t maxs )
+{
+    S32             i;
+    
+    for( i = 0; i < 3; i++ )
+    {
+        ( ( F32* )&b->mins[i] )[slot] = mins[i];
+        ( ( F32* )&b->maxs[i] )[slot] = maxs[i];
+    }
+}
+
+#else // !CM_SIMD_SSE
+
+static ID_INLINE cmVec_t CM_VecLoad3( const F32* v )
+{
+    cmVec_t         r = { { v[0], v[1], v[2], 0.0f } };
+    return r;
+}
+
+static ID_INLINE cmVec_t CM_VecLoad2( const F32* v )
+{
+    cmVec_t         r = { { v[0], v[1], 0.0f, 0.0f } };
+    return r;
+}
+
+static ID_INLINE cmVec_t CM_VecSplat( F32 f )
+{
+    cmVec_t         r = { { f, f, f, f } };
+    return r;
+}
+
+static ID_INLINE void CM_VecStore3( cmVec_t a, F32* out )
+{
+    out[0] = a.v[0];
+    out[1] = a.v[1];
+    out[2] = a.v[2];
+}
+
+static ID_INLINE cmVec_t CM_VecAdd( cmVec_t a, cmVec_t b )
+{
+    cmVec_t         r = { { a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], 0.0f } };
+    return r;
+}
+
+static ID_INLINE cmVec_t CM_VecSub( cmVec_t a, cmVec_t b )
+{
+    cmVec_t         r = { { a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], 0.0f } };
+    return r;
+}
+
+static ID_INLINE cmVec_t CM_VecScale( cmVec_t a, F32 s )
+{
+    cmVec_t         r = { { a.v[0] * s, a.v[1] * s, a.v[2] * s, 0.0f } };
+    return r;
+}
+
+static ID_INLINE cmVec_t CM_VecMA( cmVec_t a, F32 s, cmVec_t b )
+{
+    cmVec_t         r = { { a.v[0] + b.v[0] * s, a.v[1] + b.v[1] * s, a.v[2] + b.v[2] * s, 0.0f } };
+    return r;
+}
+
+static ID_INLINE cmVec_t CM_VecMin( cmVec_t a, cmVec_t b )
+{
+    cmVec_t         r = { { a.v[0] < b.v[0] ? a.v[0] : b.v[0], a.v[1] < b.v[1] ? a.v[1] : b.v[1], a.v[2] < b.v[2] ? a.v[2] : b.v[2], 0.0f } };
+    return r;
+}
+
+static ID_INLINE cmVec_t CM_VecMax( cmVec_t a, cmVec_t b )
+{
+    cmVec_t         r = { { a.v[0] > b.v[0] ? a.v[0] : b.v[0], a.v[1] > b.v[1] ? a.v[1] : b.v[1], a.v[2] > b.v[2] ? a.v[2] : b.v[2], 0.0f } };
+    return r;
+}
+
+static ID_INLINE F32 CM_VecDot( cmVec_t a, cmVec_t b )
+{
+    return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2];
+}
+
+static ID_INLINE F32 CM_Sqrt( F32 f )
+{
+    return sqrtf( f );
+}
+
+static ID_INLINE S32 CM_BoundsIntersect4( const cmBounds4_t* b, const vec3_t mins, const vec3_t maxs )
+{
+    S32             i, j, bits;
+    
+    bits = 15;
+    for( j = 0; j < 4; j++ )
+    {
+        for( i = 0; i < 3; i++ )
+        {
+            if( mins[i] > b->maxs[i].v[j] || maxs[i] < b->mins[i].v[j] )
+            {
+                bits &= ~( 1 << j );
+                break;
+            }
+        }
+    }
+    
+    return bits;
+}
+
+static ID_INLINE void CM_SetBounds4( cmBounds4_t* b, S32 slot, const vec3_t mins, const vec3_t maxs )
+{
+    S32             i;
+    
+    for( i = 0; i < 3; i++ )
+    {
+        b->mins[i].v[slot] = mins[i];
+        b->maxs[i].v[slot] = maxs[i];
+    }
+}
+
+#endif // CM_SIMD_SSE
+
+static ID_INLINE F32 CM_VecLengthSquared( cmVec_t a )
+{
+    return CM_VecDot( a, a );
+}
+
+/*
+================
+CM_SegmentDistanceSquared
+
+Squared distance from p to the segment starting at start and running along
+delta, deltaLengthSquared being the squared length of delta
+================
+*/
+static ID_INLINE F32 CM_SegmentDistanceSquared( cmVec_t p, cmVec_t start, cmVec_t delta, F32 deltaLengthSquared )
+{
+    cmVec_t         v;
+    F32             t;
+    
+    v = CM_VecSub( p, start );
+    if( deltaLengthSquared <= 0.0f )
+    {
+        return CM_VecLengthSquared( v );
+    }
+    
+    t = CM_VecDot( v, delta ) / deltaLengthSquared;
+    if( t < 0.0f )
+    {
+        t = 0.0f;
+    }
+    else if( t > 1.0f )
+    {
+        t = 1.0f;
+    }
+    
+    return CM_VecLengthSquared( CM_VecSub( v, CM_VecScale( delta, t ) ) );
+}
+
+#endif // !__CM_SIMD_H__
@@ -290,6 +290,13 @@ S32 idCollisionModelManagerLocal::PointContents( const vec3_t p, clipHandle_t mo
         return 0;
     }
     
+#ifndef BSPC
+    if( cm_recordFile )
+    {
+        CM_RecordQuery( CMQ_POINTCONTENTS, p, NULL, NULL, NULL, model, 0, 0, NULL, NULL, 0, 0 );
+    }
+#endif
+
     if( model )
     {
         clipm = CM_ClipHandleToModel( model );
@@ -450,6 +457,79 @@ void CM_FloodAreaConnections( void )
         CM_FloodArea_r( i, floodnum );
     }
     
+    cm.floodnum = floodnum;
+}
+
+/*
+====================
+CM_MergeAreaFloods
+
+A portal opened between two areas, relabel the smaller flood
+into the larger one instead of reflooding the whole map
+====================
+*/
+static void CM_MergeAreaFloods( S32 area1, S32 area2 )
+{
+    S32             i, keep, drop, count1, count2;
+    cArea_t*        area;
+    
+    keep = cm.areas[area1].floodnum;
+    drop = cm.areas[area2].floodnum;
+    
+    if( keep == drop )
+    {
+        return; // already connected through another portal
+    }
+    
+    count1 = count2 = 0;
+    for( i = 0, area = cm.areas; i < cm.numAreas; i++, area++ )
+    {
+        if( area->floodnum == keep )
+        {
+            count1++;
+        }
+        else if( area->floodnum == drop )
+        {
+            count2++;
+        }
+    }
+    
+    if( count2 > count1 )
+    {
+        drop = keep;
+        keep = cm.areas[area2].floodnum;
+    }
+    
+    for( i = 0, area = cm.areas; i < cm.numAreas; i++, area++ )
+    {
+        if( area->floodnum == drop )
+        {
+            area->floodnum = keep;
+        }
+    }
+}
+
+/*
+====================
+CM_SplitAreaFlood
+
+The last portal between two areas closed.  Removing a single connection
+can split a flood in at most two, so only the flood that contained both
+areas is reflooded, starting from each side of the closed portal.
+====================
+*/
+static void CM_SplitAreaFlood( S32 area1, S32 area2 )
+{
+    // areas outside of the old flood can't be reached from either side,
+    // so a fresh floodvalid only needs to be unique for this pass
+    cm.floodvalid++;
+    
+    CM_FloodArea_r( area1, ++cm.floodnum );
+    
+    if( cm.areas[area2].floodvalid != cm.floodvalid )
+    {
+        CM_FloodArea_r( area2, ++cm.floodnum );
+    }
 }
 
 /*
@@ -473,6 +553,8 @@ void idCollisionModelManagerLocal::AdjustAreaPortalState( S32 area1, S32 area2,
     {
         cm.areaPortals[area1 * cm.numAreas + area2]++;
         cm.areaPortals[area2 * cm.numAreas + area1]++;
+        
+        CM_MergeAreaFloods( area1, area2 );
     }
     else if( cm.areaPortals[area2 * cm.numAreas + area1] )   // Ridah, fixes loadgame issue
     {
@@ -482,9 +564,13 @@ void idCollisionModelManagerLocal::AdjustAreaPortalState( S32 area1, S32 area2,
         {
             Com_Error( ERR_DROP, "CM_AdjustAreaPortalState: negative reference count" );
         }
+        
+        // the areas stay connected while any reference remains
+        if( !cm.areaPortals[area2 * cm.numAreas + area1] )
+        {
+            CM_SplitAreaFlood( area1, area2 );
+        }
     }
-    
-    CM_FloodAreaConnections();
 }
 
 /*
@@ -564,6 +650,137 @@ S32 idCollisionModelManagerLocal::WriteAreaBits( U8* buffer, S32 area )
     return bytes;
 }
 
+/*
+====================
+CM_AreaPortalTest_f
+
+Opens and closes random area portals on the loaded map and checks the
+incrementally maintained floods against a full CM_FloodAreaConnections after
+every change.  The portal state is put back afterwards.
+====================
+*/
+void CM_AreaPortalTest_f( void )
+{
+    S32*            savedPortals;
+    S32*            floodnums;
+    S32*            floodvalids;
+    U8*             incrementalBits;
+    U8*             fullBits;
+    S32             i, j, n, area1, area2, iterations, seed, bytes, mismatches, floodvalid, floodnum;
+    bool            open, connected;
+    
+    if( Cmd_Argc() > 3 )
+    {
+        Com_Printf( "usage: cm_areaportaltest [iterations] [seed]\n" );
+        return;
+    }
+    
+    if( !cvarSystem->VariableIntegerValue( "sv_cheats" ) )
+    {
+        Com_Printf( "cm_areaportaltest: cheats are not enabled\n" );
+        return;
+    }
+    
+    if( !cm.name[0] || cm.numAreas < 2 )
+    {
+        Com_Printf( "cm_areaportaltest: needs a map with at least two areas\n" );
+        return;
+    }
+    
+    if( cm_noAreas->integer )
+    {
+        Com_Printf( "cm_areaportaltest: cm_noAreas is set\n" );
+        return;
+    }
+    
+    iterations = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 1000;
+    seed = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : Sys_Milliseconds();
+    
+    n = cm.numAreas;
+    bytes = ( n + 7 ) >> 3;
+    
+    savedPortals = ( S32* )Z_Malloc( n * n * sizeof( S32 ) );
+    floodnums = ( S32* )Z_Malloc( n * sizeof( S32 ) * 2 );
+    floodvalids = floodnums + n;
+    incrementalBits = ( U8* )Z_Malloc( n * bytes * 2 );
+    fullBits = incrementalBits + n * bytes;
+    
+    ::memcpy( savedPortals, cm.areaPortals, n * n * sizeof( S32 ) );
+    
+    mismatches = 0;
+    for( i = 0; i < iterations && mismatches < 16; i++ )
+    {
+        area1 = Q_rand( &seed ) % n;
+        area2 = Q_rand( &seed ) % ( n - 1 );
+        if( area2 >= area1 )
+        {
+            area2++;
+        }
+        
+        // closing an unopened pair is a no-op, so favour opening a little to
+        // build up floods that span several portals
+        open = ( Q_rand( &seed ) % 5 ) < 3;
+        collisionModelManagerLocal.AdjustAreaPortalState( area1, area2, open );
+        
+        // what the incremental path reports
+        ::memset( incrementalBits, 0, n * bytes );
+        for( j = 0; j < n; j++ )
+        {
+            collisionModelManagerLocal.WriteAreaBits( incrementalBits + j * bytes, j );
+            floodnums[j] = cm.areas[j].floodnum;
+            floodvalids[j] = cm.areas[j].floodvalid;
+        }
+        floodvalid = cm.floodvalid;
+        floodnum = cm.floodnum;
+        
+        CM_FloodAreaConnections();
+        
+        ::memset( fullBits, 0, n * bytes );
+        for( j = 0; j < n; j++ )
+        {
+            collisionModelManagerLocal.WriteAreaBits( fullBits + j * bytes, j );
+        }
+        
+        for( area1 = 0; area1 < n; area1++ )
+        {
+            for( area2 = area1 + 1; area2 < n; area2++ )
+            {
+                connected = collisionModelManagerLocal.AreasConnected( area1, area2 );
+                if( ( floodnums[area1] == floodnums[area2] ) != connected )
+                {
+                    Com_Printf( S_COLOR_YELLOW "cm_areaportaltest: step %i, areas %i and %i %s connected after %s a portal\n", i, area1, area2,
+                                connected ? "should be" : "shouldn't be", open ? "opening" : "closing" );
+                    mismatches++;
+                }
+            }
+            
+            if( ::memcmp( incrementalBits + area1 * bytes, fullBits + area1 * bytes, bytes ) )
+            {
+                Com_Printf( S_COLOR_YELLOW "cm_areaportaltest: step %i, area bits of %i differ from a full flood\n", i, area1 );
+                mismatches++;
+            }
+        }
+        
+        // carry on from the incremental state so errors can accumulate
+        for( j = 0; j < n; j++ )
+        {
+            cm.areas[j].floodnum = floodnums[j];
+            cm.areas[j].floodvalid = floodvalids[j];
+        }
+        cm.floodvalid = floodvalid;
+        cm.floodnum = floodnum;
+    }
+    
+    ::memcpy( cm.areaPortals, savedPortals, n * n * sizeof( S32 ) );
+    CM_FloodAreaConnections();
+    
+    Z_Free( savedPortals );
+    Z_Free( floodnums );
+    Z_Free( incrementalBits );
+    
+    Com_Printf( "cm_areaportaltest: %i changes on %i areas, %i mismatches\n", i, n, mismatches );
+}
+
 /*
 ====================
 CM_BoundsIntersect
@@ -100,54 +100,6 @@ void CreateRotationMatrix( const vec3_t angles, vec3_t matrix[3] )
     VectorInverse( matrix[1] );
 }
 
-/*
-================
-CM_ProjectPointOntoVector
-================
-*/
-void CM_ProjectPointOntoVector( vec3_t point, vec3_t vStart, vec3_t vDir, vec3_t vProj )
-{
-    vec3_t pVec;
-    
-    VectorSubtract( point, vStart, pVec );
-    // project onto the directional vector for this segment
-    VectorMA( vStart, DotProduct( pVec, vDir ), vDir, vProj );
-}
-
-/*
-================
-CM_DistanceFromLineSquared
-================
-*/
-F32 CM_DistanceFromLineSquared( vec3_t p, vec3_t lp1, vec3_t lp2, vec3_t dir )
-{
-    vec3_t          proj, t;
-    S32             j;
-    
-    CM_ProjectPointOntoVector( p, lp1, dir, proj );
-    for( j = 0; j < 3; j++ )
-    {
-        if( ( proj[j] > lp1[j] && proj[j] > lp2[j] ) || ( proj[j] < lp1[j] && proj[j] < lp2[j] ) )
-        {
-            break;
-        }
-    }
-    if( j < 3 )
-    {
-        if( fabs( proj[j] - lp1[j] ) < fabs( proj[j] - lp2[j] ) )
-        {
-            VectorSubtract( p, lp1, t );
-        }
-        else
-        {
-            VectorSubtract( p, lp2, t );
-        }
-        return VectorLengthSquared( t );
-    }
-    VectorSubtract( p, proj, t );
-    return VectorLengthSquared( t );
-}
-
 /*
 ================
 CM_VectorDistanceSquared
@@ -161,30 +113,6 @@ F32 CM_VectorDistanceSquared( vec3_t p1, vec3_t p2 )
     return VectorLengthSquared( dir );
 }
 
-/*
-================
-SquareRootFloat
-================
-*/
-F32 SquareRootFloat( F32 number )
-{
-    union
-    {
-        F32           f;
-        S32             i;
-    } t;
-    F32           x, y;
-    const F32     f = 1.5F;
-    
-    x = number * 0.5F;
-    t.f = number;
-    t.i = 0x5f3759df - ( t.i >> 1 );
-    y = t.f;
-    y = y * ( f - ( x * y * y ) );
-    y = y * ( f - ( x * y * y ) );
-    return number * y;
-}
-
 
 /*
 ===============================================================================
@@ -469,19 +397,17 @@ void CM_TestInLeaf( traceWork_t* tw, cLeaf_t* leaf )
 
 /*
 ==================
-CM_TestCapsuleInCapsule
+CM_TestCapsuleInCapsuleBounds
 
-capsule inside capsule check
+capsule inside capsule check against a capsule filling the given bounds
 ==================
 */
-void CM_TestCapsuleInCapsule( traceWork_t* tw, clipHandle_t model )
+static void CM_TestCapsuleInCapsuleBounds( traceWork_t* tw, const vec3_t mins, const vec3_t maxs )
 {
     S32             i;
-    vec3_t          mins, maxs, top, bottom, p1, p2, tmp, offset, symetricSize[2];
+    vec3_t          top, bottom, p1, p2, tmp, offset, symetricSize[2];
     F32           radius, halfwidth, halfheight, offs, r;
     
-    collisionModelManagerLocal.ModelBounds( model, mins, maxs );
-    
     VectorAdd( tw->start, tw->sphere.offset, top );
     VectorSubtract( tw->start, tw->sphere.offset, bottom );
     for( i = 0; i < 3; i++ )
@@ -540,6 +466,21 @@ void CM_TestCapsuleInCapsule( traceWork_t* tw, clipHandle_t model )
     }
 }
 
+/*
+==================
+CM_TestCapsuleInCapsule
+
+capsule inside capsule check
+==================
+*/
+void CM_TestCapsuleInCapsule( traceWork_t* tw, clipHandle_t model )
+{
+    vec3_t          mins, maxs;
+    
+    collisionModelManagerLocal.ModelBounds( model, mins, maxs );
+    CM_TestCapsuleInCapsuleBounds( tw, mins, maxs );
+}
+
 /*
 ==================
 CM_TestBoundingBoxInCapsule
@@ -1695,87 +1636,79 @@ get the first intersection of the ray with the sphere
 */
 void CM_TraceThroughSphere( traceWork_t* tw, vec3_t origin, F32 radius, vec3_t start, vec3_t end )
 {
-    F32           l1, l2, length, scale, fraction, a, b, c, d, sqrtd;
-    vec3_t          v1, dir, intersection;
+    F32             l1, l2, a, b, c, d, fraction, expanded;
+    cmVec_t         org, s, e, delta, v1, intersection, normal;
+    
+    org = CM_VecLoad3( origin );
+    s = CM_VecLoad3( start );
+    e = CM_VecLoad3( end );
     
     // if inside the sphere
-    VectorSubtract( start, origin, dir );
-    l1 = VectorLengthSquared( dir );
-    if( l1 < Square( radius ) )
+    v1 = CM_VecSub( s, org );
+    c = CM_VecLengthSquared( v1 );
+    if( c < Square( radius ) )
     {
         tw->trace.fraction = 0;
         tw->trace.startsolid = true;
         // test for allsolid
-        VectorSubtract( end, origin, dir );
-        l1 = VectorLengthSquared( dir );
-        if( l1 < Square( radius ) )
+        if( CM_VecLengthSquared( CM_VecSub( e, org ) ) < Square( radius ) )
         {
             tw->trace.allsolid = true;
         }
         return;
     }
     //
-    VectorSubtract( end, start, dir );
-    length = VectorNormalize( dir );
+    delta = CM_VecSub( e, s );
+    a = CM_VecLengthSquared( delta );
     //
-    l1 = CM_DistanceFromLineSquared( origin, start, end, dir );
-    VectorSubtract( end, origin, v1 );
-    l2 = VectorLengthSquared( v1 );
+    l1 = CM_SegmentDistanceSquared( org, s, delta, a );
+    l2 = CM_VecLengthSquared( CM_VecSub( e, org ) );
     // if no intersection with the sphere and the end point is at least an epsilon away
     if( l1 >= Square( radius ) && l2 > Square( radius + SURFACE_CLIP_EPSILON ) )
     {
         return;
     }
     
-    VectorSubtract( start, origin, v1 );
-    // dir is normalized so a = 1
-    a = 1.0f; //dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
-    b = 2.0f * ( dir[0] * v1[0] + dir[1] * v1[1] + dir[2] * v1[2] );
-    c = v1[0] * v1[0] + v1[1] * v1[1] + v1[2] * v1[2] - ( radius + RADIUS_EPSILON ) * ( radius + RADIUS_EPSILON );
+    // solve | v1 + t * delta | = radius in trace fractions directly, the
+    // direction is never normalized so only the root needs a square root
+    expanded = radius + RADIUS_EPSILON;
+    b = 2.0f * CM_VecDot( delta, v1 );
+    c -= expanded * expanded;
     
-    d = b * b - 4.0f * c;		// * a;
-    if( d > 0 )
+    if( a == 0 )
     {
-        sqrtd = SquareRootFloat( d );
-        // = (- b + sqrtd) * 0.5f; // / (2.0f * a);
-        fraction = ( -b - sqrtd ) * 0.5f;	// / (2.0f * a);
-        
-        if( fraction < 0 )
+        // not moving at all, only touching if already within the epsilon
+        if( c >= 0 )
         {
-            fraction = 0;
+            return;
         }
-        else
+        fraction = 0;
+    }
+    else
+    {
+        d = b * b - 4.0f * a * c;
+        if( d <= 0 )
         {
-            fraction /= length;
+            // d == 0 slides along the sphere, d < 0 is no intersection at all
+            return;
         }
         
-        if( fraction < tw->trace.fraction )
+        fraction = ( -b - CM_Sqrt( d ) ) / ( 2.0f * a );
+        if( fraction < 0 )
         {
-            tw->trace.fraction = fraction;
-            VectorSubtract( end, start, dir );
-            VectorMA( start, fraction, dir, intersection );
-            VectorSubtract( intersection, origin, dir );
-#ifdef CAPSULE_DEBUG
-            l2 = VectorLength( dir );
-            if( l2 < radius )
-            {
-                S32 bah = 1;
-            }
-#endif
-            scale = 1 / ( radius + RADIUS_EPSILON );
-            VectorScale( dir, scale, dir );
-            VectorCopy( dir, tw->trace.plane.normal );
-            VectorAdd( tw->modelOrigin, intersection, intersection );
-            tw->trace.plane.dist = DotProduct( tw->trace.plane.normal, intersection );
-            tw->trace.contents = CONTENTS_BODY;
+            fraction = 0;
         }
     }
-    else if( d == 0 )
+    
+    if( fraction < tw->trace.fraction )
     {
-        //t1 = (- b ) / 2;
-        // slide along the sphere
+        tw->trace.fraction = fraction;
+        intersection = CM_VecMA( s, fraction, delta );
+        normal = CM_VecScale( CM_VecSub( intersection, org ), 1.0f / expanded );
+        CM_VecStore3( normal, tw->trace.plane.normal );
+        tw->trace.plane.dist = CM_VecDot( normal, CM_VecAdd( CM_VecLoad3( tw->modelOrigin ), intersection ) );
+        tw->trace.contents = CONTENTS_BODY;
     }
-    // no intersection at all
 }
 
 /*
@@ -1788,26 +1721,26 @@ the cylinder extends halfheight above and below the origin
 */
 void CM_TraceThroughVerticalCylinder( traceWork_t* tw, vec3_t origin, F32 radius, F32 halfheight, vec3_t start, vec3_t end )
 {
-    F32           length, scale, fraction, l1, l2, a, b, c, d, sqrtd;
-    vec3_t          v1, dir, start2d, end2d, org2d, intersection;
+    F32             l1, l2, a, b, c, d, fraction, expanded;
+    cmVec_t         org2d, start2d, end2d, delta2d, v1, intersection, normal;
+    vec3_t          hit;
     
     // 2d coordinates
-    VectorSet( start2d, start[0], start[1], 0 );
-    VectorSet( end2d, end[0], end[1], 0 );
-    VectorSet( org2d, origin[0], origin[1], 0 );
+    org2d = CM_VecLoad2( origin );
+    start2d = CM_VecLoad2( start );
+    end2d = CM_VecLoad2( end );
+    
+    v1 = CM_VecSub( start2d, org2d );
+    c = CM_VecLengthSquared( v1 );
     // if between lower and upper cylinder bounds
     if( start[2] <= origin[2] + halfheight && start[2] >= origin[2] - halfheight )
     {
         // if inside the cylinder
-        VectorSubtract( start2d, org2d, dir );
-        l1 = VectorLengthSquared( dir );
-        if( l1 < Square( radius ) )
+        if( c < Square( radius ) )
         {
             tw->trace.fraction = 0;
             tw->trace.startsolid = true;
-            VectorSubtract( end2d, org2d, dir );
-            l1 = VectorLengthSquared( dir );
-            if( l1 < Square( radius ) )
+            if( CM_VecLengthSquared( CM_VecSub( end2d, org2d ) ) < Square( radius ) )
             {
                 tw->trace.allsolid = true;
             }
@@ -1815,108 +1748,95 @@ void CM_TraceThroughVerticalCylinder( traceWork_t* tw, vec3_t origin, F32 radius
         }
     }
     //
-    VectorSubtract( end2d, start2d, dir );
-    length = VectorNormalize( dir );
+    delta2d = CM_VecSub( end2d, start2d );
+    a = CM_VecLengthSquared( delta2d );
     //
-    l1 = CM_DistanceFromLineSquared( org2d, start2d, end2d, dir );
-    VectorSubtract( end2d, org2d, v1 );
-    l2 = VectorLengthSquared( v1 );
+    l1 = CM_SegmentDistanceSquared( org2d, start2d, delta2d, a );
+    l2 = CM_VecLengthSquared( CM_VecSub( end2d, org2d ) );
     // if no intersection with the cylinder and the end point is at least an epsilon away
     if( l1 >= Square( radius ) && l2 > Square( radius + SURFACE_CLIP_EPSILON ) )
     {
         return;
     }
     
-    VectorSubtract( start, origin, v1 );
-    // dir is normalized so we can use a = 1
-    a = 1.0f; // * (dir[0] * dir[0] + dir[1] * dir[1]);
-    b = 2.0f * ( v1[0] * dir[0] + v1[1] * dir[1] );
-    c = v1[0] * v1[0] + v1[1] * v1[1] - ( radius + RADIUS_EPSILON ) * ( radius + RADIUS_EPSILON );
+    // same unnormalized quadratic as the sphere, in the horizontal plane
+    expanded = radius + RADIUS_EPSILON;
+    b = 2.0f * CM_VecDot( delta2d, v1 );
+    c -= expanded * expanded;
     
-    d = b * b - 4.0f * c;// * a;
-    if( d > 0 )
+    if( a == 0 )
     {
-        sqrtd = SquareRootFloat( d );
-        // = (- b + sqrtd) * 0.5f;// / (2.0f * a);
-        fraction = ( -b - sqrtd ) * 0.5f;	// / (2.0f * a);
-        
-        if( fraction < 0 )
+        // not moving horizontally, only touching if already within the epsilon
+        if( c >= 0 )
         {
-            fraction = 0;
+            return;
         }
-        else
+        fraction = 0;
+    }
+    else
+    {
+        d = b * b - 4.0f * a * c;
+        if( d <= 0 )
         {
-            fraction /= length;
+            // d == 0 slides along the cylinder, d < 0 is no intersection at all
+            return;
         }
         
-        if( fraction < tw->trace.fraction )
-        {
-            VectorSubtract( end, start, dir );
-            VectorMA( start, fraction, dir, intersection );
-            // if the intersection is between the cylinder lower and upper bound
-            if( intersection[2] <= origin[2] + halfheight && intersection[2] >= origin[2] - halfheight )
-            {
-                tw->trace.fraction = fraction;
-                VectorSubtract( intersection, origin, dir );
-                dir[2] = 0;
-#ifdef CAPSULE_DEBUG
-                l2 = VectorLength( dir );
-                if( l2 <= radius )
-                {
-                    S32 bah = 1;
-                }
-#endif
-                scale = 1 / ( radius + RADIUS_EPSILON );
-                VectorScale( dir, scale, dir );
-                VectorCopy( dir, tw->trace.plane.normal );
-                VectorAdd( tw->modelOrigin, intersection, intersection );
-                tw->trace.plane.dist = DotProduct( tw->trace.plane.normal, intersection );
-                tw->trace.contents = CONTENTS_BODY;
-            }
+        fraction = ( -b - CM_Sqrt( d ) ) / ( 2.0f * a );
+        if( fraction < 0 )
+        {
+            fraction = 0;
         }
     }
-    else if( d == 0 )
+    
+    if( fraction < tw->trace.fraction )
     {
-        //t[0] = (- b ) / 2 * a;
-        // slide along the cylinder
+        intersection = CM_VecLoad3( start );
+        intersection = CM_VecMA( intersection, fraction, CM_VecSub( CM_VecLoad3( end ), intersection ) );
+        CM_VecStore3( intersection, hit );
+        // if the intersection is between the cylinder lower and upper bound
+        if( hit[2] <= origin[2] + halfheight && hit[2] >= origin[2] - halfheight )
+        {
+            tw->trace.fraction = fraction;
+            normal = CM_VecScale( CM_VecSub( CM_VecLoad2( hit ), org2d ), 1.0f / expanded );
+            CM_VecStore3( normal, tw->trace.plane.normal );
+            tw->trace.plane.dist = CM_VecDot( normal, CM_VecAdd( CM_VecLoad3( tw->modelOrigin ), intersection ) );
+            tw->trace.contents = CONTENTS_BODY;
+        }
     }
-    // no intersection at all
 }
 
 /*
 ================
-CM_TraceCapsuleThroughCapsule
+CM_SweepCapsuleThroughCapsule
 
-capsule vs. capsule collision (not rotated)
+capsule vs. capsule collision (not rotated) against a capsule filling the given
+bounds, the caller has already checked the bounds against the trace
 ================
 */
-void CM_TraceCapsuleThroughCapsule( traceWork_t* tw, clipHandle_t model )
+static void CM_SweepCapsuleThroughCapsule( traceWork_t* tw, const vec3_t mins, const vec3_t maxs )
 {
-    S32             i;
-    vec3_t          mins, maxs, top, bottom, starttop, startbottom, endtop, endbottom, offset, symetricSize[2];
-    F32           radius, halfwidth, halfheight, offs, h;
+    vec3_t          top, bottom, starttop, startbottom, endtop, endbottom, offset;
+    F32             radius, halfwidth, halfheight, offs, h;
+    cmVec_t         start, end, sphereOffset, center, vmins, vmaxs;
+    
+    start = CM_VecLoad3( tw->start );
+    end = CM_VecLoad3( tw->end );
+    sphereOffset = CM_VecLoad3( tw->sphere.offset );
     
-    collisionModelManagerLocal.ModelBounds( model, mins, maxs );
-    // test trace bounds vs. capsule bounds
-    if( tw->bounds[0][0] > maxs[0] + RADIUS_EPSILON || tw->bounds[0][1] > maxs[1] + RADIUS_EPSILON || tw->bounds[0][2] > maxs[2] + RADIUS_EPSILON || tw->bounds[1][0] < mins[0] - RADIUS_EPSILON || tw->bounds[1][1] < mins[1] - RADIUS_EPSILON || tw->bounds[1][2] < mins[2] - RADIUS_EPSILON )
-    {
-        return;
-    }
     // top origin and bottom origin of each sphere at start and end of trace
-    VectorAdd( tw->start, tw->sphere.offset, starttop );
-    VectorSubtract( tw->start, tw->sphere.offset, startbottom );
-    VectorAdd( tw->end, tw->sphere.offset, endtop );
-    VectorSubtract( tw->end, tw->sphere.offset, endbottom );
+    CM_VecStore3( CM_VecAdd( start, sphereOffset ), starttop );
+    CM_VecStore3( CM_VecSub( start, sphereOffset ), startbottom );
+    CM_VecStore3( CM_VecAdd( end, sphereOffset ), endtop );
+    CM_VecStore3( CM_VecSub( end, sphereOffset ), endbottom );
     
     // calculate top and bottom of the capsule spheres to collide with
-    for( i = 0; i < 3; i++ )
-    {
-        offset[i] = ( mins[i] + maxs[i] ) * 0.5;
-        symetricSize[0][i] = mins[i] - offset[i];
-        symetricSize[1][i] = maxs[i] - offset[i];
-    }
-    halfwidth = symetricSize[1][0];
-    halfheight = symetricSize[1][2];
+    vmins = CM_VecLoad3( mins );
+    vmaxs = CM_VecLoad3( maxs );
+    center = CM_VecScale( CM_VecAdd( vmins, vmaxs ), 0.5f );
+    CM_VecStore3( center, offset );
+    halfwidth = maxs[0] - offset[0];
+    halfheight = maxs[2] - offset[2];
     radius = ( halfwidth > halfheight ) ? halfheight : halfwidth;
     offs = halfheight - radius;
     VectorCopy( offset, top );
@@ -1942,6 +1862,27 @@ void CM_TraceCapsuleThroughCapsule( traceWork_t* tw, clipHandle_t model )
     CM_TraceThroughSphere( tw, bottom, radius, starttop, endtop );
 }
 
+/*
+================
+CM_TraceCapsuleThroughCapsule
+
+capsule vs. capsule collision (not rotated)
+================
+*/
+void CM_TraceCapsuleThroughCapsule( traceWork_t* tw, clipHandle_t model )
+{
+    vec3_t          mins, maxs;
+    
+    collisionModelManagerLocal.ModelBounds( model, mins, maxs );
+    // test trace bounds vs. capsule bounds
+    if( tw->bounds[0][0] > maxs[0] + RADIUS_EPSILON || tw->bounds[0][1] > maxs[1] + RADIUS_EPSILON || tw->bounds[0][2] > maxs[2] + RADIUS_EPSILON || tw->bounds[1][0] < mins[0] - RADIUS_EPSILON || tw->bounds[1][1] < mins[1] - RADIUS_EPSILON || tw->bounds[1][2] < mins[2] - RADIUS_EPSILON )
+    {
+        return;
+    }
+    
+    CM_SweepCapsuleThroughCapsule( tw, mins, maxs );
+}
+
 /*
 ================
 CM_TraceBoundingBoxThroughCapsule
@@ -2118,37 +2059,25 @@ static void CM_TraceThroughTree( traceWork_t* tw, S32 num, F32 p1f, F32 p2f, vec
 
 /*
 ==================
-CM_Trace
+CM_SetupTrace
+
+Fills in the trace work shared by every kind of sweep and returns true
+for a position test
 ==================
 */
-static void CM_Trace( trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, clipHandle_t model, const vec3_t origin, S32 brushmask, traceType_t type, sphere_t* sphere )
+static bool CM_SetupTrace( traceWork_t* tw, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, const vec3_t origin, S32 brushmask, traceType_t type, sphere_t* sphere )
 {
     S32             i;
-    traceWork_t     tw;
     vec3_t          offset;
-    cmodel_t*       cmod;
     bool            positionTest;
     vec3_t          dir;
     F32             dist;
     
-    cmod = CM_ClipHandleToModel( model );
-    
-    cm.checkcount++;			// for multi-check avoidance
-    
-    c_traces++;					// for statistics, may be zeroed
-    
     // fill in a default trace
-    ::memset( &tw, 0, sizeof( tw ) );
-    tw.trace.fraction = 1;		// assume it goes the entire distance until shown otherwise
-    VectorCopy( origin, tw.modelOrigin );
-    tw.type = type;
-    
-    if( !cm.numNodes )
-    {
-        *results = tw.trace;
-        
-        return; // map not loaded, shouldn't happen
-    }
+    ::memset( tw, 0, sizeof( *tw ) );
+    tw->trace.fraction = 1;		// assume it goes the entire distance until shown otherwise
+    VectorCopy( origin, tw->modelOrigin );
+    tw->type = type;
     
     // allow NULL to be passed in for 0,0,0
     if( !mins )
@@ -2161,7 +2090,7 @@ static void CM_Trace( trace_t* results, const vec3_t start, const vec3_t end, co
     }
     
     // set basic parms
-    tw.contents = brushmask;
+    tw->contents = brushmask;
     
     // adjust so that mins and maxs are always symetric, which
     // avoids some complications with plane expanding of rotated
@@ -2169,113 +2098,142 @@ static void CM_Trace( trace_t* results, const vec3_t start, const vec3_t end, co
     for( i = 0; i < 3; i++ )
     {
         offset[i] = ( mins[i] + maxs[i] ) * 0.5;
-        tw.size[0][i] = mins[i] - offset[i];
-        tw.size[1][i] = maxs[i] - offset[i];
-        tw.start[i] = start[i] + offset[i];
-        tw.end[i] = end[i] + offset[i];
+        tw->size[0][i] = mins[i] - offset[i];
+        tw->size[1][i] = maxs[i] - offset[i];
+        tw->start[i] = start[i] + offset[i];
+        tw->end[i] = end[i] + offset[i];
     }
     
     // if a sphere is already specified
     if( sphere )
     {
-        tw.sphere = *sphere;
+        tw->sphere = *sphere;
     }
     else
     {
-        tw.sphere.radius = ( tw.size[1][0] > tw.size[1][2] ) ? tw.size[1][2] : tw.size[1][0];
-        tw.sphere.halfheight = tw.size[1][2];
-        VectorSet( tw.sphere.offset, 0, 0, tw.size[1][2] - tw.sphere.radius );
+        tw->sphere.radius = ( tw->size[1][0] > tw->size[1][2] ) ? tw->size[1][2] : tw->size[1][0];
+        tw->sphere.halfheight = tw->size[1][2];
+        VectorSet( tw->sphere.offset, 0, 0, tw->size[1][2] - tw->sphere.radius );
     }
     
     positionTest = ( start[0] == end[0] && start[1] == end[1] && start[2] == end[2] );
     
-    tw.maxOffset = tw.size[1][0] + tw.size[1][1] + tw.size[1][2];
+    tw->maxOffset = tw->size[1][0] + tw->size[1][1] + tw->size[1][2];
     
-    // tw.offsets[signbits] = vector to apropriate corner from origin
-    tw.offsets[0][0] = tw.size[0][0];
-    tw.offsets[0][1] = tw.size[0][1];
-    tw.offsets[0][2] = tw.size[0][2];
+    // tw->offsets[signbits] = vector to apropriate corner from origin
+    tw->offsets[0][0] = tw->size[0][0];
+    tw->offsets[0][1] = tw->size[0][1];
+    tw->offsets[0][2] = tw->size[0][2];
     
-    tw.offsets[1][0] = tw.size[1][0];
-    tw.offsets[1][1] = tw.size[0][1];
-    tw.offsets[1][2] = tw.size[0][2];
+    tw->offsets[1][0] = tw->size[1][0];
+    tw->offsets[1][1] = tw->size[0][1];
+    tw->offsets[1][2] = tw->size[0][2];
     
-    tw.offsets[2][0] = tw.size[0][0];
-    tw.offsets[2][1] = tw.size[1][1];
-    tw.offsets[2][2] = tw.size[0][2];
+    tw->offsets[2][0] = tw->size[0][0];
+    tw->offsets[2][1] = tw->size[1][1];
+    tw->offsets[2][2] = tw->size[0][2];
     
-    tw.offsets[3][0] = tw.size[1][0];
-    tw.offsets[3][1] = tw.size[1][1];
-    tw.offsets[3][2] = tw.size[0][2];
+    tw->offsets[3][0] = tw->size[1][0];
+    tw->offsets[3][1] = tw->size[1][1];
+    tw->offsets[3][2] = tw->size[0][2];
     
-    tw.offsets[4][0] = tw.size[0][0];
-    tw.offsets[4][1] = tw.size[0][1];
-    tw.offsets[4][2] = tw.size[1][2];
+    tw->offsets[4][0] = tw->size[0][0];
+    tw->offsets[4][1] = tw->size[0][1];
+    tw->offsets[4][2] = tw->size[1][2];
     
-    tw.offsets[5][0] = tw.size[1][0];
-    tw.offsets[5][1] = tw.size[0][1];
-    tw.offsets[5][2] = tw.size[1][2];
+    tw->offsets[5][0] = tw->size[1][0];
+    tw->offsets[5][1] = tw->size[0][1];
+    tw->offsets[5][2] = tw->size[1][2];
     
-    tw.offsets[6][0] = tw.size[0][0];
-    tw.offsets[6][1] = tw.size[1][1];
-    tw.offsets[6][2] = tw.size[1][2];
+    tw->offsets[6][0] = tw->size[0][0];
+    tw->offsets[6][1] = tw->size[1][1];
+    tw->offsets[6][2] = tw->size[1][2];
     
-    tw.offsets[7][0] = tw.size[1][0];
-    tw.offsets[7][1] = tw.size[1][1];
-    tw.offsets[7][2] = tw.size[1][2];
+    tw->offsets[7][0] = tw->size[1][0];
+    tw->offsets[7][1] = tw->size[1][1];
+    tw->offsets[7][2] = tw->size[1][2];
     
     // check for point special case
-    if( tw.size[0][0] == 0.0f && tw.size[0][1] == 0.0f && tw.size[0][2] == 0.0f )
+    if( tw->size[0][0] == 0.0f && tw->size[0][1] == 0.0f && tw->size[0][2] == 0.0f )
     {
-        tw.isPoint = true;
-        VectorClear( tw.extents );
+        tw->isPoint = true;
+        VectorClear( tw->extents );
     }
     else
     {
-        tw.isPoint = false;
-        tw.extents[0] = tw.size[1][0];
-        tw.extents[1] = tw.size[1][1];
-        tw.extents[2] = tw.size[1][2];
+        tw->isPoint = false;
+        tw->extents[0] = tw->size[1][0];
+        tw->extents[1] = tw->size[1][1];
+        tw->extents[2] = tw->size[1][2];
     }
     
     if( positionTest )
     {
-        CM_CalcTraceBounds( &tw, false );
+        CM_CalcTraceBounds( tw, false );
     }
     else
     {
-        VectorSubtract( tw.end, tw.start, dir );
-        VectorCopy( dir, tw.dir );
+        VectorSubtract( tw->end, tw->start, dir );
+        VectorCopy( dir, tw->dir );
         VectorNormalize( dir );
-        MakeNormalVectors( dir, tw.tracePlane1.normal, tw.tracePlane2.normal );
-        tw.tracePlane1.dist = DotProduct( tw.tracePlane1.normal, tw.start );
-        tw.tracePlane2.dist = DotProduct( tw.tracePlane2.normal, tw.start );
-        if( tw.isPoint )
+        MakeNormalVectors( dir, tw->tracePlane1.normal, tw->tracePlane2.normal );
+        tw->tracePlane1.dist = DotProduct( tw->tracePlane1.normal, tw->start );
+        tw->tracePlane2.dist = DotProduct( tw->tracePlane2.normal, tw->start );
+        if( tw->isPoint )
         {
-            tw.traceDist1 = tw.traceDist2 = 1.0f;
+            tw->traceDist1 = tw->traceDist2 = 1.0f;
         }
         else
         {
-            tw.traceDist1 = tw.traceDist2 = 0.0f;
+            tw->traceDist1 = tw->traceDist2 = 0.0f;
             for( i = 0; i < 8; i++ )
             {
-                dist = Q_fabs( DotProduct( tw.tracePlane1.normal, tw.offsets[i] ) - tw.tracePlane1.dist );
-                if( dist > tw.traceDist1 )
+                dist = Q_fabs( DotProduct( tw->tracePlane1.normal, tw->offsets[i] ) - tw->tracePlane1.dist );
+                if( dist > tw->traceDist1 )
                 {
-                    tw.traceDist1 = dist;
+                    tw->traceDist1 = dist;
                 }
-                dist = Q_fabs( DotProduct( tw.tracePlane2.normal, tw.offsets[i] ) - tw.tracePlane2.dist );
-                if( dist > tw.traceDist2 )
+                dist = Q_fabs( DotProduct( tw->tracePlane2.normal, tw->offsets[i] ) - tw->tracePlane2.dist );
+                if( dist > tw->traceDist2 )
                 {
-                    tw.traceDist2 = dist;
+                    tw->traceDist2 = dist;
                 }
             }
             // expand for epsilon
-            tw.traceDist1 += 1.0f;
-            tw.traceDist2 += 1.0f;
+            tw->traceDist1 += 1.0f;
+            tw->traceDist2 += 1.0f;
         }
         
-        CM_CalcTraceBounds( &tw, true );
+        CM_CalcTraceBounds( tw, true );
+    }
+    
+    return positionTest;
+}
+
+/*
+==================
+CM_Trace
+==================
+*/
+static void CM_Trace( trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, clipHandle_t model, const vec3_t origin, S32 brushmask, traceType_t type, sphere_t* sphere )
+{
+    traceWork_t     tw;
+    cmodel_t*       cmod;
+    bool            positionTest;
+    
+    cmod = CM_ClipHandleToModel( model );
+    
+    cm.checkcount++;			// for multi-check avoidance
+    
+    c_traces++;					// for statistics, may be zeroed
+    
+    positionTest = CM_SetupTrace( &tw, start, end, mins, maxs, origin, brushmask, type, sphere );
+    
+    if( !cm.numNodes )
+    {
+        *results = tw.trace;
+        
+        return; // map not loaded, shouldn't happen
     }
     
     // check for position test special case
@@ -2399,6 +2357,28 @@ idCollisionModelManagerLocal::BoxTrace
 */
 void idCollisionModelManagerLocal::BoxTrace( trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, clipHandle_t model, S32 brushmask, traceType_t type )
 {
+#ifndef BSPC
+    if( cm_recordFile )
+    {
+        CM_RecordQuery( CMQ_BOXTRACE, start, end, mins, maxs, model, brushmask, type, NULL, NULL, 0, 0 );
+    }
+    
+    // the world never moves, so its traces stay valid until the next map is loaded
+    if( model == 0 && cm_traceCache && cm_traceCache->integer )
+    {
+        if( CM_TraceCacheLookup( &cm_worldTraceCache, results, start, end, mins, maxs, model, brushmask, type ) )
+        {
+            return;
+        }
+        
+        CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, type, NULL );
+        
+        // nothing invalidates world entries by bounds, only a clear does
+        CM_TraceCacheStore( &cm_worldTraceCache, results, start, end, mins, maxs, model, brushmask, type, vec3_origin, vec3_origin );
+        return;
+    }
+#endif
+
     CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, type, NULL );
 }
 
@@ -2439,6 +2419,13 @@ void idCollisionModelManagerLocal::TransformedBoxTrace( trace_t* results, const
     F32           t;
     sphere_t        sphere;
     
+#ifndef BSPC
+    if( cm_recordFile )
+    {
+        CM_RecordQuery( CMQ_TRANSFORMEDBOXTRACE, start, end, mins, maxs, model, brushmask, type, origin, angles, 0, 0 );
+    }
+#endif
+
     if( !mins )
     {
         mins = vec3_origin;
@@ -2543,6 +2530,115 @@ void idCollisionModelManagerLocal::TransformedBoxTrace( trace_t* results, const
     *results = trace;
 }
 
+/*
+==================
+idCollisionModelManagerLocal::CapsuleTraceBatch
+
+Sweeps a capsule against a set of unrotated capsules given by their world
+space bounds, with the same result TransformedBoxTrace would give for the
+nearest of them.  The trace setup is done once and the capsules are culled
+against the trace bounds four at a time, so this is much cheaper than one
+trace per capsule when most of them are far away.
+hitNum is set to the index of the capsule that stopped the trace, else to
+the first one the trace started in, else to -1
+==================
+*/
+void idCollisionModelManagerLocal::CapsuleTraceBatch( trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, const vec3_t* capsuleMins, const vec3_t* capsuleMaxs, S32 numCapsules, S32* hitNum )
+{
+    traceWork_t     tw;
+    cmBounds4_t     group;
+    vec3_t          traceMins, traceMaxs;
+    bool            positionTest, startsolid;
+    F32             fraction;
+    S32             i, j, base, count, bits;
+    
+    *hitNum = -1;
+    
+#ifndef BSPC
+    if( cm_recordFile )
+    {
+        vec3_t boxMins, boxMaxs;
+        
+        // record the capsule model trace each capsule stands in for, at its world bounds
+        ModelBounds( CAPSULE_MODEL_HANDLE, boxMins, boxMaxs );
+        
+        for( i = 0; i < numCapsules; i++ )
+        {
+            TempBoxModel( capsuleMins[i], capsuleMaxs[i], true );
+            CM_RecordQuery( CMQ_TRANSFORMEDBOXTRACE, start, end, mins, maxs, CAPSULE_MODEL_HANDLE, CONTENTS_BODY, TT_CAPSULE, vec3_origin, vec3_origin, 0, 0 );
+        }
+        
+        TempBoxModel( boxMins, boxMaxs, true );
+    }
+#endif
+
+    cm.checkcount++;			// for multi-check avoidance
+    
+    c_traces++;					// for statistics, may be zeroed
+    
+    positionTest = CM_SetupTrace( &tw, start, end, mins, maxs, vec3_origin, CONTENTS_BODY, TT_CAPSULE, NULL );
+    
+    // the sweep kernels accept capsules up to RADIUS_EPSILON outside the trace bounds
+    for( i = 0; i < 3; i++ )
+    {
+        traceMins[i] = tw.bounds[0][i] - RADIUS_EPSILON;
+        traceMaxs[i] = tw.bounds[1][i] + RADIUS_EPSILON;
+    }
+    
+    for( base = 0; base < numCapsules && !tw.trace.allsolid; base += 4 )
+    {
+        count = numCapsules - base < 4 ? numCapsules - base : 4;
+        
+        for( j = 0; j < count; j++ )
+        {
+            CM_SetBounds4( &group, j, capsuleMins[base + j], capsuleMaxs[base + j] );
+        }
+        
+        bits = CM_BoundsIntersect4( &group, traceMins, traceMaxs ) & ( ( 1 << count ) - 1 );
+        
+        for( j = 0; bits && !tw.trace.allsolid; j++, bits >>= 1 )
+        {
+            if( !( bits & 1 ) )
+            {
+                continue;
+            }
+            
+            fraction = tw.trace.fraction;
+            startsolid = tw.trace.startsolid;
+            
+            if( positionTest )
+            {
+                CM_TestCapsuleInCapsuleBounds( &tw, capsuleMins[base + j], capsuleMaxs[base + j] );
+            }
+            else
+            {
+                CM_SweepCapsuleThroughCapsule( &tw, capsuleMins[base + j], capsuleMaxs[base + j] );
+            }
+            
+            // ties go to the first capsule, like separate traces merged in order
+            if( tw.trace.fraction < fraction )
+            {
+                *hitNum = base + j;
+            }
+            else if( tw.trace.startsolid && !startsolid && *hitNum < 0 )
+            {
+                *hitNum = base + j;
+            }
+        }
+    }
+    
+    if( tw.trace.fraction == 1 )
+    {
+        VectorCopy( end, tw.trace.endpos );
+    }
+    else
+    {
+        VectorLerp( start, end, tw.trace.fraction, tw.trace.endpos );
+    }
+    
+    *results = tw.trace;
+}
+
 /*
 ==================
 idCollisionModelManagerLocal::BiSphereTrace
@@ -2554,7 +2650,15 @@ void idCollisionModelManagerLocal::BiSphereTrace( trace_t* results, const vec3_t
     S32             i;
     traceWork_t     tw;
     cmodel_t*       cmod;
+    cmVec_t         startSphere, endSphere;
     
+#ifndef BSPC
+    if( cm_recordFile )
+    {
+        CM_RecordQuery( CMQ_BISPHERETRACE, start, end, NULL, NULL, model, mask, TT_BISPHERE, NULL, NULL, startRad, endRad );
+    }
+#endif
+
     cmod = CM_ClipHandleToModel( model );
     
     cm.checkcount++;			// for multi-check avoidance
@@ -2588,19 +2692,10 @@ void idCollisionModelManagerLocal::BiSphereTrace( trace_t* results, const vec3_t
     //
     // calculate bounds
     //
-    for( i = 0; i < 3; i++ )
-    {
-        if( tw.start[i] < tw.end[i] )
-        {
-            tw.bounds[0][i] = tw.start[i] - tw.biSphere.startRadius;
-            tw.bounds[1][i] = tw.end[i] + tw.biSphere.endRadius;
-        }
-        else
-        {
-            tw.bounds[0][i] = tw.end[i] + tw.biSphere.endRadius;
-            tw.bounds[1][i] = tw.start[i] - tw.biSphere.startRadius;
-        }
-    }
+    startSphere = CM_VecLoad3( tw.start );
+    endSphere = CM_VecLoad3( tw.end );
+    CM_VecStore3( CM_VecMin( CM_VecSub( startSphere, CM_VecSplat( startRad ) ), CM_VecSub( endSphere, CM_VecSplat( endRad ) ) ), tw.bounds[0] );
+    CM_VecStore3( CM_VecMax( CM_VecAdd( startSphere, CM_VecSplat( startRad ) ), CM_VecAdd( endSphere, CM_VecSplat( endRad ) ) ), tw.bounds[1] );
     
     tw.isPoint = false;
     tw.extents[0] = largestRadius;
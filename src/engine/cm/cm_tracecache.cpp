@@ -0,0 +1,234 @@
+////////////////////////////////////////////////////////////////////////////////////////
+// Copyright(C) 1999 - 2010 id Software LLC, a ZeniMax Media company.
+// Copyright(C) 2011 - 2018 Dusan Jocic <dusanjocic@msn.com>
+//
+// This file is part of the OpenWolf GPL Source Code.
+// OpenWolf Source Code is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenWolf Source Code is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenWolf Source Code.  If not, see <http://www.gnu.org/licenses/>.
+//
+// In addition, the OpenWolf Source Code is also subject to certain additional terms.
+// You should have received a copy of these additional terms immediately following the
+// terms and conditions of the GNU General Public License which accompanied the
+// OpenWolf Source Code. If not, please request a copy in writing from id Software
+// at the address below.
+//
+// If you have questions concerning this license or the applicable additional terms,
+// you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+// Suite 120, Rockville, Maryland 20850 USA.
+//
+// -------------------------------------------------------------------------------------
+// File name:   cm_tracecache.cpp
+// Version:     v1.01
+// Created:
+// Compilers:   Visual Studio 2017, gcc 7.3.0
+// Description: Memoization of repeated identical trace queries
+// -------------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef DEDICATED
+#include <null/null_precompiled.h>
+#else
+#include <OWLib/precompiled.h>
+#endif
+
+/*
+
+A trace cache is a direct mapped table of trace results keyed on the exact
+query.  Entries are tagged with the generation they were stored in, so
+clearing the whole cache is a single increment.  Each entry keeps the bounds
+of the whole move, which lets callers drop the entries a moving entity may
+have changed without flushing everything.
+
+*/
+
+/*
+==================
+CM_TraceCacheHash
+==================
+*/
+static U32 CM_TraceCacheHash( const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, S32 owner, S32 mask, S32 type )
+{
+    const vec_t*    vecs[4];
+    U32             hash, bits;
+    S32             i, j;
+    
+    vecs[0] = start;
+    vecs[1] = end;
+    vecs[2] = mins;
+    vecs[3] = maxs;
+    
+    // FNV-1a over the raw bits, the key must match exactly anyway
+    hash = 2166136261u;
+    for( i = 0; i < 4; i++ )
+    {
+        for( j = 0; j < 3; j++ )
+        {
+            ::memcpy( &bits, &vecs[i][j], sizeof( bits ) );
+            hash = ( hash ^ bits ) * 16777619u;
+        }
+    }
+    
+    hash = ( hash ^ ( U32 )owner ) * 16777619u;
+    hash = ( hash ^ ( U32 )mask ) * 16777619u;
+    hash = ( hash ^ ( U32 )type ) * 16777619u;
+    
+    return hash;
+}
+
+/*
+==================
+CM_TraceCacheClear
+
+Invalidates every entry
+==================
+*/
+void CM_TraceCacheClear( traceCache_t* cache )
+{
+    cache->generation++;
+    cache->numLive = 0;
+    ClearBounds( cache->liveMins, cache->liveMaxs );
+}
+
+/*
+==================
+CM_TraceCacheLookup
+==================
+*/
+bool CM_TraceCacheLookup( traceCache_t* cache, trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, S32 owner, S32 mask, S32 type )
+{
+    traceCacheEntry_t*  entry;
+    U32                 hash;
+    
+    cache->lookups++;
+    
+    if( !cache->generation )
+    {
+        return false; // never cleared, the zeroed entries are not valid
+    }
+    
+    if( !mins )
+    {
+        mins = vec3_origin;
+    }
+    if( !maxs )
+    {
+        maxs = vec3_origin;
+    }
+    
+    hash = CM_TraceCacheHash( start, end, mins, maxs, owner, mask, type );
+    entry = &cache->entries[hash & ( TRACE_CACHE_SIZE - 1 )];
+    
+    if( entry->generation != cache->generation || entry->hash != hash || entry->owner != owner || entry->mask != mask || entry->type != type ||
+            !VectorCompare( entry->start, start ) || !VectorCompare( entry->end, end ) || !VectorCompare( entry->mins, mins ) || !VectorCompare( entry->maxs, maxs ) )
+    {
+        return false;
+    }
+    
+    cache->hits++;
+    *results = entry->trace;
+    
+    return true;
+}
+
+/*
+==================
+CM_TraceCacheStore
+
+absmins/absmaxs enclose everything the trace could have touched
+==================
+*/
+void CM_TraceCacheStore( traceCache_t* cache, const trace_t* results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, S32 owner, S32 mask, S32 type, const vec3_t absmins, const vec3_t absmaxs )
+{
+    traceCacheEntry_t*  entry;
+    U32                 hash;
+    
+    if( !mins )
+    {
+        mins = vec3_origin;
+    }
+    if( !maxs )
+    {
+        maxs = vec3_origin;
+    }
+    
+    hash = CM_TraceCacheHash( start, end, mins, maxs, owner, mask, type );
+    entry = &cache->entries[hash & ( TRACE_CACHE_SIZE - 1 )];
+    
+    if( entry->generation != cache->generation )
+    {
+        cache->numLive++;
+    }
+    
+    entry->generation = cache->generation;
+    entry->hash = hash;
+    entry->owner = owner;
+    entry->mask = mask;
+    entry->type = type;
+    VectorCopy( start, entry->start );
+    VectorCopy( end, entry->end );
+    VectorCopy( mins, entry->mins );
+    VectorCopy( maxs, entry->maxs );
+    VectorCopy( absmins, entry->absmins );
+    VectorCopy( absmaxs, entry->absmaxs );
+    entry->trace = *results;
+    
+    AddPointToBounds( absmins, cache->liveMins, cache->liveMaxs );
+    AddPointToBounds( absmaxs, cache->liveMins, cache->liveMaxs );
+    
+    cache->stores++;
+}
+
+/*
+==================
+CM_TraceCacheInvalidateBounds
+
+Drops every entry whose move overlaps the given box
+==================
+*/
+void CM_TraceCacheInvalidateBounds( traceCache_t* cache, const vec3_t mins, const vec3_t maxs )
+{
+    traceCacheEntry_t*  entry;
+    S32                 i;
+    
+    // cheap reject against the union of everything stored
+    if( !cache->numLive || !CM_BoundsIntersect( mins, maxs, cache->liveMins, cache->liveMaxs ) )
+    {
+        return;
+    }
+    
+    for( i = 0, entry = cache->entries; i < TRACE_CACHE_SIZE; i++, entry++ )
+    {
+        if( entry->generation != cache->generation )
+        {
+            continue;
+        }
+        
+        if( CM_BoundsIntersect( mins, maxs, entry->absmins, entry->absmaxs ) )
+        {
+            entry->generation = cache->generation - 1;
+            cache->numLive--;
+            cache->invalidations++;
+        }
+    }
+}
+
+/*
+==================
+CM_TraceCachePrint
+==================
+*/
+void CM_TraceCachePrint( const traceCache_t* cache, StringEntry name )
+{
+    Com_Printf( "%s: %i lookups, %i hits (%.1f%%), %i stores, %i invalidated, %i live\n", name, cache->lookups, cache->hits,
+                cache->lookups ? 100.0f * cache->hits / cache->lookups : 0.0f, cache->stores, cache->invalidations, cache->numLive );
+}
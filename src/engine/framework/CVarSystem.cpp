@@ -52,6 +52,30 @@ S32 cvar_numIndexes;
 #define FILE_HASH_SIZE 512
 static cvar_t* hashTable[FILE_HASH_SIZE];
 
+// the handle of every change in order, so the modules can update just the
+// vmCvars that changed instead of all of them, see Changes
+#define CVAR_JOURNAL_SIZE 1024
+static cvarHandle_t cvar_journal[CVAR_JOURNAL_SIZE];
+static S32 cvar_journalSequence;	// changes ever journaled
+
+// info strings are kept per flag mask and only rebuilt after a cvar with
+// one of those flags changed, see InfoChanged
+#define CVAR_INFO_FLAGS ( CVAR_USERINFO | CVAR_SERVERINFO | CVAR_SYSTEMINFO | CVAR_WOLFINFO | CVAR_SERVERINFO_NOUPDATE )
+#define MAX_INFO_CACHE 8
+
+typedef struct
+{
+    S32 bit;			// 0 for an unused one
+    bool big;
+    S32 version;		// the sum of cvar_infoVersions over bit when it was built
+    UTF8 info[BIG_INFO_STRING];
+} cvarInfoCache_t;
+
+static S32 cvar_infoVersions[32];	// changes to cvars with each flag
+static cvarInfoCache_t cvar_infoCache[MAX_INFO_CACHE];
+static cvarInfoCache_t cvar_infoScratch;	// for masks with other flags, which aren't tracked
+static S32 cvar_infoCacheNext;
+
 idCVarSystemLocal cvarSystemLocal;
 idCVarSystem* cvarSystem = &cvarSystemLocal;
 
@@ -376,6 +400,10 @@ cvar_t* idCVarSystemLocal::Get( StringEntry var_name, StringEntry var_value, S32
             cvar_modifiedFlags |= flags;
         }
         
+        if( flags & ~var->flags )
+        {
+            InfoChanged( flags & ~var->flags );
+        }
         var->flags |= flags;
         
         // only allow one non-empty reset string without a warning
@@ -448,6 +476,7 @@ cvar_t* idCVarSystemLocal::Get( StringEntry var_name, StringEntry var_value, S32
     cvar_vars = var;
     
     var->flags = flags;
+    InfoChanged( flags );
     
     hash = generateHashValue( var_name );
     var->hashNext = hashTable[hash];
@@ -595,6 +624,7 @@ cvar_t* idCVarSystemLocal::GetSet2( StringEntry var_name, StringEntry value, boo
             var->latchedString = CopyString( value );
             var->modified = true;
             var->modificationCount++;
+            cvar_journal[cvar_journalSequence++ & ( CVAR_JOURNAL_SIZE - 1 )] = var - cvar_indexes;
             return var;
         }
     }
@@ -614,6 +644,8 @@ cvar_t* idCVarSystemLocal::GetSet2( StringEntry var_name, StringEntry value, boo
     }
     var->modified = true;
     var->modificationCount++;
+    cvar_journal[cvar_journalSequence++ & ( CVAR_JOURNAL_SIZE - 1 )] = var - cvar_indexes;
+    InfoChanged( var->flags );
     
     Z_Free( var->string );		// free the old value string
     
@@ -978,6 +1010,7 @@ void idCVarSystemLocal::SetU_f( void )
     }
     
     v->flags |= CVAR_USERINFO;
+    InfoChanged( CVAR_USERINFO );
 }
 
 /*
@@ -1006,6 +1039,7 @@ void idCVarSystemLocal::SetS_f( void )
     }
     
     v->flags |= CVAR_SERVERINFO;
+    InfoChanged( CVAR_SERVERINFO );
 }
 
 /*
@@ -1236,6 +1270,7 @@ void idCVarSystemLocal::Restart_f( void )
             
             // clear the var completely, since we
             // can't remove the index from the list
+            InfoChanged( var->flags );
             ::memset( var, 0, sizeof( *var ) );
             continue;
         }
@@ -1248,50 +1283,115 @@ void idCVarSystemLocal::Restart_f( void )
 
 /*
 =====================
-idCVarSystemLocal::InfoString
+idCVarSystemLocal::InfoChanged
+
+A cvar with these flags was set, added or dropped, or got them added
 =====================
 */
-UTF8* idCVarSystemLocal::InfoString( S32 bit )
+void idCVarSystemLocal::InfoChanged( S32 flags )
 {
-    static UTF8 info[MAX_INFO_STRING];
-    cvar_t* var;
-    
-    info[0] = 0;
+    S32 i;
     
-    for( var = cvar_vars; var; var = var->next )
+    flags &= CVAR_INFO_FLAGS;
+    for( i = 0; flags; i++, flags >>= 1 )
     {
-        if( var->flags & bit )
+        if( flags & 1 )
         {
-            Info_SetValueForKey( info, var->name, var->string );
+            cvar_infoVersions[i]++;
         }
     }
-    
-    return info;
 }
 
 /*
 =====================
-idCVarSystemLocal::InfoString_Big
+idCVarSystemLocal::CachedInfoString
 
-  handles large info strings ( CS_SYSTEMINFO )
+Returns the info string of every cvar with one of the bit flags, rebuilding
+it only if one of them changed since the last call.  Only the info flags are
+tracked, a mask with anything else is rebuilt every time.
 =====================
 */
-UTF8* idCVarSystemLocal::InfoString_Big( S32 bit )
+UTF8* idCVarSystemLocal::CachedInfoString( S32 bit, bool big )
 {
-    static UTF8 info[BIG_INFO_STRING];
+    cvarInfoCache_t* cache;
     cvar_t* var;
+    S32 version, i;
+    
+    version = 0;
+    for( i = 0; i < 32; i++ )
+    {
+        if( bit & ( 1 << i ) )
+        {
+            version += cvar_infoVersions[i];
+        }
+    }
     
-    info[0] = 0;
+    for( i = 0, cache = cvar_infoCache; i < MAX_INFO_CACHE; i++, cache++ )
+    {
+        if( cache->bit == bit && cache->big == big )
+        {
+            break;
+        }
+    }
+    
+    if( bit & ~CVAR_INFO_FLAGS )
+    {
+        cache = &cvar_infoScratch;
+    }
+    else if( i == MAX_INFO_CACHE )
+    {
+        cache = &cvar_infoCache[cvar_infoCacheNext++ & ( MAX_INFO_CACHE - 1 )];
+        cache->bit = bit;
+        cache->big = big;
+    }
+    else if( cache->version == version )
+    {
+        return cache->info;
+    }
+    
+    // not valid until it's built, Info_SetValueForKey can drop out of here
+    cache->version = -1;
+    cache->info[0] = 0;
     
     for( var = cvar_vars; var; var = var->next )
     {
         if( var->flags & bit )
         {
-            Info_SetValueForKey_Big( info, var->name, var->string );
+            if( big )
+            {
+                Info_SetValueForKey_Big( cache->info, var->name, var->string );
+            }
+            else
+            {
+                Info_SetValueForKey( cache->info, var->name, var->string );
+            }
         }
     }
+    cache->version = version;
     
-    return info;
+    return cache->info;
+}
+
+/*
+=====================
+idCVarSystemLocal::InfoString
+=====================
+*/
+UTF8* idCVarSystemLocal::InfoString( S32 bit )
+{
+    return CachedInfoString( bit, false );
+}
+
+/*
+=====================
+idCVarSystemLocal::InfoString_Big
+
+  handles large info strings ( CS_SYSTEMINFO )
+=====================
+*/
+UTF8* idCVarSystemLocal::InfoString_Big( S32 bit )
+{
+    return CachedInfoString( bit, true );
 }
 
 /*
@@ -1393,6 +1493,37 @@ void idCVarSystemLocal::Update( vmCvar_t* vmCvar )
     vmCvar->integer = cv->integer;
 }
 
+/*
+=====================
+idCVarSystemLocal::Changes
+
+Fills handles with the cvars changed since *sequence and moves *sequence up
+to now.  A sequence of 0 asks for every change since startup.  Returns -1 if
+the journal has wrapped past *sequence or there are more than maxHandles,
+then the caller has to Update everything it has.  A handle can be there
+more than once.
+=====================
+*/
+S32 idCVarSystemLocal::Changes( S32* sequence, cvarHandle_t* handles, S32 maxHandles )
+{
+    S32 count, i;
+    
+    count = cvar_journalSequence - *sequence;
+    *sequence = cvar_journalSequence;
+    
+    if( count < 0 || count > CVAR_JOURNAL_SIZE || count > maxHandles )
+    {
+        return -1;
+    }
+    
+    for( i = 0; i < count; i++ )
+    {
+        handles[i] = cvar_journal[( cvar_journalSequence - count + i ) & ( CVAR_JOURNAL_SIZE - 1 )];
+    }
+    
+    return count;
+}
+
 /*
 ==================
 idCVarSystemLocal::CompleteCvarName
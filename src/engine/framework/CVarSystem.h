@@ -51,6 +51,8 @@ public:
     static S64 generateHashValue( StringEntry fname );
     static bool ValidateString( StringEntry s );
     static cvar_t* FindVar( StringEntry var_name );
+    static void InfoChanged( S32 flags );
+    static UTF8* CachedInfoString( S32 bit, bool big );
     virtual F32 VariableValue( StringEntry var_name );
     virtual S32 VariableIntegerValue( StringEntry var_name );
     virtual UTF8* VariableString( StringEntry var_name );
@@ -87,6 +89,7 @@ public:
     virtual void Update( vmCvar_t* vmCvar );
     static void CompleteCvarName( UTF8* args, S32 argNum );
     virtual void Init( void );
+    virtual S32 Changes( S32* sequence, cvarHandle_t* handles, S32 maxHandles );
 };
 
 extern idCVarSystemLocal cvarSystemLocal;
@@ -223,9 +223,44 @@ static cvar_t* fs_basegame;
 static cvar_t* fs_copyfiles;
 static cvar_t* fs_gamedirvar;
 static cvar_t* fs_restrict;
+static cvar_t* fs_index;
+static cvar_t* fs_mmap;
+static cvar_t* fs_ioThreads;
+static cvar_t* fs_fileCache;
+static cvar_t* fs_inflateWhole;
 static searchpath_t* fs_searchpaths;
 
-static S32 fs_readCount; // total bytes read
+// merged index of the search path, see idFileSystemLocal::BuildIndex
+static fsIndex_t fsIndex;
+static fsDirCacheEntry_t fsDirCache[FS_DIRCACHE_SIZE];
+
+// ReadFile buffers that are file mappings, see idFileSystemLocal::MapFile
+static fsMapping_t fs_mappings[MAX_FILE_MAPPINGS];
+static S32 fs_numMappings;
+
+// inflated pk3 files, see idFileSystemLocal::FileCacheRead
+static fsFileCache_t fs_cache;
+
+// see idFileSystemLocal::ListFilteredFiles
+static fsListCacheEntry_t fs_listCache[FS_LIST_CACHE_SIZE];
+static S32 fs_listCacheNext;
+
+// qsort has no context, see idFileSystemLocal::BuildPackDirs
+static fileInPack_t* fs_sortFiles;
+static S32* fs_sortDirLen;
+
+// ReadFileAsync, see idFileSystemLocal::StartAsyncThreads
+static SDL_Thread* fs_asyncThreads[MAX_ASYNC_THREADS];
+static S32 fs_numAsyncThreads;
+static SDL_mutex* fs_asyncLock;
+static SDL_cond* fs_asyncWake; // a request was queued or the threads should quit
+static fsAsyncRead_t* fs_asyncQueue; // waiting for a thread
+static fsAsyncRead_t** fs_asyncQueueTail;
+static fsAsyncRead_t* fs_asyncFinished; // waiting for RunAsyncCallbacks
+static fsAsyncRead_t** fs_asyncFinishedTail;
+static bool fs_asyncQuit;
+
+static SDL_atomic_t fs_readCount; // total bytes read
 static S32 fs_loadCount; // total files read
 static S32 fs_loadStack; // total files in memory
 static S32 fs_packFiles; // total number of files in packs
@@ -353,10 +388,12 @@ fileHandle_t idFileSystemLocal::HandleForFile( void )
 {
     S32 i;
     
+    // claiming a slot is atomic, so any thread can get a handle
     for( i = 1 ; i < MAX_FILE_HANDLES ; i++ )
     {
-        if( fsh[i].handleFiles.file.o == NULL )
+        if( SDL_AtomicCAS( &fs_handleUsed[i], 0, 1 ) )
         {
+            ::memset( &fsh[i], 0, sizeof( fsh[i] ) );
             return i;
         }
     }
@@ -364,6 +401,73 @@ fileHandle_t idFileSystemLocal::HandleForFile( void )
     return 0;
 }
 
+/*
+================
+idFileSystemLocal::ReleaseHandle
+
+Gives back a handle from HandleForFile, whatever it was opened on has to be
+closed already
+================
+*/
+void idFileSystemLocal::ReleaseHandle( fileHandle_t f )
+{
+    ::memset( &fsh[f], 0, sizeof( fsh[f] ) );
+    SDL_AtomicSet( &fs_handleUsed[f], 0 );
+}
+
+/*
+================
+idFileSystemLocal::AcquirePackHandle
+
+Returns an unzFile of pak that nothing else reads from, an idle one from the
+pack's pool if there is one.  Safe to call from any thread.
+================
+*/
+unzFile idFileSystemLocal::AcquirePackHandle( pack_t* pak )
+{
+    unzFile z;
+    
+    z = NULL;
+    
+    SDL_AtomicLock( &pak->poolLock );
+    if( pak->numPooledHandles )
+    {
+        z = pak->pooledHandles[--pak->numPooledHandles];
+    }
+    SDL_AtomicUnlock( &pak->poolLock );
+    
+    if( !z )
+    {
+        z = unzOpen( pak->pakFilename );
+    }
+    
+    return z;
+}
+
+/*
+================
+idFileSystemLocal::ReleasePackHandle
+
+Puts a handle from AcquirePackHandle back in the pool, or closes it if the
+pool is full
+================
+*/
+void idFileSystemLocal::ReleasePackHandle( pack_t* pak, unzFile z )
+{
+    SDL_AtomicLock( &pak->poolLock );
+    if( pak->numPooledHandles < MAX_PACK_HANDLES )
+    {
+        pak->pooledHandles[pak->numPooledHandles++] = z;
+        z = NULL;
+    }
+    SDL_AtomicUnlock( &pak->poolLock );
+    
+    if( z )
+    {
+        unzClose( z );
+    }
+}
+
 /*
 ================
 idFileSystemLocal::FileForHandle
@@ -416,6 +520,11 @@ S32 idFileSystemLocal::filelength( fileHandle_t f )
     S32 pos, end;
     FILE* h;
     
+    if( fsh[f].bundleFile )
+    {
+        return ( ( bundleEntry_t* )fsh[f].pak->bundle )[fsh[f].bundleEntry].size;
+    }
+    
     h = FileForHandle( f );
     pos = ftell( h );
     
@@ -538,6 +647,8 @@ void idFileSystemLocal::FSCopyFile( UTF8* fromOSPath, UTF8* toOSPath )
     
     Com_Printf( "copy %s to %s\n", fromOSPath, toOSPath );
     
+    InvalidateDirCache();
+    
     if( strstr( fromOSPath, "journal.dat" ) || strstr( fromOSPath, "journaldata.dat" ) )
     {
         Com_Printf( "Ignoring journal files\n" );
@@ -593,6 +704,7 @@ idFileSystemLocal::Remove
 */
 bool idFileSystemLocal::Remove( StringEntry osPath )
 {
+    InvalidateDirCache();
     return ( bool )!remove( osPath );
 }
 
@@ -603,6 +715,7 @@ idFileSystemLocal::HomeRemove
 */
 void idFileSystemLocal::HomeRemove( StringEntry homePath )
 {
+    InvalidateDirCache();
     remove( BuildOSPath( fs_homepath->string, fs_gamedir, homePath ) );
 }
 
@@ -694,6 +807,8 @@ fileHandle_t idFileSystemLocal::SV_FOpenFileWrite( StringEntry filename )
         Com_Error( ERR_FATAL, "idFileSystemLocal::SV_FOpenFileWrite: Filesystem call made without initialization\n" );
     }
     
+    InvalidateDirCache();
+    
     ospath = BuildOSPath( fs_homepath->string, filename, "" );
     ospath[strlen( ospath ) - 1] = '\0';
     
@@ -707,6 +822,7 @@ fileHandle_t idFileSystemLocal::SV_FOpenFileWrite( StringEntry filename )
     
     if( CreatePath( ospath ) )
     {
+        ReleaseHandle( f );
         return 0;
     }
     
@@ -719,6 +835,7 @@ fileHandle_t idFileSystemLocal::SV_FOpenFileWrite( StringEntry filename )
     
     if( !fsh[f].handleFiles.file.o )
     {
+        ReleaseHandle( f );
         f = 0;
     }
     
@@ -779,14 +896,15 @@ S32 idFileSystemLocal::SV_FOpenFileRead( StringEntry filename, fileHandle_t* fp
             
             fsh[f].handleFiles.file.o = fopen( ospath, "rb" );
             fsh[f].handleSync = false;
-            
-            if( !fsh[f].handleFiles.file.o )
-            {
-                f = 0;
-            }
         }
     }
     
+    if( !fsh[f].handleFiles.file.o )
+    {
+        ReleaseHandle( f );
+        f = 0;
+    }
+    
     *fp = f;
     if( f )
     {
@@ -810,6 +928,8 @@ void idFileSystemLocal::SV_Rename( StringEntry from, StringEntry to )
         Com_Error( ERR_FATAL, "idFileSystemLocal::SV_Rename: Filesystem call made without initialization\n" );
     }
     
+    InvalidateDirCache();
+    
     // don't let sound stutter
     //S_ClearSoundBuffer();
     
@@ -845,6 +965,8 @@ void idFileSystemLocal::Rename( StringEntry from, StringEntry to )
         Com_Error( ERR_FATAL, "idFileSystemLocal::Rename: Filesystem call made without initialization\n" );
     }
     
+    InvalidateDirCache();
+    
     // don't let sound stutter
     //S_ClearSoundBuffer();
     
@@ -881,15 +1003,23 @@ void idFileSystemLocal::FCloseFile( fileHandle_t f )
         Com_Error( ERR_FATAL, "idFileSystemLocal::FCloseFile: Filesystem call made without initialization\n" );
     }
     
+    if( fsh[f].bundleFile )
+    {
+        free( fsh[f].bundleData );
+        ReleaseHandle( f );
+        
+        return;
+    }
+    
     if( fsh[f].zipFile == true )
     {
         unzCloseCurrentFile( fsh[f].handleFiles.file.z );
         
         if( fsh[f].handleFiles.unique )
         {
-            unzClose( fsh[f].handleFiles.file.z );
+            ReleasePackHandle( fsh[f].pak, fsh[f].handleFiles.file.z );
         }
-        ::memset( &fsh[f], 0, sizeof( fsh[f] ) );
+        ReleaseHandle( f );
         
         return;
     }
@@ -900,7 +1030,7 @@ void idFileSystemLocal::FCloseFile( fileHandle_t f )
         fclose( fsh[f].handleFiles.file.o );
     }
     
-    ::memset( &fsh[f], 0, sizeof( fsh[f] ) );
+    ReleaseHandle( f );
 }
 
 /*
@@ -918,6 +1048,8 @@ fileHandle_t idFileSystemLocal::FOpenFileWrite( StringEntry filename )
         Com_Error( ERR_FATAL, "idFileSystemLocal::FOpenFileWrite: Filesystem call made without initialization\n" );
     }
     
+    InvalidateDirCache();
+    
     f = HandleForFile();
     fsh[f].zipFile = false;
     
@@ -930,6 +1062,7 @@ fileHandle_t idFileSystemLocal::FOpenFileWrite( StringEntry filename )
     
     if( CreatePath( ospath ) )
     {
+        ReleaseHandle( f );
         return 0;
     }
     
@@ -944,6 +1077,7 @@ fileHandle_t idFileSystemLocal::FOpenFileWrite( StringEntry filename )
     
     if( !fsh[f].handleFiles.file.o )
     {
+        ReleaseHandle( f );
         f = 0;
     }
     
@@ -965,6 +1099,8 @@ fileHandle_t idFileSystemLocal::FOpenFileAppend( StringEntry filename )
         Com_Error( ERR_FATAL, "Filesystem call made without initialization\n" );
     }
     
+    InvalidateDirCache();
+    
     f = HandleForFile();
     fsh[f].zipFile = false;
     
@@ -982,6 +1118,7 @@ fileHandle_t idFileSystemLocal::FOpenFileAppend( StringEntry filename )
     
     if( CreatePath( ospath ) )
     {
+        ReleaseHandle( f );
         return 0;
     }
     
@@ -990,6 +1127,7 @@ fileHandle_t idFileSystemLocal::FOpenFileAppend( StringEntry filename )
     
     if( !fsh[f].handleFiles.file.o )
     {
+        ReleaseHandle( f );
         f = 0;
     }
     
@@ -1011,6 +1149,8 @@ S32 idFileSystemLocal::FOpenFileDirect( StringEntry filename, fileHandle_t* f )
         Com_Error( ERR_FATAL, "idFileSystemLocal::FOpenFileDirect: Filesystem call made without initialization\n" );
     }
     
+    InvalidateDirCache();
+    
     *f = HandleForFile();
     fsh[*f].zipFile	= false;
     
@@ -1028,6 +1168,7 @@ S32 idFileSystemLocal::FOpenFileDirect( StringEntry filename, fileHandle_t* f )
     
     if( !fsh[*f].handleFiles.file.o )
     {
+        ReleaseHandle( *f );
         *f = 0;
         return 0;
     }
@@ -1054,6 +1195,8 @@ fileHandle_t idFileSystemLocal::FOpenFileUpdate( StringEntry filename, S32* leng
         Com_Error( ERR_FATAL, "idFileSystemLocal::FOpenFileUpdate: Filesystem call made without initialization\n" );
     }
     
+    InvalidateDirCache();
+    
     f = HandleForFile();
     fsh[f].zipFile = false;
     
@@ -1066,6 +1209,7 @@ fileHandle_t idFileSystemLocal::FOpenFileUpdate( StringEntry filename, S32* leng
     
     if( CreatePath( ospath ) )
     {
+        ReleaseHandle( f );
         return 0;
     }
     
@@ -1076,6 +1220,7 @@ fileHandle_t idFileSystemLocal::FOpenFileUpdate( StringEntry filename, S32* leng
     
     if( !fsh[f].handleFiles.file.o )
     {
+        ReleaseHandle( f );
         f = 0;
     }
     
@@ -1169,6 +1314,306 @@ UTF8* idFileSystemLocal::ShiftStr( StringEntry string, S32 shift )
     return buf;
 }
 
+/*
+===========
+idFileSystemLocal::FOpenFileInPack
+
+Opens pakFile of pak on the given handle and marks the pak as referenced
+===========
+*/
+S32 idFileSystemLocal::FOpenFileInPack( StringEntry filename, fileHandle_t file, pack_t* pak, fileInPack_t* pakFile, bool uniqueFILE )
+{
+    S32 l;
+    
+    // mark the pak as having been referenced and mark specifics on cgame and ui
+    // shaders, txt, arena files  by themselves do not count as a reference as
+    // these are loaded from all pk3s
+    // from every pk3 file..
+    l = strlen( filename );
+    if( !( pak->referenced & FS_GENERAL_REF ) )
+    {
+        if( Q_stricmp( filename + l - 7, ".shader" ) != 0 &&
+                Q_stricmp( filename + l - 4, ".mtr" ) != 0 &&
+                Q_stricmp( filename + l - 4, ".txt" ) != 0 &&
+                Q_stricmp( filename + l - 4, ".ttf" ) != 0 &&
+                Q_stricmp( filename + l - 4, ".otf" ) != 0 &&
+                Q_stricmp( filename + l - 4, ".cfg" ) != 0 &&
+                Q_stricmp( filename + l - 7, ".config" ) != 0 &&
+                strstr( filename, "levelshots" ) == NULL &&
+                Q_stricmp( filename + l - 4, ".bot" ) != 0 &&
+                Q_stricmp( filename + l - 6, ".arena" ) != 0 &&
+                Q_stricmp( filename + l - 5, ".menu" ) != 0 )
+        {
+            pak->referenced |= FS_GENERAL_REF;
+        }
+    }
+    
+    // for OS client/server interoperability, we expect binaries for .so and .dll to be in the same pk3
+    // so that when we reference the DLL files on any platform, this covers everyone else
+    
+    // qagame dll
+    if( !( pak->referenced & FS_QAGAME_REF ) && !Q_stricmp( filename, Sys_GetDLLName( "sgame" ) ) )
+    {
+        pak->referenced |= FS_QAGAME_REF;
+    }
+    // cgame dll
+    if( !( pak->referenced & FS_CGAME_REF ) && !Q_stricmp( filename, Sys_GetDLLName( "cgame" ) ) )
+    {
+        pak->referenced |= FS_CGAME_REF;
+    }
+    
+    // bundle files are read with their own FILE, so they are always unique
+    if( pak->bundle )
+    {
+        Q_strncpyz( fsh[file].name, filename, sizeof( fsh[file].name ) );
+        fsh[file].bundleFile = true;
+        fsh[file].bundleEntry = pakFile->pos;
+        fsh[file].pak = pak;
+        
+        if( fs_debug->integer )
+        {
+            Com_Printf( "idFileSystemLocal::FOpenFileRead: %s (found in '%s')\n", filename, pak->pakFilename );
+        }
+        
+        return pakFile->len;
+    }
+    
+    if( uniqueFILE )
+    {
+        // open a new file on the pakfile
+        fsh[file].handleFiles.file.z = AcquirePackHandle( pak );
+        if( fsh[file].handleFiles.file.z == NULL )
+        {
+            Com_Error( ERR_FATAL, "Couldn't reopen %s", pak->pakFilename );
+        }
+    }
+    else
+    {
+        fsh[file].handleFiles.file.z = pak->handle;
+    }
+    
+    Q_strncpyz( fsh[file].name, filename, sizeof( fsh[file].name ) );
+    fsh[file].zipFile = true;
+    fsh[file].pak = pak;
+    
+    // set the file position in the zip file (also sets the current file info)
+    unzSetOffset( fsh[file].handleFiles.file.z, pakFile->pos );
+    
+    // open the file in the zip, after the first time we know where its data
+    // starts and the local header doesn't need to be read again
+    if( pakFile->dataPos )
+    {
+        unzOpenCurrentFileAt( fsh[file].handleFiles.file.z, pakFile->dataPos );
+    }
+    else
+    {
+        unzOpenCurrentFile( fsh[file].handleFiles.file.z );
+        pakFile->dataPos = unzGetCurrentFileDataOffset( fsh[file].handleFiles.file.z );
+    }
+    fsh[file].zipFilePos = pakFile->pos;
+    fsh[file].zipDataPos = pakFile->dataPos;
+    
+    if( fs_debug->integer )
+    {
+        Com_Printf( "idFileSystemLocal::FOpenFileRead: %s (found in '%s')\n", filename, pak->pakFilename );
+    }
+    
+    return pakFile->len;
+}
+
+/*
+===========
+FS_ReadBundleEntry
+
+Reads and if needed inflates the whole of a bundle file into out, which has
+room for entry->size bytes.  Only uses its own FILE and the system allocator,
+so it is safe on any thread.
+===========
+*/
+static bool FS_ReadBundleEntry( const pack_t* pak, const bundleEntry_t* entry, U8* out )
+{
+    z_stream stream;
+    FILE* file;
+    U8* compressed;
+    bool ok;
+    
+    file = fopen( pak->pakFilename, "rb" );
+    if( !file )
+    {
+        return false;
+    }
+    
+    if( fseek( file, entry->offset, SEEK_SET ) )
+    {
+        fclose( file );
+        return false;
+    }
+    
+    if( entry->compression == BUNDLE_STORED )
+    {
+        ok = fread( out, 1, entry->size, file ) == ( size_t )entry->size;
+        fclose( file );
+    }
+    else
+    {
+        compressed = ( U8* )malloc( entry->storedSize );
+        ok = compressed && fread( compressed, 1, entry->storedSize, file ) == ( size_t )entry->storedSize;
+        fclose( file );
+        
+        if( ok )
+        {
+            ::memset( &stream, 0, sizeof( stream ) );
+            stream.next_in = compressed;
+            stream.avail_in = entry->storedSize;
+            stream.next_out = out;
+            stream.avail_out = entry->size;
+            
+            ok = false;
+            if( inflateInit2( &stream, -MAX_WBITS ) == Z_OK )
+            {
+                ok = ( inflate( &stream, Z_FINISH ) == Z_STREAM_END && stream.total_out == ( uLong )entry->size );
+                inflateEnd( &stream );
+            }
+        }
+        
+        free( compressed );
+    }
+    
+    return ok && crc32( crc32( 0, NULL, 0 ), out, entry->size ) == entry->crc;
+}
+
+/*
+===========
+idFileSystemLocal::ReadBundleFile
+
+Loads the whole of the bundle file open on f, for reads that don't start at
+the beginning or don't want all of it
+===========
+*/
+bool idFileSystemLocal::ReadBundleFile( fileHandle_t f )
+{
+    bundleEntry_t* entry;
+    
+    if( fsh[f].bundleData )
+    {
+        return true;
+    }
+    
+    entry = &( ( bundleEntry_t* )fsh[f].pak->bundle )[fsh[f].bundleEntry];
+    fsh[f].bundleData = ( U8* )malloc( entry->size + 1 );
+    if( !fsh[f].bundleData )
+    {
+        return false;
+    }
+    
+    if( !FS_ReadBundleEntry( fsh[f].pak, entry, fsh[f].bundleData ) )
+    {
+        Com_Printf( S_COLOR_YELLOW "WARNING: couldn't read %s from %s\n", fsh[f].name, fsh[f].pak->pakFilename );
+        free( fsh[f].bundleData );
+        fsh[f].bundleData = NULL;
+        return false;
+    }
+    
+    return true;
+}
+
+/*
+===========
+idFileSystemLocal::DirAllowsFile
+
+If we are running restricted, or if the filesystem is configured for pure (fs_numServerPaks)
+the only files we will allow to come from the directory are .cfg files
+===========
+*/
+bool idFileSystemLocal::DirAllowsFile( StringEntry filename )
+{
+    S32 l;
+    UTF8 demoExt[16];
+    
+    if( !fs_restrict->integer && !fs_numServerPaks )
+    {
+        return true;
+    }
+    
+    Com_sprintf( demoExt, sizeof( demoExt ), ".dm_%d", ETPROTOCOL_VERSION );
+    
+    l = strlen( filename );
+    if( Q_stricmp( filename + l - 4, ".cfg" )        // for config files
+            && Q_stricmp( filename + l - 4, ".ttf" )
+            && Q_stricmp( filename + l - 4, ".otf" )
+            && Q_stricmp( filename + l - 5, ".menu" )  // menu files
+            && Q_stricmp( filename + l - 5, ".game" )  // menu files
+            && Q_stricmp( filename + l - strlen( demoExt ), demoExt )	// menu files
+            && Q_stricmp( filename + l - 4, ".dat" ) // for journal files
+            && Q_stricmp( filename + l - 8, "bots.txt" )
+            && Q_stricmp( filename + l - 8, ".botents" )
+#ifdef __MACOS__
+            // even when pure is on, let the server game be loaded
+            && Q_stricmp( filename, "qagame_mac" ) // Dushan - this is wrong now
+#endif
+      )
+    {
+        return false;
+    }
+    
+    return true;
+}
+
+/*
+===========
+idFileSystemLocal::FOpenFileInDir
+
+Opens filename from a directory of the search path on the given handle.
+Returns -1 if the file isn't there or may not be loaded from a directory.
+===========
+*/
+S32 idFileSystemLocal::FOpenFileInDir( StringEntry filename, fileHandle_t file, directory_t* dir )
+{
+    UTF8* netpath;
+    S32 l;
+    UTF8 demoExt[16];
+    
+    // check a file in the directory tree
+    if( !DirAllowsFile( filename ) )
+    {
+        return -1;
+    }
+    
+    netpath = BuildOSPath( dir->path, dir->gamedir, filename );
+    fsh[file].handleFiles.file.o = fopen( netpath, "rb" );
+    
+    if( !fsh[file].handleFiles.file.o )
+    {
+        return -1;
+    }
+    
+    Com_sprintf( demoExt, sizeof( demoExt ), ".dm_%d", ETPROTOCOL_VERSION );
+    
+    l = strlen( filename );
+    if( Q_stricmp( filename + l - 4, ".cfg" )        // for config files
+            && Q_stricmp( filename + l - 4, ".ttf" ) != 0
+            && Q_stricmp( filename + l - 4, ".otf" ) != 0
+            && Q_stricmp( filename + l - 5, ".menu" )  // menu files
+            && Q_stricmp( filename + l - 5, ".game" )  // menu files
+            && Q_stricmp( filename + l - strlen( demoExt ), demoExt ) // menu files
+            && Q_stricmp( filename + l - 4, ".dat" )
+            && Q_stricmp( filename + l - 8, ".botents" )
+            && !strstr( filename, "botfiles" ) )   // RF, need this for dev
+    {
+        fs_fakeChkSum = random();
+    }
+    
+    Q_strncpyz( fsh[file].name, filename, sizeof( fsh[file].name ) );
+    fsh[file].zipFile = false;
+    if( fs_debug->integer )
+    {
+        Com_Printf( "idFileSystemLocal::FOpenFileRead: %s (found in '%s/%s')\n", filename,
+                    dir->path, dir->gamedir );
+    }
+    
+    return filelength( file );
+}
+
 /*
 ===========
 idFileSystemLocal::FOpenFileRead
@@ -1189,7 +1634,7 @@ S32 idFileSystemLocal::FOpenFileRead( StringEntry filename, fileHandle_t* file,
     S64 hash = 0;
     FILE* temp;
     S32 l;
-    UTF8 demoExt[16];
+    bool searchAll;
     
     hash = 0;
     
@@ -1203,6 +1648,11 @@ S32 idFileSystemLocal::FOpenFileRead( StringEntry filename, fileHandle_t* file,
     // sure this chunk of code is really up to date with everything
     if( file == NULL )
     {
+        if( fs_index->integer && fsIndex.hashTable )
+        {
+            return IndexLookup( filename, false, &search, &pakFile );
+        }
+        
         // just wants to see if file is there
         for( search = fs_searchpaths ; search ; search = search->next )
         {
@@ -1264,7 +1714,6 @@ S32 idFileSystemLocal::FOpenFileRead( StringEntry filename, fileHandle_t* file,
         Com_Error( ERR_FATAL, "idFileSystemLocal::FOpenFileRead: NULL 'filename' parameter passed\n" );
     }
     
-    //Com_sprintf( demoExt, sizeof( demoExt ), ".dm_%d",PROTOCOL_VERSION );
     // qpaths are not supposed to have a leading slash
     if( filename[0] == '/' || filename[0] == '\\' )
     {
@@ -1292,7 +1741,33 @@ S32 idFileSystemLocal::FOpenFileRead( StringEntry filename, fileHandle_t* file,
     *file = HandleForFile();
     fsh[*file].handleFiles.unique = uniqueFILE;
     
-    for( search = fs_searchpaths ; search ; search = search->next )
+    // the index knows where every pk3 file lives, so a single probe gives the answer
+    searchAll = true;
+    if( fs_index->integer && fsIndex.hashTable )
+    {
+        if( IndexLookup( filename, true, &search, &pakFile ) )
+        {
+            if( search->pack )
+            {
+                return FOpenFileInPack( filename, *file, search->pack, pakFile, uniqueFILE );
+            }
+            
+            l = FOpenFileInDir( filename, *file, search->dir );
+            if( l >= 0 )
+            {
+                return l;
+            }
+            
+            // the file went away since it was cached, do it the slow way
+            InvalidateDirCache();
+        }
+        else
+        {
+            searchAll = false;
+        }
+    }
+    
+    for( search = searchAll ? fs_searchpaths : NULL ; search ; search = search->next )
     {
         if( search->pack )
         {
@@ -1322,103 +1797,7 @@ S32 idFileSystemLocal::FOpenFileRead( StringEntry filename, fileHandle_t* file,
                 if( !FilenameCompare( pakFile->name, filename ) )
                 {
                     // found it!
-                    
-                    // mark the pak as having been referenced and mark specifics on cgame and ui
-                    // shaders, txt, arena files  by themselves do not count as a reference as
-                    // these are loaded from all pk3s
-                    // from every pk3 file..
-                    l = strlen( filename );
-                    if( !( pak->referenced & FS_GENERAL_REF ) )
-                    {
-                        if( Q_stricmp( filename + l - 7, ".shader" ) != 0 &&
-                                Q_stricmp( filename + l - 4, ".mtr" ) != 0 &&
-                                Q_stricmp( filename + l - 4, ".txt" ) != 0 &&
-                                Q_stricmp( filename + l - 4, ".ttf" ) != 0 &&
-                                Q_stricmp( filename + l - 4, ".otf" ) != 0 &&
-                                Q_stricmp( filename + l - 4, ".cfg" ) != 0 &&
-                                Q_stricmp( filename + l - 7, ".config" ) != 0 &&
-                                strstr( filename, "levelshots" ) == NULL &&
-                                Q_stricmp( filename + l - 4, ".bot" ) != 0 &&
-                                Q_stricmp( filename + l - 6, ".arena" ) != 0 &&
-                                Q_stricmp( filename + l - 5, ".menu" ) != 0 )
-                        {
-                            pak->referenced |= FS_GENERAL_REF;
-                        }
-                    }
-                    
-                    // for OS client/server interoperability, we expect binaries for .so and .dll to be in the same pk3
-                    // so that when we reference the DLL files on any platform, this covers everyone else
-                    
-                    // qagame dll
-                    if( !( pak->referenced & FS_QAGAME_REF ) && !Q_stricmp( filename, Sys_GetDLLName( "sgame" ) ) )
-                    {
-                        pak->referenced |= FS_QAGAME_REF;
-                    }
-                    // cgame dll
-                    if( !( pak->referenced & FS_CGAME_REF ) && !Q_stricmp( filename, Sys_GetDLLName( "cgame" ) ) )
-                    {
-                        pak->referenced |= FS_CGAME_REF;
-                    }
-                    
-                    if( uniqueFILE )
-                    {
-                        // open a new file on the pakfile
-                        fsh[*file].handleFiles.file.z = unzOpen( pak->pakFilename );
-                        if( fsh[*file].handleFiles.file.z == NULL )
-                        {
-                            Com_Error( ERR_FATAL, "Couldn't reopen %s", pak->pakFilename );
-                        }
-                    }
-                    else
-                    {
-                        fsh[*file].handleFiles.file.z = pak->handle;
-                    }
-                    
-                    Q_strncpyz( fsh[*file].name, filename, sizeof( fsh[*file].name ) );
-                    fsh[*file].zipFile = true;
-                    
-                    // set the file position in the zip file (also sets the current file info)
-                    unzSetOffset( fsh[*file].handleFiles.file.z, pakFile->pos );
-                    
-                    // open the file in the zip
-                    unzOpenCurrentFile( fsh[*file].handleFiles.file.z );
-                    fsh[*file].zipFilePos = pakFile->pos;
-                    
-                    if( fs_debug->integer )
-                    {
-                        Com_Printf( "idFileSystemLocal::FOpenFileRead: %s (found in '%s')\n", filename, pak->pakFilename );
-                    }
-                    
-                    // Arnout: let's make this thing work from pakfiles as well
-                    // FIXME: doing this seems to break things?
-                    /*if ( fs_copyfiles->integer && fs_buildpath->string[0] && Q_stricmpn( fs_buildpath->string, pak->pakFilename, strlen(fs_buildpath->string) ) ) {
-                    	UTF8			copypath[MAX_OSPATH];
-                    	fileHandle_t	f;
-                    	U8			*srcData;
-                    	S32				len = zfi->cur_file_info.uncompressed_size;
-                    
-                    	Q_strncpyz( copypath, BuildOSPath( fs_buildpath->string, fs_buildgame->string, filename ), sizeof(copypath) );
-                    	netpath = BuildOSPath( fs_basepath->string, fs_gamedir, filename );
-                    
-                    	f = FOpenFileWrite( filename );
-                    	if ( !f ) {
-                    		Com_Printf( "idFileSystemLocal::FOpenFileRead Failed to open %s for copying\n", filename );
-                    	} else {
-                    		srcData = Hunk_AllocateTempMemory( len) ;
-                    		Read( srcData, len, *file );
-                    		Write( srcData, len, f );
-                    		FCloseFile( f );
-                    		Hunk_FreeTempMemory( srcData );
-                    
-                    		if (rename( netpath, copypath )) {
-                    			// Failed, try copying it and deleting the original
-                    			CopyFile ( netpath, copypath );
-                    			Remove ( netpath );
-                    		}
-                    	}
-                    }*/
-                    
-                    return pakFile->len;
+                    return FOpenFileInPack( filename, *file, pak, pakFile, uniqueFILE );
                 }
                 pakFile = pakFile->next;
             }
@@ -1431,65 +1810,11 @@ S32 idFileSystemLocal::FOpenFileRead( StringEntry filename, fileHandle_t* file,
                 continue;
             }
             
-            // check a file in the directory tree
-            
-            // if we are running restricted, or if the filesystem is configured for pure (fs_numServerPaks)
-            // the only files we will allow to come from the directory are .cfg files
-            l = strlen( filename );
-            if( fs_restrict->integer || fs_numServerPaks )
-            {
-            
-                if( Q_stricmp( filename + l - 4, ".cfg" )        // for config files
-                        && Q_stricmp( filename + l - 4, ".ttf" )
-                        && Q_stricmp( filename + l - 4, ".otf" )
-                        && Q_stricmp( filename + l - 5, ".menu" )  // menu files
-                        && Q_stricmp( filename + l - 5, ".game" )  // menu files
-                        && Q_stricmp( filename + l - strlen( demoExt ), demoExt )	// menu files
-                        && Q_stricmp( filename + l - 4, ".dat" ) // for journal files
-                        && Q_stricmp( filename + l - 8, "bots.txt" )
-                        && Q_stricmp( filename + l - 8, ".botents" )
-#ifdef __MACOS__
-                        // even when pure is on, let the server game be loaded
-                        && Q_stricmp( filename, "qagame_mac" ) // Dushan - this is wrong now
-#endif
-                  )
-                {
-                    continue;
-                }
-            }
-            
-            dir = search->dir;
-            
-            netpath = BuildOSPath( dir->path, dir->gamedir, filename );
-            fsh[*file].handleFiles.file.o = fopen( netpath, "rb" );
-            
-            if( !fsh[*file].handleFiles.file.o )
-            {
-                continue;
-            }
-            
-            if( Q_stricmp( filename + l - 4, ".cfg" )        // for config files
-                    && Q_stricmp( filename + l - 4, ".ttf" ) != 0
-                    && Q_stricmp( filename + l - 4, ".otf" ) != 0
-                    && Q_stricmp( filename + l - 5, ".menu" )  // menu files
-                    && Q_stricmp( filename + l - 5, ".game" )  // menu files
-                    && Q_stricmp( filename + l - strlen( demoExt ), demoExt ) // menu files
-                    && Q_stricmp( filename + l - 4, ".dat" )
-                    && Q_stricmp( filename + l - 8, ".botents" )
-                    && !strstr( filename, "botfiles" ) )   // RF, need this for dev
-            {
-                fs_fakeChkSum = random();
-            }
-            
-            Q_strncpyz( fsh[*file].name, filename, sizeof( fsh[*file].name ) );
-            fsh[*file].zipFile = false;
-            if( fs_debug->integer )
+            l = FOpenFileInDir( filename, *file, search->dir );
+            if( l >= 0 )
             {
-                Com_Printf( "idFileSystemLocal::FOpenFileRead: %s (found in '%s/%s')\n", filename,
-                            dir->path, dir->gamedir );
+                return l;
             }
-            
-            return filelength( *file );
         }
     }
     
@@ -1502,6 +1827,7 @@ S32 idFileSystemLocal::FOpenFileRead( StringEntry filename, fileHandle_t* file,
     }
 #endif
     
+    ReleaseHandle( *file );
     *file = 0;
     return -1;
 }
@@ -1559,6 +1885,8 @@ bool idFileSystemLocal::CL_ExtractFromPakFile( StringEntry base, StringEntry gam
     fn = BuildOSPath( base, gamedir, filename );
     needToCopy = true;
     
+    InvalidateDirCache();
+    
     // read in compressed file
     srcLength = ReadFile( filename, ( void** )&srcData );
     
@@ -1664,6 +1992,8 @@ S32 idFileSystemLocal::DeleteDir( UTF8* dirname, bool nonEmpty, bool recursive )
         Com_Error( ERR_FATAL, "idFileSystemLocal::DeleteDir: Filesystem call made without initialization\n" );
     }
     
+    InvalidateDirCache();
+    
     if( !dirname || dirname[0] == 0 )
     {
         return 0;
@@ -1772,6 +2102,8 @@ S32 idFileSystemLocal::Delete( UTF8* filename )
         Com_Error( ERR_FATAL, "idFileSystemLocal::Delete: Filesystem call made without initialization\n" );
     }
     
+    InvalidateDirCache();
+    
     if( !filename || filename[0] == 0 )
     {
         return 0;
@@ -1870,6 +2202,7 @@ idFileSystemLocal::Read
 S32 idFileSystemLocal::Read( void* buffer, S32 len, fileHandle_t f )
 {
     S32 block, remaining, read, tries;
+    bundleEntry_t* entry;
     U8* buf;
     
     if( !fs_searchpaths )
@@ -1883,7 +2216,41 @@ S32 idFileSystemLocal::Read( void* buffer, S32 len, fileHandle_t f )
     }
     
     buf = ( U8* )buffer;
-    fs_readCount += len;
+    SDL_AtomicAdd( &fs_readCount, len );
+    
+    if( fsh[f].bundleFile )
+    {
+        entry = &( ( bundleEntry_t* )fsh[f].pak->bundle )[fsh[f].bundleEntry];
+        if( len > entry->size - fsh[f].bundlePos )
+        {
+            len = entry->size - fsh[f].bundlePos;
+        }
+        if( len <= 0 )
+        {
+            return 0;
+        }
+        
+        // reading all of it, as ReadFile does, goes straight into the buffer
+        if( !fsh[f].bundleData && !fsh[f].bundlePos && len == entry->size )
+        {
+            if( !FS_ReadBundleEntry( fsh[f].pak, entry, buf ) )
+            {
+                Com_Printf( S_COLOR_YELLOW "WARNING: couldn't read %s from %s\n", fsh[f].name, fsh[f].pak->pakFilename );
+                return 0;
+            }
+        }
+        else
+        {
+            if( !ReadBundleFile( f ) )
+            {
+                return 0;
+            }
+            ::memcpy( buf, fsh[f].bundleData + fsh[f].bundlePos, len );
+        }
+        
+        fsh[f].bundlePos += len;
+        return len;
+    }
     
     if( fsh[f].zipFile == false )
     {
@@ -2015,7 +2382,7 @@ idFileSystemLocal::Seek
 */
 S32 idFileSystemLocal::Seek( fileHandle_t f, S64 offset, S32 origin )
 {
-    S32 _origin;
+    S32 _origin, size;
     
     if( !fs_searchpaths )
     {
@@ -2030,6 +2397,37 @@ S32 idFileSystemLocal::Seek( fileHandle_t f, S64 offset, S32 origin )
         fsh[f].streamed = true;
     }
     
+    if( fsh[f].bundleFile )
+    {
+        size = ( ( bundleEntry_t* )fsh[f].pak->bundle )[fsh[f].bundleEntry].size;
+        
+        switch( origin )
+        {
+            case FS_SEEK_CUR:
+                offset += fsh[f].bundlePos;
+                break;
+            
+            case FS_SEEK_END:
+                offset += size;
+                break;
+            
+            case FS_SEEK_SET:
+                break;
+            
+            default:
+                Com_Error( ERR_FATAL, "Bad origin in idFileSystemLocal::Seek\n" );
+                return -1;
+        }
+        
+        if( offset < 0 || offset > size )
+        {
+            return -1;
+        }
+        
+        fsh[f].bundlePos = offset;
+        return 0;
+    }
+    
     if( fsh[f].zipFile == true )
     {
         //FIXME: this is incomplete and really, really
@@ -2048,7 +2446,7 @@ S32 idFileSystemLocal::Seek( fileHandle_t f, S64 offset, S32 origin )
         {
             case FS_SEEK_SET:
                 unzSetOffset( fsh[f].handleFiles.file.z, fsh[f].zipFilePos );
-                unzOpenCurrentFile( fsh[f].handleFiles.file.z );
+                unzOpenCurrentFileAt( fsh[f].handleFiles.file.z, fsh[f].zipDataPos );
                 //fallthrough
                 
             case FS_SEEK_CUR:
@@ -2194,749 +2592,2335 @@ S32 idFileSystemLocal::FileIsInPAK( StringEntry filename, S32* pChecksum )
 
 /*
 ============
-idFileSystemLocal::ReadFile
+idFileSystemLocal::MapFile
 
-Filename are relative to the quake search path
-a null buffer will just return the file length without loading
+Returns the len bytes of f as a private file mapping, or NULL if they have
+to be read into memory instead.  Loose files and pk3 and bundle entries that
+are stored without compression can be mapped, the byte after the data is set to
+zero like ReadFile does, which only copies the page it is in.
 ============
 */
-S32 idFileSystemLocal::ReadFile( StringEntry qpath, void** buffer )
+void* idFileSystemLocal::MapFile( fileHandle_t f, S32 len )
 {
-    fileHandle_t h;
+    unz_file_info64 info;
+    bundleEntry_t* entry;
+    fsMapping_t* m;
+    FILE* file;
+    S64 offset;
     U8* buf;
-    bool isConfig;
-    S32 len;
-    
-    if( !fs_searchpaths )
-    {
-        Com_Error( ERR_FATAL, "idFileSystemLocal::ReadFile: Filesystem call made without initialization\n" );
-    }
     
-    if( !qpath || !qpath[0] )
+    if( !fs_mmap->integer || len < FS_MMAP_MIN_SIZE || fs_numMappings == MAX_FILE_MAPPINGS )
     {
-        Com_Error( ERR_FATAL, "idFileSystemLocal::ReadFile with empty name\n" );
+        return NULL;
     }
     
-    buf = NULL; // quiet compiler warning
-    
-    // if this is a .cfg file and we are playing back a journal, read
-    // it from the journal file
-    if( strstr( qpath, ".cfg" ) )
+    if( fsh[f].bundleFile )
     {
-        isConfig = true;
-        if( com_journal && com_journal->integer == 2 )
+        entry = &( ( bundleEntry_t* )fsh[f].pak->bundle )[fsh[f].bundleEntry];
+        if( entry->compression != BUNDLE_STORED || entry->size != len || fsh[f].bundlePos )
         {
-            S32 r;
-            
-            Com_DPrintf( "Loading %s from journal file.\n", qpath );
-            
-            r = Read( &len, sizeof( len ), com_journalDataFile );
-            
-            if( r != sizeof( len ) )
-            {
-                if( buffer != NULL )
-                {
-                    *buffer = NULL;
-                }
-                return -1;
-            }
-            
-            // if the file didn't exist when the journal was created
-            if( !len )
-            {
-                if( buffer == NULL )
-                {
-                    return 1;           // hack for old journal files
-                }
-                *buffer = NULL;
-                
-                return -1;
-            }
-            
-            if( buffer == NULL )
-            {
-                return len;
-            }
-            
-            //buf = ( U8* )Hunk_AllocateTempMemory( len + 1 );
-            buf = ( U8* )Z_Malloc( len + 1 );
-            buf[len] = '\0';	// because we're not calling Z_Malloc with optional trailing 'bZeroIt' bool
-            *buffer = buf;
-            
-            r = Read( buf, len, com_journalDataFile );
-            if( r != len )
-            {
-                Com_Error( ERR_FATAL, "Read from journalDataFile failed" );
-            }
-            
-            fs_loadCount++;
-            fs_loadStack++;
-            
-            // guarantee that it will have a trailing 0 for string operations
-            buf[len] = 0;
-            
-            return len;
+            return NULL;
         }
+        
+        file = fopen( fsh[f].pak->pakFilename, "rb" );
+        if( !file )
+        {
+            return NULL;
+        }
+        offset = entry->offset;
     }
-    else
-    {
-        isConfig = false;
-    }
-    
-    // look for it in the filesystem or pack files
-    len = FOpenFileRead( qpath, &h, false );
-    if( h == 0 )
+    else if( fsh[f].zipFile )
     {
-        if( buffer )
+        // only stored, unencrypted entries are the same on disk and in memory
+        if( !fsh[f].pak || unzGetCurrentFileInfo64( fsh[f].handleFiles.file.z, &info, NULL, 0, NULL, 0, NULL, 0 ) != UNZ_OK ||
+                info.compression_method != 0 || ( info.flag & 1 ) || info.uncompressed_size != ( U64 )len )
         {
-            *buffer = NULL;
+            return NULL;
         }
-        // if we are journalling and it is a config file, write a zero to the journal file
-        if( isConfig && com_journal && com_journal->integer == 1 )
+        
+        file = fopen( fsh[f].pak->pakFilename, "rb" );
+        if( !file )
         {
-            Com_DPrintf( "Writing zero for %s to journal file.\n", qpath );
-            len = 0;
-            Write( &len, sizeof( len ), com_journalDataFile );
-            Flush( com_journalDataFile );
+            return NULL;
         }
-        return -1;
+        offset = unzGetCurrentFileZStreamPos64( fsh[f].handleFiles.file.z );
     }
-    
-    if( !buffer )
+    else
     {
-        if( isConfig && com_journal && com_journal->integer == 1 )
-        {
-            Com_DPrintf( "Writing len for %s to journal file.\n", qpath );
-            Write( &len, sizeof( len ), com_journalDataFile );
-            Flush( com_journalDataFile );
-        }
-        FCloseFile( h );
-        return len;
+        file = FileForHandle( f );
+        offset = 0;
     }
     
-    buf = ( U8* )Hunk_AllocateTempMemory( len + 1 );
-    *buffer = buf;
-    
-    Read( buf, len, h );
-    
-    fs_loadCount++;
-    fs_loadStack++;
-    
-    // guarantee that it will have a trailing 0 for string operations
-    buf[len] = 0;
-    FCloseFile( h );
+    m = &fs_mappings[fs_numMappings];
+    buf = ( U8* )Sys_MapFile( file, offset, len, &m->mapping );
     
-    // if we are journalling and it is a config file, write it to the journal file
-    if( isConfig && com_journal && com_journal->integer == 1 )
+    // the mapping outlives the file
+    if( fsh[f].zipFile || fsh[f].bundleFile )
     {
-        Com_DPrintf( "Writing %s to journal file.\n", qpath );
-        Write( &len, sizeof( len ), com_journalDataFile );
-        Write( buf, len, com_journalDataFile );
-        Flush( com_journalDataFile );
+        fclose( file );
     }
-    return len;
-}
-
-/*
-=============
-idFileSystemLocal::FreeFile
-=============
-*/
-void idFileSystemLocal::FreeFile( void* buffer )
-{
-    if( !fs_searchpaths )
+    
+    if( !buf )
     {
-        Com_Error( ERR_FATAL, "idFileSystemLocal::FreeFile: Filesystem call made without initialization\n" );
+        return NULL;
     }
-    if( !buffer )
+    
+    // guarantee that it will have a trailing 0 for string operations, it
+    // usually is already and then the page is never copied
+    if( buf[len] )
     {
-        Com_Error( ERR_FATAL, "idFileSystemLocal::FreeFile( NULL )" );
+        buf[len] = 0;
     }
-    fs_loadStack--;
     
-    Hunk_FreeTempMemory( buffer );
+    m->buffer = buf;
+    fs_numMappings++;
     
-    // if all of our temp files are free, clear all of our space
-    if( fs_loadStack == 0 )
-    {
-        Hunk_ClearTempMemory();
-    }
+    return buf;
 }
 
 /*
 ============
-idFileSystemLocal::WriteFile
+idFileSystemLocal::InflateFile
 
-Filename are reletive to the quake search path
+Inflates the whole of the deflated pk3 file just opened on f straight into
+buffer with a single inflate call, after reading all of the compressed data
+with a single read, instead of going through the small buffers of
+unzReadCurrentFile.  Returns false, without touching the handle, for files
+it doesn't handle or if anything goes wrong, Read still works then.
 ============
 */
-void idFileSystemLocal::WriteFile( StringEntry qpath, const void* buffer, S32 size )
+bool idFileSystemLocal::InflateFile( fileHandle_t f, void* buffer, S32 len )
 {
-    fileHandle_t f;
+    unz_file_info64 info;
+    z_stream stream;
+    FILE* file;
+    U8* compressed;
+    S64 offset;
+    S32 r;
+    bool ok;
     
-    if( !fs_searchpaths )
+    if( !fs_inflateWhole->integer || !fsh[f].zipFile || !fsh[f].pak || len < FS_INFLATE_MIN_SIZE )
     {
-        Com_Error( ERR_FATAL, "Filesystem call made without initialization\n" );
+        return false;
     }
     
-    if( !qpath || !buffer )
+    if( unzGetCurrentFileInfo64( fsh[f].handleFiles.file.z, &info, NULL, 0, NULL, 0, NULL, 0 ) != UNZ_OK ||
+            info.compression_method != Z_DEFLATED || ( info.flag & 1 ) || info.uncompressed_size != ( U64 )len ||
+            !info.compressed_size || info.compressed_size > FS_INFLATE_MAX_COMPRESSED )
     {
-        Com_Error( ERR_FATAL, "idFileSystemLocal::WriteFile: NULL parameter" );
+        return false;
     }
     
-    f = FOpenFileWrite( qpath );
-    if( !f )
+    // nothing has been read yet, so this is where the data starts
+    offset = unzGetCurrentFileZStreamPos64( fsh[f].handleFiles.file.z );
+    if( offset <= 0 || offset > 0x7fffffff )
     {
-        Com_Printf( "Failed to open %s\n", qpath );
-        return;
+        return false;
     }
     
-    Write( buffer, size, f );
+    file = fopen( fsh[f].pak->pakFilename, "rb" );
+    if( !file )
+    {
+        return false;
+    }
     
-    FCloseFile( f );
-}
-
-/*
-==========================================================================
-ZIP FILE LOADING
-==========================================================================
-*/
-
-/*
-=================
-idFileSystemLocal::LoadZipFile
-
-Creates a new pak_t in the search chain for the contents
-of a zip file.
-=================
-*/
-pack_t* idFileSystemLocal::LoadZipFile( StringEntry zipfile, StringEntry basename )
-{
-    fileInPack_t* buildBuffer;
-    pack_t* pack;
-    unzFile uf;
-    S32 err, i, len, fs_numHeaderLongs, *fs_headerLongs, sizeOfHeaderLongs;
-    unz_global_info gi;
-    UTF8 filename_inzip[MAX_ZPATH];
-    unz_file_info file_info;
-    S64	hash;
-    UTF8* namePtr;
-    
-    fs_numHeaderLongs = 0;
-    
-    uf = unzOpen( zipfile );
-    err = unzGetGlobalInfo( uf, &gi );
-    
-    if( err != UNZ_OK )
+    // not from the hunk, temp hunk memory drops the level when it runs out and
+    // the streaming path must get its chance instead
+    compressed = ( U8* )malloc( ( size_t )info.compressed_size );
+    if( !compressed )
     {
-        return NULL;
+        fclose( file );
+        return false;
     }
     
-    len = 0;
-    unzGoToFirstFile( uf );
+    ok = !fseek( file, ( long )offset, SEEK_SET ) && fread( compressed, 1, ( size_t )info.compressed_size, file ) == info.compressed_size;
+    fclose( file );
     
-    for( i = 0; i < gi.number_entry; i++ )
+    if( ok )
     {
-        err = unzGetCurrentFileInfo( uf, &file_info, filename_inzip, sizeof( filename_inzip ), NULL, 0, NULL, 0 );
+        ::memset( &stream, 0, sizeof( stream ) );
+        stream.next_in = compressed;
+        stream.avail_in = ( uInt )info.compressed_size;
+        stream.next_out = ( Bytef* )buffer;
+        stream.avail_out = len;
         
-        if( err != UNZ_OK )
+        ok = false;
+        if( inflateInit2( &stream, -MAX_WBITS ) == Z_OK )
         {
-            // it's better to fail and have the user notified than to have a half-loaded pk3,
-            // or worse a failed pack referenced that results in further failures (yes it does happen)
-            Com_Error( ERR_FATAL, "Corrupted pk3 file \'%s\'", basename );
-            break;
+            r = inflate( &stream, Z_FINISH );
+            ok = ( r == Z_STREAM_END && stream.total_out == ( uLong )len );
+            inflateEnd( &stream );
         }
         
-        filename_inzip[sizeof( filename_inzip ) - 1] = '\0';
-        len += strlen( filename_inzip ) + 1;
-        
-        unzGoToNextFile( uf );
-    }
-    
-    buildBuffer = ( fileInPack_t* )Z_Malloc( ( gi.number_entry * sizeof( fileInPack_t ) ) + len );
-    namePtr = ( ( UTF8* ) buildBuffer ) + gi.number_entry * sizeof( fileInPack_t );
-    fs_headerLongs = ( S32* )Z_Malloc( ( gi.number_entry + 1 ) * sizeof( S32 ) );
-    fs_headerLongs[ fs_numHeaderLongs++ ] = LittleLong( fs_checksumFeed );
-    
-    // get the hash table size from the number of files in the zip
-    // because lots of custom pk3 files have less than 32 or 64 files
-    for( i = 1; i <= MAX_FILEHASH_SIZE; i <<= 1 )
-    {
-        if( i > gi.number_entry )
-        {
-            break;
-        }
+        // unzReadCurrentFile checks the crc when it's done too
+        ok = ok && crc32( crc32( 0, NULL, 0 ), ( const Bytef* )buffer, len ) == info.crc;
     }
     
-    pack = ( pack_t* )Z_Malloc( sizeof( pack_t ) + i * sizeof( fileInPack_t* ) );
-    pack->hashSize = i;
-    pack->hashTable = ( fileInPack_t** )( ( ( UTF8* ) pack ) + sizeof( pack_t ) );
+    free( compressed );
     
-    for( i = 0; i < pack->hashSize; i++ )
+    if( ok )
     {
-        pack->hashTable[i] = NULL;
+        SDL_AtomicAdd( &fs_readCount, len );
     }
     
-    Q_strncpyz( pack->pakFilename, zipfile, sizeof( pack->pakFilename ) );
-    Q_strncpyz( pack->pakBasename, basename, sizeof( pack->pakBasename ) );
+    return ok;
+}
+
+/*
+============
+FS_CacheHash
+============
+*/
+static ID_INLINE S32 FS_CacheHash( S32 checksum, U64 pos )
+{
+    return ( ( U32 )checksum ^ ( U32 )( pos * 2654435761u ) ) & ( FS_CACHE_HASH_SIZE - 1 );
+}
+
+/*
+============
+idFileSystemLocal::FileCacheRead
+
+Copies the cached contents of the pk3 file open on f to buffer.  Entries are
+keyed on the pack checksum and the position of the file in the pack, so
+they stay valid across restarts as long as the pack is still there.
+============
+*/
+bool idFileSystemLocal::FileCacheRead( fileHandle_t f, void* buffer, S32 len )
+{
+    fsCacheEntry_t* entry;
+    S32 checksum;
     
-    // strip .pk3 if needed
-    if( strlen( pack->pakBasename ) > 4 && !Q_stricmp( pack->pakBasename + strlen( pack->pakBasename ) - 4, ".pk3" ) )
+    if( fs_fileCache->integer <= 0 || !fsh[f].zipFile || !fsh[f].pak || len > FS_CACHE_MAX_FILE )
     {
-        pack->pakBasename[strlen( pack->pakBasename ) - 4] = 0;
+        return false;
     }
     
-    pack->handle = uf;
-    pack->numfiles = gi.number_entry;
-    unzGoToFirstFile( uf );
-    
-    for( i = 0; i < gi.number_entry; i++ )
+    checksum = fsh[f].pak->checksum;
+    for( entry = fs_cache.hashTable[FS_CacheHash( checksum, fsh[f].zipFilePos )]; entry; entry = entry->hashNext )
     {
-        err = unzGetCurrentFileInfo( uf, &file_info, filename_inzip, sizeof( filename_inzip ), NULL, 0, NULL, 0 );
-        
-        if( err != UNZ_OK )
+        if( entry->checksum == checksum && entry->pos == ( U64 )fsh[f].zipFilePos && entry->len == len && !Q_stricmp( entry->name, fsh[f].name ) )
         {
-            Com_Error( ERR_FATAL, "Corrupted pk3 file \'%s\'", basename );
             break;
         }
-        
-        if( file_info.uncompressed_size > 0 )
-        {
-            fs_headerLongs[fs_numHeaderLongs++] = LittleLong( file_info.crc );
-        }
-        
-        Q_strlwr( filename_inzip );
-        
-        hash = HashFileName( filename_inzip, pack->hashSize );
-        buildBuffer[i].name = namePtr;
-        
-        strcpy( buildBuffer[i].name, filename_inzip );
-        
-        namePtr += strlen( filename_inzip ) + 1;
-        
-        // store the file position in the zip
-        buildBuffer[i].pos = unzGetOffset( uf );
-        buildBuffer[i].len = file_info.uncompressed_size;
-        buildBuffer[i].next = pack->hashTable[hash];
-        
-        pack->hashTable[hash] = &buildBuffer[i];
-        
-        unzGoToNextFile( uf );
     }
     
-    sizeOfHeaderLongs = sizeof( *fs_headerLongs );
+    if( !entry )
+    {
+        fs_cache.misses++;
+        return false;
+    }
     
-    pack->checksum = Com_BlockChecksum( &fs_headerLongs[ 1 ], sizeof( *fs_headerLongs ) * ( fs_numHeaderLongs - 1 ) );
-    pack->pure_checksum = Com_BlockChecksum( fs_headerLongs, sizeof( *fs_headerLongs ) * fs_numHeaderLongs );
-    pack->checksum = LittleLong( pack->checksum );
-    pack->pure_checksum = LittleLong( pack->pure_checksum );
+    ::memcpy( buffer, entry->data, len );
+    fs_cache.hits++;
     
-    Z_Free( fs_headerLongs );
+    // move it to the front
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->prev = &fs_cache.lru;
+    entry->next = fs_cache.lru.next;
+    entry->next->prev = entry;
+    fs_cache.lru.next = entry;
     
-    pack->buildBuffer = buildBuffer;
-    return pack;
+    return true;
 }
 
 /*
-=================================================================================
-DIRECTORY SCANNING FUNCTIONS
-=================================================================================
+============
+idFileSystemLocal::FileCacheStore
+
+Adds the contents of the pk3 file open on f, dropping the least recently
+used files to stay under fs_fileCache kilobytes
+============
 */
-S32 idFileSystemLocal::ReturnPath( StringEntry zname, UTF8* zpath, S32* depth )
+void idFileSystemLocal::FileCacheStore( fileHandle_t f, const void* buffer, S32 len )
 {
-    S32 len, at, newdep;
+    fsCacheEntry_t* entry;
+    S32 hash, limit;
     
-    newdep = 0;
-    zpath[0] = 0;
-    len = 0;
-    at = 0;
+    limit = fs_fileCache->integer << 10;
+    if( limit <= 0 || !fsh[f].zipFile || !fsh[f].pak || len > FS_CACHE_MAX_FILE || len > limit )
+    {
+        return;
+    }
     
-    while( zname[at] != 0 )
+    while( fs_cache.size + len > limit )
     {
-        if( zname[at] == '/' || zname[at] == '\\' )
-        {
-            len = at;
-            newdep++;
-        }
-        at++;
+        FileCacheRemove( fs_cache.lru.prev );
+        fs_cache.evictions++;
     }
     
-    strcpy( zpath, zname );
+    entry = ( fsCacheEntry_t* )Z_Malloc( sizeof( *entry ) + len );
+    entry->checksum = fsh[f].pak->checksum;
+    entry->pos = fsh[f].zipFilePos;
+    entry->len = len;
+    Q_strncpyz( entry->name, fsh[f].name, sizeof( entry->name ) );
+    entry->data = ( U8* )( entry + 1 );
+    ::memcpy( entry->data, buffer, len );
     
-    zpath[len] = 0;
-    *depth = newdep;
+    hash = FS_CacheHash( entry->checksum, entry->pos );
+    entry->hashNext = fs_cache.hashTable[hash];
+    fs_cache.hashTable[hash] = entry;
     
-    return len;
+    if( !fs_cache.lru.next )
+    {
+        fs_cache.lru.next = fs_cache.lru.prev = &fs_cache.lru;
+    }
+    entry->prev = &fs_cache.lru;
+    entry->next = fs_cache.lru.next;
+    entry->next->prev = entry;
+    fs_cache.lru.next = entry;
+    
+    fs_cache.numEntries++;
+    fs_cache.size += len;
 }
 
 /*
-==================
-idFileSystemLocal::AddFileToList
-==================
+============
+idFileSystemLocal::FileCacheRemove
+============
 */
-S32 idFileSystemLocal::AddFileToList( UTF8* name, UTF8* list[MAX_FOUND_FILES], S32 nfiles )
+void idFileSystemLocal::FileCacheRemove( fsCacheEntry_t* entry )
 {
-    S32 i;
+    fsCacheEntry_t** link;
     
-    if( nfiles == MAX_FOUND_FILES - 1 )
+    for( link = &fs_cache.hashTable[FS_CacheHash( entry->checksum, entry->pos )]; *link != entry; link = &( *link )->hashNext )
     {
-        return nfiles;
     }
+    *link = entry->hashNext;
     
-    for( i = 0 ; i < nfiles ; i++ )
-    {
-        if( !Q_stricmp( name, list[i] ) )
-        {
-            return nfiles;      // allready in list
-        }
-    }
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
     
-    list[nfiles] = CopyString( name );
-    nfiles++;
+    fs_cache.numEntries--;
+    fs_cache.size -= entry->len;
     
-    return nfiles;
+    Z_Free( entry );
 }
 
 /*
-===============
-idFileSystemLocal::ListFilteredFiles
+============
+idFileSystemLocal::PruneFileCache
 
-Returns a uniqued list of files that match the given criteria
-from all search paths
-===============
+Drops the files of packs that are no longer in the search path, called
+whenever it is rebuilt
+============
 */
-UTF8** idFileSystemLocal::ListFilteredFiles( StringEntry path, StringEntry extension, UTF8* filter, S32* numfiles )
+void idFileSystemLocal::PruneFileCache( void )
 {
-    S32 nfiles, i, pathLength, extensionLength, length, pathDepth, temp;
-    UTF8** listCopy, *list[MAX_FOUND_FILES];
+    fsCacheEntry_t* entry, *next;
     searchpath_t* search;
-    pack_t* pak;
-    fileInPack_t* buildBuffer;
-    UTF8 zpath[MAX_ZPATH];
     
-    if( !fs_searchpaths )
+    if( !fs_cache.lru.next )
     {
-        Com_Error( ERR_FATAL, "idFileSystemLocal::ListFilteredFiles: Filesystem call made without initialization\n" );
+        return;
     }
     
-    if( !path )
+    for( entry = fs_cache.lru.next; entry != &fs_cache.lru; entry = next )
     {
-        *numfiles = 0;
-        return NULL;
+        next = entry->next;
+        
+        for( search = fs_searchpaths; search; search = search->next )
+        {
+            if( search->pack && search->pack->checksum == entry->checksum )
+            {
+                break;
+            }
+        }
+        
+        if( !search )
+        {
+            FileCacheRemove( entry );
+        }
     }
+}
+
+/*
+============
+idFileSystemLocal::ReadFile
+
+Filename are relative to the quake search path
+a null buffer will just return the file length without loading
+============
+*/
+S32 idFileSystemLocal::ReadFile( StringEntry qpath, void** buffer )
+{
+    fileHandle_t h;
+    U8* buf;
+    bool isConfig;
+    S32 len;
     
-    if( !extension )
+    if( !fs_searchpaths )
     {
-        extension = "";
+        Com_Error( ERR_FATAL, "idFileSystemLocal::ReadFile: Filesystem call made without initialization\n" );
     }
     
-    pathLength = strlen( path );
-    
-    if( path[pathLength - 1] == '\\' || path[pathLength - 1] == '/' )
+    if( !qpath || !qpath[0] )
     {
-        pathLength--;
+        Com_Error( ERR_FATAL, "idFileSystemLocal::ReadFile with empty name\n" );
     }
     
-    extensionLength = strlen( extension );
-    nfiles = 0;
-    ReturnPath( path, zpath, &pathDepth );
+    buf = NULL; // quiet compiler warning
     
-    // search through the path, one element at a time, adding to list
-    for( search = fs_searchpaths ; search ; search = search->next )
+    // if this is a .cfg file and we are playing back a journal, read
+    // it from the journal file
+    if( strstr( qpath, ".cfg" ) )
     {
-        // is the element a pak file?
-        if( search->pack )
+        isConfig = true;
+        if( com_journal && com_journal->integer == 2 )
         {
-            //ZOID:  If we are pure, don't search for files on paks that
-            // aren't on the pure list
-            if( !PakIsPure( search->pack ) )
-            {
-                continue;
-            }
+            S32 r;
             
-            // look through all the pak file elements
-            pak = search->pack;
-            buildBuffer = pak->buildBuffer;
-            for( i = 0; i < pak->numfiles; i++ )
+            Com_DPrintf( "Loading %s from journal file.\n", qpath );
+            
+            r = Read( &len, sizeof( len ), com_journalDataFile );
+            
+            if( r != sizeof( len ) )
             {
-                UTF8*    name;
-                S32 zpathLen, depth;
-                
-                // check for directory match
-                name = buildBuffer[i].name;
-                
-                if( filter )
+                if( buffer != NULL )
                 {
-                    // case insensitive
-                    if( !Com_FilterPath( filter, name, false ) )
-                    {
-                        continue;
-                    }
-                    // unique the match
-                    nfiles = AddFileToList( name, list, nfiles );
+                    *buffer = NULL;
                 }
-                else
+                return -1;
+            }
+            
+            // if the file didn't exist when the journal was created
+            if( !len )
+            {
+                if( buffer == NULL )
                 {
-                    zpathLen = ReturnPath( name, zpath, &depth );
-                    
-                    if( ( depth - pathDepth ) > 2 || pathLength > zpathLen || Q_stricmpn( name, path, pathLength ) )
-                    {
-                        continue;
-                    }
-                    
-                    // check for extension match
-                    length = strlen( name );
-                    
-                    if( length < extensionLength )
-                    {
-                        continue;
-                    }
-                    
-                    if( Q_stricmp( name + length - extensionLength, extension ) )
-                    {
-                        continue;
-                    }
-                    
-                    // unique the match
-                    temp = pathLength;
-                    if( pathLength )
-                    {
-                        temp++; // include the '/'
-                    }
-                    
-                    nfiles = AddFileToList( name + temp, list, nfiles );
+                    return 1;           // hack for old journal files
                 }
+                *buffer = NULL;
+                
+                return -1;
             }
-        }
-        else if( search->dir ) // scan for files in the filesystem
-        {
-            UTF8* netpath;
-            S32 numSysFiles;
-            UTF8** sysFiles;
-            UTF8* name;
             
-            // don't scan directories for files if we are pure or restricted
-            if( fs_numServerPaks )
-            {
-                continue;
-            }
-            else if( fs_restrict->integer && ( !com_gameInfo.usesProfiles || ( com_gameInfo.usesProfiles && Q_stricmpn( path, "profiles", 8 ) ) ) &&
-                     Q_stricmpn( path, "demos", 5 ) )
+            if( buffer == NULL )
             {
-                continue;
+                return len;
             }
-            else
+            
+            //buf = ( U8* )Hunk_AllocateTempMemory( len + 1 );
+            buf = ( U8* )Z_Malloc( len + 1 );
+            buf[len] = '\0';	// because we're not calling Z_Malloc with optional trailing 'bZeroIt' bool
+            *buffer = buf;
+            
+            r = Read( buf, len, com_journalDataFile );
+            if( r != len )
             {
-                netpath = BuildOSPath( search->dir->path, search->dir->gamedir, path );
-                sysFiles = Sys_ListFiles( netpath, extension, filter, &numSysFiles, false );
-                
-                for( i = 0 ; i < numSysFiles ; i++ )
-                {
-                    // unique the match
-                    name = sysFiles[i];
-                    nfiles = AddFileToList( name, list, nfiles );
-                }
-                
-                Sys_FreeFileList( sysFiles );
+                Com_Error( ERR_FATAL, "Read from journalDataFile failed" );
             }
+            
+            fs_loadCount++;
+            fs_loadStack++;
+            
+            // guarantee that it will have a trailing 0 for string operations
+            buf[len] = 0;
+            
+            return len;
         }
     }
-    
-    // return a copy of the list
-    *numfiles = nfiles;
-    
-    if( !nfiles )
+    else
     {
-        return NULL;
+        isConfig = false;
     }
     
-    listCopy = ( UTF8** )Z_Malloc( ( nfiles + 1 ) * sizeof( *listCopy ) );
-    
-    for( i = 0 ; i < nfiles ; i++ )
+    // look for it in the filesystem or pack files
+    len = FOpenFileRead( qpath, &h, false );
+    if( h == 0 )
     {
-        listCopy[i] = list[i];
+        if( buffer )
+        {
+            *buffer = NULL;
+        }
+        // if we are journalling and it is a config file, write a zero to the journal file
+        if( isConfig && com_journal && com_journal->integer == 1 )
+        {
+            Com_DPrintf( "Writing zero for %s to journal file.\n", qpath );
+            len = 0;
+            Write( &len, sizeof( len ), com_journalDataFile );
+            Flush( com_journalDataFile );
+        }
+        return -1;
     }
-    listCopy[i] = NULL;
-    
-    return listCopy;
-}
-
-/*
-=================
-idFileSystemLocal::ListFiles
-=================
-*/
-UTF8** idFileSystemLocal::ListFiles( StringEntry path, StringEntry extension, S32* numfiles )
-{
-    return ListFilteredFiles( path, extension, NULL, numfiles );
-}
-
-/*
-=================
-idFileSystemLocal::FreeFileList
-=================
-*/
-void idFileSystemLocal::FreeFileList( UTF8** list )
-{
-    S32 i;
     
-    if( !fs_searchpaths )
+    if( !buffer )
     {
-        Com_Error( ERR_FATAL, "idFileSystemLocal::FreeFileList: Filesystem call made without initialization\n" );
+        if( isConfig && com_journal && com_journal->integer == 1 )
+        {
+            Com_DPrintf( "Writing len for %s to journal file.\n", qpath );
+            Write( &len, sizeof( len ), com_journalDataFile );
+            Flush( com_journalDataFile );
+        }
+        FCloseFile( h );
+        return len;
     }
     
-    if( !list )
+    buf = ( U8* )MapFile( h, len );
+    if( !buf )
     {
-        return;
+        buf = ( U8* )Hunk_AllocateTempMemory( len + 1 );
+        if( !FileCacheRead( h, buf, len ) && ( InflateFile( h, buf, len ) || Read( buf, len, h ) == len ) )
+        {
+            FileCacheStore( h, buf, len );
+        }
     }
+    *buffer = buf;
     
-    for( i = 0 ; list[i] ; i++ )
+    fs_loadCount++;
+    fs_loadStack++;
+    
+    // guarantee that it will have a trailing 0 for string operations
+    buf[len] = 0;
+    FCloseFile( h );
+    
+    // if we are journalling and it is a config file, write it to the journal file
+    if( isConfig && com_journal && com_journal->integer == 1 )
     {
-        Z_Free( list[i] );
+        Com_DPrintf( "Writing %s to journal file.\n", qpath );
+        Write( &len, sizeof( len ), com_journalDataFile );
+        Write( buf, len, com_journalDataFile );
+        Flush( com_journalDataFile );
     }
-    
-    Z_Free( list );
+    return len;
 }
 
 /*
-================
-idFileSystemLocal::GetFileList
-================
+=============
+FS_AsyncRead
+
+Reads the file of req into a new buffer, runs on an I/O thread
+=============
 */
-S32 idFileSystemLocal::GetFileList( StringEntry path, StringEntry extension, UTF8* listbuf, S32 bufsize )
+static void FS_AsyncRead( fsAsyncRead_t* req )
 {
-    S32 nFiles, i, nTotal, nLen;
-    UTF8** pFiles = NULL;
+    unzFile z;
+    S32 r;
     
-    *listbuf = 0;
-    nFiles = 0;
-    nTotal = 0;
+    req->buffer = ( U8* )malloc( req->len + 1 );
+    r = -1;
     
-    if( Q_stricmp( path, "$modlist" ) == 0 )
+    if( req->file )
     {
-        return GetModList( listbuf, bufsize );
+        if( req->buffer )
+        {
+            r = fread( req->buffer, 1, req->len, req->file );
+        }
+        fclose( req->file );
+        req->file = NULL;
     }
-    
-    pFiles = ListFiles( path, extension, &nFiles );
-    
-    for( i = 0; i < nFiles; i++ )
+    else if( req->buffer && req->pak->bundle )
     {
-        nLen = strlen( pFiles[i] ) + 1;
-        
-        if( nTotal + nLen + 1 < bufsize )
+        if( FS_ReadBundleEntry( req->pak, &( ( bundleEntry_t* )req->pak->bundle )[req->pos], req->buffer ) )
         {
-            strcpy( listbuf, pFiles[i] );
-            listbuf += nLen;
-            nTotal += nLen;
+            r = req->len;
         }
-        else
+    }
+    else if( req->buffer )
+    {
+        z = fileSystemLocal.AcquirePackHandle( req->pak );
+        if( z )
         {
-            nFiles = i;
-            break;
+            if( unzSetOffset( z, req->pos ) == UNZ_OK && unzOpenCurrentFileAt( z, req->dataPos ) == UNZ_OK )
+            {
+                r = unzReadCurrentFile( z, req->buffer, req->len );
+                unzCloseCurrentFile( z );
+            }
+            fileSystemLocal.ReleasePackHandle( req->pak, z );
         }
     }
     
-    FreeFileList( pFiles );
+    if( r != req->len )
+    {
+        free( req->buffer );
+        req->buffer = NULL;
+        return;
+    }
     
-    return nFiles;
+    req->buffer[req->len] = 0;
 }
 
 /*
-=======================
-idFileSystemLocal::ConcatenateFileLists
-
-mkv: Naive implementation. Concatenates three lists into a
-new list, and frees the old lists from the heap.
-bk001129 - from cvs1.17 (mkv)
-
-FIXME TTimo those two should move to common.c next to Sys_ListFiles
-=======================
+=============
+FS_AsyncThread
+=============
 */
-U32 idFileSystemLocal::CountFileList( UTF8** list )
+static S32 FS_AsyncThread( void* arg )
 {
-    S32 i = 0;
+    fsAsyncRead_t* req;
     
-    if( list )
+    SDL_LockMutex( fs_asyncLock );
+    while( 1 )
     {
-        while( *list )
+        while( !fs_asyncQuit && !fs_asyncQueue )
         {
-            list++;
-            i++;
+            SDL_CondWait( fs_asyncWake, fs_asyncLock );
+        }
+        
+        // the queue is finished before quitting
+        if( !fs_asyncQueue )
+        {
+            break;
+        }
+        
+        req = fs_asyncQueue;
+        fs_asyncQueue = req->next;
+        if( !fs_asyncQueue )
+        {
+            fs_asyncQueueTail = &fs_asyncQueue;
         }
+        SDL_UnlockMutex( fs_asyncLock );
+        
+        FS_AsyncRead( req );
+        
+        SDL_LockMutex( fs_asyncLock );
+        req->next = NULL;
+        *fs_asyncFinishedTail = req;
+        fs_asyncFinishedTail = &req->next;
     }
-    return i;
+    SDL_UnlockMutex( fs_asyncLock );
+    
+    return 0;
 }
 
 /*
-=======================
-idFileSystemLocal::ConcatenateFileLists
-=======================
+=============
+idFileSystemLocal::StartAsyncThreads
+
+The I/O threads only do file and zip I/O and decompression, the file is
+looked up and the pk3 referenced on the main thread.  The threads read pk3s
+through pooled handles, so they never share a read position with each other
+or with the main thread.
+=============
 */
-UTF8** idFileSystemLocal::ConcatenateFileLists( UTF8** list0, UTF8** list1, UTF8** list2 )
+void idFileSystemLocal::StartAsyncThreads( void )
 {
-    S32 totalLength = 0;
-    UTF8** cat = NULL, **dst, **src;
-    
-    totalLength += CountFileList( list0 );
-    totalLength += CountFileList( list1 );
-    totalLength += CountFileList( list2 );
+    S32 i, count;
     
-    /* Create new list. */
-    dst = cat = ( UTF8** )Z_Malloc( ( totalLength + 1 ) * sizeof( UTF8* ) );
+    count = fs_ioThreads->integer;
+    if( count > MAX_ASYNC_THREADS )
+    {
+        count = MAX_ASYNC_THREADS;
+    }
     
-    /* Copy over lists. */
-    if( list0 )
+    if( count <= 0 )
     {
-        for( src = list0; *src; src++, dst++ )
-        {
-            *dst = *src;
-        }
+        return;
     }
     
-    if( list1 )
+    fs_asyncLock = SDL_CreateMutex();
+    fs_asyncWake = SDL_CreateCond();
+    if( !fs_asyncLock || !fs_asyncWake )
     {
-        for( src = list1; *src; src++, dst++ )
-        {
-            *dst = *src;
-        }
+        Com_Printf( S_COLOR_YELLOW "WARNING: couldn't create I/O thread locks: %s\n", SDL_GetError() );
+        StopAsyncThreads();
+        return;
     }
     
-    if( list2 )
+    fs_asyncQueue = NULL;
+    fs_asyncQueueTail = &fs_asyncQueue;
+    fs_asyncFinished = NULL;
+    fs_asyncFinishedTail = &fs_asyncFinished;
+    fs_asyncQuit = false;
+    
+    for( i = 0; i < count; i++ )
     {
-        for( src = list2; *src; src++, dst++ )
+        fs_asyncThreads[i] = SDL_CreateThread( FS_AsyncThread, "fsIO", NULL );
+        if( !fs_asyncThreads[i] )
         {
-            *dst = *src;
+            Com_Printf( S_COLOR_YELLOW "WARNING: couldn't create I/O thread: %s\n", SDL_GetError() );
+            break;
         }
+        fs_numAsyncThreads++;
     }
+}
+
+/*
+=============
+idFileSystemLocal::StopAsyncThreads
+
+Finishes every outstanding read and runs its callback
+=============
+*/
+void idFileSystemLocal::StopAsyncThreads( void )
+{
+    S32 i;
     
-    // Terminate the list
-    *dst = NULL;
-    
-    // Free our old lists.
-    // NOTE: not freeing their content, it's been merged in dst and still being used
-    if( list0 )
+    if( fs_numAsyncThreads )
     {
-        Z_Free( list0 );
+        SDL_LockMutex( fs_asyncLock );
+        fs_asyncQuit = true;
+        SDL_CondBroadcast( fs_asyncWake );
+        SDL_UnlockMutex( fs_asyncLock );
+        
+        for( i = 0; i < fs_numAsyncThreads; i++ )
+        {
+            SDL_WaitThread( fs_asyncThreads[i], NULL );
+            fs_asyncThreads[i] = NULL;
+        }
+        fs_numAsyncThreads = 0;
+        
+        RunAsyncCallbacks();
     }
     
-    if( list1 )
+    if( fs_asyncWake )
     {
-        Z_Free( list1 );
+        SDL_DestroyCond( fs_asyncWake );
+        fs_asyncWake = NULL;
     }
-    
-    if( list2 )
+    if( fs_asyncLock )
     {
-        Z_Free( list2 );
+        SDL_DestroyMutex( fs_asyncLock );
+        fs_asyncLock = NULL;
     }
-    
-    return cat;
 }
 
 /*
-================
-idFileSystemLocal::GetModList
+=============
+idFileSystemLocal::ReadFileAsync
 
-Returns a list of mod directory names
+Queues qpath to be read by an I/O thread, callback is called from
+RunAsyncCallbacks once it has been.  Returns the length of the file, or -1
+without ever calling callback if it doesn't exist.  Without I/O threads the
+file is read and callback called before this returns.
+=============
+*/
+S32 idFileSystemLocal::ReadFileAsync( StringEntry qpath, fileAsyncCallback_t callback, void* userData )
+{
+    fsAsyncRead_t* req;
+    fileHandle_t h;
+    void* buffer;
+    S32 len;
+    
+    if( !fs_searchpaths )
+    {
+        Com_Error( ERR_FATAL, "idFileSystemLocal::ReadFileAsync: Filesystem call made without initialization\n" );
+    }
+    
+    if( !qpath || !qpath[0] )
+    {
+        Com_Error( ERR_FATAL, "idFileSystemLocal::ReadFileAsync with empty name\n" );
+    }
+    
+    // config files have to go through the journal in order
+    if( !fs_numAsyncThreads || ( com_journal && com_journal->integer && strstr( qpath, ".cfg" ) ) )
+    {
+        len = ReadFile( qpath, &buffer );
+        if( buffer )
+        {
+            callback( qpath, buffer, len, userData );
+            FreeFile( buffer );
+        }
+        return len;
+    }
+    
+    len = FOpenFileRead( qpath, &h, false );
+    if( !h )
+    {
+        return -1;
+    }
+    
+    req = ( fsAsyncRead_t* )Z_Malloc( sizeof( *req ) );
+    Q_strncpyz( req->qpath, qpath, sizeof( req->qpath ) );
+    req->callback = callback;
+    req->userData = userData;
+    req->len = len;
+    
+    if( fsh[h].bundleFile )
+    {
+        req->pak = fsh[h].pak;
+        req->pos = fsh[h].bundleEntry;
+    }
+    else if( fsh[h].zipFile )
+    {
+        req->pak = fsh[h].pak;
+        req->pos = fsh[h].zipFilePos;
+        req->dataPos = fsh[h].zipDataPos;
+    }
+    else
+    {
+        // the request takes over the FILE
+        req->file = fsh[h].handleFiles.file.o;
+        fsh[h].handleFiles.file.o = NULL;
+    }
+    FCloseFile( h );
+    
+    SDL_LockMutex( fs_asyncLock );
+    *fs_asyncQueueTail = req;
+    fs_asyncQueueTail = &req->next;
+    SDL_CondSignal( fs_asyncWake );
+    SDL_UnlockMutex( fs_asyncLock );
+    
+    return len;
+}
+
+/*
+=============
+idFileSystemLocal::RunAsyncCallbacks
+
+Calls back every ReadFileAsync request that has finished, once per frame
+=============
+*/
+void idFileSystemLocal::RunAsyncCallbacks( void )
+{
+    fsAsyncRead_t* req, *next;
+    
+    if( !fs_asyncLock )
+    {
+        return;
+    }
+    
+    SDL_LockMutex( fs_asyncLock );
+    req = fs_asyncFinished;
+    fs_asyncFinished = NULL;
+    fs_asyncFinishedTail = &fs_asyncFinished;
+    SDL_UnlockMutex( fs_asyncLock );
+    
+    for( ; req; req = next )
+    {
+        next = req->next;
+        
+        if( req->buffer )
+        {
+            fs_loadCount++;
+            req->callback( req->qpath, req->buffer, req->len, req->userData );
+            free( req->buffer );
+        }
+        else
+        {
+            Com_Printf( S_COLOR_YELLOW "WARNING: couldn't read %s\n", req->qpath );
+            req->callback( req->qpath, NULL, -1, req->userData );
+        }
+        
+        Z_Free( req );
+    }
+}
+
+/*
+=============
+idFileSystemLocal::FreeFile
+=============
+*/
+void idFileSystemLocal::FreeFile( void* buffer )
+{
+    S32 i;
+    
+    if( !fs_searchpaths )
+    {
+        Com_Error( ERR_FATAL, "idFileSystemLocal::FreeFile: Filesystem call made without initialization\n" );
+    }
+    if( !buffer )
+    {
+        Com_Error( ERR_FATAL, "idFileSystemLocal::FreeFile( NULL )" );
+    }
+    fs_loadStack--;
+    
+    for( i = 0; i < fs_numMappings; i++ )
+    {
+        if( fs_mappings[i].buffer == buffer )
+        {
+            break;
+        }
+    }
+    
+    if( i < fs_numMappings )
+    {
+        Sys_UnmapFile( &fs_mappings[i].mapping );
+        fs_mappings[i] = fs_mappings[--fs_numMappings];
+    }
+    else
+    {
+        Hunk_FreeTempMemory( buffer );
+    }
+    
+    // if all of our temp files are free, clear all of our space
+    if( fs_loadStack == 0 )
+    {
+        Hunk_ClearTempMemory();
+    }
+}
+
+/*
+============
+idFileSystemLocal::WriteFile
+
+Filename are reletive to the quake search path
+============
+*/
+void idFileSystemLocal::WriteFile( StringEntry qpath, const void* buffer, S32 size )
+{
+    fileHandle_t f;
+    
+    if( !fs_searchpaths )
+    {
+        Com_Error( ERR_FATAL, "Filesystem call made without initialization\n" );
+    }
+    
+    if( !qpath || !buffer )
+    {
+        Com_Error( ERR_FATAL, "idFileSystemLocal::WriteFile: NULL parameter" );
+    }
+    
+    f = FOpenFileWrite( qpath );
+    if( !f )
+    {
+        Com_Printf( "Failed to open %s\n", qpath );
+        return;
+    }
+    
+    Write( buffer, size, f );
+    
+    FCloseFile( f );
+}
+
+/*
+==========================================================================
+ZIP FILE LOADING
+==========================================================================
+*/
+
+/*
+=================
+FS_BeginZipScan
+
+Sets up the buffers for numEntries files, dropping anything a previous
+attempt left behind
+=================
+*/
+static bool FS_BeginZipScan( fsZipScan_t* scan, S32 numEntries )
+{
+    free( scan->entries );
+    free( scan->names );
+    free( scan->headerLongs );
+    
+    scan->numEntries = 0;
+    scan->namesLen = 0;
+    scan->namesSize = MAX_ZPATH * 16;
+    scan->numHeaderLongs = 0;
+    
+    scan->entries = ( fsZipEntry_t* )malloc( ( numEntries + 1 ) * sizeof( *scan->entries ) );
+    scan->names = ( UTF8* )malloc( scan->namesSize );
+    scan->headerLongs = ( S32* )malloc( ( numEntries + 1 ) * sizeof( *scan->headerLongs ) );
+    if( !scan->entries || !scan->names || !scan->headerLongs )
+    {
+        return false;
+    }
+    
+    scan->headerLongs[scan->numHeaderLongs++] = LittleLong( fs_checksumFeed );
+    
+    return true;
+}
+
+/*
+=================
+FS_AddZipEntry
+
+name is at most MAX_ZPATH - 1 characters
+=================
+*/
+static bool FS_AddZipEntry( fsZipScan_t* scan, StringEntry name, U64 pos, U64 len, U32 crc )
+{
+    fsZipEntry_t* entry;
+    
+    if( len > 0 )
+    {
+        scan->headerLongs[scan->numHeaderLongs++] = LittleLong( crc );
+    }
+    
+    // the names end up in one block after the entries, grow it as we go
+    if( scan->namesLen + MAX_ZPATH > scan->namesSize )
+    {
+        UTF8* names;
+        
+        // keep the old block on failure so the caller can still free it
+        names = ( UTF8* )realloc( scan->names, scan->namesSize * 2 );
+        if( !names )
+        {
+            return false;
+        }
+        
+        scan->names = names;
+        scan->namesSize *= 2;
+    }
+    
+    entry = &scan->entries[scan->numEntries++];
+    entry->name = scan->namesLen;
+    entry->pos = pos;
+    entry->len = len;
+    
+    strcpy( scan->names + scan->namesLen, name );
+    Q_strlwr( scan->names + scan->namesLen );
+    scan->namesLen += strlen( name ) + 1;
+    
+    return true;
+}
+
+static ID_INLINE U32 FS_ZipShort( const U8* p )
+{
+    return p[0] | ( p[1] << 8 );
+}
+
+static ID_INLINE U32 FS_ZipLong( const U8* p )
+{
+    return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( ( U32 )p[3] << 24 );
+}
+
+#define ZIP_EOCD_SIGNATURE      0x06054b50
+#define ZIP_EOCD_SIZE           22
+#define ZIP_CENTRAL_SIGNATURE   0x02014b50
+#define ZIP_CENTRAL_SIZE        46
+
+/*
+=================
+FS_ParseCentralDirectory
+
+Reads the whole central directory with one read and walks it in memory,
+instead of the seek and small reads per file that minizip does.  Returns
+false for anything it doesn't handle, zip64 and spanned archives mostly,
+so the caller can fall back to minizip.
+=================
+*/
+static bool FS_ParseCentralDirectory( fsZipScan_t* scan )
+{
+    FILE* f;
+    U8* buf, *p, *end;
+    S64 fileSize, tailSize, eocdPos, before;
+    U32 cdSize, cdOffset, entrySize;
+    S32 i, numEntries, nameLen;
+    UTF8 name[MAX_ZPATH];
+    
+    f = fopen( scan->zipfile, "rb" );
+    if( !f )
+    {
+        return false;
+    }
+    
+    if( fseek( f, 0, SEEK_END ) || ( fileSize = ftell( f ) ) < ZIP_EOCD_SIZE )
+    {
+        fclose( f );
+        return false;
+    }
+    
+    // the end of central directory record is followed by a comment of up to 64k
+    tailSize = fileSize < 0xffff + ZIP_EOCD_SIZE ? fileSize : 0xffff + ZIP_EOCD_SIZE;
+    buf = ( U8* )malloc( tailSize );
+    if( !buf || fseek( f, ( long )( fileSize - tailSize ), SEEK_SET ) || fread( buf, 1, tailSize, f ) != ( size_t )tailSize )
+    {
+        free( buf );
+        fclose( f );
+        return false;
+    }
+    
+    for( p = buf + tailSize - ZIP_EOCD_SIZE; p >= buf; p-- )
+    {
+        if( FS_ZipLong( p ) == ZIP_EOCD_SIGNATURE )
+        {
+            break;
+        }
+    }
+    
+    if( p < buf || FS_ZipShort( p + 4 ) || FS_ZipShort( p + 6 ) )
+    {
+        free( buf );
+        fclose( f );
+        return false;
+    }
+    
+    numEntries = FS_ZipShort( p + 10 );
+    cdSize = FS_ZipLong( p + 12 );
+    cdOffset = FS_ZipLong( p + 16 );
+    eocdPos = fileSize - tailSize + ( p - buf );
+    free( buf );
+    
+    // anything at 0xffff may be a zip64 archive, and there may be data
+    // in front of the archive itself (self extracting exes)
+    before = eocdPos - ( ( S64 )cdOffset + cdSize );
+    if( numEntries == 0xffff || cdSize == 0xffffffff || cdOffset == 0xffffffff || before < 0 )
+    {
+        fclose( f );
+        return false;
+    }
+    
+    buf = ( U8* )malloc( cdSize + 1 );
+    if( !buf || fseek( f, ( long )( cdOffset + before ), SEEK_SET ) || fread( buf, 1, cdSize, f ) != cdSize )
+    {
+        free( buf );
+        fclose( f );
+        return false;
+    }
+    fclose( f );
+    
+    if( !FS_BeginZipScan( scan, numEntries ) )
+    {
+        free( buf );
+        scan->corrupted = true;
+        return true;
+    }
+    
+    p = buf;
+    end = buf + cdSize;
+    for( i = 0; i < numEntries; i++ )
+    {
+        if( end - p < ZIP_CENTRAL_SIZE || FS_ZipLong( p ) != ZIP_CENTRAL_SIGNATURE )
+        {
+            break;
+        }
+        
+        nameLen = FS_ZipShort( p + 28 );
+        entrySize = ZIP_CENTRAL_SIZE + nameLen + FS_ZipShort( p + 30 ) + FS_ZipShort( p + 32 );
+        if( ( U32 )( end - p ) < entrySize )
+        {
+            break;
+        }
+        
+        // sizes or offsets that need the zip64 extra field
+        if( FS_ZipLong( p + 20 ) == 0xffffffff || FS_ZipLong( p + 24 ) == 0xffffffff || FS_ZipLong( p + 42 ) == 0xffffffff )
+        {
+            break;
+        }
+        
+        // names are cut the same way unzGetCurrentFileInfo does
+        if( nameLen > MAX_ZPATH - 1 )
+        {
+            nameLen = MAX_ZPATH - 1;
+        }
+        ::memcpy( name, p + ZIP_CENTRAL_SIZE, nameLen );
+        name[nameLen] = '\0';
+        
+        // the position is the one unzGetOffset would give, relative to the archive start
+        if( !FS_AddZipEntry( scan, name, cdOffset + ( p - buf ), FS_ZipLong( p + 24 ), FS_ZipLong( p + 16 ) ) )
+        {
+            free( buf );
+            scan->corrupted = true;
+            return true;
+        }
+        
+        p += entrySize;
+    }
+    
+    free( buf );
+    
+    return i == numEntries;
+}
+
+/*
+=================
+FS_WalkCentralDirectory
+
+The minizip way, one file at a time through the zip handle
+=================
+*/
+static void FS_WalkCentralDirectory( fsZipScan_t* scan )
+{
+    unz_global_info gi;
+    unz_file_info file_info;
+    UTF8 filename_inzip[MAX_ZPATH];
+    S32 i;
+    
+    if( unzGetGlobalInfo( scan->handle, &gi ) != UNZ_OK )
+    {
+        scan->valid = false;
+        return;
+    }
+    
+    if( !FS_BeginZipScan( scan, gi.number_entry ) )
+    {
+        scan->corrupted = true;
+        return;
+    }
+    
+    unzGoToFirstFile( scan->handle );
+    
+    for( i = 0; i < gi.number_entry; i++ )
+    {
+        if( unzGetCurrentFileInfo( scan->handle, &file_info, filename_inzip, sizeof( filename_inzip ), NULL, 0, NULL, 0 ) != UNZ_OK )
+        {
+            // it's better to fail and have the user notified than to have a half-loaded pk3,
+            // or worse a failed pack referenced that results in further failures (yes it does happen)
+            scan->corrupted = true;
+            return;
+        }
+        
+        filename_inzip[sizeof( filename_inzip ) - 1] = '\0';
+        
+        // store the file position in the zip
+        if( !FS_AddZipEntry( scan, filename_inzip, unzGetOffset( scan->handle ), file_info.uncompressed_size, file_info.crc ) )
+        {
+            scan->corrupted = true;
+            return;
+        }
+        
+        unzGoToNextFile( scan->handle );
+    }
+}
+
+/*
+=================
+FS_BundleHash
+
+The name hash the bundle directory is sorted on, case and separator
+insensitive like the rest of the file system
+=================
+*/
+static U32 FS_BundleHash( StringEntry name )
+{
+    U32 hash;
+    S32 c;
+    
+    hash = 2166136261u;
+    for( ; *name; name++ )
+    {
+        c = tolower( *name );
+        if( c == '\\' )
+        {
+            c = '/';
+        }
+        hash = ( hash ^ ( U32 )c ) * 16777619u;
+    }
+    
+    return hash;
+}
+
+/*
+=================
+FS_SwapBundleHeader
+=================
+*/
+static void FS_SwapBundleHeader( bundleHeader_t* header )
+{
+    header->ident = LittleLong( header->ident );
+    header->version = LittleLong( header->version );
+    header->numFiles = LittleLong( header->numFiles );
+    header->numChecksums = LittleLong( header->numChecksums );
+    header->namesSize = LittleLong( header->namesSize );
+    header->dirOffset = LittleLong( header->dirOffset );
+}
+
+/*
+=================
+FS_SwapBundleEntry
+=================
+*/
+static void FS_SwapBundleEntry( bundleEntry_t* entry )
+{
+    entry->hash = LittleLong( entry->hash );
+    entry->name = LittleLong( entry->name );
+    entry->offset = LittleLong( entry->offset );
+    entry->size = LittleLong( entry->size );
+    entry->storedSize = LittleLong( entry->storedSize );
+    entry->crc = LittleLong( entry->crc );
+    entry->compression = LittleLong( entry->compression );
+}
+
+/*
+=================
+FS_ScanBundleFile
+
+Reads the directory of a .owb bundle with one read and fills the scan the
+same way a zip file does, the entries get their directory index as position.
+The checksums come from the manifest instead of the crcs of the entries.
+=================
+*/
+static void FS_ScanBundleFile( fsZipScan_t* scan )
+{
+    bundleHeader_t header;
+    bundleEntry_t* entry;
+    FILE* f;
+    U8* buf;
+    UTF8* names;
+    S64 fileSize, dirSize;
+    S32 i;
+    
+    f = fopen( scan->zipfile, "rb" );
+    if( !f )
+    {
+        return;
+    }
+    
+    if( fread( &header, 1, sizeof( header ), f ) != sizeof( header ) || LittleLong( header.ident ) != BUNDLE_IDENT )
+    {
+        fclose( f );
+        return;
+    }
+    
+    scan->valid = true;
+    FS_SwapBundleHeader( &header );
+    
+    fseek( f, 0, SEEK_END );
+    fileSize = ftell( f );
+    
+    dirSize = ( S64 )header.numFiles * sizeof( bundleEntry_t ) + ( S64 )header.numChecksums * sizeof( S32 ) + header.namesSize;
+    if( header.version != BUNDLE_VERSION || header.numFiles < 0 || header.numChecksums < 0 || header.namesSize < 0 ||
+            header.dirOffset < ( S32 )sizeof( header ) || header.dirOffset + dirSize > fileSize )
+    {
+        fclose( f );
+        scan->corrupted = true;
+        return;
+    }
+    
+    buf = ( U8* )malloc( dirSize + 1 );
+    if( !buf || fseek( f, header.dirOffset, SEEK_SET ) || fread( buf, 1, dirSize, f ) != ( size_t )dirSize )
+    {
+        free( buf );
+        fclose( f );
+        scan->corrupted = true;
+        return;
+    }
+    fclose( f );
+    
+    // the names are zero terminated, make sure the last one is too
+    buf[dirSize] = 0;
+    names = ( UTF8* )buf + dirSize - header.namesSize;
+    
+    scan->bundleEntries = ( bundleEntry_t* )malloc( header.numFiles * sizeof( bundleEntry_t ) + 1 );
+    if( !scan->bundleEntries || !FS_BeginZipScan( scan, header.numFiles > header.numChecksums ? header.numFiles : header.numChecksums ) )
+    {
+        free( buf );
+        scan->corrupted = true;
+        return;
+    }
+    ::memcpy( scan->bundleEntries, buf, header.numFiles * sizeof( bundleEntry_t ) );
+    
+    for( i = 0; i < header.numFiles; i++ )
+    {
+        entry = &scan->bundleEntries[i];
+        FS_SwapBundleEntry( entry );
+        
+        if( entry->name < 0 || entry->name >= header.namesSize || strlen( names + entry->name ) >= MAX_ZPATH ||
+                entry->size < 0 || entry->storedSize < 0 || entry->offset < ( S32 )sizeof( header ) ||
+                ( S64 )entry->offset + entry->storedSize > header.dirOffset ||
+                ( entry->compression == BUNDLE_STORED && entry->storedSize != entry->size ) ||
+                ( entry->compression != BUNDLE_STORED && entry->compression != BUNDLE_DEFLATE ) ||
+                !FS_AddZipEntry( scan, names + entry->name, i, entry->size, entry->crc ) )
+        {
+            free( buf );
+            scan->corrupted = true;
+            return;
+        }
+    }
+    
+    // the checksum feed stays, the manifest replaces the crcs of the entries
+    scan->numHeaderLongs = 1;
+    ::memcpy( &scan->headerLongs[1], buf + header.numFiles * sizeof( bundleEntry_t ), header.numChecksums * sizeof( S32 ) );
+    scan->numHeaderLongs += header.numChecksums;
+    
+    free( buf );
+}
+
+/*
+=================
+FS_ScanZipFile
+
+Reads the central directory of an opened zip file, or the directory of a
+bundle, and computes its checksums.  Called from the job workers, so it may
+only use the handle it was given and the system allocator.
+=================
+*/
+static void FS_ScanZipFile( fsZipScan_t* scan )
+{
+    S64 start;
+    
+    start = Sys_Microseconds();
+    
+    if( scan->bundle )
+    {
+        FS_ScanBundleFile( scan );
+    }
+    else if( scan->handle )
+    {
+        scan->valid = true;
+        
+        if( !FS_ParseCentralDirectory( scan ) )
+        {
+            FS_WalkCentralDirectory( scan );
+        }
+    }
+    
+    if( scan->valid && !scan->corrupted )
+    {
+        scan->checksum = Com_BlockChecksum( &scan->headerLongs[ 1 ], sizeof( *scan->headerLongs ) * ( scan->numHeaderLongs - 1 ) );
+        scan->pure_checksum = Com_BlockChecksum( scan->headerLongs, sizeof( *scan->headerLongs ) * scan->numHeaderLongs );
+        scan->checksum = LittleLong( scan->checksum );
+        scan->pure_checksum = LittleLong( scan->pure_checksum );
+    }
+    
+    free( scan->headerLongs );
+    scan->headerLongs = NULL;
+    
+    scan->usec = Sys_Microseconds() - start;
+}
+
+/*
+=================
+FS_ScanZipJob
+=================
+*/
+static void FS_ScanZipJob( void* data, S32 index )
+{
+    FS_ScanZipFile( &( ( fsZipScan_t* )data )[index] );
+}
+
+/*
+=================
+FS_FreeZipScan
+
+Releases what a scan holds that was not handed to a pack
+=================
+*/
+static void FS_FreeZipScan( fsZipScan_t* scan )
+{
+    free( scan->entries );
+    free( scan->names );
+    free( scan->bundleEntries );
+    scan->entries = NULL;
+    scan->names = NULL;
+    scan->bundleEntries = NULL;
+    
+    if( scan->handle )
+    {
+        unzClose( scan->handle );
+        scan->handle = NULL;
+    }
+}
+
+/*
+=================
+idFileSystemLocal::MountZipFile
+
+Builds the pack_t of a scanned zip file or bundle.  The scan owns the zip
+handle until then and its buffers are released here.
+=================
+*/
+pack_t* idFileSystemLocal::MountZipFile( fsZipScan_t* scan )
+{
+    fileInPack_t* buildBuffer;
+    pack_t* pack;
+    S32 i;
+    S64	hash;
+    UTF8* namePtr;
+    
+    if( !scan->valid )
+    {
+        FS_FreeZipScan( scan );
+        return NULL;
+    }
+    
+    if( scan->corrupted )
+    {
+        Com_Error( ERR_FATAL, "Corrupted %s file \'%s\'", scan->bundle ? "bundle" : "pk3", scan->basename );
+    }
+    
+    buildBuffer = ( fileInPack_t* )Z_Malloc( ( scan->numEntries * sizeof( fileInPack_t ) ) + scan->namesLen );
+    namePtr = ( ( UTF8* ) buildBuffer ) + scan->numEntries * sizeof( fileInPack_t );
+    ::memcpy( namePtr, scan->names, scan->namesLen );
+    
+    // get the hash table size from the number of files in the zip
+    // because lots of custom pk3 files have less than 32 or 64 files
+    for( i = 1; i <= MAX_FILEHASH_SIZE; i <<= 1 )
+    {
+        if( i > scan->numEntries )
+        {
+            break;
+        }
+    }
+    
+    pack = ( pack_t* )Z_Malloc( sizeof( pack_t ) + i * sizeof( fileInPack_t* ) );
+    pack->hashSize = i;
+    pack->hashTable = ( fileInPack_t** )( ( ( UTF8* ) pack ) + sizeof( pack_t ) );
+    
+    for( i = 0; i < pack->hashSize; i++ )
+    {
+        pack->hashTable[i] = NULL;
+    }
+    
+    Q_strncpyz( pack->pakFilename, scan->zipfile, sizeof( pack->pakFilename ) );
+    Q_strncpyz( pack->pakBasename, scan->basename, sizeof( pack->pakBasename ) );
+    
+    // strip .pk3 or .owb if needed
+    if( strlen( pack->pakBasename ) > 4 && ( !Q_stricmp( pack->pakBasename + strlen( pack->pakBasename ) - 4, ".pk3" ) ||
+            !Q_stricmp( pack->pakBasename + strlen( pack->pakBasename ) - 4, ".owb" ) ) )
+    {
+        pack->pakBasename[strlen( pack->pakBasename ) - 4] = 0;
+    }
+    
+    pack->handle = scan->handle;
+    pack->numfiles = scan->numEntries;
+    
+    if( scan->bundle )
+    {
+        pack->bundle = Z_Malloc( scan->numEntries * sizeof( bundleEntry_t ) + 1 );
+        ::memcpy( pack->bundle, scan->bundleEntries, scan->numEntries * sizeof( bundleEntry_t ) );
+    }
+    
+    for( i = 0; i < scan->numEntries; i++ )
+    {
+        buildBuffer[i].name = namePtr + scan->entries[i].name;
+        buildBuffer[i].pos = scan->entries[i].pos;
+        buildBuffer[i].len = scan->entries[i].len;
+        
+        hash = HashFileName( buildBuffer[i].name, pack->hashSize );
+        buildBuffer[i].next = pack->hashTable[hash];
+        pack->hashTable[hash] = &buildBuffer[i];
+    }
+    
+    pack->checksum = scan->checksum;
+    pack->pure_checksum = scan->pure_checksum;
+    pack->buildBuffer = buildBuffer;
+    
+    BuildPackDirs( pack );
+    
+    // the pack owns the handle now
+    scan->handle = NULL;
+    FS_FreeZipScan( scan );
+    
+    return pack;
+}
+
+/*
+=================
+idFileSystemLocal::FreePack
+
+Closes and frees a pack from MountZipFile
+=================
+*/
+void idFileSystemLocal::FreePack( pack_t* pack )
+{
+    S32 i;
+    
+    for( i = 0; i < pack->numPooledHandles; i++ )
+    {
+        unzClose( pack->pooledHandles[i] );
+    }
+    if( pack->handle )
+    {
+        unzClose( pack->handle );
+    }
+    if( pack->bundle )
+    {
+        Z_Free( pack->bundle );
+    }
+    FreePackDirs( pack );
+    Z_Free( pack->buildBuffer );
+    Z_Free( pack );
+}
+
+/*
+=================
+idFileSystemLocal::LoadZipFile
+
+Creates a new pak_t in the search chain for the contents
+of a zip file.
+=================
+*/
+pack_t* idFileSystemLocal::LoadZipFile( StringEntry zipfile, StringEntry basename )
+{
+    fsZipScan_t scan;
+    
+    ::memset( &scan, 0, sizeof( scan ) );
+    Q_strncpyz( scan.zipfile, zipfile, sizeof( scan.zipfile ) );
+    Q_strncpyz( scan.basename, basename, sizeof( scan.basename ) );
+    
+    scan.handle = unzOpen( zipfile );
+    FS_ScanZipFile( &scan );
+    
+    return MountZipFile( &scan );
+}
+
+/*
+=================================================================================
+DIRECTORY SCANNING FUNCTIONS
+=================================================================================
+*/
+S32 idFileSystemLocal::ReturnPath( StringEntry zname, UTF8* zpath, S32* depth )
+{
+    S32 len, at, newdep;
+    
+    newdep = 0;
+    zpath[0] = 0;
+    len = 0;
+    at = 0;
+    
+    while( zname[at] != 0 )
+    {
+        if( zname[at] == '/' || zname[at] == '\\' )
+        {
+            len = at;
+            newdep++;
+        }
+        at++;
+    }
+    
+    strcpy( zpath, zname );
+    
+    zpath[len] = 0;
+    *depth = newdep;
+    
+    return len;
+}
+
+/*
+==================
+idFileSystemLocal::AddFileToList
+==================
+*/
+S32 idFileSystemLocal::AddFileToList( UTF8* name, UTF8* list[MAX_FOUND_FILES], S32 nfiles )
+{
+    S32 i;
+    
+    if( nfiles == MAX_FOUND_FILES - 1 )
+    {
+        return nfiles;
+    }
+    
+    for( i = 0 ; i < nfiles ; i++ )
+    {
+        if( !Q_stricmp( name, list[i] ) )
+        {
+            return nfiles;      // allready in list
+        }
+    }
+    
+    list[nfiles] = CopyString( name );
+    nfiles++;
+    
+    return nfiles;
+}
+
+/*
+==================
+FS_FoldChar
+
+Case folding of the directory index, letters only like Q_stricmp
+==================
+*/
+static ID_INLINE S32 FS_FoldChar( S32 c )
+{
+    c = ( U8 )c;
+    if( c >= 'A' && c <= 'Z' )
+    {
+        c += 'a' - 'A';
+    }
+    return c;
+}
+
+/*
+==================
+FS_CompareDirs
+
+Orders the first aLen characters of a against the first bLen of b
+==================
+*/
+static S32 FS_CompareDirs( StringEntry a, S32 aLen, StringEntry b, S32 bLen )
+{
+    S32 i, c1, c2;
+    
+    for( i = 0; i < aLen && i < bLen; i++ )
+    {
+        c1 = FS_FoldChar( a[i] );
+        c2 = FS_FoldChar( b[i] );
+        if( c1 != c2 )
+        {
+            return c1 - c2;
+        }
+    }
+    
+    return aLen - bLen;
+}
+
+/*
+==================
+FS_CompareDirPrefix
+
+Zero if the directory starts with the first pathLength characters of path,
+otherwise which side of them it sorts on
+==================
+*/
+static S32 FS_CompareDirPrefix( const packDir_t* dir, StringEntry path, S32 pathLength )
+{
+    S32 i, c1, c2;
+    
+    for( i = 0; i < pathLength; i++ )
+    {
+        c1 = i < dir->nameLen ? FS_FoldChar( dir->name[i] ) : 0;
+        c2 = FS_FoldChar( path[i] );
+        if( c1 != c2 )
+        {
+            return c1 - c2;
+        }
+    }
+    
+    return 0;
+}
+
+/*
+==================
+FS_SortDirFiles
+==================
+*/
+static S32 FS_SortDirFiles( const void* a, const void* b )
+{
+    S32 i1 = *( const S32* )a, i2 = *( const S32* )b, r;
+    
+    r = FS_CompareDirs( fs_sortFiles[i1].name, fs_sortDirLen[i1], fs_sortFiles[i2].name, fs_sortDirLen[i2] );
+    if( r )
+    {
+        return r;
+    }
+    
+    // keep the pk3 order within a directory
+    return i1 - i2;
+}
+
+/*
+==================
+FS_SortInts
+==================
+*/
+static S32 FS_SortInts( const void* a, const void* b )
+{
+    return *( const S32* )a - *( const S32* )b;
+}
+
+/*
+==================
+FS_AddUniqueFile
+
+idFileSystemLocal::AddFileToList with a hash of what is already in the list
+instead of comparing against all of it
+==================
+*/
+static S32 FS_AddUniqueFile( StringEntry name, UTF8* list[MAX_FOUND_FILES], S32 nfiles, S16* unique )
+{
+    StringEntry p;
+    U32 h;
+    
+    if( nfiles == MAX_FOUND_FILES - 1 )
+    {
+        return nfiles;
+    }
+    
+    h = 2166136261u;
+    for( p = name; *p; p++ )
+    {
+        h = ( h ^ FS_FoldChar( *p ) ) * 16777619u;
+    }
+    
+    for( h &= FS_LIST_HASH_SIZE - 1; unique[h]; h = ( h + 1 ) & ( FS_LIST_HASH_SIZE - 1 ) )
+    {
+        if( !Q_stricmp( name, list[unique[h] - 1] ) )
+        {
+            return nfiles; // allready in list
+        }
+    }
+    
+    unique[h] = nfiles + 1;
+    list[nfiles] = CopyString( name );
+    
+    return nfiles + 1;
+}
+
+/*
+==================
+FS_CopyFileList
+==================
+*/
+static UTF8** FS_CopyFileList( UTF8** list, S32 nfiles )
+{
+    UTF8** copy;
+    S32 i;
+    
+    if( !nfiles )
+    {
+        return NULL;
+    }
+    
+    copy = ( UTF8** )Z_Malloc( ( nfiles + 1 ) * sizeof( *copy ) );
+    for( i = 0; i < nfiles; i++ )
+    {
+        copy[i] = CopyString( list[i] );
+    }
+    copy[i] = NULL;
+    
+    return copy;
+}
+
+/*
+==================
+FS_FreeCachedList
+==================
+*/
+static void FS_FreeCachedList( fsListCacheEntry_t* entry )
+{
+    S32 i;
+    
+    if( entry->files )
+    {
+        for( i = 0; i < entry->numFiles; i++ )
+        {
+            Z_Free( entry->files[i] );
+        }
+        Z_Free( entry->files );
+    }
+    
+    entry->files = NULL;
+    entry->numFiles = 0;
+    entry->generation = 0;
+}
+
+/*
+==================
+idFileSystemLocal::BuildPackDirs
+
+Groups the files of pack by directory and sorts the directories, so that a
+listing only has to look at the ones under the path it lists
+==================
+*/
+void idFileSystemLocal::BuildPackDirs( pack_t* pack )
+{
+    S32* dirLen;
+    S32 i, j, n, depth;
+    StringEntry name;
+    packDir_t* dir;
+    
+    n = pack->numfiles;
+    if( !n )
+    {
+        return;
+    }
+    
+    pack->dirFiles = ( S32* )Z_Malloc( n * sizeof( *pack->dirFiles ) );
+    dirLen = ( S32* )Z_Malloc( n * sizeof( *dirLen ) );
+    
+    for( i = 0; i < n; i++ )
+    {
+        pack->dirFiles[i] = i;
+        
+        // same as the length idFileSystemLocal::ReturnPath gives
+        dirLen[i] = 0;
+        for( name = pack->buildBuffer[i].name, j = 0; name[j]; j++ )
+        {
+            if( name[j] == '/' || name[j] == '\\' )
+            {
+                dirLen[i] = j;
+            }
+        }
+    }
+    
+    fs_sortFiles = pack->buildBuffer;
+    fs_sortDirLen = dirLen;
+    qsort( pack->dirFiles, n, sizeof( *pack->dirFiles ), FS_SortDirFiles );
+    
+    pack->numDirs = 1;
+    for( i = 1; i < n; i++ )
+    {
+        if( FS_CompareDirs( pack->buildBuffer[pack->dirFiles[i - 1]].name, dirLen[pack->dirFiles[i - 1]],
+                            pack->buildBuffer[pack->dirFiles[i]].name, dirLen[pack->dirFiles[i]] ) )
+        {
+            pack->numDirs++;
+        }
+    }
+    
+    pack->dirs = ( packDir_t* )Z_Malloc( pack->numDirs * sizeof( *pack->dirs ) );
+    
+    dir = NULL;
+    for( i = 0; i < n; i++ )
+    {
+        j = pack->dirFiles[i];
+        if( dir && !FS_CompareDirs( dir->name, dir->nameLen, pack->buildBuffer[j].name, dirLen[j] ) )
+        {
+            dir->numFiles++;
+            continue;
+        }
+        
+        dir = dir ? dir + 1 : pack->dirs;
+        dir->name = pack->buildBuffer[j].name;
+        dir->nameLen = dirLen[j];
+        dir->firstFile = i;
+        dir->numFiles = 1;
+        
+        // folding only touches letters, so every file of the directory has as many separators
+        for( name = dir->name, depth = 0; *name; name++ )
+        {
+            if( *name == '/' || *name == '\\' )
+            {
+                depth++;
+            }
+        }
+        dir->depth = depth;
+    }
+    
+    Z_Free( dirLen );
+}
+
+/*
+==================
+idFileSystemLocal::FreePackDirs
+==================
+*/
+void idFileSystemLocal::FreePackDirs( pack_t* pack )
+{
+    if( pack->dirs )
+    {
+        Z_Free( pack->dirs );
+        pack->dirs = NULL;
+    }
+    if( pack->dirFiles )
+    {
+        Z_Free( pack->dirFiles );
+        pack->dirFiles = NULL;
+    }
+    pack->numDirs = 0;
+}
+
+/*
+==================
+idFileSystemLocal::ListPackDir
+
+Adds the files of pak that ListFilteredFiles lists for path and extension:
+those at most two levels below the depth of path, in directories whose
+name starts with it.  They are added in pk3 order, as a scan of every
+file would.
+==================
+*/
+S32 idFileSystemLocal::ListPackDir( pack_t* pak, StringEntry path, S32 pathLength, S32 pathDepth, StringEntry extension, UTF8** list, S32 nfiles, S16* unique )
+{
+    S32 lo, hi, mid, first, last, i, j, numMatches, extensionLength, length, skip;
+    S32* matches;
+    StringEntry name;
+    
+    if( !pak->numDirs )
+    {
+        return nfiles;
+    }
+    
+    // the directories starting with path are a contiguous range
+    lo = 0;
+    hi = pak->numDirs;
+    while( lo < hi )
+    {
+        mid = ( lo + hi ) >> 1;
+        if( FS_CompareDirPrefix( &pak->dirs[mid], path, pathLength ) < 0 )
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    first = lo;
+    
+    numMatches = 0;
+    for( last = first; last < pak->numDirs && !FS_CompareDirPrefix( &pak->dirs[last], path, pathLength ); last++ )
+    {
+        if( pak->dirs[last].depth - pathDepth <= 2 )
+        {
+            numMatches += pak->dirs[last].numFiles;
+        }
+    }
+    
+    if( !numMatches )
+    {
+        return nfiles;
+    }
+    
+    matches = ( S32* )Z_Malloc( numMatches * sizeof( *matches ) );
+    numMatches = 0;
+    for( i = first; i < last; i++ )
+    {
+        if( pak->dirs[i].depth - pathDepth <= 2 )
+        {
+            for( j = 0; j < pak->dirs[i].numFiles; j++ )
+            {
+                matches[numMatches++] = pak->dirFiles[pak->dirs[i].firstFile + j];
+            }
+        }
+    }
+    qsort( matches, numMatches, sizeof( *matches ), FS_SortInts );
+    
+    extensionLength = strlen( extension );
+    skip = pathLength ? pathLength + 1 : 0; // include the '/'
+    
+    for( i = 0; i < numMatches; i++ )
+    {
+        name = pak->buildBuffer[matches[i]].name;
+        
+        // check for extension match
+        length = strlen( name );
+        if( length < extensionLength || Q_stricmp( name + length - extensionLength, extension ) )
+        {
+            continue;
+        }
+        
+        // unique the match
+        nfiles = FS_AddUniqueFile( name + skip, list, nfiles, unique );
+    }
+    
+    Z_Free( matches );
+    
+    return nfiles;
+}
+
+/*
+==================
+idFileSystemLocal::FreeListCache
+==================
+*/
+void idFileSystemLocal::FreeListCache( void )
+{
+    S32 i;
+    
+    for( i = 0; i < FS_LIST_CACHE_SIZE; i++ )
+    {
+        FS_FreeCachedList( &fs_listCache[i] );
+    }
+}
+
+/*
+===============
+idFileSystemLocal::ListFilteredFiles
+
+Returns a uniqued list of files that match the given criteria
+from all search paths
+===============
+*/
+UTF8** idFileSystemLocal::ListFilteredFiles( StringEntry path, StringEntry extension, UTF8* filter, S32* numfiles )
+{
+    S32 nfiles, i, pathLength, pathDepth;
+    UTF8** listCopy, *list[MAX_FOUND_FILES];
+    S16 unique[FS_LIST_HASH_SIZE];
+    fsListCacheEntry_t* entry;
+    searchpath_t* search;
+    pack_t* pak;
+    fileInPack_t* buildBuffer;
+    UTF8 zpath[MAX_ZPATH];
+    bool cacheable;
+    
+    if( !fs_searchpaths )
+    {
+        Com_Error( ERR_FATAL, "idFileSystemLocal::ListFilteredFiles: Filesystem call made without initialization\n" );
+    }
+    
+    if( !path )
+    {
+        *numfiles = 0;
+        return NULL;
+    }
+    
+    if( !extension )
+    {
+        extension = "";
+    }
+    
+    // the same listings are asked for over and over, remember them until a
+    // file is written or the search path changes
+    cacheable = strlen( path ) < MAX_QPATH && strlen( extension ) < MAX_QPATH && ( !filter || strlen( filter ) < MAX_QPATH );
+    if( cacheable )
+    {
+        for( i = 0; i < FS_LIST_CACHE_SIZE; i++ )
+        {
+            entry = &fs_listCache[i];
+            if( entry->generation && entry->generation == fsIndex.dirGeneration && entry->filtered == ( filter != NULL ) &&
+                    !strcmp( entry->path, path ) && !strcmp( entry->extension, extension ) && ( !filter || !strcmp( entry->filter, filter ) ) )
+            {
+                fsIndex.listHits++;
+                *numfiles = entry->numFiles;
+                return FS_CopyFileList( entry->files, entry->numFiles );
+            }
+        }
+        fsIndex.listMisses++;
+    }
+    
+    pathLength = strlen( path );
+    
+    if( path[pathLength - 1] == '\\' || path[pathLength - 1] == '/' )
+    {
+        pathLength--;
+    }
+    
+    nfiles = 0;
+    ::memset( unique, 0, sizeof( unique ) );
+    ReturnPath( path, zpath, &pathDepth );
+    
+    // search through the path, one element at a time, adding to list
+    for( search = fs_searchpaths ; search ; search = search->next )
+    {
+        // is the element a pak file?
+        if( search->pack )
+        {
+            //ZOID:  If we are pure, don't search for files on paks that
+            // aren't on the pure list
+            if( !PakIsPure( search->pack ) )
+            {
+                continue;
+            }
+            
+            pak = search->pack;
+            
+            // only the directories under path are looked at
+            if( !filter )
+            {
+                nfiles = ListPackDir( pak, path, pathLength, pathDepth, extension, list, nfiles, unique );
+                continue;
+            }
+            
+            // look through all the pak file elements
+            buildBuffer = pak->buildBuffer;
+            for( i = 0; i < pak->numfiles; i++ )
+            {
+                // case insensitive
+                if( !Com_FilterPath( filter, buildBuffer[i].name, false ) )
+                {
+                    continue;
+                }
+                // unique the match
+                nfiles = FS_AddUniqueFile( buildBuffer[i].name, list, nfiles, unique );
+            }
+        }
+        else if( search->dir ) // scan for files in the filesystem
+        {
+            UTF8* netpath;
+            S32 numSysFiles;
+            UTF8** sysFiles;
+            UTF8* name;
+            
+            // don't scan directories for files if we are pure or restricted
+            if( fs_numServerPaks )
+            {
+                continue;
+            }
+            else if( fs_restrict->integer && ( !com_gameInfo.usesProfiles || ( com_gameInfo.usesProfiles && Q_stricmpn( path, "profiles", 8 ) ) ) &&
+                     Q_stricmpn( path, "demos", 5 ) )
+            {
+                continue;
+            }
+            else
+            {
+                netpath = BuildOSPath( search->dir->path, search->dir->gamedir, path );
+                sysFiles = Sys_ListFiles( netpath, extension, filter, &numSysFiles, false );
+                
+                for( i = 0 ; i < numSysFiles ; i++ )
+                {
+                    // unique the match
+                    name = sysFiles[i];
+                    nfiles = FS_AddUniqueFile( name, list, nfiles, unique );
+                }
+                
+                Sys_FreeFileList( sysFiles );
+            }
+        }
+    }
+    
+    // return a copy of the list
+    *numfiles = nfiles;
+    
+    if( cacheable )
+    {
+        entry = &fs_listCache[fs_listCacheNext];
+        fs_listCacheNext = ( fs_listCacheNext + 1 ) % FS_LIST_CACHE_SIZE;
+        
+        FS_FreeCachedList( entry );
+        entry->generation = fsIndex.dirGeneration;
+        Q_strncpyz( entry->path, path, sizeof( entry->path ) );
+        Q_strncpyz( entry->extension, extension, sizeof( entry->extension ) );
+        Q_strncpyz( entry->filter, filter ? filter : "", sizeof( entry->filter ) );
+        entry->filtered = ( filter != NULL );
+        entry->numFiles = nfiles;
+        entry->files = FS_CopyFileList( list, nfiles );
+    }
+    
+    if( !nfiles )
+    {
+        return NULL;
+    }
+    
+    listCopy = ( UTF8** )Z_Malloc( ( nfiles + 1 ) * sizeof( *listCopy ) );
+    
+    for( i = 0 ; i < nfiles ; i++ )
+    {
+        listCopy[i] = list[i];
+    }
+    listCopy[i] = NULL;
+    
+    return listCopy;
+}
+
+/*
+=================
+idFileSystemLocal::ListFiles
+=================
+*/
+UTF8** idFileSystemLocal::ListFiles( StringEntry path, StringEntry extension, S32* numfiles )
+{
+    return ListFilteredFiles( path, extension, NULL, numfiles );
+}
+
+/*
+=================
+idFileSystemLocal::FreeFileList
+=================
+*/
+void idFileSystemLocal::FreeFileList( UTF8** list )
+{
+    S32 i;
+    
+    if( !fs_searchpaths )
+    {
+        Com_Error( ERR_FATAL, "idFileSystemLocal::FreeFileList: Filesystem call made without initialization\n" );
+    }
+    
+    if( !list )
+    {
+        return;
+    }
+    
+    for( i = 0 ; list[i] ; i++ )
+    {
+        Z_Free( list[i] );
+    }
+    
+    Z_Free( list );
+}
+
+/*
+================
+idFileSystemLocal::GetFileList
+================
+*/
+S32 idFileSystemLocal::GetFileList( StringEntry path, StringEntry extension, UTF8* listbuf, S32 bufsize )
+{
+    S32 nFiles, i, nTotal, nLen;
+    UTF8** pFiles = NULL;
+    
+    *listbuf = 0;
+    nFiles = 0;
+    nTotal = 0;
+    
+    if( Q_stricmp( path, "$modlist" ) == 0 )
+    {
+        return GetModList( listbuf, bufsize );
+    }
+    
+    pFiles = ListFiles( path, extension, &nFiles );
+    
+    for( i = 0; i < nFiles; i++ )
+    {
+        nLen = strlen( pFiles[i] ) + 1;
+        
+        if( nTotal + nLen + 1 < bufsize )
+        {
+            strcpy( listbuf, pFiles[i] );
+            listbuf += nLen;
+            nTotal += nLen;
+        }
+        else
+        {
+            nFiles = i;
+            break;
+        }
+    }
+    
+    FreeFileList( pFiles );
+    
+    return nFiles;
+}
+
+/*
+=======================
+idFileSystemLocal::ConcatenateFileLists
+
+mkv: Naive implementation. Concatenates three lists into a
+new list, and frees the old lists from the heap.
+bk001129 - from cvs1.17 (mkv)
+
+FIXME TTimo those two should move to common.c next to Sys_ListFiles
+=======================
+*/
+U32 idFileSystemLocal::CountFileList( UTF8** list )
+{
+    S32 i = 0;
+    
+    if( list )
+    {
+        while( *list )
+        {
+            list++;
+            i++;
+        }
+    }
+    return i;
+}
+
+/*
+=======================
+idFileSystemLocal::ConcatenateFileLists
+=======================
+*/
+UTF8** idFileSystemLocal::ConcatenateFileLists( UTF8** list0, UTF8** list1, UTF8** list2 )
+{
+    S32 totalLength = 0;
+    UTF8** cat = NULL, **dst, **src;
+    
+    totalLength += CountFileList( list0 );
+    totalLength += CountFileList( list1 );
+    totalLength += CountFileList( list2 );
+    
+    /* Create new list. */
+    dst = cat = ( UTF8** )Z_Malloc( ( totalLength + 1 ) * sizeof( UTF8* ) );
+    
+    /* Copy over lists. */
+    if( list0 )
+    {
+        for( src = list0; *src; src++, dst++ )
+        {
+            *dst = *src;
+        }
+    }
+    
+    if( list1 )
+    {
+        for( src = list1; *src; src++, dst++ )
+        {
+            *dst = *src;
+        }
+    }
+    
+    if( list2 )
+    {
+        for( src = list2; *src; src++, dst++ )
+        {
+            *dst = *src;
+        }
+    }
+    
+    // Terminate the list
+    *dst = NULL;
+    
+    // Free our old lists.
+    // NOTE: not freeing their content, it's been merged in dst and still being used
+    if( list0 )
+    {
+        Z_Free( list0 );
+    }
+    
+    if( list1 )
+    {
+        Z_Free( list1 );
+    }
+    
+    if( list2 )
+    {
+        Z_Free( list2 );
+    }
+    
+    return cat;
+}
+
+/*
+================
+idFileSystemLocal::GetModList
+
+Returns a list of mod directory names
 A mod directory is a peer to baseq3 with a pk3 in it
 The directories are searched in base path, cd path and home path
 ================
@@ -3094,164 +5078,741 @@ void idFileSystemLocal::Dir_f( void )
     }
     else
     {
-        path = Cmd_Argv( 1 );
-        extension = Cmd_Argv( 2 );
+        path = Cmd_Argv( 1 );
+        extension = Cmd_Argv( 2 );
+    }
+    
+    Com_Printf( "Directory of %s %s\n", path, extension );
+    Com_Printf( "---------------\n" );
+    
+    dirnames = fileSystemLocal.ListFiles( path, extension, &ndirs );
+    
+    for( i = 0; i < ndirs; i++ )
+    {
+        Com_Printf( "%s\n", dirnames[i] );
+    }
+    
+    fileSystemLocal.FreeFileList( dirnames );
+}
+
+/*
+===========
+idFileSystemLocal::ConvertPath
+===========
+*/
+void idFileSystemLocal::ConvertPath( UTF8* s )
+{
+    while( *s )
+    {
+        if( *s == '\\' || *s == ':' )
+        {
+            *s = '/';
+        }
+        s++;
+    }
+}
+
+/*
+===========
+idFileSystemLocal::PathCmp
+
+Ignore case and seprator UTF8 distinctions
+===========
+*/
+S32 idFileSystemLocal::PathCmp( StringEntry s1, StringEntry s2 )
+{
+    S32 c1, c2;
+    
+    do
+    {
+        c1 = *s1++;
+        c2 = *s2++;
+        
+        if( c1 >= 'a' && c1 <= 'z' )
+        {
+            c1 -= ( 'a' - 'A' );
+        }
+        
+        if( c2 >= 'a' && c2 <= 'z' )
+        {
+            c2 -= ( 'a' - 'A' );
+        }
+        
+        if( c1 == '\\' || c1 == ':' )
+        {
+            c1 = '/';
+        }
+        
+        if( c2 == '\\' || c2 == ':' )
+        {
+            c2 = '/';
+        }
+        
+        if( c1 < c2 )
+        {
+            return -1; // strings not equal
+        }
+        
+        if( c1 > c2 )
+        {
+            return 1;
+        }
+    }
+    while( c1 );
+    
+    return 0; // strings are equal
+}
+
+/*
+================
+idFileSystemLocal::SortFileList
+================
+*/
+void idFileSystemLocal::SortFileList( UTF8** filelist, S32 numfiles )
+{
+    S32 i, j, k, width, mid, end;
+    UTF8** sortedlist, **from, **to, **swap;
+    
+    if( numfiles < 2 )
+    {
+        return;
+    }
+    
+    // bottom up merge sort, stable like the insertion sort it replaced
+    sortedlist = ( UTF8** )Z_Malloc( numfiles * sizeof( *sortedlist ) );
+    from = filelist;
+    to = sortedlist;
+    
+    for( width = 1; width < numfiles; width <<= 1 )
+    {
+        for( i = 0; i < numfiles; i += 2 * width )
+        {
+            mid = i + width < numfiles ? i + width : numfiles;
+            end = i + 2 * width < numfiles ? i + 2 * width : numfiles;
+            
+            for( j = i, k = mid; j < mid || k < end; )
+            {
+                if( j < mid && ( k == end || PathCmp( from[k], from[j] ) >= 0 ) )
+                {
+                    to[j + k - mid] = from[j];
+                    j++;
+                }
+                else
+                {
+                    to[j + k - mid] = from[k];
+                    k++;
+                }
+            }
+        }
+        
+        swap = from;
+        from = to;
+        to = swap;
+    }
+    
+    if( from != filelist )
+    {
+        ::memcpy( filelist, from, numfiles * sizeof( *filelist ) );
+    }
+    Z_Free( sortedlist );
+}
+
+/*
+================
+idFileSystemLocal::NewDir_f
+================
+*/
+void idFileSystemLocal::NewDir_f( void )
+{
+    UTF8* filter;
+    UTF8** dirnames;
+    S32 ndirs;
+    S32 i;
+    
+    if( Cmd_Argc() < 2 )
+    {
+        Com_Printf( "usage: fdir <filter>\n" );
+        Com_Printf( "example: fdir *q3dm*.world\n" );
+        return;
     }
     
-    Com_Printf( "Directory of %s %s\n", path, extension );
+    filter = Cmd_Argv( 1 );
+    
     Com_Printf( "---------------\n" );
     
-    dirnames = fileSystemLocal.ListFiles( path, extension, &ndirs );
+    dirnames = fileSystemLocal.ListFilteredFiles( "", "", filter, &ndirs );
+    
+    fileSystemLocal.SortFileList( dirnames, ndirs );
     
     for( i = 0; i < ndirs; i++ )
     {
+        fileSystemLocal.ConvertPath( dirnames[i] );
         Com_Printf( "%s\n", dirnames[i] );
     }
     
+    Com_Printf( "%d files listed\n", ndirs );
+    
     fileSystemLocal.FreeFileList( dirnames );
 }
 
 /*
-===========
-idFileSystemLocal::ConvertPath
-===========
-*/
-void idFileSystemLocal::ConvertPath( UTF8* s )
-{
-    while( *s )
-    {
-        if( *s == '\\' || *s == ':' )
-        {
-            *s = '/';
-        }
-        s++;
-    }
-}
-
-/*
-===========
-idFileSystemLocal::PathCmp
+============
+FS_StressThread
 
-Ignore case and seprator UTF8 distinctions
-===========
+Reads and checks files of a fs_stress run until there are none left,
+using nothing but the thread safe parts of the file system
+============
 */
-S32 idFileSystemLocal::PathCmp( StringEntry s1, StringEntry s2 )
+static S32 FS_StressThread( void* arg )
 {
-    S32 c1, c2;
+    fsStress_t* stress = ( fsStress_t* )arg;
+    unz_file_info64 info;
+    fileInPack_t* pakFile;
+    fileHandle_t h;
+    pack_t* pak;
+    unzFile z;
+    U8 buf[16384];
+    uLong crc;
+    S64 total;
+    S32 i, r;
     
-    do
+    while( ( i = SDL_AtomicAdd( &stress->next, 1 ) ) < stress->numFiles )
     {
-        c1 = *s1++;
-        c2 = *s2++;
+        pak = stress->paks[i];
+        pakFile = stress->files[i];
         
-        if( c1 >= 'a' && c1 <= 'z' )
+        z = fileSystemLocal.AcquirePackHandle( pak );
+        if( !z )
         {
-            c1 -= ( 'a' - 'A' );
+            SDL_AtomicIncRef( &stress->errors );
+            continue;
         }
         
-        if( c2 >= 'a' && c2 <= 'z' )
+        h = fileSystemLocal.HandleForFile();
+        fsh[h].handleFiles.file.z = z;
+        fsh[h].handleFiles.unique = true;
+        fsh[h].zipFile = true;
+        fsh[h].pak = pak;
+        fsh[h].zipFilePos = pakFile->pos;
+        
+        if( unzSetOffset( z, pakFile->pos ) != UNZ_OK || unzGetCurrentFileInfo64( z, &info, NULL, 0, NULL, 0, NULL, 0 ) != UNZ_OK ||
+                unzOpenCurrentFileAt( z, pakFile->dataPos ) != UNZ_OK )
         {
-            c2 -= ( 'a' - 'A' );
+            SDL_AtomicIncRef( &stress->errors );
+            fileSystemLocal.FCloseFile( h );
+            continue;
         }
         
-        if( c1 == '\\' || c1 == ':' )
+        crc = crc32( 0, NULL, 0 );
+        total = 0;
+        while( ( r = fileSystemLocal.Read( buf, sizeof( buf ), h ) ) > 0 )
         {
-            c1 = '/';
+            crc = crc32( crc, buf, r );
+            total += r;
         }
         
-        if( c2 == '\\' || c2 == ':' )
+        if( r < 0 || total != ( S64 )info.uncompressed_size || crc != info.crc )
         {
-            c2 = '/';
+            SDL_AtomicIncRef( &stress->errors );
         }
+        SDL_AtomicAdd( &stress->kbytes, ( S32 )( total >> 10 ) );
         
-        if( c1 < c2 )
+        fileSystemLocal.FCloseFile( h );
+    }
+    
+    return 0;
+}
+
+/*
+============
+idFileSystemLocal::Stress_f
+
+Reads pk3 files from several threads at once and checks them against
+their crc, for testing the handle table and the pack handle pools
+============
+*/
+void idFileSystemLocal::Stress_f( void )
+{
+    SDL_Thread* threads[MAX_STRESS_THREADS];
+    searchpath_t* search;
+    fsStress_t stress;
+    S32 i, j, numThreads, numStarted, handlesBefore, handlesAfter;
+    S64 start, usec;
+    
+    if( Cmd_Argc() > 3 )
+    {
+        Com_Printf( "usage: fs_stress [threads] [files]\n" );
+        return;
+    }
+    
+    numThreads = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : SDL_GetCPUCount();
+    numThreads = numThreads < 1 ? 1 : numThreads > MAX_STRESS_THREADS ? MAX_STRESS_THREADS : numThreads;
+    
+    ::memset( &stress, 0, sizeof( stress ) );
+    stress.numFiles = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 4096;
+    if( stress.numFiles < 1 )
+    {
+        stress.numFiles = 1;
+    }
+    
+    // every file of every pk3, repeated until there are enough
+    stress.paks = ( pack_t** )Z_Malloc( stress.numFiles * sizeof( *stress.paks ) );
+    stress.files = ( fileInPack_t** )Z_Malloc( stress.numFiles * sizeof( *stress.files ) );
+    for( i = 0; i < stress.numFiles; )
+    {
+        for( search = fs_searchpaths; search && i < stress.numFiles; search = search->next )
         {
-            return -1; // strings not equal
+            if( !search->pack || search->pack->bundle )
+            {
+                continue;
+            }
+            
+            for( j = 0; j < search->pack->numfiles && i < stress.numFiles; j++, i++ )
+            {
+                stress.paks[i] = search->pack;
+                stress.files[i] = &search->pack->buildBuffer[j];
+            }
         }
         
-        if( c1 > c2 )
+        if( !i )
         {
-            return 1;
+            break;
         }
     }
-    while( c1 );
     
-    return 0; // strings are equal
+    if( !i )
+    {
+        Com_Printf( "no pk3 files to read\n" );
+        Z_Free( stress.paks );
+        Z_Free( stress.files );
+        return;
+    }
+    
+    handlesBefore = 0;
+    for( i = 1; i < MAX_FILE_HANDLES; i++ )
+    {
+        handlesBefore += SDL_AtomicGet( &fs_handleUsed[i] );
+    }
+    
+    start = Sys_Microseconds();
+    
+    for( numStarted = 0; numStarted < numThreads; numStarted++ )
+    {
+        threads[numStarted] = SDL_CreateThread( FS_StressThread, "fsStress", &stress );
+        if( !threads[numStarted] )
+        {
+            Com_Printf( S_COLOR_YELLOW "WARNING: couldn't create thread: %s\n", SDL_GetError() );
+            break;
+        }
+    }
+    
+    // help out, and make sure the files get read even without threads
+    FS_StressThread( &stress );
+    
+    for( i = 0; i < numStarted; i++ )
+    {
+        SDL_WaitThread( threads[i], NULL );
+    }
+    
+    usec = Sys_Microseconds() - start;
+    
+    handlesAfter = 0;
+    for( i = 1; i < MAX_FILE_HANDLES; i++ )
+    {
+        handlesAfter += SDL_AtomicGet( &fs_handleUsed[i] );
+    }
+    
+    Com_Printf( "%i files, %.1f MB in %.1f ms with %i threads, %i errors\n", stress.numFiles, SDL_AtomicGet( &stress.kbytes ) / 1024.0f,
+                usec / 1000.0f, numStarted + 1, SDL_AtomicGet( &stress.errors ) );
+    
+    if( handlesAfter != handlesBefore )
+    {
+        Com_Printf( S_COLOR_RED "%i file handles in use before, %i after\n", handlesBefore, handlesAfter );
+    }
+    
+    Z_Free( stress.paks );
+    Z_Free( stress.files );
 }
 
 /*
-================
-idFileSystemLocal::SortFileList
-================
+============
+idFileSystemLocal::ReadBench_f
+
+Reads every file a listing gives, by default the maps a map load would
+read, once through the streaming unzip path and once with InflateFile
+============
 */
-void idFileSystemLocal::SortFileList( UTF8** filelist, S32 numfiles )
+void idFileSystemLocal::ReadBench_f( void )
 {
-    S32 i, j, k, numsortedfiles;
-    UTF8** sortedlist;
+    UTF8** files;
+    StringEntry path, extension;
+    fileHandle_t h;
+    U8* streamed, *whole;
+    S32 i, pass, len, numFiles, numRead[2], numMismatched;
+    S64 start, usec[2], bytes[2];
+    bool read[2];
+    
+    if( Cmd_Argc() > 3 )
+    {
+        Com_Printf( "usage: fs_readBench [path] [extension]\n" );
+        return;
+    }
+    
+    path = Cmd_Argc() > 1 ? Cmd_Argv( 1 ) : "maps";
+    extension = Cmd_Argc() > 2 ? Cmd_Argv( 2 ) : "bsp";
+    
+    files = fileSystemLocal.ListFiles( path, extension, &numFiles );
     
-    sortedlist = ( UTF8** )Z_Malloc( ( numfiles + 1 ) * sizeof( *sortedlist ) );
-    sortedlist[0] = NULL;
-    numsortedfiles = 0;
+    numMismatched = 0;
+    for( pass = 0; pass < 2; pass++ )
+    {
+        usec[pass] = 0;
+        bytes[pass] = 0;
+        numRead[pass] = 0;
+    }
     
-    for( i = 0; i < numfiles; i++ )
+    for( i = 0; i < numFiles; i++ )
     {
-        for( j = 0; j < numsortedfiles; j++ )
+        len = fileSystemLocal.FOpenFileRead( va( "%s/%s", path, files[i] ), &h, false );
+        if( !h )
+        {
+            continue;
+        }
+        fileSystemLocal.FCloseFile( h );
+        
+        streamed = ( U8* )Hunk_AllocateTempMemory( len + 1 );
+        whole = ( U8* )Hunk_AllocateTempMemory( len + 1 );
+        
+        for( pass = 0; pass < 2; pass++ )
         {
-            if( PathCmp( filelist[i], sortedlist[j] ) < 0 )
+            fileSystemLocal.FOpenFileRead( va( "%s/%s", path, files[i] ), &h, false );
+            
+            start = Sys_Microseconds();
+            read[pass] = ( pass == 0 ? fileSystemLocal.Read( streamed, len, h ) == len : fileSystemLocal.InflateFile( h, whole, len ) );
+            if( read[pass] )
             {
-                break;
+                usec[pass] += Sys_Microseconds() - start;
+                bytes[pass] += len;
+                numRead[pass]++;
             }
+            
+            fileSystemLocal.FCloseFile( h );
         }
         
-        for( k = numsortedfiles; k > j; k-- )
+        if( read[0] && read[1] && ::memcmp( streamed, whole, len ) )
         {
-            sortedlist[k] = sortedlist[k - 1];
+            numMismatched++;
         }
         
-        sortedlist[j] = filelist[i];
-        numsortedfiles++;
+        Hunk_FreeTempMemory( whole );
+        Hunk_FreeTempMemory( streamed );
     }
     
-    ::memcpy( filelist, sortedlist, numfiles * sizeof( *filelist ) );
-    Z_Free( sortedlist );
+    fileSystemLocal.FreeFileList( files );
+    
+    Com_Printf( "streaming: %i files, %.1f MB in %.1f ms\n", numRead[0], bytes[0] / ( 1024.0f * 1024.0f ), usec[0] / 1000.0f );
+    Com_Printf( "whole file: %i files, %.1f MB in %.1f ms\n", numRead[1], bytes[1] / ( 1024.0f * 1024.0f ), usec[1] / 1000.0f );
+    Com_Printf( "%i files are only read by streaming, %i differ\n", numRead[0] - numRead[1], numMismatched );
 }
 
 /*
-================
-idFileSystemLocal::NewDir_f
-================
+============
+FS_SortBundleEntries
+============
 */
-void idFileSystemLocal::NewDir_f( void )
+static bundleEntry_t* fs_sortBundle;
+static UTF8* fs_sortBundleNames;
+
+static S32 FS_SortBundleEntries( const void* a, const void* b )
 {
-    UTF8* filter;
-    UTF8** dirnames;
-    S32 ndirs;
-    S32 i;
+    const bundleEntry_t* ea = &fs_sortBundle[*( const S32* )a];
+    const bundleEntry_t* eb = &fs_sortBundle[*( const S32* )b];
     
-    if( Cmd_Argc() < 2 )
+    if( ea->hash != eb->hash )
     {
-        Com_Printf( "usage: fdir <filter>\n" );
-        Com_Printf( "example: fdir *q3dm*.world\n" );
+        return ea->hash < eb->hash ? -1 : 1;
+    }
+    
+    return strcmp( fs_sortBundleNames + ea->name, fs_sortBundleNames + eb->name );
+}
+
+/*
+============
+idFileSystemLocal::MakeBundle_f
+
+Converts a loaded pk3 into a .owb bundle in the home game directory.  Files
+are deflated when that saves at least an eighth, stored ones of a page or
+more start on a page, and files with the same contents are only stored once.
+The crcs of the pk3 go into the manifest, so the bundle can replace the pk3
+on a pure server.
+============
+*/
+#define BUNDLE_DEDUP_HASH 1024
+
+void idFileSystemLocal::MakeBundle_f( void )
+{
+    static const U8 zeros[BUNDLE_ALIGN] = { 0 };
+    searchpath_t* search;
+    pack_t* pak;
+    fileInPack_t* pakFile;
+    bundleHeader_t header;
+    bundleEntry_t* entries, *entry, *other, swapped;
+    S32* checksums, *sums, *order, *dedupNext;
+    S32 dedupHash[BUNDLE_DEDUP_HASH];
+    UTF8* names;
+    U8* data, *packed;
+    z_stream stream;
+    unzFile z;
+    fileHandle_t f;
+    S32 i, j, numChecksums, namesSize, numDeflated, numShared, packedLen, checksum;
+    S64 pos, sharedBytes;
+    bool ok;
+    
+    if( Cmd_Argc() != 2 )
+    {
+        Com_Printf( "usage: fs_makeBundle <pk3 name>\n" );
+        return;
+    }
+    
+    pak = NULL;
+    for( search = fs_searchpaths; search; search = search->next )
+    {
+        if( search->pack && !search->pack->bundle && !Q_stricmp( search->pack->pakBasename, Cmd_Argv( 1 ) ) )
+        {
+            pak = search->pack;
+            break;
+        }
+    }
+    
+    if( !pak )
+    {
+        Com_Printf( "%s.pk3 isn't loaded\n", Cmd_Argv( 1 ) );
+        return;
+    }
+    
+    z = fileSystemLocal.AcquirePackHandle( pak );
+    if( !z )
+    {
+        Com_Printf( "couldn't open %s\n", pak->pakFilename );
         return;
     }
     
-    filter = Cmd_Argv( 1 );
-    
-    Com_Printf( "---------------\n" );
-    
-    dirnames = fileSystemLocal.ListFilteredFiles( "", "", filter, &ndirs );
+    f = fileSystemLocal.FOpenFileWrite( va( "%s.owb", pak->pakBasename ) );
+    if( !f )
+    {
+        Com_Printf( "couldn't write %s.owb\n", pak->pakBasename );
+        fileSystemLocal.ReleasePackHandle( pak, z );
+        return;
+    }
+    
+    namesSize = 0;
+    for( i = 0; i < pak->numfiles; i++ )
+    {
+        namesSize += strlen( pak->buildBuffer[i].name ) + 1;
+    }
+    
+    entries = ( bundleEntry_t* )Z_Malloc( pak->numfiles * sizeof( *entries ) + 1 );
+    checksums = ( S32* )Z_Malloc( pak->numfiles * sizeof( *checksums ) + 1 );
+    sums = ( S32* )Z_Malloc( pak->numfiles * sizeof( *sums ) + 1 );
+    order = ( S32* )Z_Malloc( pak->numfiles * sizeof( *order ) + 1 );
+    dedupNext = ( S32* )Z_Malloc( pak->numfiles * sizeof( *dedupNext ) + 1 );
+    names = ( UTF8* )Z_Malloc( namesSize + 1 );
+    
+    for( i = 0; i < BUNDLE_DEDUP_HASH; i++ )
+    {
+        dedupHash[i] = -1;
+    }
+    
+    // the header is written again at the end, when the directory is known
+    ::memset( &header, 0, sizeof( header ) );
+    fileSystemLocal.Write( &header, sizeof( header ), f );
+    
+    pos = sizeof( header );
+    namesSize = 0;
+    numChecksums = 0;
+    numDeflated = 0;
+    numShared = 0;
+    sharedBytes = 0;
+    ok = true;
+    
+    // the pk3 order, so the manifest has the crcs in the order of the checksums
+    for( i = 0; i < pak->numfiles && ok; i++ )
+    {
+        pakFile = &pak->buildBuffer[i];
+        entry = &entries[i];
+        order[i] = i;
+        
+        entry->name = namesSize;
+        strcpy( names + namesSize, pakFile->name );
+        namesSize += strlen( pakFile->name ) + 1;
+        entry->hash = FS_BundleHash( pakFile->name );
+        entry->size = ( S32 )pakFile->len;
+        
+        data = ( U8* )Hunk_AllocateTempMemory( entry->size + 1 );
+        if( unzSetOffset( z, pakFile->pos ) != UNZ_OK || unzOpenCurrentFile( z ) != UNZ_OK )
+        {
+            Com_Printf( "couldn't open %s in %s\n", pakFile->name, pak->pakFilename );
+            Hunk_FreeTempMemory( data );
+            ok = false;
+            break;
+        }
+        
+        // closing checks the crc of what was read
+        ok = unzReadCurrentFile( z, data, entry->size ) == entry->size;
+        ok = ( unzCloseCurrentFile( z ) == UNZ_OK ) && ok;
+        if( !ok )
+        {
+            Com_Printf( "couldn't read %s from %s\n", pakFile->name, pak->pakFilename );
+            Hunk_FreeTempMemory( data );
+            break;
+        }
+        
+        entry->crc = crc32( crc32( 0, NULL, 0 ), data, entry->size );
+        if( entry->size > 0 )
+        {
+            checksums[numChecksums++] = LittleLong( entry->crc );
+        }
+        sums[i] = Com_BlockChecksum( data, entry->size );
+        
+        // share the payload of an earlier file with the same contents
+        for( j = dedupHash[entry->crc & ( BUNDLE_DEDUP_HASH - 1 )]; j >= 0; j = dedupNext[j] )
+        {
+            other = &entries[j];
+            if( other->crc == entry->crc && other->size == entry->size && sums[j] == sums[i] )
+            {
+                break;
+            }
+        }
+        
+        if( j >= 0 )
+        {
+            entry->offset = entries[j].offset;
+            entry->storedSize = entries[j].storedSize;
+            entry->compression = entries[j].compression;
+            numShared++;
+            sharedBytes += entry->storedSize;
+            Hunk_FreeTempMemory( data );
+            continue;
+        }
+        
+        dedupNext[i] = dedupHash[entry->crc & ( BUNDLE_DEDUP_HASH - 1 )];
+        dedupHash[entry->crc & ( BUNDLE_DEDUP_HASH - 1 )] = i;
+        
+        packed = NULL;
+        packedLen = 0;
+        if( entry->size > 0 )
+        {
+            ::memset( &stream, 0, sizeof( stream ) );
+            if( deflateInit2( &stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 9, Z_DEFAULT_STRATEGY ) == Z_OK )
+            {
+                packedLen = deflateBound( &stream, entry->size );
+                packed = ( U8* )Hunk_AllocateTempMemory( packedLen );
+                
+                stream.next_in = data;
+                stream.avail_in = entry->size;
+                stream.next_out = packed;
+                stream.avail_out = packedLen;
+                
+                packedLen = deflate( &stream, Z_FINISH ) == Z_STREAM_END ? ( S32 )stream.total_out : entry->size;
+                deflateEnd( &stream );
+            }
+        }
+        
+        if( packed && packedLen < entry->size - entry->size / 8 )
+        {
+            entry->compression = BUNDLE_DEFLATE;
+            entry->storedSize = packedLen;
+            numDeflated++;
+        }
+        else
+        {
+            entry->compression = BUNDLE_STORED;
+            entry->storedSize = entry->size;
+            
+            // so ReadFile can map it
+            if( entry->size >= BUNDLE_ALIGN && ( pos & ( BUNDLE_ALIGN - 1 ) ) )
+            {
+                fileSystemLocal.Write( zeros, BUNDLE_ALIGN - ( pos & ( BUNDLE_ALIGN - 1 ) ), f );
+                pos += BUNDLE_ALIGN - ( pos & ( BUNDLE_ALIGN - 1 ) );
+            }
+        }
+        
+        if( pos + entry->storedSize > 0x7fffffff )
+        {
+            Com_Printf( "%s is too big for a bundle\n", pak->pakFilename );
+            ok = false;
+        }
+        else
+        {
+            entry->offset = ( S32 )pos;
+            ok = fileSystemLocal.Write( entry->compression == BUNDLE_DEFLATE ? packed : data, entry->storedSize, f ) == entry->storedSize;
+            pos += entry->storedSize;
+        }
+        
+        if( packed )
+        {
+            Hunk_FreeTempMemory( packed );
+        }
+        Hunk_FreeTempMemory( data );
+    }
+    
+    if( ok && pos + pak->numfiles * sizeof( bundleEntry_t ) + numChecksums * sizeof( S32 ) + namesSize <= 0x7fffffff )
+    {
+        fs_sortBundle = entries;
+        fs_sortBundleNames = names;
+        qsort( order, pak->numfiles, sizeof( *order ), FS_SortBundleEntries );
+        
+        for( i = 0; i < pak->numfiles; i++ )
+        {
+            swapped = entries[order[i]];
+            FS_SwapBundleEntry( &swapped );
+            fileSystemLocal.Write( &swapped, sizeof( swapped ), f );
+        }
+        fileSystemLocal.Write( checksums, numChecksums * sizeof( S32 ), f );
+        fileSystemLocal.Write( names, namesSize, f );
+        
+        header.ident = BUNDLE_IDENT;
+        header.version = BUNDLE_VERSION;
+        header.numFiles = pak->numfiles;
+        header.numChecksums = numChecksums;
+        header.namesSize = namesSize;
+        header.dirOffset = ( S32 )pos;
+        FS_SwapBundleHeader( &header );
+        
+        fileSystemLocal.Seek( f, 0, FS_SEEK_SET );
+        fileSystemLocal.Write( &header, sizeof( header ), f );
+    }
+    else
+    {
+        ok = false;
+    }
     
-    fileSystemLocal.SortFileList( dirnames, ndirs );
+    fileSystemLocal.FCloseFile( f );
+    fileSystemLocal.ReleasePackHandle( pak, z );
     
-    for( i = 0; i < ndirs; i++ )
+    if( ok )
     {
-        fileSystemLocal.ConvertPath( dirnames[i] );
-        Com_Printf( "%s\n", dirnames[i] );
+        checksum = LittleLong( Com_BlockChecksum( checksums, numChecksums * sizeof( S32 ) ) );
+        
+        Com_Printf( "wrote %s.owb: %i files, %i deflated, %i sharing %i KB with others, %i KB\n", pak->pakBasename, pak->numfiles,
+                    numDeflated, numShared, ( S32 )( sharedBytes >> 10 ), ( S32 )( ( pos + pak->numfiles * sizeof( bundleEntry_t ) ) >> 10 ) );
+        if( checksum != pak->checksum )
+        {
+            Com_Printf( S_COLOR_YELLOW "WARNING: the bundle checksum %i doesn't match the pk3 checksum %i\n", checksum, pak->checksum );
+        }
+        Com_Printf( "it replaces %s once the pk3 is removed\n", pak->pakFilename );
+    }
+    else
+    {
+        fileSystemLocal.HomeRemove( va( "%s.owb", pak->pakBasename ) );
     }
     
-    Com_Printf( "%d files listed\n", ndirs );
-    
-    fileSystemLocal.FreeFileList( dirnames );
+    Z_Free( names );
+    Z_Free( dedupNext );
+    Z_Free( order );
+    Z_Free( sums );
+    Z_Free( checksums );
+    Z_Free( entries );
 }
 
 /*
@@ -3293,6 +5854,18 @@ void idFileSystemLocal::Path_f( void )
     
     Com_Printf( "\n" );
     
+    if( fsIndex.hashTable )
+    {
+        Com_Printf( "index: %i pk3 files in %i buckets, %i lookups, directory cache %i hits %i misses\n", fsIndex.numEntries,
+                    fsIndex.hashSize, fsIndex.lookups, fsIndex.dirHits, fsIndex.dirMisses );
+        Com_Printf( "listing cache: %i hits %i misses\n", fsIndex.listHits, fsIndex.listMisses );
+        Com_Printf( "\n" );
+    }
+    
+    Com_Printf( "file cache: %i files, %i of %i KB, %i hits, %i misses, %i evicted\n", fs_cache.numEntries, fs_cache.size >> 10,
+                fs_fileCache->integer, fs_cache.hits, fs_cache.misses, fs_cache.evictions );
+    Com_Printf( "\n" );
+    
     for( i = 1 ; i < MAX_FILE_HANDLES ; i++ )
     {
         if( fsh[i].handleFiles.file.o )
@@ -3453,6 +6026,29 @@ bool idFileSystemLocal::IsExt( StringEntry filename, StringEntry ext, S32 namele
 }
 
 
+/*
+================
+FS_FindPakChecksum
+
+The link to the search path entry of a mounted pk3, or of a mounted bundle,
+with the given checksum, NULL if there is none
+================
+*/
+static searchpath_t** FS_FindPakChecksum( S32 checksum, bool bundle )
+{
+    searchpath_t** link;
+    
+    for( link = &fs_searchpaths; *link; link = &( *link )->next )
+    {
+        if( ( *link )->pack && ( *link )->pack->checksum == checksum && ( ( *link )->pack->bundle != NULL ) == bundle )
+        {
+            return link;
+        }
+    }
+    
+    return NULL;
+}
+
 /*
 ================
 idFileSystemLocal::AddGameDirectory
@@ -3463,12 +6059,12 @@ then loads the zip headers
 */
 void idFileSystemLocal::AddGameDirectory( StringEntry path, StringEntry dir )
 {
-    searchpath_t* sp;
+    searchpath_t* sp, **link;
     searchpath_t* search;
     pack_t* pak;
     UTF8 curpath[MAX_OSPATH + 1], *pakfile;
-    S32 numfiles;
-    UTF8** pakfiles;
+    S32 numfiles, numzips, numbundles;
+    UTF8** pakfiles, **zipfiles, **bundlefiles;
     S32 pakfilesi;
     UTF8** pakfilestmp;
     S32 numdirs;
@@ -3477,6 +6073,9 @@ void idFileSystemLocal::AddGameDirectory( StringEntry path, StringEntry dir )
     UTF8** pakdirstmp;
     S32 pakwhich;
     S32 len;
+    fsZipScan_t* scans;
+    S32 i;
+    S64 usec;
     
     // Unique
     for( sp = fs_searchpaths; sp; sp = sp->next )
@@ -3493,8 +6092,20 @@ void idFileSystemLocal::AddGameDirectory( StringEntry path, StringEntry dir )
     Q_strncpyz( curpath, fileSystemLocal.BuildOSPath( path, dir, "" ), sizeof( curpath ) );
     curpath[strlen( curpath ) - 1] = '\0';	// strip the trailing slash
     
-    // Get .pk3 files
-    pakfiles = Sys_ListFiles( curpath, ".pk3", NULL, &numfiles, false );
+    // Get .pk3 files and .owb bundles, they are mounted the same way
+    zipfiles = Sys_ListFiles( curpath, ".pk3", NULL, &numzips, false );
+    bundlefiles = Sys_ListFiles( curpath, ".owb", NULL, &numbundles, false );
+    
+    pakfiles = ( UTF8** )Z_Malloc( ( numzips + numbundles + 1 ) * sizeof( UTF8* ) );
+    numfiles = 0;
+    for( i = 0; i < numzips; i++ )
+    {
+        pakfiles[numfiles++] = zipfiles[i];
+    }
+    for( i = 0; i < numbundles; i++ )
+    {
+        pakfiles[numfiles++] = bundlefiles[i];
+    }
     
     // Get top level directories (we'll filter them later since the Sys_ListFiles filtering is terrible)
     pakdirs = Sys_ListFiles( curpath, "/", NULL, &numdirs, false );
@@ -3508,6 +6119,32 @@ void idFileSystemLocal::AddGameDirectory( StringEntry path, StringEntry dir )
     // Log may not be initialized at this point, but it will still show in the console.
     Com_Printf( "idFileSystemLocal::AddGameDirectory: \"%s\" \"%s\"\n", path, dir );
     
+    // parse all the pk3 files up front on the job workers, they are
+    // mounted below in paksort order so the search path doesn't change
+    scans = NULL;
+    usec = 0;
+    if( numfiles )
+    {
+        scans = ( fsZipScan_t* )Z_Malloc( numfiles * sizeof( *scans ) );
+        
+        for( i = 0; i < numfiles; i++ )
+        {
+            Q_strncpyz( scans[i].zipfile, fileSystemLocal.BuildOSPath( path, dir, pakfiles[i] ), sizeof( scans[i].zipfile ) );
+            Q_strncpyz( scans[i].basename, pakfiles[i], sizeof( scans[i].basename ) );
+            scans[i].bundle = fileSystemLocal.IsExt( pakfiles[i], ".owb", strlen( pakfiles[i] ) );
+            
+            // the zone isn't thread safe, so the handles are opened here
+            if( !scans[i].bundle )
+            {
+                scans[i].handle = unzOpen( scans[i].zipfile );
+            }
+        }
+        
+        usec = Sys_Microseconds();
+        Com_RunJobs( FS_ScanZipJob, scans, numfiles );
+        usec = Sys_Microseconds() - usec;
+    }
+    
     while( ( pakfilesi < numfiles ) || ( pakdirsi < numdirs ) )
     {
         // Check if a pakfile or pakdir comes next
@@ -3533,10 +6170,40 @@ void idFileSystemLocal::AddGameDirectory( StringEntry path, StringEntry dir )
         if( pakwhich )
         {
             // The next .pk3 file is before the next .pk3dir
-            pakfile = fileSystemLocal.BuildOSPath( path, dir, pakfiles[pakfilesi] );
-            Com_Printf( "    pk3: %s\n", pakfile );
+            pakfile = scans[pakfilesi].zipfile;
+            Com_Printf( "    %s: %s (%.2f ms)\n", scans[pakfilesi].bundle ? "owb" : "pk3", pakfile, scans[pakfilesi].usec / 1000.0f );
+            
+            // a bundle made by fs_makeBundle carries the checksums of its pk3,
+            // and fs_makeBundle writes to fs_homepath while the pk3 is usually
+            // in fs_basepath, so the pair is matched by checksum in every
+            // search path.  Only the bundle is mounted, where the later of the
+            // two would have gone.
+            link = NULL;
+            if( scans[pakfilesi].valid && !scans[pakfilesi].corrupted )
+            {
+                link = FS_FindPakChecksum( scans[pakfilesi].checksum, !scans[pakfilesi].bundle );
+            }
+            
+            if( link && !scans[pakfilesi].bundle )
+            {
+                Com_Printf( "    skipping %s, %s/%s.owb replaces it\n", pakfile, ( *link )->pack->pakPathname, ( *link )->pack->pakBasename );
+                
+                search = *link;
+                *link = search->next;
+                search->pack->bundleHasPk3 = true;
+                // clients download the pk3 under its own name, less the .pk3
+                Q_strncpyz( search->pack->pakBasename, scans[pakfilesi].basename, sizeof( search->pack->pakBasename ) );
+                search->pack->pakBasename[strlen( search->pack->pakBasename ) - 4] = '\0';
+                Q_strncpyz( search->pack->pakGamename, dir, sizeof( search->pack->pakGamename ) );
+                search->next = fs_searchpaths;
+                fs_searchpaths = search;
+                
+                FS_FreeZipScan( &scans[pakfilesi] );
+                pakfilesi++;
+                continue;
+            }
             
-            if( ( pak = fileSystemLocal.LoadZipFile( pakfile, pakfiles[pakfilesi] ) ) == 0 )
+            if( ( pak = fileSystemLocal.MountZipFile( &scans[pakfilesi] ) ) == 0 )
             {
                 // This isn't a .pk3! Next!
                 pakfilesi++;
@@ -3548,6 +6215,21 @@ void idFileSystemLocal::AddGameDirectory( StringEntry path, StringEntry dir )
             // store the game name for downloading
             Q_strncpyz( pak->pakGamename, dir, sizeof( pak->pakGamename ) );
             
+            if( link )
+            {
+                Com_Printf( "    %s replaces %s/%s.pk3\n", pakfile, ( *link )->pack->pakPathname, ( *link )->pack->pakBasename );
+                
+                // clients download the pk3 under its own name
+                search = *link;
+                *link = search->next;
+                pak->bundleHasPk3 = true;
+                Q_strncpyz( pak->pakBasename, search->pack->pakBasename, sizeof( pak->pakBasename ) );
+                Q_strncpyz( pak->pakGamename, search->pack->pakGamename, sizeof( pak->pakGamename ) );
+                fs_packFiles -= search->pack->numfiles;
+                fileSystemLocal.FreePack( search->pack );
+                Z_Free( search );
+            }
+            
             fs_packFiles += pak->numfiles;
             
             search = ( searchpath_t* )Z_Malloc( sizeof( searchpath_t ) );
@@ -3588,8 +6270,16 @@ void idFileSystemLocal::AddGameDirectory( StringEntry path, StringEntry dir )
         }
     }
     
+    if( scans )
+    {
+        Com_Printf( "    %i pk3 files and %i bundles parsed in %.2f ms on %i threads\n", numzips, numbundles, usec / 1000.0f, Com_JobWorkers() + 1 );
+        Z_Free( scans );
+    }
+    
     // done
-    Sys_FreeFileList( pakfiles );
+    Z_Free( pakfiles );
+    Sys_FreeFileList( zipfiles );
+    Sys_FreeFileList( bundlefiles );
     Sys_FreeFileList( pakdirs );
     
     // add the directory to the search path
@@ -3855,6 +6545,9 @@ void idFileSystemLocal::Shutdown( bool closemfp )
     searchpath_t* p, *next;
     S32 i;
     
+    // the I/O threads have handles to the packs
+    StopAsyncThreads();
+    
     for( i = 0; i < MAX_FILE_HANDLES; i++ )
     {
         if( fsh[i].fileSize )
@@ -3863,6 +6556,8 @@ void idFileSystemLocal::Shutdown( bool closemfp )
         }
     }
     
+    FreeIndex();
+    
     // free everything
     for( p = fs_searchpaths ; p ; p = next )
     {
@@ -3870,9 +6565,7 @@ void idFileSystemLocal::Shutdown( bool closemfp )
         
         if( p->pack )
         {
-            unzClose( p->pack->handle );
-            Z_Free( p->pack->buildBuffer );
-            Z_Free( p->pack );
+            FreePack( p->pack );
         }
         
         if( p->dir )
@@ -3891,6 +6584,9 @@ void idFileSystemLocal::Shutdown( bool closemfp )
     Cmd_RemoveCommand( "fdir" );
     Cmd_RemoveCommand( "touchFile" );
     Cmd_RemoveCommand( "which" );
+    Cmd_RemoveCommand( "fs_stress" );
+    Cmd_RemoveCommand( "fs_readBench" );
+    Cmd_RemoveCommand( "fs_makeBundle" );
     
 #ifdef FS_MISSING
     if( closemfp )
@@ -3950,6 +6646,277 @@ void idFileSystemLocal::ReorderPurePaks( void )
     }
 }
 
+/*
+================
+FS_IndexHash
+
+Hash of the whole name, ignoring case and separator differences the same way
+idFileSystemLocal::FilenameCompare does
+================
+*/
+static U32 FS_IndexHash( StringEntry fname )
+{
+    U32 hash;
+    S32 c;
+    
+    hash = 2166136261u;
+    for( ; *fname; fname++ )
+    {
+        c = tolower( *fname );
+        if( c == '\\' || c == ':' )
+        {
+            c = '/';
+        }
+        hash = ( hash ^ ( U32 )c ) * 16777619u;
+    }
+    
+    return hash;
+}
+
+/*
+================
+idFileSystemLocal::BuildIndex
+
+Merges the hash tables of every pk3 in the search path into a single table,
+so finding a file no longer means probing each pk3 in turn. The chains keep
+search path order, so the first match is the one the search path would find.
+================
+*/
+void idFileSystemLocal::BuildIndex( void )
+{
+    searchpath_t* search, **paths;
+    fsIndexEntry_t* entry;
+    S32 i, j, numPaths, hashSize;
+    
+    FreeIndex();
+    
+    numPaths = 0;
+    fsIndex.numEntries = 0;
+    fsIndex.numDirs = 0;
+    for( search = fs_searchpaths ; search ; search = search->next )
+    {
+        numPaths++;
+        if( search->pack )
+        {
+            fsIndex.numEntries += search->pack->numfiles;
+        }
+        else if( search->dir )
+        {
+            fsIndex.numDirs++;
+        }
+    }
+    
+    if( !numPaths )
+    {
+        return;
+    }
+    
+    for( hashSize = MAX_FILEHASH_SIZE; hashSize < fsIndex.numEntries; hashSize <<= 1 )
+    {
+    }
+    
+    fsIndex.hashSize = hashSize;
+    fsIndex.hashTable = ( fsIndexEntry_t** )Z_Malloc( hashSize * sizeof( *fsIndex.hashTable ) );
+    fsIndex.entries = ( fsIndexEntry_t* )Z_Malloc( ( fsIndex.numEntries + 1 ) * sizeof( *fsIndex.entries ) );
+    fsIndex.dirs = ( searchpath_t** )Z_Malloc( ( fsIndex.numDirs + 1 ) * sizeof( *fsIndex.dirs ) );
+    fsIndex.dirOrder = ( S32* )Z_Malloc( ( fsIndex.numDirs + 1 ) * sizeof( *fsIndex.dirOrder ) );
+    paths = ( searchpath_t** )Z_Malloc( numPaths * sizeof( *paths ) );
+    
+    numPaths = 0;
+    fsIndex.numDirs = 0;
+    for( search = fs_searchpaths ; search ; search = search->next )
+    {
+        if( search->dir )
+        {
+            fsIndex.dirs[fsIndex.numDirs] = search;
+            fsIndex.dirOrder[fsIndex.numDirs] = numPaths;
+            fsIndex.numDirs++;
+        }
+        paths[numPaths++] = search;
+    }
+    
+    // insert back to front, so the chains end up in search path order
+    entry = fsIndex.entries;
+    for( i = numPaths - 1; i >= 0; i-- )
+    {
+        if( !paths[i]->pack )
+        {
+            continue;
+        }
+        
+        for( j = 0; j < paths[i]->pack->numfiles; j++, entry++ )
+        {
+            entry->file = &paths[i]->pack->buildBuffer[j];
+            entry->search = paths[i];
+            entry->order = i;
+            entry->hash = FS_IndexHash( entry->file->name );
+            entry->next = fsIndex.hashTable[entry->hash & ( hashSize - 1 )];
+            fsIndex.hashTable[entry->hash & ( hashSize - 1 )] = entry;
+        }
+    }
+    
+    Z_Free( paths );
+    
+    InvalidateDirCache();
+}
+
+/*
+================
+idFileSystemLocal::FreeIndex
+================
+*/
+void idFileSystemLocal::FreeIndex( void )
+{
+    if( !fsIndex.hashTable )
+    {
+        return;
+    }
+    
+    FreeListCache();
+    
+    Z_Free( fsIndex.hashTable );
+    Z_Free( fsIndex.entries );
+    Z_Free( fsIndex.dirs );
+    Z_Free( fsIndex.dirOrder );
+    
+    fsIndex.hashTable = NULL;
+    fsIndex.entries = NULL;
+    fsIndex.dirs = NULL;
+    fsIndex.dirOrder = NULL;
+    fsIndex.hashSize = 0;
+    fsIndex.numEntries = 0;
+    fsIndex.numDirs = 0;
+}
+
+/*
+================
+idFileSystemLocal::InvalidateDirCache
+
+Forgets every cached directory lookup, called whenever a file is written,
+renamed or removed through the filesystem
+================
+*/
+void idFileSystemLocal::InvalidateDirCache( void )
+{
+    fsIndex.dirGeneration++;
+}
+
+/*
+================
+idFileSystemLocal::IndexFindDir
+
+Returns the first directory of the search path holding filename, or -1.
+Results, including misses, are remembered until the cache is invalidated.
+================
+*/
+S32 idFileSystemLocal::IndexFindDir( StringEntry filename, U32 hash )
+{
+    fsDirCacheEntry_t* slot;
+    searchpath_t* search;
+    FILE* temp;
+    S32 i;
+    
+    slot = &fsDirCache[hash & ( FS_DIRCACHE_SIZE - 1 )];
+    if( slot->generation == fsIndex.dirGeneration && slot->hash == hash && !FilenameCompare( slot->name, filename ) )
+    {
+        fsIndex.dirHits++;
+        return slot->dir;
+    }
+    
+    fsIndex.dirMisses++;
+    
+    for( i = 0; i < fsIndex.numDirs; i++ )
+    {
+        search = fsIndex.dirs[i];
+        temp = fopen( BuildOSPath( search->dir->path, search->dir->gamedir, filename ), "rb" );
+        if( temp )
+        {
+            fclose( temp );
+            break;
+        }
+    }
+    
+    if( i == fsIndex.numDirs )
+    {
+        i = -1;
+    }
+    
+    if( strlen( filename ) < sizeof( slot->name ) )
+    {
+        slot->generation = fsIndex.dirGeneration;
+        slot->hash = hash;
+        slot->dir = i;
+        Q_strncpyz( slot->name, filename, sizeof( slot->name ) );
+    }
+    
+    return i;
+}
+
+/*
+================
+idFileSystemLocal::IndexLookup
+
+Finds where the search path would load filename from. With forOpen set the
+pure and directory restrictions of idFileSystemLocal::FOpenFileRead apply,
+otherwise it is a plain existence check.
+================
+*/
+bool idFileSystemLocal::IndexLookup( StringEntry filename, bool forOpen, searchpath_t** search, fileInPack_t** pakFile )
+{
+    fsIndexEntry_t* entry, *found;
+    U32 hash;
+    S32 dir;
+    
+    fsIndex.lookups++;
+    
+    hash = FS_IndexHash( filename );
+    
+    found = NULL;
+    if( !( fs_filter_flag & FS_EXCLUDE_PK3 ) )
+    {
+        for( entry = fsIndex.hashTable[hash & ( fsIndex.hashSize - 1 )]; entry; entry = entry->next )
+        {
+            if( entry->hash != hash || FilenameCompare( entry->file->name, filename ) )
+            {
+                continue;
+            }
+            
+            // disregard if it doesn't match one of the allowed pure pak files
+            if( forOpen && !PakIsPure( entry->search->pack ) )
+            {
+                continue;
+            }
+            
+            found = entry;
+            break;
+        }
+    }
+    
+    if( !( fs_filter_flag & FS_EXCLUDE_DIR ) && fsIndex.numDirs && ( !forOpen || DirAllowsFile( filename ) ) )
+    {
+        // a directory only matters if it comes before the pk3 we found
+        if( !found || fsIndex.dirOrder[0] < found->order )
+        {
+            dir = IndexFindDir( filename, hash );
+            if( dir >= 0 && ( !found || fsIndex.dirOrder[dir] < found->order ) )
+            {
+                *search = fsIndex.dirs[dir];
+                *pakFile = NULL;
+                return true;
+            }
+        }
+    }
+    
+    if( !found )
+    {
+        return false;
+    }
+    
+    *search = found->search;
+    *pakFile = found->file;
+    return true;
+}
+
 /*
 ================
 idFileSystemLocal::Startup
@@ -3982,6 +6949,11 @@ void idFileSystemLocal::Startup( StringEntry gameName )
     fs_homepath = cvarSystem->Get( "fs_homepath", homePath, CVAR_INIT );
     fs_gamedirvar = cvarSystem->Get( "fs_game", "", CVAR_INIT | CVAR_SYSTEMINFO );
     fs_restrict = cvarSystem->Get( "fs_restrict", "", CVAR_INIT );
+    fs_index = cvarSystem->Get( "fs_index", "1", CVAR_ARCHIVE );
+    fs_mmap = cvarSystem->Get( "fs_mmap", "1", CVAR_ARCHIVE );
+    fs_ioThreads = cvarSystem->Get( "fs_ioThreads", "2", CVAR_ARCHIVE | CVAR_LATCH );
+    fs_fileCache = cvarSystem->Get( "fs_fileCache", "4096", CVAR_ARCHIVE );
+    fs_inflateWhole = cvarSystem->Get( "fs_inflateWhole", "1", CVAR_ARCHIVE );
     
     // add search path elements in reverse priority order
     if( fs_basepath->string[0] )
@@ -4036,11 +7008,20 @@ void idFileSystemLocal::Startup( StringEntry gameName )
     Cmd_AddCommand( "fdir", NewDir_f );
     Cmd_AddCommand( "touchFile", TouchFile_f );
     Cmd_AddCommand( "which", Which_f );
+    Cmd_AddCommand( "fs_stress", Stress_f );
+    Cmd_AddCommand( "fs_readBench", ReadBench_f );
+    Cmd_AddCommand( "fs_makeBundle", MakeBundle_f );
     
     // show_bug.cgi?id=506
     // reorder the pure pk3 files according to server order
     ReorderPurePaks();
     
+    // the search path is final now
+    BuildIndex();
+    PruneFileCache();
+    
+    StartAsyncThreads();
+    
     //print the current search paths
     //idFileSystemLocal::Path_f();
     
@@ -4188,6 +7169,19 @@ StringEntry idFileSystemLocal::LoadedPakPureChecksums( void )
     return info;
 }
 
+/*
+=====================
+FS_PakDownloadable
+
+Downloads always fetch <name>.pk3, which a bundle only has when the pk3 it
+was made from is in one of the search paths
+=====================
+*/
+static bool FS_PakDownloadable( const pack_t* pak )
+{
+    return !pak->bundle || pak->bundleHasPk3;
+}
+
 /*
 =====================
 idFileSystemLocal::ReferencedPakChecksums
@@ -4205,8 +7199,8 @@ StringEntry idFileSystemLocal::ReferencedPakChecksums( void )
     
     for( search = fs_searchpaths ; search ; search = search->next )
     {
-        // is the element a pak file?
-        if( search->pack )
+        // is the element a pak file clients can download?
+        if( search->pack && FS_PakDownloadable( search->pack ) )
         {
             if( search->pack->referenced || Q_stricmpn( search->pack->pakGamename, BASEGAME, strlen( BASEGAME ) ) )
             {
@@ -4237,8 +7231,8 @@ StringEntry idFileSystemLocal::ReferencedPakNames( void )
     // and referenced one's from baseq3
     for( search = fs_searchpaths ; search ; search = search->next )
     {
-        // is the element a pak file?
-        if( search->pack )
+        // is the element a pak file clients can download?
+        if( search->pack && FS_PakDownloadable( search->pack ) )
         {
             if( *info )
             {
@@ -4358,10 +7352,19 @@ exception of .cfg and .dat files.
 void idFileSystemLocal::PureServerSetLoadedPaks( StringEntry pakSums, StringEntry pakNames )
 {
     S32 i, c, d;
+    UTF8 sum[32], *name;
+    cmdTokens_t* tokens;
+    void* mark;
+    
+    // the pure list decides what listings see
+    InvalidateDirCache();
     
-    Cmd_TokenizeString( pakSums );
+    // split as spans, this runs inside commands like map and mustn't replace their arguments
+    mark = Hunk_FrameMark();
+    tokens = Hunk_FrameAllocType<cmdTokens_t>();
+    name = Hunk_FrameAllocArray<UTF8>( BIG_INFO_STRING );
     
-    c = Cmd_Argc();
+    c = Cmd_TokenizeSpans( pakSums, tokens, false );
     if( c > MAX_SEARCH_PATHS )
     {
         c = MAX_SEARCH_PATHS;
@@ -4371,7 +7374,8 @@ void idFileSystemLocal::PureServerSetLoadedPaks( StringEntry pakSums, StringEntr
     
     for( i = 0 ; i < c ; i++ )
     {
-        fs_serverPaks[i] = atoi( Cmd_Argv( i ) );
+        Cmd_SpanCopy( &tokens->argv[i], sum, sizeof( sum ) );
+        fs_serverPaks[i] = atoi( sum );
     }
     
     if( fs_numServerPaks )
@@ -4385,6 +7389,7 @@ void idFileSystemLocal::PureServerSetLoadedPaks( StringEntry pakSums, StringEntr
             // show_bug.cgi?id=540
             // force a restart to make sure the search order will be correct
             Com_DPrintf( "FS search reorder is required\n" );
+            Hunk_FrameResetTo( mark );
             Restart( fs_checksumFeed );
             return;
         }
@@ -4401,9 +7406,7 @@ void idFileSystemLocal::PureServerSetLoadedPaks( StringEntry pakSums, StringEntr
     
     if( pakNames && *pakNames )
     {
-        Cmd_TokenizeString( pakNames );
-        
-        d = Cmd_Argc();
+        d = Cmd_TokenizeSpans( pakNames, tokens, false );
         
         if( d > MAX_SEARCH_PATHS )
         {
@@ -4412,9 +7415,12 @@ void idFileSystemLocal::PureServerSetLoadedPaks( StringEntry pakSums, StringEntr
         
         for( i = 0 ; i < d ; i++ )
         {
-            fs_serverPakNames[i] = CopyString( Cmd_Argv( i ) );
+            Cmd_SpanCopy( &tokens->argv[i], name, BIG_INFO_STRING );
+            fs_serverPakNames[i] = CopyString( name );
         }
     }
+    
+    Hunk_FrameResetTo( mark );
 }
 
 /*
@@ -4429,10 +7435,16 @@ checksums to see if any pk3 files need to be auto-downloaded.
 void idFileSystemLocal::PureServerSetReferencedPaks( StringEntry pakSums, StringEntry pakNames )
 {
     S32 i, c, d;
+    UTF8 sum[32], *name;
+    cmdTokens_t* tokens;
+    void* mark;
     
-    Cmd_TokenizeString( pakSums );
+    // split as spans, this runs inside commands like map and mustn't replace their arguments
+    mark = Hunk_FrameMark();
+    tokens = Hunk_FrameAllocType<cmdTokens_t>();
+    name = Hunk_FrameAllocArray<UTF8>( BIG_INFO_STRING );
     
-    c = Cmd_Argc();
+    c = Cmd_TokenizeSpans( pakSums, tokens, false );
     if( c > MAX_SEARCH_PATHS )
     {
         c = MAX_SEARCH_PATHS;
@@ -4442,7 +7454,8 @@ void idFileSystemLocal::PureServerSetReferencedPaks( StringEntry pakSums, String
     
     for( i = 0 ; i < c ; i++ )
     {
-        fs_serverReferencedPaks[i] = atoi( Cmd_Argv( i ) );
+        Cmd_SpanCopy( &tokens->argv[i], sum, sizeof( sum ) );
+        fs_serverReferencedPaks[i] = atoi( sum );
     }
     
     for( i = 0 ; i < c ; i++ )
@@ -4457,9 +7470,7 @@ void idFileSystemLocal::PureServerSetReferencedPaks( StringEntry pakSums, String
     
     if( pakNames && *pakNames )
     {
-        Cmd_TokenizeString( pakNames );
-        
-        d = Cmd_Argc();
+        d = Cmd_TokenizeSpans( pakNames, tokens, false );
         
         if( d > MAX_SEARCH_PATHS )
         {
@@ -4468,9 +7479,12 @@ void idFileSystemLocal::PureServerSetReferencedPaks( StringEntry pakSums, String
         
         for( i = 0 ; i < d ; i++ )
         {
-            fs_serverReferencedPakNames[i] = CopyString( Cmd_Argv( i ) );
+            Cmd_SpanCopy( &tokens->argv[i], name, BIG_INFO_STRING );
+            fs_serverReferencedPakNames[i] = CopyString( name );
         }
     }
+    
+    Hunk_FrameResetTo( mark );
 }
 
 /*
@@ -4735,7 +7749,11 @@ idFileSystemLocal::FOpenFileByMode
 S32 idFileSystemLocal::FTell( fileHandle_t f )
 {
     S32 pos;
-    if( fsh[f].zipFile == true )
+    if( fsh[f].bundleFile )
+    {
+        pos = fsh[f].bundlePos;
+    }
+    else if( fsh[f].zipFile == true )
     {
         pos = unztell( fsh[f].handleFiles.file.z );
     }
@@ -4771,7 +7789,7 @@ bool idFileSystemLocal::VerifyPak( StringEntry pak )
     
     for( search = fs_searchpaths ; search ; search = search->next )
     {
-        if( search->pack )
+        if( search->pack && FS_PakDownloadable( search->pack ) )
         {
             Q_strncpyz( teststring, search->pack->pakGamename, sizeof( teststring ) );
             Q_strcat( teststring, sizeof( teststring ), "/" );
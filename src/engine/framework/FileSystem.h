@@ -88,12 +88,19 @@ typedef struct
     S32 baseOffset;
     S32 fileSize;
     S32 zipFilePos;
+    U64 zipDataPos;
+    pack_t* pak; // the pk3 a zip handle was opened from
     bool zipFile;
+    bool bundleFile; // an entry of a .owb bundle, pak is the bundle
+    S32 bundleEntry; // into the pack_t::bundle directory
+    S32 bundlePos; // read position
+    U8* bundleData; // the whole file, loaded by the first Read that needs it
     bool streamed;
     UTF8 name[MAX_ZPATH];
 } fileHandleData_t;
 
 static fileHandleData_t fsh[MAX_FILE_HANDLES];
+static SDL_atomic_t fs_handleUsed[MAX_FILE_HANDLES]; // see idFileSystemLocal::HandleForFile
 
 // TTimo - show_bug.cgi?id=540
 // wether we did a reorder on the current search path when joining the server
@@ -152,6 +159,207 @@ typedef struct
 #define FS_EXCLUDE_DIR 0x1
 #define FS_EXCLUDE_PK3 0x2
 
+/*
+.owb asset bundles are mounted next to the pk3 files, through the same pack_t.
+The directory, sorted by the name hash, is at the end of the file so it can be
+read with one read, the checksums are the crcs of the pk3 the bundle was made
+from so it gets the same checksum and pure checksum.  Everything is little
+endian, payloads of stored files are aligned for mapping.
+*/
+#define BUNDLE_IDENT ( ( '1' << 24 ) + ( 'B' << 16 ) + ( 'W' << 8 ) + 'O' )
+#define BUNDLE_VERSION 1
+#define BUNDLE_ALIGN 4096
+
+#define BUNDLE_STORED 0
+#define BUNDLE_DEFLATE 1
+
+typedef struct
+{
+    S32 ident;
+    S32 version;
+    S32 numFiles;
+    S32 numChecksums;
+    S32 namesSize;
+    S32 dirOffset; // the directory, then the checksums, then the names
+    S32 pad[2];
+} bundleHeader_t;
+
+typedef struct
+{
+    U32 hash; // FS_BundleHash of the name
+    S32 name; // offset into the names
+    S32 offset; // of the payload, files with the same contents share it
+    S32 size;
+    S32 storedSize;
+    U32 crc; // of the uncompressed data
+    S32 compression;
+    S32 pad;
+} bundleEntry_t;
+
+// one central directory entry of a pk3, as read by a job worker
+typedef struct
+{
+    S32 name; // offset into fsZipScan_t::names
+    U64 pos;
+    U64 len;
+} fsZipEntry_t;
+
+// everything AddGameDirectory needs from a pk3 that can be done off the main
+// thread, the arrays are malloc'ed since the zone isn't thread safe
+typedef struct
+{
+    UTF8 zipfile[MAX_OSPATH];
+    UTF8 basename[MAX_OSPATH];
+    unzFile handle;
+    bool bundle; // a .owb bundle instead of a zip file
+    bundleEntry_t* bundleEntries; // pos of the entries is the index into it
+    bool valid; // false if it isn't a zip file at all
+    bool corrupted;
+    S32 numEntries;
+    fsZipEntry_t* entries;
+    UTF8* names;
+    S32 namesSize; // allocated
+    S32 namesLen; // used
+    S32* headerLongs; // the checksum feed and the crc of every file
+    S32 numHeaderLongs;
+    S32 checksum;
+    S32 pure_checksum;
+    S64 usec; // time spent parsing
+} fsZipScan_t;
+
+// size of the loose file lookup cache, must be a power of two
+#define FS_DIRCACHE_SIZE 4096
+
+// one file of one pk3 in the merged search path index
+typedef struct fsIndexEntry_s
+{
+    U32 hash;
+    S32 order; // position of the pk3 in the search path
+    fileInPack_t* file;
+    searchpath_t* search;
+    struct fsIndexEntry_s* next;
+} fsIndexEntry_t;
+
+typedef struct
+{
+    S32 hashSize;
+    fsIndexEntry_t** hashTable;
+    fsIndexEntry_t* entries;
+    S32 numEntries;
+    
+    // the directories of the search path in order, with their position in it
+    S32 numDirs;
+    searchpath_t** dirs;
+    S32* dirOrder;
+    
+    S32 dirGeneration;
+    S32 lookups;
+    S32 dirHits;
+    S32 dirMisses;
+    S32 listHits;
+    S32 listMisses;
+} fsIndex_t;
+
+// remembers which directory, if any, a name was last found in
+typedef struct
+{
+    U32 hash;
+    S32 generation;
+    S32 dir; // -1 when the name is in no directory
+    UTF8 name[MAX_QPATH];
+} fsDirCacheEntry_t;
+
+// ReadFile maps files at least this big instead of copying them
+#define FS_MMAP_MIN_SIZE 65536
+#define MAX_FILE_MAPPINGS 256
+
+// a ReadFile buffer that points into a file mapping
+typedef struct
+{
+    void* buffer;
+    sysMapping_t mapping;
+} fsMapping_t;
+
+#define MAX_ASYNC_THREADS 8
+
+// a ReadFileAsync request, everything an I/O thread needs to read the file
+// is resolved on the main thread when it is queued
+typedef struct fsAsyncRead_s
+{
+    UTF8 qpath[MAX_ZPATH];
+    fileAsyncCallback_t callback;
+    void* userData;
+    S32 len;
+    pack_t* pak; // the pk3 or bundle the file is in, NULL for loose files
+    U64 pos; // the bundle directory index for bundle files
+    U64 dataPos;
+    FILE* file; // the loose file, owned by the request
+    U8* buffer; // malloc'ed by the I/O thread, NULL if the read failed
+    struct fsAsyncRead_s* next;
+} fsAsyncRead_t;
+
+
+// recent ListFilteredFiles results
+#define FS_LIST_CACHE_SIZE 16
+// uniquing hash of a listing, must be a power of two above MAX_FOUND_FILES
+#define FS_LIST_HASH_SIZE 8192
+
+typedef struct
+{
+    S32 generation; // fsIndex_t::dirGeneration it is valid in
+    UTF8 path[MAX_QPATH];
+    UTF8 extension[MAX_QPATH];
+    UTF8 filter[MAX_QPATH];
+    bool filtered;
+    S32 numFiles;
+    UTF8** files;
+} fsListCacheEntry_t;
+
+// ReadFile inflates compressed pk3 files at least this big in one go
+#define FS_INFLATE_MIN_SIZE 65536
+#define FS_INFLATE_MAX_COMPRESSED ( 64 << 20 )
+
+// ReadFile keeps pk3 files up to this size in the file cache
+#define FS_CACHE_MAX_FILE 262144
+#define FS_CACHE_HASH_SIZE 1024
+
+// the inflated contents of one pk3 file, the data follows the struct
+typedef struct fsCacheEntry_s
+{
+    S32 checksum; // of the pack
+    U64 pos; // of the file in the pack
+    S32 len;
+    UTF8 name[MAX_ZPATH];
+    U8* data;
+    struct fsCacheEntry_s* hashNext;
+    struct fsCacheEntry_s* prev; // least recently used order
+    struct fsCacheEntry_s* next;
+} fsCacheEntry_t;
+
+typedef struct
+{
+    fsCacheEntry_t* hashTable[FS_CACHE_HASH_SIZE];
+    fsCacheEntry_t lru; // lru.next is the most recently used entry
+    S32 numEntries;
+    S32 size;
+    S32 hits;
+    S32 misses;
+    S32 evictions;
+} fsFileCache_t;
+
+#define MAX_STRESS_THREADS 16
+
+// one run of the fs_stress command
+typedef struct
+{
+    pack_t** paks;
+    fileInPack_t** files;
+    S32 numFiles;
+    SDL_atomic_t next;
+    SDL_atomic_t errors;
+    SDL_atomic_t kbytes;
+} fsStress_t;
+
 //
 // idFileSystemLocal
 //
@@ -191,6 +399,9 @@ public:
     virtual bool FilenameCompare( StringEntry s1, StringEntry s2 );
     virtual UTF8* ShiftedStrStr( StringEntry string, StringEntry substring, S32 shift );
     virtual UTF8* ShiftStr( StringEntry string, S32 shift );
+    virtual S32 FOpenFileInPack( StringEntry filename, fileHandle_t file, pack_t* pak, fileInPack_t* pakFile, bool uniqueFILE );
+    virtual bool DirAllowsFile( StringEntry filename );
+    virtual S32 FOpenFileInDir( StringEntry filename, fileHandle_t file, directory_t* dir );
     virtual S32 FOpenFileRead( StringEntry filename, fileHandle_t* file, bool uniqueFILE );
     virtual S32 FOpenFileRead_Filtered( StringEntry qpath, fileHandle_t* file, bool uniqueFILE, S32 filter_flag );
     virtual bool CL_ExtractFromPakFile( StringEntry base, StringEntry gamedir, StringEntry filename );
@@ -207,8 +418,12 @@ public:
     virtual S32 FileIsInPAK( StringEntry filename, S32* pChecksum );
     virtual S32 ReadFile( StringEntry qpath, void** buffer );
     virtual void FreeFile( void* buffer );
+    virtual S32 ReadFileAsync( StringEntry qpath, fileAsyncCallback_t callback, void* userData );
+    virtual void RunAsyncCallbacks( void );
     virtual void WriteFile( StringEntry qpath, const void* buffer, S32 size );
     virtual pack_t* LoadZipFile( StringEntry zipfile, StringEntry basename );
+    virtual pack_t* MountZipFile( fsZipScan_t* scan );
+    virtual bool ReadBundleFile( fileHandle_t f );
     virtual S32 ReturnPath( StringEntry zname, UTF8* zpath, S32* depth );
     virtual S32 AddFileToList( UTF8* name, UTF8* list[MAX_FOUND_FILES], S32 nfiles );
     virtual UTF8** ListFilteredFiles( StringEntry path, StringEntry extension, UTF8* filter, S32* numfiles );
@@ -226,6 +441,9 @@ public:
     static void Path_f( void );
     static void TouchFile_f( void );
     static void Which_f( void );
+    static void Stress_f( void );
+    static void ReadBench_f( void );
+    static void MakeBundle_f( void );
     static S32 paksort( const void* a, const void* b );
     virtual bool IsExt( StringEntry filename, StringEntry ext, S32 namelen );
     static void AddGameDirectory( StringEntry path, StringEntry dir );
@@ -234,6 +452,27 @@ public:
     virtual bool ComparePaks( UTF8* neededpaks, S32 len, bool dlstring );
     virtual void Shutdown( bool closemfp );
     virtual void ReorderPurePaks( void );
+    virtual void BuildIndex( void );
+    virtual void FreeIndex( void );
+    virtual void InvalidateDirCache( void );
+    virtual S32 IndexFindDir( StringEntry filename, U32 hash );
+    virtual bool IndexLookup( StringEntry filename, bool forOpen, searchpath_t** search, fileInPack_t** pakFile );
+    virtual void BuildPackDirs( pack_t* pack );
+    virtual void FreePackDirs( pack_t* pack );
+    virtual void FreePack( pack_t* pack );
+    virtual S32 ListPackDir( pack_t* pak, StringEntry path, S32 pathLength, S32 pathDepth, StringEntry extension, UTF8** list, S32 nfiles, S16* unique );
+    virtual void FreeListCache( void );
+    virtual void* MapFile( fileHandle_t f, S32 len );
+    virtual bool InflateFile( fileHandle_t f, void* buffer, S32 len );
+    virtual bool FileCacheRead( fileHandle_t f, void* buffer, S32 len );
+    virtual void FileCacheStore( fileHandle_t f, const void* buffer, S32 len );
+    virtual void FileCacheRemove( fsCacheEntry_t* entry );
+    virtual void PruneFileCache( void );
+    virtual void ReleaseHandle( fileHandle_t f );
+    virtual unzFile AcquirePackHandle( pack_t* pak );
+    virtual void ReleasePackHandle( pack_t* pak, unzFile z );
+    virtual void StartAsyncThreads( void );
+    virtual void StopAsyncThreads( void );
     virtual void Startup( StringEntry gameName );
     virtual StringEntry GamePureChecksum( void );
     virtual StringEntry LoadedPakChecksums( void );
@@ -52,6 +52,12 @@
 #include <libgen.h>
 #include <fcntl.h>
 #include <fenv.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 bool stdinIsATTY;
 
@@ -150,6 +156,253 @@ S32 Sys_Milliseconds( void )
     return ( tp.tv_sec - initial_tv_sec ) * 1000 + tp.tv_usec / 1000;
 }
 
+/*
+================
+Sys_Microseconds
+================
+*/
+S64 Sys_Microseconds( void )
+{
+    struct timespec ts;
+    
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    
+    return ( S64 )ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+==================
+Sys_Backtrace
+
+Fills frames with the return addresses of the calling stack, innermost
+first, leaving out Sys_Backtrace and skip more frames
+==================
+*/
+S32 Sys_Backtrace( void** frames, S32 maxFrames, S32 skip )
+{
+    void* all[64];
+    S32 i, numFrames;
+    
+    numFrames = backtrace( all, ARRAY_LEN( all ) );
+    
+    for( i = 0; i < maxFrames && i + skip + 1 < numFrames; i++ )
+    {
+        frames[i] = all[i + skip + 1];
+    }
+    
+    return i;
+}
+
+/*
+==================
+Sys_BacktraceSymbol
+
+Module, symbol and offset of a return address, as far as they are known
+==================
+*/
+void Sys_BacktraceSymbol( void* address, UTF8* buf, S32 size )
+{
+    StringEntry module;
+    Dl_info info;
+    
+    if( !dladdr( address, &info ) || !info.dli_fname )
+    {
+        Com_sprintf( buf, size, "%p", address );
+        return;
+    }
+    
+    module = strrchr( info.dli_fname, '/' ) ? strrchr( info.dli_fname, '/' ) + 1 : info.dli_fname;
+    
+    if( info.dli_sname )
+    {
+        Com_sprintf( buf, size, "%s(%s+0x%lx)", module, info.dli_sname, ( unsigned long )( ( U8* )address - ( U8* )info.dli_saddr ) );
+    }
+    else
+    {
+        Com_sprintf( buf, size, "%s+0x%lx", module, ( unsigned long )( ( U8* )address - ( U8* )info.dli_fbase ) );
+    }
+}
+
+/*
+==================
+Sys_MapFile
+
+Maps length bytes of f from offset as a private copy on write view and
+returns a pointer to the first one.  The byte after the range is part of the
+view too, so a range that ends the file exactly on a page boundary fails.
+==================
+*/
+void* Sys_MapFile( FILE* f, S64 offset, S32 length, sysMapping_t* mapping )
+{
+    struct stat st;
+    S64 pageSize, start, end;
+    void* base;
+    S32 fd;
+    
+    fd = fileno( f );
+    if( fd < 0 || fstat( fd, &st ) )
+    {
+        return NULL;
+    }
+    
+    // past the end of the file only the rest of the last page can be touched
+    pageSize = sysconf( _SC_PAGESIZE );
+    end = offset + length + 1;
+    if( offset < 0 || length <= 0 || end > ( ( ( S64 )st.st_size + pageSize - 1 ) & ~( pageSize - 1 ) ) )
+    {
+        return NULL;
+    }
+    
+    start = offset & ~( pageSize - 1 );
+    base = mmap( NULL, end - start, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, start );
+    if( base == MAP_FAILED )
+    {
+        return NULL;
+    }
+    
+    mapping->base = base;
+    mapping->size = end - start;
+    
+    return ( U8* )base + ( offset - start );
+}
+
+/*
+==================
+Sys_UnmapFile
+==================
+*/
+void Sys_UnmapFile( sysMapping_t* mapping )
+{
+    munmap( mapping->base, mapping->size );
+}
+
+#define HUGE_PAGE_SIZE ( 2 * 1024 * 1024 )
+
+/*
+==================
+Sys_AllocMemory
+
+Maps size bytes of zeroed memory.  hugePages 2 asks for explicit huge pages
+out of the pool in /proc/sys/vm/nr_hugepages and falls back to 1, which
+aligns the block to a huge page and asks for transparent huge pages.
+==================
+*/
+void* Sys_AllocMemory( size_t size, S32 hugePages, sysMemory_t* memory )
+{
+    size_t hugeSize, head;
+    U8* base;
+    
+    hugeSize = ( size + HUGE_PAGE_SIZE - 1 ) & ~( ( size_t )HUGE_PAGE_SIZE - 1 );
+
+#ifdef MAP_HUGETLB
+    if( hugePages >= 2 )
+    {
+        base = ( U8* )mmap( NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if( base != MAP_FAILED )
+        {
+            memory->base = base;
+            memory->size = hugeSize;
+            memory->hugePages = 2;
+            return base;
+        }
+    }
+#endif
+
+    if( !hugePages )
+    {
+        base = ( U8* )mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if( base == MAP_FAILED )
+        {
+            return NULL;
+        }
+        
+        memory->base = base;
+        memory->size = size;
+        memory->hugePages = 0;
+        return base;
+    }
+    
+    // only the huge page aligned parts of a mapping can get huge pages, so
+    // map one more and trim the ends
+    base = ( U8* )mmap( NULL, hugeSize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( base == MAP_FAILED )
+    {
+        return NULL;
+    }
+    
+    head = ( ( uintptr_t )base + HUGE_PAGE_SIZE - 1 ) & ~( ( uintptr_t )HUGE_PAGE_SIZE - 1 );
+    head -= ( uintptr_t )base;
+    if( head )
+    {
+        munmap( base, head );
+    }
+    munmap( base + head + hugeSize, HUGE_PAGE_SIZE - head );
+    base += head;
+    
+    memory->base = base;
+    memory->size = hugeSize;
+    memory->hugePages = 0;
+#ifdef MADV_HUGEPAGE
+    if( !madvise( base, hugeSize, MADV_HUGEPAGE ) )
+    {
+        memory->hugePages = 1;
+    }
+#endif
+
+    return base;
+}
+
+/*
+==================
+Sys_FreeMemory
+==================
+*/
+void Sys_FreeMemory( sysMemory_t* memory )
+{
+    if( memory->base )
+    {
+        munmap( memory->base, memory->size );
+    }
+    memory->base = NULL;
+}
+
+/*
+==================
+Sys_TLBMisses
+
+Data TLB misses of the first thread to call this since that first call, or
+-1 if the kernel won't count them
+==================
+*/
+S64 Sys_TLBMisses( void )
+{
+#ifdef __linux__
+    static S32 fd = -2;
+    struct perf_event_attr attr;
+    U64 count;
+    
+    if( fd == -2 )
+    {
+        ::memset( &attr, 0, sizeof( attr ) );
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof( attr );
+        attr.config = PERF_COUNT_HW_CACHE_DTLB | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+    }
+    
+    if( fd < 0 || read( fd, &count, sizeof( count ) ) != sizeof( count ) )
+    {
+        return -1;
+    }
+    
+    return ( S64 )count;
+#else
+    return -1;
+#endif
+}
+
 /*
 ==================
 Sys_RandomBytes
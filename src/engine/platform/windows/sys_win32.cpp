@@ -171,6 +171,226 @@ S32 Sys_Milliseconds( void )
     return sys_curtime;
 }
 
+/*
+================
+Sys_Microseconds
+================
+*/
+S64 Sys_Microseconds( void )
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    
+    if( !frequency.QuadPart )
+    {
+        QueryPerformanceFrequency( &frequency );
+    }
+    QueryPerformanceCounter( &counter );
+    
+    return ( S64 )( counter.QuadPart / frequency.QuadPart ) * 1000000 + ( counter.QuadPart % frequency.QuadPart ) * 1000000 / frequency.QuadPart;
+}
+
+/*
+==================
+Sys_Backtrace
+
+Fills frames with the return addresses of the calling stack, innermost
+first, leaving out Sys_Backtrace and skip more frames
+==================
+*/
+S32 Sys_Backtrace( void** frames, S32 maxFrames, S32 skip )
+{
+    return CaptureStackBackTrace( skip + 1, maxFrames, frames, NULL );
+}
+
+/*
+==================
+Sys_BacktraceSymbol
+
+Module and offset of a return address, for looking up in the pdb
+==================
+*/
+void Sys_BacktraceSymbol( void* address, UTF8* buf, S32 size )
+{
+    HMODULE module;
+    UTF8 path[MAX_OSPATH];
+    StringEntry name;
+    
+    if( !GetModuleHandleExA( GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, ( LPCSTR )address, &module ) ||
+            !GetModuleFileNameA( module, path, sizeof( path ) ) )
+    {
+        Com_sprintf( buf, size, "%p", address );
+        return;
+    }
+    
+    name = strrchr( path, '\\' ) ? strrchr( path, '\\' ) + 1 : path;
+    Com_sprintf( buf, size, "%s+0x%lx", name, ( unsigned long )( ( U8* )address - ( U8* )module ) );
+}
+
+/*
+==================
+Sys_MapFile
+
+Maps length bytes of f from offset as a private copy on write view and
+returns a pointer to the first one.  The byte after the range is part of the
+view too, so a range that ends the file exactly on a page boundary fails.
+==================
+*/
+void* Sys_MapFile( FILE* f, S64 offset, S32 length, sysMapping_t* mapping )
+{
+    SYSTEM_INFO info;
+    LARGE_INTEGER size;
+    HANDLE file, map;
+    S64 start, end;
+    void* base;
+    
+    file = ( HANDLE )_get_osfhandle( _fileno( f ) );
+    if( file == INVALID_HANDLE_VALUE || !GetFileSizeEx( file, &size ) )
+    {
+        return NULL;
+    }
+    
+    // past the end of the file only the rest of the last page can be touched
+    GetSystemInfo( &info );
+    end = offset + length + 1;
+    if( offset < 0 || length <= 0 || end > ( ( size.QuadPart + info.dwPageSize - 1 ) & ~( ( S64 )info.dwPageSize - 1 ) ) )
+    {
+        return NULL;
+    }
+    
+    map = CreateFileMapping( file, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+    if( !map )
+    {
+        return NULL;
+    }
+    
+    // views can't reach past the end of the file, the page they end in is still all there
+    if( end > size.QuadPart )
+    {
+        end = size.QuadPart;
+    }
+    
+    start = offset & ~( ( S64 )info.dwAllocationGranularity - 1 );
+    base = MapViewOfFile( map, FILE_MAP_COPY, ( DWORD )( start >> 32 ), ( DWORD )start, ( SIZE_T )( end - start ) );
+    
+    // the view keeps the mapping object alive
+    CloseHandle( map );
+    
+    if( !base )
+    {
+        return NULL;
+    }
+    
+    mapping->base = base;
+    mapping->size = end - start;
+    
+    return ( U8* )base + ( offset - start );
+}
+
+/*
+==================
+Sys_UnmapFile
+==================
+*/
+void Sys_UnmapFile( sysMapping_t* mapping )
+{
+    UnmapViewOfFile( mapping->base );
+}
+
+/*
+==================
+Sys_EnableLockMemory
+
+Large pages need the "Lock pages in memory" right, which has to be granted
+to the account and then switched on in the process token
+==================
+*/
+static bool Sys_EnableLockMemory( void )
+{
+    TOKEN_PRIVILEGES tp;
+    HANDLE token;
+    bool ok;
+    
+    if( !OpenProcessToken( GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token ) )
+    {
+        return false;
+    }
+    
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    ok = LookupPrivilegeValueA( NULL, "SeLockMemoryPrivilege", &tp.Privileges[0].Luid ) &&
+         AdjustTokenPrivileges( token, FALSE, &tp, 0, NULL, NULL ) && GetLastError() == ERROR_SUCCESS;
+    
+    CloseHandle( token );
+    
+    return ok;
+}
+
+/*
+==================
+Sys_AllocMemory
+
+Allocates size bytes of zeroed memory.  hugePages 2 asks for large pages and
+falls back to normal ones, there are no transparent huge pages to ask for
+==================
+*/
+void* Sys_AllocMemory( size_t size, S32 hugePages, sysMemory_t* memory )
+{
+    SIZE_T largeSize;
+    void* base;
+    
+    if( hugePages >= 2 && ( largeSize = GetLargePageMinimum() ) != 0 && Sys_EnableLockMemory() )
+    {
+        largeSize = ( size + largeSize - 1 ) & ~( largeSize - 1 );
+        base = VirtualAlloc( NULL, largeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE );
+        if( base )
+        {
+            memory->base = base;
+            memory->size = largeSize;
+            memory->hugePages = 2;
+            return base;
+        }
+    }
+    
+    base = VirtualAlloc( NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+    if( !base )
+    {
+        return NULL;
+    }
+    
+    memory->base = base;
+    memory->size = size;
+    memory->hugePages = 0;
+    
+    return base;
+}
+
+/*
+==================
+Sys_FreeMemory
+==================
+*/
+void Sys_FreeMemory( sysMemory_t* memory )
+{
+    if( memory->base )
+    {
+        VirtualFree( memory->base, 0, MEM_RELEASE );
+    }
+    memory->base = NULL;
+}
+
+/*
+==================
+Sys_TLBMisses
+
+Windows doesn't hand out the hardware counters without a driver
+==================
+*/
+S64 Sys_TLBMisses( void )
+{
+    return -1;
+}
+
 /*
 ================
 Sys_RandomBytes
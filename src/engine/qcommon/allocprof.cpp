@@ -0,0 +1,653 @@
+////////////////////////////////////////////////////////////////////////////////////////
+// Copyright(C) 1999 - 2010 id Software LLC, a ZeniMax Media company.
+// Copyright(C) 2011 - 2018 Dusan Jocic <dusanjocic@msn.com>
+//
+// This file is part of the OpenWolf GPL Source Code.
+// OpenWolf Source Code is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenWolf Source Code is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenWolf Source Code.  If not, see <http://www.gnu.org/licenses/>.
+//
+// In addition, the OpenWolf Source Code is also subject to certain additional terms.
+// You should have received a copy of these additional terms immediately following the
+// terms and conditions of the GNU General Public License which accompanied the
+// OpenWolf Source Code. If not, please request a copy in writing from id Software
+// at the address below.
+//
+// If you have questions concerning this license or the applicable additional terms,
+// you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+// Suite 120, Rockville, Maryland 20850 USA.
+//
+// -------------------------------------------------------------------------------------
+// -------------------------------------------------------------------------------------
+// File name:   allocprof.cpp
+// Version:     v1.01
+// Created:
+// Compilers:   Visual Studio 2017, gcc 7.3.0
+// Description: Sampling allocation profiler for the zone and the hunk
+// -------------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef DEDICATED
+#include <null/null_precompiled.h>
+#else
+#include <OWLib/precompiled.h>
+#endif
+
+/*
+
+While com_allocProfile is set, every zone and hunk allocation is counted by
+tag, which gives the allocation rate and the live and peak bytes of each tag.
+On average one allocation every com_allocProfile kilobytes is sampled: the
+call stack is recorded and the block remembers its sample, so the live bytes
+of every call site can be estimated by weighting each sample with the bytes
+it stands for.  Botlib and renderer memory come from the zone under their
+own tags, so they show up like everything else.
+
+The tables are malloc'd, the profiler must not allocate from what it
+watches.  Zone blocks keep the value Com_AllocProfileAlloc returned, with the
+profiling run in the upper bits, so blocks from an earlier run are ignored
+when they are freed.
+
+*/
+
+#define ALLOC_PROF_FRAMES 8
+#define ALLOC_PROF_SAMPLE_BITS 17
+#define MAX_ALLOC_SAMPLES ( ( 1 << ( ALLOC_PROF_SAMPLE_BITS - 1 ) ) )
+#define MAX_ALLOC_SITES 4096
+#define ALLOC_SITE_HASH 4096
+#define ALLOC_PROF_TAGS ( TAG_HUNK + 1 )
+#define ALLOC_PROF_MINUTES 30
+#define ALLOC_PROF_TOP_SITES 16
+
+typedef struct
+{
+    void*           frames[ALLOC_PROF_FRAMES];
+    S32             numFrames;
+    S32             tag;
+    U32             hash;
+    S32             nextHash;
+    S64             liveBytes; // weighted
+    S32             liveSamples;
+    S32             totalSamples;
+    S64             totalBytes; // weighted
+} allocSite_t;
+
+typedef struct
+{
+    S32             site; // -1 while the sample is free
+    S32             weight;
+    S32             nextFree;
+} allocSample_t;
+
+typedef struct
+{
+    SDL_atomic_t    allocs;
+    SDL_atomic_t    bytes; // wraps, only differences are used
+    SDL_atomic_t    live;
+    SDL_atomic_t    peak;
+} allocTagStats_t;
+
+static struct
+{
+    SDL_SpinLock    lock; // guards everything below but the atomics
+    SDL_atomic_t    run;
+    S32             interval;
+    U32             seed;
+    SDL_atomic_t    countdown;
+    
+    allocTagStats_t tags[ALLOC_PROF_TAGS];
+    
+    allocSample_t*  samples;
+    S32             firstFree;
+    
+    allocSite_t*    sites;
+    S32             numSites;
+    S32             siteHash[ALLOC_SITE_HASH];
+    
+    // for the rates, since the last report
+    S32             lastTime;
+    S32             lastAllocs[ALLOC_PROF_TAGS];
+    S32             lastBytes[ALLOC_PROF_TAGS];
+    
+    // peak total live bytes of each minute, for the growth over time
+    S32             minutePeak[ALLOC_PROF_MINUTES];
+    S32             numMinutes;
+    S32             minuteStart;
+    S32             nextDump;
+    S32             startTime;
+} ap;
+
+SDL_atomic_t com_allocProfileActive;
+
+static cvar_t* com_allocProfile;
+static cvar_t* com_allocProfileDump;
+
+static StringEntry allocTagNames[ALLOC_PROF_TAGS] = { "free", "general", "botlib", "renderer", "small", "crypto", "static", "slab", "hunk" };
+
+/*
+=================
+Com_AllocProfileSample
+
+Records the call stack of an allocation that was picked for sampling
+=================
+*/
+static S32 Com_AllocProfileSample( S32 run, S32 size, S32 tag )
+{
+    allocSample_t*  sample;
+    allocSite_t*    site;
+    void*           frames[ALLOC_PROF_FRAMES];
+    S32             i, numFrames, index, weight;
+    U32             hash;
+    
+    // leave out the profiler and the allocator itself
+    numFrames = Sys_Backtrace( frames, ALLOC_PROF_FRAMES, 3 );
+    
+    hash = 2166136261u ^ ( U32 )tag;
+    for( i = 0; i < numFrames; i++ )
+    {
+        hash = ( hash ^ ( U32 )( intptr_t )frames[i] ) * 16777619u;
+    }
+    
+    SDL_AtomicLock( &ap.lock );
+    
+    // the next sample comes after interval bytes on average, the jitter
+    // keeps it from locking on to a repeating pattern
+    ap.seed = ap.seed * 1664525 + 1013904223;
+    SDL_AtomicSet( &ap.countdown, ap.interval / 2 + ( S32 )( ( ap.seed >> 8 ) % ( U32 )ap.interval ) );
+    
+    // hunk memory is never freed on its own, so hunk samples only count
+    // for their site and don't need a slot
+    if( run != SDL_AtomicGet( &ap.run ) || ( tag != TAG_HUNK && ap.firstFree < 0 ) )
+    {
+        SDL_AtomicUnlock( &ap.lock );
+        return 0;
+    }
+    
+    for( index = ap.siteHash[hash & ( ALLOC_SITE_HASH - 1 )]; index >= 0; index = ap.sites[index].nextHash )
+    {
+        site = &ap.sites[index];
+        if( site->hash == hash && site->tag == tag && site->numFrames == numFrames && !::memcmp( site->frames, frames, numFrames * sizeof( frames[0] ) ) )
+        {
+            break;
+        }
+    }
+    
+    if( index < 0 )
+    {
+        if( ap.numSites == MAX_ALLOC_SITES )
+        {
+            SDL_AtomicUnlock( &ap.lock );
+            return 0;
+        }
+        
+        index = ap.numSites++;
+        site = &ap.sites[index];
+        ::memset( site, 0, sizeof( *site ) );
+        ::memcpy( site->frames, frames, numFrames * sizeof( frames[0] ) );
+        site->numFrames = numFrames;
+        site->tag = tag;
+        site->hash = hash;
+        site->nextHash = ap.siteHash[hash & ( ALLOC_SITE_HASH - 1 )];
+        ap.siteHash[hash & ( ALLOC_SITE_HASH - 1 )] = index;
+    }
+    
+    // an allocation bigger than the interval is always sampled and stands
+    // for itself, smaller ones for the whole interval
+    weight = size > ap.interval ? size : ap.interval;
+    
+    site = &ap.sites[index];
+    site->liveBytes += weight;
+    site->liveSamples++;
+    site->totalBytes += weight;
+    site->totalSamples++;
+    
+    if( tag == TAG_HUNK )
+    {
+        SDL_AtomicUnlock( &ap.lock );
+        return 0;
+    }
+    
+    i = ap.firstFree;
+    sample = &ap.samples[i];
+    ap.firstFree = sample->nextFree;
+    sample->site = index;
+    sample->weight = weight;
+    
+    SDL_AtomicUnlock( &ap.lock );
+    
+    return i + 1;
+}
+
+/*
+=================
+Com_AllocProfileAlloc
+
+Counts an allocation of size bytes, returns what the block has to hand to
+Com_AllocProfileFree, never 0
+=================
+*/
+S32 Com_AllocProfileAlloc( S32 size, S32 tag )
+{
+    allocTagStats_t* stats;
+    S32             run, live, peak, sample;
+    
+    run = SDL_AtomicGet( &ap.run );
+    stats = &ap.tags[tag > 0 && tag < ALLOC_PROF_TAGS ? tag : TAG_GENERAL];
+    
+    SDL_AtomicIncRef( &stats->allocs );
+    SDL_AtomicAdd( &stats->bytes, size );
+    live = SDL_AtomicAdd( &stats->live, size ) + size;
+    do
+    {
+        peak = SDL_AtomicGet( &stats->peak );
+    }
+    while( live > peak && !SDL_AtomicCAS( &stats->peak, peak, live ) );
+    
+    sample = 0;
+    if( SDL_AtomicAdd( &ap.countdown, -size ) - size <= 0 )
+    {
+        sample = Com_AllocProfileSample( run, size, tag );
+    }
+    
+    return ( run << ALLOC_PROF_SAMPLE_BITS ) | sample;
+}
+
+/*
+=================
+Com_AllocProfileFree
+=================
+*/
+void Com_AllocProfileFree( S32 profile, S32 size, S32 tag )
+{
+    allocSample_t*  sample;
+    allocSite_t*    site;
+    S32             index;
+    
+    if( ( profile >> ALLOC_PROF_SAMPLE_BITS ) != SDL_AtomicGet( &ap.run ) )
+    {
+        return; // counted by an earlier run
+    }
+    
+    SDL_AtomicAdd( &ap.tags[tag > 0 && tag < ALLOC_PROF_TAGS ? tag : TAG_GENERAL].live, -size );
+    
+    index = ( profile & ( ( 1 << ALLOC_PROF_SAMPLE_BITS ) - 1 ) ) - 1;
+    if( index < 0 )
+    {
+        return;
+    }
+    
+    SDL_AtomicLock( &ap.lock );
+    if( ( profile >> ALLOC_PROF_SAMPLE_BITS ) == SDL_AtomicGet( &ap.run ) )
+    {
+        sample = &ap.samples[index];
+        site = &ap.sites[sample->site];
+        site->liveBytes -= sample->weight;
+        site->liveSamples--;
+        
+        sample->site = -1;
+        sample->nextFree = ap.firstFree;
+        ap.firstFree = index;
+    }
+    SDL_AtomicUnlock( &ap.lock );
+}
+
+/*
+=================
+Com_AllocProfileHunkFree
+
+The hunk gave back bytes off the top of the permanent side
+=================
+*/
+void Com_AllocProfileHunkFree( S32 bytes )
+{
+    S32             i, live;
+    
+    if( !SDL_AtomicGet( &ap.run ) )
+    {
+        return;
+    }
+    
+    // hunk allocations made before the run started are given back too
+    live = SDL_AtomicAdd( &ap.tags[TAG_HUNK].live, -bytes ) - bytes;
+    if( live < 0 )
+    {
+        SDL_AtomicAdd( &ap.tags[TAG_HUNK].live, -live );
+    }
+    
+    // hunk samples don't know their address, so they all go
+    SDL_AtomicLock( &ap.lock );
+    for( i = 0; i < ap.numSites; i++ )
+    {
+        if( ap.sites[i].tag == TAG_HUNK )
+        {
+            ap.sites[i].liveBytes = 0;
+            ap.sites[i].liveSamples = 0;
+        }
+    }
+    SDL_AtomicUnlock( &ap.lock );
+}
+
+/*
+=================
+Com_AllocProfileStart
+
+Starts a new run, blocks counted by the old one are forgotten
+=================
+*/
+static bool Com_AllocProfileStart( S32 intervalKB )
+{
+    S32             i, run;
+    
+    if( !ap.samples )
+    {
+        ap.samples = ( allocSample_t* )malloc( MAX_ALLOC_SAMPLES * sizeof( *ap.samples ) );
+        ap.sites = ( allocSite_t* )malloc( MAX_ALLOC_SITES * sizeof( *ap.sites ) );
+        if( !ap.samples || !ap.sites )
+        {
+            free( ap.samples );
+            free( ap.sites );
+            ap.samples = NULL;
+            ap.sites = NULL;
+            return false;
+        }
+    }
+    
+    SDL_AtomicSet( &com_allocProfileActive, 0 );
+    SDL_AtomicLock( &ap.lock );
+    
+    // the run goes in the upper bits of a positive S32
+    run = ( SDL_AtomicGet( &ap.run ) + 1 ) & ( ( 1 << ( 31 - ALLOC_PROF_SAMPLE_BITS ) ) - 1 );
+    SDL_AtomicSet( &ap.run, run ? run : 1 );
+    
+    ap.interval = intervalKB * 1024;
+    ap.seed = ( U32 )Sys_Milliseconds();
+    SDL_AtomicSet( &ap.countdown, ap.interval );
+    
+    for( i = 0; i < ALLOC_PROF_TAGS; i++ )
+    {
+        SDL_AtomicSet( &ap.tags[i].allocs, 0 );
+        SDL_AtomicSet( &ap.tags[i].bytes, 0 );
+        SDL_AtomicSet( &ap.tags[i].live, 0 );
+        SDL_AtomicSet( &ap.tags[i].peak, 0 );
+        ap.lastAllocs[i] = 0;
+        ap.lastBytes[i] = 0;
+    }
+    
+    for( i = 0; i < MAX_ALLOC_SAMPLES; i++ )
+    {
+        ap.samples[i].site = -1;
+        ap.samples[i].nextFree = i + 1 < MAX_ALLOC_SAMPLES ? i + 1 : -1;
+    }
+    ap.firstFree = 0;
+    
+    ap.numSites = 0;
+    for( i = 0; i < ALLOC_SITE_HASH; i++ )
+    {
+        ap.siteHash[i] = -1;
+    }
+    
+    ap.startTime = ap.lastTime = ap.minuteStart = Sys_Milliseconds();
+    ap.numMinutes = 0;
+    ap.minutePeak[0] = 0;
+    ap.nextDump = ap.startTime + com_allocProfileDump->integer * 1000;
+    
+    SDL_AtomicUnlock( &ap.lock );
+    SDL_AtomicSet( &com_allocProfileActive, 1 );
+    
+    return true;
+}
+
+/*
+=================
+Com_AllocProfileLine
+=================
+*/
+static void Com_AllocProfileLine( fileHandle_t f, StringEntry fmt, ... )
+{
+    UTF8            line[1024];
+    va_list         argptr;
+    
+    va_start( argptr, fmt );
+    Q_vsnprintf( line, sizeof( line ), fmt, argptr );
+    va_end( argptr );
+    
+    if( f )
+    {
+        fileSystem->Write( line, strlen( line ), f );
+    }
+    else
+    {
+        Com_Printf( "%s", line );
+    }
+}
+
+/*
+=================
+Com_AllocProfileCompareSites
+=================
+*/
+static S32 Com_AllocProfileCompareSites( const void* a, const void* b )
+{
+    const allocSite_t* sa = ( const allocSite_t* )a;
+    const allocSite_t* sb = ( const allocSite_t* )b;
+    
+    if( sa->liveBytes != sb->liveBytes )
+    {
+        return sa->liveBytes > sb->liveBytes ? -1 : 1;
+    }
+    
+    return sb->totalSamples - sa->totalSamples;
+}
+
+/*
+=================
+Com_AllocProfileReport
+
+Prints to the console, or writes to f if it is set
+=================
+*/
+static void Com_AllocProfileReport( fileHandle_t f )
+{
+    allocSite_t*    sites;
+    UTF8            symbol[256];
+    S32             i, j, numSites, now, allocs, bytes;
+    F32             seconds;
+    
+    if( !SDL_AtomicGet( &ap.run ) )
+    {
+        Com_AllocProfileLine( f, "allocation profiler not started, set com_allocProfile\n" );
+        return;
+    }
+    
+    now = Sys_Milliseconds();
+    seconds = ( now - ap.lastTime ) / 1000.0f;
+    if( seconds <= 0.0f )
+    {
+        seconds = 0.001f;
+    }
+    
+    Com_AllocProfileLine( f, "allocation profile, %i s running, one sample every %i K\n", ( now - ap.startTime ) / 1000, ap.interval / 1024 );
+    Com_AllocProfileLine( f, "     tag    allocs/s       K/s    live K    peak K\n" );
+    for( i = 1; i < ALLOC_PROF_TAGS; i++ )
+    {
+        allocs = SDL_AtomicGet( &ap.tags[i].allocs );
+        bytes = SDL_AtomicGet( &ap.tags[i].bytes );
+        
+        if( allocs || SDL_AtomicGet( &ap.tags[i].live ) )
+        {
+            Com_AllocProfileLine( f, "%8s %11.1f %9.1f %9i %9i\n", allocTagNames[i], ( U32 )( allocs - ap.lastAllocs[i] ) / seconds,
+                                  ( U32 )( bytes - ap.lastBytes[i] ) / 1024.0f / seconds, SDL_AtomicGet( &ap.tags[i].live ) / 1024,
+                                  SDL_AtomicGet( &ap.tags[i].peak ) / 1024 );
+        }
+        
+        ap.lastAllocs[i] = allocs;
+        ap.lastBytes[i] = bytes;
+    }
+    ap.lastTime = now;
+    
+    Com_AllocProfileLine( f, "peak live K of each minute, oldest first:" );
+    for( i = ap.numMinutes < ALLOC_PROF_MINUTES ? 0 : ap.numMinutes - ALLOC_PROF_MINUTES + 1; i <= ap.numMinutes; i++ )
+    {
+        Com_AllocProfileLine( f, " %i", ap.minutePeak[i % ALLOC_PROF_MINUTES] / 1024 );
+    }
+    Com_AllocProfileLine( f, "\n" );
+    
+    // copy the sites out, resolving symbols can take a while
+    sites = ( allocSite_t* )malloc( MAX_ALLOC_SITES * sizeof( *sites ) );
+    if( !sites )
+    {
+        return;
+    }
+    
+    SDL_AtomicLock( &ap.lock );
+    numSites = ap.numSites;
+    ::memcpy( sites, ap.sites, numSites * sizeof( *sites ) );
+    SDL_AtomicUnlock( &ap.lock );
+    
+    qsort( sites, numSites, sizeof( *sites ), Com_AllocProfileCompareSites );
+    
+    Com_AllocProfileLine( f, "%i call sites, by estimated live bytes:\n", numSites );
+    for( i = 0; i < numSites && i < ALLOC_PROF_TOP_SITES; i++ )
+    {
+        Com_AllocProfileLine( f, "%9i K live in %i samples, %i K total, %s\n", ( S32 )( sites[i].liveBytes / 1024 ), sites[i].liveSamples,
+                              ( S32 )( sites[i].totalBytes / 1024 ), allocTagNames[sites[i].tag] );
+        for( j = 0; j < sites[i].numFrames; j++ )
+        {
+            Sys_BacktraceSymbol( sites[i].frames[j], symbol, sizeof( symbol ) );
+            Com_AllocProfileLine( f, "            %s\n", symbol );
+        }
+    }
+    
+    free( sites );
+}
+
+/*
+=================
+Com_AllocProfile_f
+=================
+*/
+static void Com_AllocProfile_f( void )
+{
+    fileHandle_t    f;
+    
+    if( Cmd_Argc() == 3 && !Q_stricmp( Cmd_Argv( 1 ), "dump" ) )
+    {
+        f = fileSystem->FOpenFileWrite( Cmd_Argv( 2 ) );
+        if( !f )
+        {
+            Com_Printf( "couldn't write %s\n", Cmd_Argv( 2 ) );
+            return;
+        }
+        Com_AllocProfileReport( f );
+        fileSystem->FCloseFile( f );
+        return;
+    }
+    
+    if( Cmd_Argc() == 2 && !Q_stricmp( Cmd_Argv( 1 ), "reset" ) )
+    {
+        if( SDL_AtomicGet( &com_allocProfileActive ) )
+        {
+            Com_AllocProfileStart( ap.interval / 1024 );
+        }
+        return;
+    }
+    
+    if( Cmd_Argc() != 1 )
+    {
+        Com_Printf( "usage: allocprof [reset | dump <file>]\n" );
+        return;
+    }
+    
+    Com_AllocProfileReport( 0 );
+}
+
+/*
+=================
+Com_AllocProfileFrame
+
+Starts and stops runs as com_allocProfile changes, keeps the per minute
+peaks and writes the periodic dumps
+=================
+*/
+void Com_AllocProfileFrame( void )
+{
+    fileHandle_t    f;
+    S32             i, now, live;
+    
+    if( com_allocProfile->modified )
+    {
+        com_allocProfile->modified = false;
+        
+        if( com_allocProfile->integer > 0 )
+        {
+            if( !Com_AllocProfileStart( com_allocProfile->integer ) )
+            {
+                Com_Printf( S_COLOR_YELLOW "WARNING: not enough memory for the allocation profiler\n" );
+            }
+        }
+        else
+        {
+            SDL_AtomicSet( &com_allocProfileActive, 0 );
+        }
+    }
+    
+    if( !SDL_AtomicGet( &com_allocProfileActive ) )
+    {
+        return;
+    }
+    
+    now = Sys_Milliseconds();
+    
+    live = 0;
+    for( i = 1; i < ALLOC_PROF_TAGS; i++ )
+    {
+        live += SDL_AtomicGet( &ap.tags[i].live );
+    }
+    
+    if( now - ap.minuteStart >= 60000 )
+    {
+        ap.minuteStart = now;
+        ap.numMinutes++;
+        ap.minutePeak[ap.numMinutes % ALLOC_PROF_MINUTES] = 0;
+    }
+    if( live > ap.minutePeak[ap.numMinutes % ALLOC_PROF_MINUTES] )
+    {
+        ap.minutePeak[ap.numMinutes % ALLOC_PROF_MINUTES] = live;
+    }
+    
+    if( com_allocProfileDump->integer > 0 && now - ap.nextDump >= 0 )
+    {
+        ap.nextDump = now + com_allocProfileDump->integer * 1000;
+        
+        f = fileSystem->FOpenFileAppend( "allocprof.log" );
+        if( f )
+        {
+            Com_AllocProfileLine( f, "\n" );
+            Com_AllocProfileReport( f );
+            fileSystem->FCloseFile( f );
+        }
+    }
+}
+
+/*
+=================
+Com_InitAllocProfile
+=================
+*/
+void Com_InitAllocProfile( void )
+{
+    com_allocProfile = cvarSystem->Get( "com_allocProfile", "0", CVAR_TEMP );
+    com_allocProfileDump = cvarSystem->Get( "com_allocProfileDump", "60", CVAR_ARCHIVE );
+    com_allocProfile->modified = true;
+    
+    Cmd_AddCommand( "allocprof", Com_AllocProfile_f );
+}
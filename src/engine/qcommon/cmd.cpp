@@ -43,18 +43,52 @@
 
 #define MAX_CMD_BUFFER  131072
 #define MAX_CMD_LINE    1024
+#define MAX_CMD_SEGMENTS	64
+#define MAX_EXEC_CACHE	32
 
 typedef struct
 {
     U8*           data;
     S32             maxsize;
     S32             cursize;
+    S32             head;		// offset of the first byte, the text wraps around the end of data
 } cmd_t;
 
 S32             cmd_wait;
 cmd_t           cmd_text;
 U8            cmd_text_buf[MAX_CMD_BUFFER];
 
+// a config file already split into command lines the way Cbuf_Execute would split it
+typedef struct cmdScript_s
+{
+    UTF8            name[MAX_QPATH];
+    U32             hash;		// of the file as read, before COM_Compress
+    S32             length;
+    UTF8*           source;		// the file as read, a matching hash alone isn't trusted
+    S32             refs;		// the exec cache holds one, every buffered run of it another
+    UTF8*           text;		// the compressed file with each line 0 terminated in place
+    UTF8**          lines;
+    S32             numLines;
+    struct cmdScript_s* next;
+} cmdScript_t;
+
+// the buffer is run front to back as a list of segments, either text in
+// cmd_text or the remaining lines of a compiled script
+typedef struct
+{
+    cmdScript_t*    script;		// NULL for text in cmd_text
+    S32             size;		// bytes of cmd_text, or lines left in the script
+    S32             next;		// next line of the script
+} cmdSegment_t;
+
+static cmdSegment_t	cmd_segments[MAX_CMD_SEGMENTS];
+static S32			cmd_firstSegment;
+static S32			cmd_numSegments;
+
+static cmdScript_t*	cmd_execCache;	// most recently used first
+
+static void Cmd_ReleaseScript( cmdScript_t* script );
+
 // Delay stuff
 
 #define MAX_DELAYED_COMMANDS    64
@@ -80,6 +114,7 @@ delayed_cmd_s delayed_cmd[MAX_DELAYED_COMMANDS];
 typedef struct cmd_function_s
 {
     struct cmd_function_s* next;
+    struct cmd_function_s* hashNext;
     UTF8*           name;
     xcommand_t      function;
     completionFunc_t	complete;
@@ -101,12 +136,39 @@ static cmdContext_t		savedCmd;
 // static UTF8     cmd.tokenized[BIG_INFO_STRING + MAX_STRING_TOKENS];	// will have 0 bytes inserted
 // static UTF8     cmd.cmd[BIG_INFO_STRING];	// the original command we received (no token processing)
 
-static cmd_function_t* cmd_functions;	// possible commands to execute
-
+static cmd_function_t* cmd_functions;	// possible commands to execute, in the order completion lists them
 
+#define CMD_HASH_SIZE	1024
+static cmd_function_t* cmd_hashTable[CMD_HASH_SIZE];	// the same commands chained by Cmd_HashName
 
 //=============================================================================
 
+/*
+============
+Cmd_HashName
+
+Folds case the way Q_stricmp does, commands and aliases are looked up without it
+============
+*/
+static S32 Cmd_HashName( StringEntry name )
+{
+    U32             hash;
+    S32             c;
+    
+    // FNV-1a
+    hash = 2166136261u;
+    while( ( c = *name++ ) != 0 )
+    {
+        if( c >= 'A' && c <= 'Z' )
+        {
+            c += 'a' - 'A';
+        }
+        hash = ( hash ^ ( U8 )c ) * 16777619u;
+    }
+    
+    return hash & ( CMD_HASH_SIZE - 1 );
+}
+
 /*
 ============
 Cmd_FindCommand
@@ -115,7 +177,7 @@ Cmd_FindCommand
 cmd_function_t* Cmd_FindCommand( StringEntry cmd_name )
 {
     cmd_function_t* cmd;
-    for( cmd = cmd_functions; cmd; cmd = cmd->next )
+    for( cmd = cmd_hashTable[Cmd_HashName( cmd_name )]; cmd; cmd = cmd->hashNext )
         if( !Q_stricmp( cmd_name, cmd->name ) )
             return cmd;
     return NULL;
@@ -165,6 +227,135 @@ void Cbuf_Init( void )
     cmd_text.data = cmd_text_buf;
     cmd_text.maxsize = MAX_CMD_BUFFER;
     cmd_text.cursize = 0;
+    cmd_text.head = 0;
+    
+    cmd_firstSegment = 0;
+    cmd_numSegments = 0;
+}
+
+/*
+============
+Cbuf_WriteText
+
+Copies text into cmd_text starting at offset, wrapping around the end
+============
+*/
+static void Cbuf_WriteText( S32 offset, StringEntry text, S32 length )
+{
+    S32             split;
+    
+    split = cmd_text.maxsize - offset;
+    if( length <= split )
+    {
+        ::memcpy( &cmd_text.data[offset], text, length );
+    }
+    else
+    {
+        ::memcpy( &cmd_text.data[offset], text, split );
+        ::memcpy( cmd_text.data, text + split, length - split );
+    }
+}
+
+/*
+============
+Cbuf_PushSegment
+
+Adds an empty segment at the front or the back of the buffer
+============
+*/
+static cmdSegment_t* Cbuf_PushSegment( bool front )
+{
+    cmdSegment_t*   seg;
+    
+    if( cmd_numSegments == MAX_CMD_SEGMENTS )
+    {
+        return NULL;
+    }
+    
+    if( front )
+    {
+        cmd_firstSegment = ( cmd_firstSegment + MAX_CMD_SEGMENTS - 1 ) % MAX_CMD_SEGMENTS;
+        seg = &cmd_segments[cmd_firstSegment];
+    }
+    else
+    {
+        seg = &cmd_segments[( cmd_firstSegment + cmd_numSegments ) % MAX_CMD_SEGMENTS];
+    }
+    cmd_numSegments++;
+    
+    ::memset( seg, 0, sizeof( *seg ) );
+    return seg;
+}
+
+/*
+============
+Cbuf_PopSegment
+============
+*/
+static void Cbuf_PopSegment( void )
+{
+    cmd_firstSegment = ( cmd_firstSegment + 1 ) % MAX_CMD_SEGMENTS;
+    cmd_numSegments--;
+}
+
+/*
+============
+Cbuf_ExpandScript
+
+Turns the lines left in a script segment at the front or the back of the
+buffer back into text in cmd_text, for when every segment is in use.  Joined
+with \n the lines split exactly the same way again.  Returns false if the
+text and reserve more bytes don't fit.
+============
+*/
+static bool Cbuf_ExpandScript( cmdSegment_t* seg, bool front, S32 reserve )
+{
+    cmdScript_t*    script;
+    S32             i, len, size, pos;
+    
+    script = seg->script;
+    
+    size = 0;
+    for( i = seg->next; i < script->numLines; i++ )
+    {
+        size += strlen( script->lines[i] ) + 1;
+    }
+    
+    if( cmd_text.cursize + size + reserve > cmd_text.maxsize )
+    {
+        return false;
+    }
+    
+    if( front )
+    {
+        // last line first, each one goes in just before the one after it
+        for( i = script->numLines - 1; i >= seg->next; i-- )
+        {
+            len = strlen( script->lines[i] );
+            cmd_text.head = ( cmd_text.head + cmd_text.maxsize - len - 1 ) % cmd_text.maxsize;
+            Cbuf_WriteText( cmd_text.head, script->lines[i], len );
+            cmd_text.data[( cmd_text.head + len ) % cmd_text.maxsize] = '\n';
+        }
+    }
+    else
+    {
+        pos = ( cmd_text.head + cmd_text.cursize ) % cmd_text.maxsize;
+        for( i = seg->next; i < script->numLines; i++ )
+        {
+            len = strlen( script->lines[i] );
+            Cbuf_WriteText( pos, script->lines[i], len );
+            cmd_text.data[( pos + len ) % cmd_text.maxsize] = '\n';
+            pos = ( pos + len + 1 ) % cmd_text.maxsize;
+        }
+    }
+    cmd_text.cursize += size;
+    
+    seg->script = NULL;
+    seg->size = size;
+    seg->next = 0;
+    Cmd_ReleaseScript( script );
+    
+    return true;
 }
 
 /*
@@ -176,6 +367,7 @@ Adds command text at the end of the buffer, does NOT add a final \n
 */
 void Cbuf_AddText( StringEntry text )
 {
+    cmdSegment_t*   seg;
     S32             l;
     
     l = strlen( text );
@@ -185,8 +377,31 @@ void Cbuf_AddText( StringEntry text )
         Com_Printf( "Cbuf_AddText: overflow\n" );
         return;
     }
-    ::memcpy( &cmd_text.data[cmd_text.cursize], text, l );
+    
+    if( !l )
+    {
+        return;
+    }
+    
+    // text appended to a partial line has to join it, so only start a new
+    // segment when the last one is a script
+    seg = cmd_numSegments ? &cmd_segments[( cmd_firstSegment + cmd_numSegments - 1 ) % MAX_CMD_SEGMENTS] : NULL;
+    if( !seg || seg->script )
+    {
+        if( cmd_numSegments < MAX_CMD_SEGMENTS )
+        {
+            seg = Cbuf_PushSegment( false );
+        }
+        else if( !Cbuf_ExpandScript( seg, false, l + 1 ) )
+        {
+            Com_Printf( "Cbuf_AddText: overflow\n" );
+            return;
+        }
+    }
+    
+    Cbuf_WriteText( ( cmd_text.head + cmd_text.cursize ) % cmd_text.maxsize, text, l );
     cmd_text.cursize += l;
+    seg->size += l;
 }
 
 
@@ -200,8 +415,8 @@ Adds a \n to the text
 */
 void Cbuf_InsertText( StringEntry text )
 {
+    cmdSegment_t*   seg;
     S32             len;
-    S32             i;
     
     len = strlen( text ) + 1;
     if( len + cmd_text.cursize > cmd_text.maxsize )
@@ -210,19 +425,52 @@ void Cbuf_InsertText( StringEntry text )
         return;
     }
     
-    // move the existing command text
-    for( i = cmd_text.cursize - 1; i >= 0; i-- )
+    seg = cmd_numSegments ? &cmd_segments[cmd_firstSegment] : NULL;
+    if( !seg || seg->script )
     {
-        cmd_text.data[i + len] = cmd_text.data[i];
+        if( cmd_numSegments < MAX_CMD_SEGMENTS )
+        {
+            seg = Cbuf_PushSegment( true );
+        }
+        else if( !Cbuf_ExpandScript( seg, true, len ) )
+        {
+            Com_Printf( "Cbuf_InsertText overflowed\n" );
+            return;
+        }
     }
     
-    // copy the new text in
-    ::memcpy( cmd_text.data, text, len - 1 );
-    
-    // add a \n
-    cmd_text.data[len - 1] = '\n';
+    // the text goes in just before the head, nothing already buffered moves
+    cmd_text.head = ( cmd_text.head + cmd_text.maxsize - len ) % cmd_text.maxsize;
+    Cbuf_WriteText( cmd_text.head, text, len - 1 );
+    cmd_text.data[( cmd_text.head + len - 1 ) % cmd_text.maxsize] = '\n';
     
     cmd_text.cursize += len;
+    seg->size += len;
+}
+
+/*
+============
+Cbuf_InsertScript
+
+Queues the lines of a compiled script immediately after the current command,
+returns false when there is no room and the text has to be inserted instead
+============
+*/
+static bool Cbuf_InsertScript( cmdScript_t* script )
+{
+    cmdSegment_t*   seg;
+    
+    seg = Cbuf_PushSegment( true );
+    if( !seg )
+    {
+        return false;
+    }
+    
+    seg->script = script;
+    seg->size = script->numLines;
+    script->refs++;
+    
+    return true;
 }
 
 
@@ -244,7 +492,7 @@ void Cbuf_ExecuteText( S32 exec_when, StringEntry text )
             else
             {
                 Cbuf_Execute();
-                Com_DPrintf( S_COLOR_YELLOW "EXEC_NOW %s\n", cmd_text.data );
+                Com_DPrintf( S_COLOR_YELLOW "EXEC_NOW\n" );
             }
             break;
         case EXEC_INSERT:
@@ -258,6 +506,54 @@ void Cbuf_ExecuteText( S32 exec_when, StringEntry text )
     }
 }
 
+/*
+============
+Cbuf_LineLength
+
+Length of the command starting at text[start], breaking on \n, \r and ; outside
+of quotes, size if there is no break.  Positions wrap back to 0 at wrap.
+============
+*/
+static S32 Cbuf_LineLength( const UTF8* text, S32 wrap, S32 start, S32 size )
+{
+    S32             i, pos;
+    S32             quotes;
+    UTF8            c;
+    
+    quotes = 0;
+    pos = start;
+    for( i = 0; i < size; i++, pos++ )
+    {
+        if( pos >= wrap )
+        {
+            pos -= wrap;
+        }
+        c = text[pos];
+        
+        if( c == '\\' && i + 1 < size && text[( pos + 1 ) % wrap] == '"' )
+        {
+            i++;
+            pos++;
+            continue;
+        }
+        
+        if( c == '"' )
+        {
+            quotes++;
+        }
+        if( !( quotes & 1 ) && c == ';' )
+        {
+            break;			// don't break if inside a quoted string
+        }
+        if( c == '\n' || c == '\r' )
+        {
+            break;
+        }
+    }
+    
+    return i;
+}
+
 /*
 ============
 Cbuf_Execute
@@ -266,11 +562,11 @@ Cbuf_Execute
 void Cbuf_Execute( void )
 {
     S32             i;
-    UTF8*           text;
     UTF8            line[MAX_CMD_LINE];
-    S32             quotes;
+    cmdSegment_t*   seg;
+    cmdScript_t*    script;
     
-    while( cmd_text.cursize )
+    while( cmd_numSegments )
     {
         if( cmd_wait )
         {
@@ -280,53 +576,55 @@ void Cbuf_Execute( void )
             break;
         }
         
-        // find a \n or ; line break
-        text = ( UTF8* )cmd_text.data;
+        seg = &cmd_segments[cmd_firstSegment];
         
-        quotes = 0;
-        for( i = 0; i < cmd_text.cursize; i++ )
+        // take the line off the buffer before running it, commands (exec)
+        // can insert new segments in front of the rest
+        if( seg->script )
         {
-            if( text[i] == '\\' && text[i + 1] == '"' )
+            script = seg->script;
+            Q_strncpyz( line, script->lines[seg->next++], sizeof( line ) );
+            
+            if( !--seg->size )
             {
-                i++;
-                continue;
+                Cbuf_PopSegment();
+                Cmd_ReleaseScript( script );
+            }
+        }
+        else
+        {
+            // find a \n or ; line break, the text may wrap around the end of the buffer
+            i = Cbuf_LineLength( ( UTF8* )cmd_text.data, cmd_text.maxsize, cmd_text.head, seg->size );
+            
+            if( i >= ( MAX_CMD_LINE - 1 ) )
+            {
+                i = MAX_CMD_LINE - 1;
             }
             
-            if( text[i] == '"' )
+            if( cmd_text.head + i <= cmd_text.maxsize )
             {
-                quotes++;
+                ::memcpy( line, &cmd_text.data[cmd_text.head], i );
             }
-            if( !( quotes & 1 ) && text[i] == ';' )
+            else
             {
-                break;			// don't break if inside a quoted string
+                ::memcpy( line, &cmd_text.data[cmd_text.head], cmd_text.maxsize - cmd_text.head );
+                ::memcpy( line + cmd_text.maxsize - cmd_text.head, cmd_text.data, i - ( cmd_text.maxsize - cmd_text.head ) );
             }
-            if( text[i] == '\n' || text[i] == '\r' )
+            line[i] = 0;
+            
+            // step the head past the line and its break, the rest stays where it is
+            if( i < seg->size )
             {
-                break;
+                i++;
             }
-        }
-        
-        if( i >= ( MAX_CMD_LINE - 1 ) )
-        {
-            i = MAX_CMD_LINE - 1;
-        }
-        
-        memcpy( line, text, i );
-        line[i] = 0;
-        
-// delete the text from the command buffer and move remaining commands down
-// this is necessary because commands (exec) can insert data at the
-// beginning of the text buffer
-
-        if( i == cmd_text.cursize )
-        {
-            cmd_text.cursize = 0;
-        }
-        else
-        {
-            i++;
+            cmd_text.head = ( cmd_text.head + i ) % cmd_text.maxsize;
             cmd_text.cursize -= i;
-            memmove( text, text + i, cmd_text.cursize );
+            seg->size -= i;
+            
+            if( !seg->size )
+            {
+                Cbuf_PopSegment();
+            }
         }
         
 // execute the command line
@@ -403,96 +701,246 @@ Cmd_Exec_f
 
 /*
 ===============
-Cmd_Exec_f
+Cmd_ReleaseScript
 ===============
 */
-static void Cmd_ExecFile( UTF8* f )
+static void Cmd_ReleaseScript( cmdScript_t* script )
 {
-    S32 i;
-    
-    COM_Compress( f );
-    
-    cvarSystem->Get( "arg_all", Cmd_ArgsFrom( 2 ), CVAR_TEMP | CVAR_ROM | CVAR_USER_CREATED );
-    cvarSystem->Set( "arg_all", Cmd_ArgsFrom( 2 ) );
-    cvarSystem->Get( "arg_count", va( "%i", Cmd_Argc() - 2 ), CVAR_TEMP | CVAR_ROM | CVAR_USER_CREATED );
-    cvarSystem->Set( "arg_count", va( "%i", Cmd_Argc() - 2 ) );
-    
-    for( i = Cmd_Argc() - 2; i; i-- )
+    if( --script->refs )
     {
-        cvarSystem->Get( va( "arg_%i", i ), Cmd_Argv( i + 1 ), CVAR_TEMP | CVAR_ROM | CVAR_USER_CREATED );
-        cvarSystem->Set( va( "arg_%i", i ), Cmd_Argv( i + 1 ) );
+        return;
     }
     
-    Cbuf_InsertText( f );
+    Z_Free( script->source );
+    Z_Free( script );
 }
 
-void Cmd_Exec_f( void )
+/*
+===============
+Cmd_CompileScript
+
+Splits a compressed file into the lines Cbuf_Execute would have pulled off
+the buffer after Cbuf_InsertText, truncation of long lines included
+===============
+*/
+static cmdScript_t* Cmd_CompileScript( StringEntry name, U32 hash, UTF8* source, S32 length, StringEntry f )
 {
-    union
-    {
-        UTF8*	c;
-        void*	v;
-    } f;
-    S32		len;
-    UTF8	filename[MAX_QPATH];
-    fileHandle_t h;
-    bool success = false;
+    cmdScript_t*    script;
+    UTF8*           text;
+    S32             size, p, i, numLines;
     
-    if( Cmd_Argc() < 2 )
+    // Cbuf_InsertText adds the final \n, it also guarantees every line ends
+    // on a break inside the text
+    size = strlen( f ) + 1;
+    
+    // count against f itself, running out of text is where that final \n would break
+    numLines = 0;
+    for( p = 0; p < size; p += i + 1 )
     {
-        Com_Printf( "exec <filename> (args) : execute a script file\n" );
-        return;
+        i = Cbuf_LineLength( f, size, p, size - 1 - p );
+        if( i >= ( MAX_CMD_LINE - 1 ) )
+        {
+            i = MAX_CMD_LINE - 1;
+        }
+        numLines++;
     }
     
-    Com_Printf( "execing %s\n", Cmd_Argv( 1 ) );
-    
-    Q_strncpyz( filename, Cmd_Argv( 1 ), sizeof( filename ) );
-    COM_DefaultExtension( filename, sizeof( filename ), ".cfg" );
+    script = ( cmdScript_t* )Z_Malloc( sizeof( *script ) + numLines * sizeof( UTF8* ) + size + 1 );
+    Q_strncpyz( script->name, name, sizeof( script->name ) );
+    script->hash = hash;
+    script->length = length;
+    script->source = source;
+    script->refs = 1;
+    script->lines = ( UTF8** )( script + 1 );
+    script->text = ( UTF8* )( script->lines + numLines );
+    script->numLines = 0;
+    script->next = NULL;
     
-    len = fileSystem->SV_FOpenFileRead( filename, &h );
-    if( h )
-    {
-        success = true;
-        f.v = Hunk_AllocateTempMemory( len + 1 );
-        fileSystem->Read( f.v, len, h );
-        f.c[len] = 0;
-        fileSystem->FCloseFile( h );
-        Cmd_ExecFile( f.c );
-        Hunk_FreeTempMemory( f.v );
-    }
+    text = script->text;
+    ::memcpy( text, f, size - 1 );
+    text[size - 1] = '\n';
+    text[size] = 0;
     
-    fileSystem->ReadFile( filename, &f.v );
-    if( f.c )
+    for( p = 0; p < size; p += i + 1 )
     {
-        success = true;
-        Cmd_ExecFile( f.c );
-        fileSystem->FreeFile( f.v );
+        i = Cbuf_LineLength( text, size, p, size - p );
+        if( i >= ( MAX_CMD_LINE - 1 ) )
+        {
+            i = MAX_CMD_LINE - 1;
+        }
+        
+        // the break, or the character a truncated line loses, becomes the terminator
+        script->lines[script->numLines++] = text + p;
+        text[p + i] = 0;
     }
     
-    if( !success )
-        Com_Printf( "couldn't exec %s\n", Cmd_Argv( 1 ) );
+    return script;
 }
 
-
 /*
 ===============
-Cmd_Vstr_f
+Cmd_CachedScript
 
-Inserts the current value of a variable as command text
+Returns the compiled form of a file read for exec, compiling it on a miss.
+f is compressed in place when that happens.
 ===============
 */
-void Cmd_Vstr_f( void )
+static cmdScript_t* Cmd_CachedScript( StringEntry filename, UTF8* f )
 {
-    UTF8*           v;
+    cmdScript_t*    script;
+    cmdScript_t**   prev;
+    U32             hash;
+    S32             length, count;
+    const UTF8*     s;
+    UTF8*           source;
     
-    if( Cmd_Argc() != 2 )
+    // FNV-1a over the file as read, a quick reject before comparing the stored source
+    hash = 2166136261u;
+    for( s = f; *s; s++ )
     {
-        Com_Printf( "vstr <variablename> : execute a variable command\n" );
-        return;
+        hash = ( hash ^ ( U8 )*s ) * 16777619u;
     }
+    length = s - f;
     
-    v = cvarSystem->VariableString( Cmd_Argv( 1 ) );
-    Cbuf_InsertText( va( "%s\n", v ) );
+    for( prev = &cmd_execCache; *prev; prev = &( *prev )->next )
+    {
+        script = *prev;
+        if( script->hash == hash && script->length == length && !Q_stricmp( script->name, filename ) &&
+                !::memcmp( script->source, f, length ) )
+        {
+            // move to the front
+            *prev = script->next;
+            script->next = cmd_execCache;
+            cmd_execCache = script;
+            return script;
+        }
+    }
+    
+    source = ( UTF8* )Z_Malloc( length + 1 );
+    ::memcpy( source, f, length );
+    
+    COM_Compress( f );
+    script = Cmd_CompileScript( filename, hash, source, length, f );
+    script->next = cmd_execCache;
+    cmd_execCache = script;
+    
+    // drop the least recently used, buffered runs keep their own reference
+    for( count = 1, prev = &cmd_execCache->next; *prev; prev = &( *prev )->next )
+    {
+        if( ++count > MAX_EXEC_CACHE )
+        {
+            Cmd_ReleaseScript( *prev );
+            *prev = NULL;
+            break;
+        }
+    }
+    
+    return script;
+}
+
+/*
+===============
+Cmd_ExecFile
+===============
+*/
+static void Cmd_ExecFile( StringEntry filename, UTF8* f )
+{
+    S32 i;
+    
+    cvarSystem->Get( "arg_all", Cmd_ArgsFrom( 2 ), CVAR_TEMP | CVAR_ROM | CVAR_USER_CREATED );
+    cvarSystem->Set( "arg_all", Cmd_ArgsFrom( 2 ) );
+    cvarSystem->Get( "arg_count", va( "%i", Cmd_Argc() - 2 ), CVAR_TEMP | CVAR_ROM | CVAR_USER_CREATED );
+    cvarSystem->Set( "arg_count", va( "%i", Cmd_Argc() - 2 ) );
+    
+    for( i = Cmd_Argc() - 2; i; i-- )
+    {
+        cvarSystem->Get( va( "arg_%i", i ), Cmd_Argv( i + 1 ), CVAR_TEMP | CVAR_ROM | CVAR_USER_CREATED );
+        cvarSystem->Set( va( "arg_%i", i ), Cmd_Argv( i + 1 ) );
+    }
+    
+    // with every segment in use (deeply nested execs) fall back to the text
+    if( cmd_numSegments < MAX_CMD_SEGMENTS )
+    {
+        Cbuf_InsertScript( Cmd_CachedScript( filename, f ) );
+        return;
+    }
+    
+    COM_Compress( f );
+    Cbuf_InsertText( f );
+}
+
+/*
+===============
+Cmd_Exec_f
+===============
+*/
+void Cmd_Exec_f( void )
+{
+    union
+    {
+        UTF8*	c;
+        void*	v;
+    } f;
+    S32		len;
+    UTF8	filename[MAX_QPATH];
+    fileHandle_t h;
+    bool success = false;
+    
+    if( Cmd_Argc() < 2 )
+    {
+        Com_Printf( "exec <filename> (args) : execute a script file\n" );
+        return;
+    }
+    
+    Com_Printf( "execing %s\n", Cmd_Argv( 1 ) );
+    
+    Q_strncpyz( filename, Cmd_Argv( 1 ), sizeof( filename ) );
+    COM_DefaultExtension( filename, sizeof( filename ), ".cfg" );
+    
+    len = fileSystem->SV_FOpenFileRead( filename, &h );
+    if( h )
+    {
+        success = true;
+        f.v = Hunk_AllocateTempMemory( len + 1 );
+        fileSystem->Read( f.v, len, h );
+        f.c[len] = 0;
+        fileSystem->FCloseFile( h );
+        Cmd_ExecFile( filename, f.c );
+        Hunk_FreeTempMemory( f.v );
+    }
+    
+    fileSystem->ReadFile( filename, &f.v );
+    if( f.c )
+    {
+        success = true;
+        Cmd_ExecFile( filename, f.c );
+        fileSystem->FreeFile( f.v );
+    }
+    
+    if( !success )
+        Com_Printf( "couldn't exec %s\n", Cmd_Argv( 1 ) );
+}
+
+
+/*
+===============
+Cmd_Vstr_f
+
+Inserts the current value of a variable as command text
+===============
+*/
+void Cmd_Vstr_f( void )
+{
+    UTF8*           v;
+    
+    if( Cmd_Argc() != 2 )
+    {
+        Com_Printf( "vstr <variablename> : execute a variable command\n" );
+        return;
+    }
+    
+    v = cvarSystem->VariableString( Cmd_Argv( 1 ) );
+    Cbuf_InsertText( va( "%s\n", v ) );
 }
 
 /*
@@ -1186,11 +1634,56 @@ void Cmd_Random_f( void )
 typedef struct cmd_alias_s
 {
     struct cmd_alias_s*	next;
+    struct cmd_alias_s*	hashNext;
     UTF8*				name;
     UTF8*				exec;
 } cmd_alias_t;
 
 static cmd_alias_t*	cmd_aliases = NULL;
+static cmd_alias_t*	cmd_aliasHashTable[CMD_HASH_SIZE];
+
+/*
+============
+Cmd_FindAlias
+============
+*/
+static cmd_alias_t* Cmd_FindAlias( StringEntry name )
+{
+    cmd_alias_t*	alias;
+    
+    for( alias = cmd_aliasHashTable[Cmd_HashName( name )]; alias; alias = alias->hashNext )
+    {
+        if( !Q_stricmp( name, alias->name ) )
+            break;
+    }
+    
+    return alias;
+}
+
+/*
+============
+Cmd_FreeAlias
+
+Unlinks the alias from the hash table, the caller takes it off cmd_aliases
+============
+*/
+static void Cmd_FreeAlias( cmd_alias_t* alias )
+{
+    cmd_alias_t**	back;
+    
+    for( back = &cmd_aliasHashTable[Cmd_HashName( alias->name )]; *back; back = &( *back )->hashNext )
+    {
+        if( *back == alias )
+        {
+            *back = alias->hashNext;
+            break;
+        }
+    }
+    
+    Z_Free( alias->name );
+    Z_Free( alias->exec );
+    Z_Free( alias );
+}
 
 /*
 ============
@@ -1204,11 +1697,7 @@ void Cmd_RunAlias_f( void )
     UTF8*		 args = Cmd_ArgsFrom( 1 );
     
     // Find existing alias
-    for( alias = cmd_aliases; alias; alias = alias->next )
-    {
-        if( !Q_stricmp( name, alias->name ) )
-            break;
-    }
+    alias = Cmd_FindAlias( name );
     
     if( !alias )
         Com_Error( ERR_FATAL, "Alias: Alias %s doesn't exist", name );
@@ -1274,9 +1763,7 @@ void Cmd_ClearAliases_f( void )
     {
         next = alias->next;
         Cmd_RemoveCommand( alias->name );
-        Z_Free( alias->name );
-        Z_Free( alias->exec );
-        Z_Free( alias );
+        Cmd_FreeAlias( alias );
         alias = next;
     }
     cmd_aliases = NULL;
@@ -1312,9 +1799,7 @@ void Cmd_UnAlias_f( void )
         if( !Q_stricmp( name, alias->name ) )
         {
             *back = alias->next;
-            Z_Free( alias->name );
-            Z_Free( alias->exec );
-            Z_Free( alias );
+            Cmd_FreeAlias( alias );
             Cmd_RemoveCommand( name );
             
             // update autogen.cfg
@@ -1345,11 +1830,7 @@ void Cmd_Alias_f( void )
     name = Cmd_Argv( 1 );
     
     // Find existing alias
-    for( alias = cmd_aliases; alias; alias = alias->next )
-    {
-        if( !Q_stricmp( name, alias->name ) )
-            break;
-    }
+    alias = Cmd_FindAlias( name );
     
     // Modify/create an alias
     if( Cmd_Argc() > 2 )
@@ -1379,6 +1860,8 @@ void Cmd_Alias_f( void )
             alias->exec = CopyString( Cmd_ArgsFrom( 2 ) );
             alias->next = cmd_aliases;
             cmd_aliases = alias;
+            alias->hashNext = cmd_aliasHashTable[Cmd_HashName( name )];
+            cmd_aliasHashTable[Cmd_HashName( name )] = alias;
             Cmd_AddCommand( name, Cmd_RunAlias_f );
         }
         else
@@ -1447,7 +1930,15 @@ Cmd_SaveCmdContext
 */
 void Cmd_SaveCmdContext( void )
 {
-    ::memcpy( &savedCmd, &cmd, sizeof( cmdContext_t ) );
+    S32 used;
+    
+    // only what is in use, the argv pointers keep pointing into cmd
+    used = cmd.argc ? cmd.argv[cmd.argc - 1] + strlen( cmd.argv[cmd.argc - 1] ) + 1 - cmd.tokenized : 0;
+    
+    savedCmd.argc = cmd.argc;
+    ::memcpy( savedCmd.argv, cmd.argv, cmd.argc * sizeof( cmd.argv[0] ) );
+    ::memcpy( savedCmd.tokenized, cmd.tokenized, used );
+    ::memcpy( savedCmd.cmd, cmd.cmd, strlen( cmd.cmd ) + 1 );
 }
 
 /*
@@ -1457,7 +1948,19 @@ Cmd_RestoreCmdContext
 */
 void Cmd_RestoreCmdContext( void )
 {
-    ::memcpy( &cmd, &savedCmd, sizeof( cmdContext_t ) );
+    S32 used;
+    
+    used = 0;
+    if( savedCmd.argc )
+    {
+        used = savedCmd.argv[savedCmd.argc - 1] - cmd.tokenized;
+        used += strlen( savedCmd.tokenized + used ) + 1;
+    }
+    
+    cmd.argc = savedCmd.argc;
+    ::memcpy( cmd.argv, savedCmd.argv, savedCmd.argc * sizeof( cmd.argv[0] ) );
+    ::memcpy( cmd.tokenized, savedCmd.tokenized, used );
+    ::memcpy( cmd.cmd, savedCmd.cmd, strlen( savedCmd.cmd ) + 1 );
 }
 
 /*
@@ -1500,27 +2003,48 @@ void Cmd_ArgvBuffer( S32 arg, UTF8* buffer, S32 bufferLength )
 
 /*
 ============
-Cmd_Args
+Cmd_JoinArgs
 
-Returns a single string containing argv(1) to argv(argc()-1)
+argv(arg) to argv(argc()-1) with a space between each, cut off at size
 ============
 */
-UTF8*           Cmd_Args( void )
+static UTF8* Cmd_JoinArgs( S32 arg, UTF8* buffer, S32 size )
 {
-    static UTF8     cmd_args[MAX_STRING_CHARS];
-    S32             i;
+    S32             i, length, used;
     
-    cmd_args[0] = 0;
-    for( i = 1; i < cmd.argc; i++ )
+    used = 0;
+    for( i = arg; i < cmd.argc; i++ )
     {
-        strcat( cmd_args, cmd.argv[i] );
-        if( i != cmd.argc - 1 )
+        length = strlen( cmd.argv[i] );
+        if( used + length >= size )
+        {
+            length = size - 1 - used;
+        }
+        ::memcpy( buffer + used, cmd.argv[i], length );
+        used += length;
+        
+        if( i != cmd.argc - 1 && used < size - 1 )
         {
-            strcat( cmd_args, " " );
+            buffer[used++] = ' ';
         }
     }
+    buffer[used] = 0;
+    
+    return buffer;
+}
+
+/*
+============
+Cmd_Args
+
+Returns a single string containing argv(1) to argv(argc()-1)
+============
+*/
+UTF8*           Cmd_Args( void )
+{
+    static UTF8     cmd_args[MAX_STRING_CHARS];
     
-    return cmd_args;
+    return Cmd_JoinArgs( 1, cmd_args, sizeof( cmd_args ) );
 }
 
 /*
@@ -1533,23 +2057,13 @@ Returns a single string containing argv(arg) to argv(argc()-1)
 UTF8*           Cmd_ArgsFrom( S32 arg )
 {
     static UTF8     cmd_args[BIG_INFO_STRING];
-    S32             i;
     
-    cmd_args[0] = 0;
     if( arg < 0 )
     {
         arg = 0;
     }
-    for( i = arg; i < cmd.argc; i++ )
-    {
-        strcat( cmd_args, cmd.argv[i] );
-        if( i != cmd.argc - 1 )
-        {
-            strcat( cmd_args, " " );
-        }
-    }
     
-    return cmd_args;
+    return Cmd_JoinArgs( arg, cmd_args, sizeof( cmd_args ) );
 }
 
 /*
@@ -1659,6 +2173,245 @@ UTF8* Cmd_EscapeString( StringEntry in )
     *out = '\0';
     return buffer;
 }
+/*
+============
+Cmd_TokenizeSpans
+
+Splits text into the same tokens Cmd_TokenizeString would, but as spans
+pointing into text instead of copies, and returns how many there are.
+Unlike Cmd_TokenizeString the text isn't cut off at BIG_INFO_STRING.
+============
+*/
+S32 Cmd_TokenizeSpans( StringEntry text, cmdTokens_t* tokens, bool ignoreQuotes )
+{
+    cmdSpan_t*      span;
+    
+    tokens->argc = 0;
+    if( !text )
+    {
+        return 0;
+    }
+    
+    while( 1 )
+    {
+        if( tokens->argc == MAX_STRING_TOKENS )
+        {
+            return tokens->argc;	// this is usually something malicious
+        }
+        
+        while( 1 )
+        {
+            // skip whitespace
+            while( *text > '\0' && *text <= ' ' )
+            {
+                text++;
+            }
+            if( !*text )
+            {
+                return tokens->argc;	// all tokens parsed
+            }
+            
+            // skip // comments
+            if( text[0] == '/' && text[1] == '/' )
+            {
+                return tokens->argc;	// all tokens parsed
+            }
+            
+            // skip /* */ comments
+            if( text[0] == '/' && text[1] == '*' )
+            {
+                while( *text && ( text[0] != '*' || text[1] != '/' ) )
+                {
+                    text++;
+                }
+                if( !*text )
+                {
+                    return tokens->argc;	// all tokens parsed
+                }
+                text += 2;
+            }
+            else
+            {
+                break;			// we are ready to parse a token
+            }
+        }
+        
+        // an escaped quote between tokens doesn't end up in any of them
+        if( !ignoreQuotes && text[0] == '\\' && text[1] == '"' )
+        {
+            text += 2;
+            continue;
+        }
+        
+        span = &tokens->argv[tokens->argc++];
+        span->escaped = false;
+        span->quoted = false;
+        
+        // handle quoted strings
+        if( !ignoreQuotes && *text == '"' )
+        {
+            span->quoted = true;
+            span->text = ++text;
+            while( *text && *text != '"' )
+            {
+                if( text[0] == '\\' && text[1] == '"' )
+                {
+                    span->escaped = true;
+                    text += 2;
+                    continue;
+                }
+                text++;
+            }
+            span->length = text - span->text;
+            if( !*text )
+            {
+                return tokens->argc;	// all tokens parsed
+            }
+            text++;
+            continue;
+        }
+        
+        // regular token, runs until whitespace, quote, or command
+        span->text = text;
+        while( *text > ' ' || *text < '\0' )
+        {
+            if( !ignoreQuotes && text[0] == '\\' && text[1] == '"' )
+            {
+                span->escaped = true;
+                text += 2;
+                continue;
+            }
+            
+            if( !ignoreQuotes && text[0] == '"' )
+            {
+                break;
+            }
+            
+            if( text[0] == '/' && ( text[1] == '/' || text[1] == '*' ) )
+            {
+                break;
+            }
+            
+            text++;
+        }
+        span->length = text - span->text;
+        
+        if( !*text )
+        {
+            return tokens->argc;	// all tokens parsed
+        }
+    }
+}
+
+/*
+============
+Cmd_SpanCopy
+
+Copies the token into buffer as Cmd_Argv would have it and returns its
+length, cut off at bufferLength
+============
+*/
+S32 Cmd_SpanCopy( const cmdSpan_t* span, UTF8* buffer, S32 bufferLength )
+{
+    StringEntry     in, end;
+    UTF8*           out;
+    
+    if( bufferLength <= 0 )
+    {
+        return 0;
+    }
+    
+    in = span->text;
+    end = in + span->length;
+    out = buffer;
+    
+    if( !span->escaped )
+    {
+        if( span->length > bufferLength - 1 )
+        {
+            end = in + bufferLength - 1;
+        }
+        ::memcpy( out, in, end - in );
+        out += end - in;
+    }
+    else
+    {
+        while( in < end && out < buffer + bufferLength - 1 )
+        {
+            if( in[0] == '\\' && in + 1 < end && in[1] == '"' )
+            {
+                in++;
+            }
+            *out++ = *in++;
+        }
+    }
+    *out = 0;
+    
+    return out - buffer;
+}
+
+/*
+============
+Cmd_SpanCompare
+
+Q_stricmp against a span, without copying it out
+============
+*/
+S32 Cmd_SpanCompare( const cmdSpan_t* span, StringEntry s )
+{
+    UTF8            buffer[MAX_TOKEN_CHARS];
+    S32             i, c1, c2;
+    
+    if( span->escaped )
+    {
+        Cmd_SpanCopy( span, buffer, sizeof( buffer ) );
+        return Q_stricmp( buffer, s );
+    }
+    
+    for( i = 0; i < span->length; i++ )
+    {
+        c1 = span->text[i];
+        c2 = s[i];
+        if( c1 >= 'a' && c1 <= 'z' )
+        {
+            c1 -= ( 'a' - 'A' );
+        }
+        if( c2 >= 'a' && c2 <= 'z' )
+        {
+            c2 -= ( 'a' - 'A' );
+        }
+        if( c1 != c2 )
+        {
+            return c1 < c2 ? -1 : 1;
+        }
+    }
+    
+    return s[i] ? -1 : 0;
+}
+
+/*
+============
+Cmd_SpanArgsFrom
+
+The rest of the original text from token arg on, quotes and spacing as they
+were sent, unlike Cmd_ArgsFrom which joins the tokens with single spaces
+============
+*/
+StringEntry Cmd_SpanArgsFrom( const cmdTokens_t* tokens, S32 arg )
+{
+    if( arg < 0 )
+    {
+        arg = 0;
+    }
+    if( arg >= tokens->argc )
+    {
+        return "";
+    }
+    
+    // back up onto the opening quote
+    return tokens->argv[arg].text - ( tokens->argv[arg].quoted ? 1 : 0 );
+}
+
 /*
 ============
 Cmd_TokenizeString
@@ -1676,7 +2429,9 @@ static void Cmd_TokenizeString2( StringEntry text_in, bool ignoreQuotes, bool pa
     UTF8*	text;
     UTF8*	textOut;
     StringEntry cvarName;
-    UTF8 buffer[ BIG_INFO_STRING ];
+    UTF8* buffer;
+    void* mark;
+    cmdTokens_t* tokens;
     
 #ifdef TKN_DBG
     // FIXME TTimo blunt hook to try to find the tokenization of userinfo
@@ -1695,7 +2450,9 @@ static void Cmd_TokenizeString2( StringEntry text_in, bool ignoreQuotes, bool pa
     // parse for cvar substitution
     if( parseCvar )
     {
-        Q_strncpyz( buffer, text_in, sizeof( buffer ) );
+        mark = Hunk_FrameMark();
+        buffer = Hunk_FrameAllocArray<UTF8>( BIG_INFO_STRING );
+        Q_strncpyz( buffer, text_in, BIG_INFO_STRING );
         text = buffer;
         textOut = cmd.cmd;
         while( *text )
@@ -1775,131 +2532,25 @@ static void Cmd_TokenizeString2( StringEntry text_in, bool ignoreQuotes, bool pa
                 *textOut++ = *text++;
         }
         *textOut = '\0';
+        
+        Hunk_FrameResetTo( mark );
     }
     else
         Q_strncpyz( cmd.cmd, text_in, sizeof( cmd.cmd ) );
         
-    text = cmd.cmd;
-    textOut = cmd.tokenized;
+    // the spans point into cmd.cmd, copying them out unescaped makes argv
+    mark = Hunk_FrameMark();
+    tokens = Hunk_FrameAllocType<cmdTokens_t>();
+    Cmd_TokenizeSpans( cmd.cmd, tokens, ignoreQuotes );
     
-    while( 1 )
+    textOut = cmd.tokenized;
+    for( cmd.argc = 0; cmd.argc < tokens->argc; cmd.argc++ )
     {
-        if( cmd.argc == MAX_STRING_TOKENS )
-        {
-            return;			// this is usually something malicious
-        }
-        
-        while( 1 )
-        {
-            // skip whitespace
-            while( *text > '\0' && *text <= ' ' )
-            {
-                text++;
-            }
-            if( !*text )
-            {
-                return;			// all tokens parsed
-            }
-            
-            // skip // comments
-            if( text[0] == '/' && text[1] == '/' )
-            {
-                return;			// all tokens parsed
-            }
-            
-            // skip /* */ comments
-            if( text[0] == '/' && text[1] == '*' )
-            {
-                while( *text && ( text[0] != '*' || text[1] != '/' ) )
-                {
-                    text++;
-                }
-                if( !*text )
-                {
-                    return;		// all tokens parsed
-                }
-                text += 2;
-            }
-            else
-            {
-                break;			// we are ready to parse a token
-            }
-        }
-        
-        // handle quote escaping
-        if( !ignoreQuotes && text[0] == '\\' && text[1] == '"' )
-        {
-            *textOut++ = '"';
-            text += 2;
-            continue;
-        }
-        
-        // handle quoted strings
-        if( !ignoreQuotes && *text == '"' )
-        {
-            cmd.argv[cmd.argc] = textOut;
-            cmd.argc++;
-            text++;
-            while( *text && *text != '"' )
-            {
-                if( text[0] == '\\' && text[1] == '"' )
-                {
-                    *textOut++ = '"';
-                    text += 2;
-                    continue;
-                }
-                *textOut++ = *text++;
-            }
-            *textOut++ = 0;
-            if( !*text )
-            {
-                return;		// all tokens parsed
-            }
-            text++;
-            continue;
-        }
-        
-        // regular token
         cmd.argv[cmd.argc] = textOut;
-        cmd.argc++;
-        
-        // skip until whitespace, quote, or command
-        while( *text > ' ' || *text < '\0' )
-        {
-            if( !ignoreQuotes && text[0] == '\\' && text[1] == '"' )
-            {
-                *textOut++ = '"';
-                text += 2;
-                continue;
-            }
-            
-            if( !ignoreQuotes && text[0] == '"' )
-            {
-                break;
-            }
-            
-            if( text[0] == '/' && text[1] == '/' )
-            {
-                break;
-            }
-            
-            // skip /* */ comments
-            if( text[0] == '/' && text[1] == '*' )
-            {
-                break;
-            }
-            
-            *textOut++ = *text++;
-        }
-        
-        *textOut++ = 0;
-        
-        if( !*text )
-        {
-            return;		// all tokens parsed
-        }
+        textOut += Cmd_SpanCopy( &tokens->argv[cmd.argc], textOut, sizeof( cmd.tokenized ) - ( textOut - cmd.tokenized ) ) + 1;
     }
     
+    Hunk_FrameResetTo( mark );
 }
 
 /*
@@ -1941,9 +2592,12 @@ Cmd_AddCommand
 void Cmd_AddCommand( StringEntry cmd_name, xcommand_t function )
 {
     cmd_function_t* cmd;
+    S32             hash;
+    
+    hash = Cmd_HashName( cmd_name );
     
     // fail if the command already exists
-    for( cmd = cmd_functions; cmd; cmd = cmd->next )
+    for( cmd = cmd_hashTable[hash]; cmd; cmd = cmd->hashNext )
     {
         if( !strcmp( cmd_name, cmd->name ) )
         {
@@ -1963,6 +2617,8 @@ void Cmd_AddCommand( StringEntry cmd_name, xcommand_t function )
     cmd->next = cmd_functions;
     cmd->complete = NULL;
     cmd_functions = cmd;
+    cmd->hashNext = cmd_hashTable[hash];
+    cmd_hashTable[hash] = cmd;
 }
 
 /*
@@ -1974,7 +2630,7 @@ void Cmd_SetCommandCompletionFunc( StringEntry command, completionFunc_t complet
 {
     cmd_function_t*	cmd;
     
-    for( cmd = cmd_functions; cmd; cmd = cmd->next )
+    for( cmd = cmd_hashTable[Cmd_HashName( command )]; cmd; cmd = cmd->hashNext )
     {
         if( !Q_stricmp( command, cmd->name ) )
         {
@@ -1991,11 +2647,12 @@ Cmd_RemoveCommand
 */
 void Cmd_RemoveCommand( StringEntry cmd_name )
 {
-    cmd_function_t** back = &cmd_functions;
+    cmd_function_t** back = &cmd_hashTable[Cmd_HashName( cmd_name )];
+    cmd_function_t* cmd;
     
     while( 1 )
     {
-        cmd_function_t* cmd = *back;
+        cmd = *back;
         if( !cmd )
         {
             // command wasn't active
@@ -2003,13 +2660,19 @@ void Cmd_RemoveCommand( StringEntry cmd_name )
         }
         if( !strcmp( cmd_name, cmd->name ) )
         {
-            *back = cmd->next;
-            Z_Free( cmd->name );
-            Z_Free( cmd );
-            return;
+            *back = cmd->hashNext;
+            break;
         }
-        back = &cmd->next;
+        back = &cmd->hashNext;
     }
+    
+    for( back = &cmd_functions; *back != cmd; back = &( *back )->next )
+    {
+    }
+    *back = cmd->next;
+    
+    Z_Free( cmd->name );
+    Z_Free( cmd );
 }
 
 
@@ -2037,7 +2700,7 @@ void Cmd_CompleteArgument( StringEntry command, UTF8* args, S32 argNum )
 {
     cmd_function_t*	cmd;
     
-    for( cmd = cmd_functions; cmd; cmd = cmd->next )
+    for( cmd = cmd_hashTable[Cmd_HashName( command )]; cmd; cmd = cmd->hashNext )
     {
         if( !Q_stricmp( command, cmd->name ) && cmd->complete )
         {
@@ -2063,31 +2726,13 @@ void Cmd_ExecuteString( StringEntry text )
         return;					// no tokens
     }
     
-    // check registered command functions
-    cmd_function_t* cmdFunc, **prev;
-    for( prev = &cmd_functions; *prev; prev = &cmdFunc->next )
+    // check registered command functions, the ones without a function
+    // are there for completion and the cgame or game handles them
+    cmd_function_t* cmdFunc = Cmd_FindCommand( cmd.argv[0] );
+    if( cmdFunc && cmdFunc->function )
     {
-        cmdFunc = *prev;
-        if( !Q_stricmp( cmd.argv[0], cmdFunc->name ) )
-        {
-            // rearrange the links so that the command will be
-            // near the head of the list next time it is used
-            *prev = cmdFunc->next;
-            cmdFunc->next = cmd_functions;
-            cmd_functions = cmdFunc;
-            
-            // perform the action
-            if( !cmdFunc->function )
-            {
-                // let the cgame or game handle it
-                break;
-            }
-            else
-            {
-                cmdFunc->function();
-            }
-            return;
-        }
+        cmdFunc->function();
+        return;
     }
     
     // check cvars
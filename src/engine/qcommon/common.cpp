@@ -573,17 +573,28 @@ skip loading of wolfconfig.cfg
 bool Com_SafeMode( void )
 {
     S32             i;
+    cmdTokens_t*    tokens;
+    void*           mark;
+    bool            safe;
     
+    // only the command name is looked at, spans leave the command arguments alone
+    mark = Hunk_FrameMark();
+    tokens = Hunk_FrameAllocType<cmdTokens_t>();
+    
+    safe = false;
     for( i = 0; i < com_numConsoleLines; i++ )
     {
-        Cmd_TokenizeString( com_consoleLines[i] );
-        if( !Q_stricmp( Cmd_Argv( 0 ), "safe" ) || !Q_stricmp( Cmd_Argv( 0 ), "cvar_restart" ) )
+        if( Cmd_TokenizeSpans( com_consoleLines[i], tokens, false ) &&
+                ( !Cmd_SpanCompare( &tokens->argv[0], "safe" ) || !Cmd_SpanCompare( &tokens->argv[0], "cvar_restart" ) ) )
         {
             com_consoleLines[i][0] = 0;
-            return true;
+            safe = true;
+            break;
         }
     }
-    return false;
+    
+    Hunk_FrameResetTo( mark );
+    return safe;
 }
 
 
@@ -602,25 +613,45 @@ void Com_StartupVariable( StringEntry match )
 {
     S32             i;
     UTF8*           s;
+    UTF8*           value;
     cvar_t*         cv;
+    cmdTokens_t*    tokens;
+    void*           mark;
+    
+    mark = Hunk_FrameMark();
+    tokens = Hunk_FrameAllocType<cmdTokens_t>();
+    s = Hunk_FrameAllocArray<UTF8>( BIG_INFO_STRING );
+    value = Hunk_FrameAllocArray<UTF8>( BIG_INFO_STRING );
     
     for( i = 0; i < com_numConsoleLines; i++ )
     {
-        Cmd_TokenizeString( com_consoleLines[i] );
-        if( strcmp( Cmd_Argv( 0 ), "set" ) )
+        // most lines aren't sets, so they are only split, never copied
+        if( !Cmd_TokenizeSpans( com_consoleLines[i], tokens, false ) || tokens->argv[0].length != 3 ||
+                strncmp( tokens->argv[0].text, "set", 3 ) )
         {
             continue;
         }
         
-        s = Cmd_Argv( 1 );
+        s[0] = value[0] = '\0';
+        if( tokens->argc > 1 )
+        {
+            Cmd_SpanCopy( &tokens->argv[1], s, BIG_INFO_STRING );
+        }
+        if( tokens->argc > 2 )
+        {
+            Cmd_SpanCopy( &tokens->argv[2], value, BIG_INFO_STRING );
+        }
+        
         if( !match || !strcmp( s, match ) )
         {
-            cvarSystem->Set( s, Cmd_Argv( 2 ) );
+            cvarSystem->Set( s, value );
             cv = cvarSystem->Get( s, "", 0 );
             cv->flags |= CVAR_USER_CREATED;
 //          com_consoleLines[i] = 0;
         }
     }
+    
+    Hunk_FrameResetTo( mark );
 }
 
 
@@ -984,6 +1015,7 @@ typedef struct memblock_s
     S32             tag;		// a tag of 0 is a free block
     struct memblock_s* next, *prev;
     S32             id;			// should be ZONEID
+    S32             profile;	// from Com_AllocProfileAlloc, 0 if it wasn't counted
 #ifdef ZONE_DEBUG
     zonedebug_t     d;
 #endif
@@ -1004,186 +1036,748 @@ memzone_t*      mainzone;
 // fragment the main zone (think of cvar and cmd strings)
 memzone_t*      smallzone;
 
+/*
+Allocations up to ZONE_MAX_CLASS bytes come from slabs, main zone blocks cut
+into equal slots, one list of slabs per size class.  Getting or freeing a
+slot never walks the block list.  Slots have the usual block header with
+SLABID instead of ZONEID, so Z_Free can tell them apart while the tags and
+the trash tester work the same, and prev points back to their slab.
+*/
+#define SLABID  0x1d4a12
+#define ZONE_NUM_CLASSES 16
+#define ZONE_MAX_CLASS 4096
+#define ZONE_SLAB_SIZE 65536
+
+static const S32 zoneClassSizes[ZONE_NUM_CLASSES] = { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096 };
+
+typedef struct zoneSlab_s
+{
+    struct zoneSlab_s* next, *prev; // all slabs of the class
+    struct zoneSlab_s* nextPartial, *prevPartial; // slabs with free slots
+    memblock_t*     freeSlots; // linked through next
+    S32             used;
+    S32             cls;
+    S32             pad;
+} zoneSlab_t;
+
+typedef struct
+{
+    S32             slotSize; // including the header and the trash tester
+    S32             slotsPerSlab;
+    zoneSlab_t*     slabs;
+    zoneSlab_t*     partial;
+    S32             numSlabs;
+    S32             numFree;
+    S32             used;
+    S32             peak;
+    S32             allocs;
+    S32             frees;
+} zoneClass_t;
+
+typedef struct
+{
+    bool            enabled;
+    U8              classForSize[ZONE_MAX_CLASS / 16 + 1]; // by size rounded up to 16
+    zoneClass_t     classes[ZONE_NUM_CLASSES];
+} zoneSlabs_t;
+
+static zoneSlabs_t s_zoneSlabs;
+static zoneSlabs_t* zoneSlabs = &s_zoneSlabs; // swapped by Com_ZoneBench_f
+
+/*
+The zones, the slabs and the hunk are shared by every thread.  zoneLock
+guards the block lists and the slab lists, hunkLock the hunk tops.  Each
+thread keeps a few free slots of every slab class in a zoneThreadCache_t
+found through thread local storage, so most small allocations and frees
+never touch the lock, it is only taken to move half a cache at a time to or
+from the slabs.  Slots sitting in a cache are marked free (tag 0) but are
+still counted as used by their class.  Worker threads also carve their small
+Hunk_Alloc calls out of a private hunk chunk.
+*/
+#define ZONE_CACHE_SLOTS 32
+#define HUNK_CACHE_SIZE 65536
+#define HUNK_CACHE_MAX 2048
+
+typedef struct
+{
+    S32             generation; // zoneGeneration the slots came from
+    S32             count[ZONE_NUM_CLASSES];
+    memblock_t*     slots[ZONE_NUM_CLASSES][ZONE_CACHE_SLOTS];
+    
+    S32             hunkGeneration;
+    U8*             hunkChunk;
+    S32             hunkLeft;
+} zoneThreadCache_t;
+
+static SDL_SpinLock zoneLock;
+static SDL_atomic_t zoneCacheEnabled; // off while tracing or benchmarking
+static S32 zoneGeneration; // bumped whenever the zones are rebuilt
+static SDL_TLSID zoneCacheTLS;
+
+static memblock_t* Z_ZoneAlloc( S32 size, S32 tag );
+static void Z_ZoneFree( memblock_t* block );
+
+// allocation trace for Com_ZoneBench_f, see Com_ZoneTrace_f
+#define ZONE_TRACE_ALLOC 1
+#define ZONE_TRACE_FREE 2
+#define ZONE_TRACE_EVENTS 4096
+
+typedef struct
+{
+    S32             op;
+    S32             tag;
+    S32             size;
+    U32             ptrLow, ptrHigh;
+} zoneTraceEvent_t;
+
+static fileHandle_t zoneTraceFile;
+static zoneTraceEvent_t zoneTrace[ZONE_TRACE_EVENTS];
+static S32 zoneTraceCount;
+static S32 zoneTraceTotal;
 
 void            Z_CheckHeap( void );
 
 /*
 ========================
-Z_ClearZone
+Z_FlushTrace
 ========================
 */
-void Z_ClearZone( memzone_t* zone, S32 size )
+static void Z_FlushTrace( void )
 {
-    memblock_t*     block;
+    fileHandle_t    f;
     
-    // set the entire zone to one free block
+    // writing must not trace anything itself
+    f = zoneTraceFile;
+    zoneTraceFile = 0;
+    fileSystem->Write( zoneTrace, zoneTraceCount * sizeof( zoneTraceEvent_t ), f );
+    zoneTraceFile = f;
     
-    zone->blocklist.next = zone->blocklist.prev = block = ( memblock_t* )( ( U8* ) zone + sizeof( memzone_t ) );
-    zone->blocklist.tag = 1;	// in use block
-    zone->blocklist.id = 0;
-    zone->blocklist.size = 0;
-    zone->rover = block;
-    zone->size = size;
-    zone->used = 0;
+    zoneTraceCount = 0;
+}
+
+/*
+========================
+Z_TraceEvent
+========================
+*/
+static void Z_TraceEvent( S32 op, const void* ptr, S32 size, S32 tag )
+{
+    zoneTraceEvent_t* ev;
+    U64             p;
     
-    block->prev = block->next = &zone->blocklist;
-    block->tag = 0;				// free block
-    block->id = ZONEID;
-    block->size = size - sizeof( memzone_t );
+    p = ( U64 )( intptr_t )ptr;
+    ev = &zoneTrace[zoneTraceCount++];
+    ev->op = LittleLong( op );
+    ev->tag = LittleLong( tag );
+    ev->size = LittleLong( size );
+    ev->ptrLow = LittleLong( ( U32 )p );
+    ev->ptrHigh = LittleLong( ( U32 )( p >> 32 ) );
+    zoneTraceTotal++;
+    
+    if( zoneTraceCount == ZONE_TRACE_EVENTS )
+    {
+        Z_FlushTrace();
+    }
 }
 
 /*
 ========================
-Z_Free
+Z_InitSlabs
 ========================
 */
-void Z_Free( void* ptr )
+static void Z_InitSlabs( zoneSlabs_t* slabs, bool enabled )
 {
-    memblock_t*     block, *other;
-    memzone_t*      zone;
+    zoneClass_t*    cls;
+    S32             i, size;
     
-    if( !ptr )
+    ::memset( slabs, 0, sizeof( *slabs ) );
+    slabs->enabled = enabled;
+    
+    for( i = 0, size = 0; i < ZONE_NUM_CLASSES; i++ )
     {
-        Com_Error( ERR_DROP, "Z_Free: NULL pointer" );
+        cls = &slabs->classes[i];
+        cls->slotSize = PAD( sizeof( memblock_t ) + zoneClassSizes[i] + 4, sizeof( intptr_t ) );
+        cls->slotsPerSlab = ( ZONE_SLAB_SIZE - sizeof( zoneSlab_t ) ) / cls->slotSize;
+        
+        for( ; size <= zoneClassSizes[i]; size += 16 )
+        {
+            slabs->classForSize[size >> 4] = i;
+        }
     }
+}
+
+/*
+========================
+Z_SlabAlloc
+
+Returns a slot of the smallest class that fits size, the block header is
+filled in except for the debug info
+========================
+*/
+static memblock_t* Z_SlabAlloc( S32 size, S32 tag )
+{
+    zoneClass_t*    cls;
+    zoneSlab_t*     slab;
+    memblock_t*     block;
+    U8*             slot;
+    S32             i, c;
     
-    block = ( memblock_t* )( ( U8* ) ptr - sizeof( memblock_t ) );
-    if( block->id != ZONEID )
+    c = zoneSlabs->classForSize[( size + 15 ) >> 4];
+    cls = &zoneSlabs->classes[c];
+    
+    slab = cls->partial;
+    if( !slab )
     {
-        Com_Error( ERR_FATAL, "Z_Free: freed a pointer without ZONEID" );
+        slab = ( zoneSlab_t* )( Z_ZoneAlloc( sizeof( zoneSlab_t ) + cls->slotsPerSlab * cls->slotSize, TAG_SLAB ) + 1 );
+        ::memset( slab, 0, sizeof( *slab ) );
+        slab->cls = c;
+        
+        // thread the free list through the slots in address order
+        slot = ( U8* )( slab + 1 ) + ( cls->slotsPerSlab - 1 ) * cls->slotSize;
+        for( i = 0; i < cls->slotsPerSlab; i++, slot -= cls->slotSize )
+        {
+            block = ( memblock_t* )slot;
+            block->size = cls->slotSize;
+            block->tag = 0;
+            block->id = SLABID;
+            block->prev = ( memblock_t* )slab;
+            block->next = slab->freeSlots;
+            slab->freeSlots = block;
+        }
+        
+        slab->next = cls->slabs;
+        if( cls->slabs )
+        {
+            cls->slabs->prev = slab;
+        }
+        cls->slabs = slab;
+        cls->partial = slab;
+        cls->numSlabs++;
+        cls->numFree += cls->slotsPerSlab;
     }
-    if( block->tag == 0 )
+    
+    block = slab->freeSlots;
+    slab->freeSlots = block->next;
+    slab->used++;
+    
+    // a full slab leaves the partial list until a slot comes back
+    if( !slab->freeSlots )
     {
-        Com_Error( ERR_FATAL, "Z_Free: freed a freed pointer" );
+        cls->partial = slab->nextPartial;
+        if( cls->partial )
+        {
+            cls->partial->prevPartial = NULL;
+        }
+        slab->nextPartial = NULL;
     }
-    // if static memory
-    if( block->tag == TAG_STATIC )
+    
+    block->tag = tag;
+    block->next = NULL;
+    
+    cls->numFree--;
+    cls->allocs++;
+    if( ++cls->used > cls->peak )
     {
-        return;
+        cls->peak = cls->used;
     }
     
-    // check the memory trash tester
-    if( *( S32* )( ( U8* ) block + block->size - 4 ) != ZONEID )
+    return block;
+}
+
+/*
+========================
+Z_SlabFree
+
+Puts a slot back in its slab, the slab goes back to the main zone when it is
+empty and its class has a whole slab worth of other free slots.  Returns
+true if the slab was released.  The caller trashes the slot contents.
+========================
+*/
+static bool Z_SlabFree( memblock_t* block )
+{
+    zoneClass_t*    cls;
+    zoneSlab_t*     slab;
+    
+    slab = ( zoneSlab_t* )block->prev;
+    cls = &zoneSlabs->classes[slab->cls];
+    
+    block->tag = 0;
+    
+    // it was full, so it isn't on the partial list
+    if( !slab->freeSlots )
     {
-        Com_Error( ERR_FATAL, "Z_Free: memory block wrote past end" );
+        slab->prevPartial = NULL;
+        slab->nextPartial = cls->partial;
+        if( cls->partial )
+        {
+            cls->partial->prevPartial = slab;
+        }
+        cls->partial = slab;
     }
     
-    if( block->tag == TAG_SMALL )
+    block->next = slab->freeSlots;
+    slab->freeSlots = block;
+    slab->used--;
+    
+    cls->numFree++;
+    cls->used--;
+    cls->frees++;
+    
+    if( slab->used || cls->numFree - cls->slotsPerSlab < cls->slotsPerSlab )
     {
-        zone = smallzone;
+        return false;
+    }
+    
+    if( slab->prevPartial )
+    {
+        slab->prevPartial->nextPartial = slab->nextPartial;
     }
     else
     {
-        zone = mainzone;
+        cls->partial = slab->nextPartial;
+    }
+    if( slab->nextPartial )
+    {
+        slab->nextPartial->prevPartial = slab->prevPartial;
     }
     
-    zone->used -= block->size;
-    // set the block to something that should cause problems
-    // if it is referenced...
-    memset( ptr, 0xaa, block->size - sizeof( *block ) );
+    if( slab->prev )
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        cls->slabs = slab->next;
+    }
+    if( slab->next )
+    {
+        slab->next->prev = slab->prev;
+    }
     
-    block->tag = 0;				// mark as free
+    cls->numSlabs--;
+    cls->numFree -= cls->slotsPerSlab;
+    Z_ZoneFree( ( memblock_t* )slab - 1 );
     
-    other = block->prev;
-    if( !other->tag )
+    return true;
+}
+
+/*
+========================
+Z_FreeSlabTags
+========================
+*/
+static void Z_FreeSlabTags( S32 tag )
+{
+    zoneClass_t*    cls;
+    zoneSlab_t*     slab, *next;
+    memblock_t*     block;
+    S32             c, i;
+    
+    for( c = 0; c < ZONE_NUM_CLASSES; c++ )
     {
-        // merge with previous free block
-        other->size += block->size;
-        other->next = block->next;
-        other->next->prev = other;
-        if( block == zone->rover )
+        cls = &zoneSlabs->classes[c];
+        
+        for( slab = cls->slabs; slab; slab = next )
         {
-            zone->rover = other;
+            next = slab->next;
+            
+            for( i = 0; i < cls->slotsPerSlab; i++ )
+            {
+                block = ( memblock_t* )( ( U8* )( slab + 1 ) + i * cls->slotSize );
+                if( block->tag != tag )
+                {
+                    continue;
+                }
+                
+                if( zoneTraceFile )
+                {
+                    Z_TraceEvent( ZONE_TRACE_FREE, block + 1, 0, tag );
+                }
+                if( block->profile )
+                {
+                    Com_AllocProfileFree( block->profile, block->size, tag );
+                }
+                
+                ::memset( block + 1, 0xaa, block->size - sizeof( *block ) );
+                if( Z_SlabFree( block ) )
+                {
+                    break;
+                }
+            }
         }
-        block = other;
     }
+}
+
+/*
+========================
+Z_FreeThreadCache
+
+Thread local storage destructor, hands the cached slots back to the slabs
+========================
+*/
+static void SDLCALL Z_FreeThreadCache( void* data )
+{
+    zoneThreadCache_t* tc;
+    S32             c;
     
-    zone->rover = block;
+    tc = ( zoneThreadCache_t* )data;
     
-    other = block->next;
-    if( !other->tag )
+    if( tc->generation == zoneGeneration && mainzone )
     {
-        // merge the next free block onto the end
-        block->size += other->size;
-        block->next = other->next;
-        block->next->prev = block;
-        if( other == zone->rover )
+        SDL_AtomicLock( &zoneLock );
+        for( c = 0; c < ZONE_NUM_CLASSES; c++ )
         {
-            zone->rover = block;
+            while( tc->count[c] )
+            {
+                Z_SlabFree( tc->slots[c][--tc->count[c]] );
+            }
         }
+        SDL_AtomicUnlock( &zoneLock );
     }
+    
+    free( tc );
 }
 
-
 /*
-================
-Z_FreeTags
-================
+========================
+Z_GetThreadCache
+========================
 */
-void Z_FreeTags( S32 tag )
+static zoneThreadCache_t* Z_GetThreadCache( void )
 {
-    S32             count;
-    memzone_t*      zone;
+    zoneThreadCache_t* tc;
     
-    if( tag == TAG_SMALL )
-    {
-        zone = smallzone;
-    }
-    else
+    if( !zoneCacheTLS )
     {
-        zone = mainzone;
+        return NULL;
     }
-    count = 0;
-    // use the rover as our pointer, because
-    // Z_Free automatically adjusts it
-    zone->rover = zone->blocklist.next;
-    do
+    
+    tc = ( zoneThreadCache_t* )SDL_TLSGet( zoneCacheTLS );
+    if( !tc )
     {
-        if( zone->rover->tag == tag )
+        tc = ( zoneThreadCache_t* )calloc( 1, sizeof( *tc ) );
+        if( !tc )
         {
-            count++;
-            Z_Free( ( void* )( zone->rover + 1 ) );
-            continue;
+            return NULL;
         }
-        zone->rover = zone->rover->next;
+        
+        tc->generation = zoneGeneration;
+        SDL_TLSSet( zoneCacheTLS, tc, Z_FreeThreadCache );
     }
-    while( zone->rover != &zone->blocklist );
+    
+    // the zones were rebuilt, the cached slots went with them
+    if( tc->generation != zoneGeneration )
+    {
+        ::memset( tc->count, 0, sizeof( tc->count ) );
+        tc->generation = zoneGeneration;
+    }
+    
+    return tc;
 }
 
 /*
-================
-Z_TagMalloc
-================
-*/
-
-memblock_t*     debugblock;		// RF, jusy so we can track a block to find out when it's getting trashed
+========================
+Z_CacheAlloc
 
-#ifdef ZONE_DEBUG
-void*           Z_TagMallocDebug( S32 size, S32 tag, UTF8* label, UTF8* file, S32 line )
-{
-#else
-void*           Z_TagMalloc( S32 size, S32 tag )
+Takes a slot from the thread cache, refilling it from the slabs when empty
+========================
+*/
+static memblock_t* Z_CacheAlloc( zoneThreadCache_t* tc, S32 size, S32 tag )
 {
-#endif
-    S32             extra, allocSize;
-    memblock_t*     start, *rover, *_new, *base;
-    memzone_t*      zone;
+    memblock_t*     block;
+    S32             c;
     
-    if( !tag )
-    {
-        Com_Error( ERR_FATAL, "Z_TagMalloc: tried to use a 0 tag" );
-    }
+    c = s_zoneSlabs.classForSize[( size + 15 ) >> 4];
     
-    if( tag == TAG_SMALL )
+    if( !tc->count[c] )
     {
-        zone = smallzone;
+        SDL_AtomicLock( &zoneLock );
+        while( tc->count[c] < ZONE_CACHE_SLOTS / 2 )
+        {
+            block = Z_SlabAlloc( zoneClassSizes[c], 0 );
+            tc->slots[c][tc->count[c]++] = block;
+        }
+        SDL_AtomicUnlock( &zoneLock );
     }
-    else
-    {
+    
+    block = tc->slots[c][--tc->count[c]];
+    block->tag = tag;
+    
+    // marker for memory trash testing, trashed with the rest on free
+    *( S32* )( ( U8* ) block + block->size - 4 ) = ZONEID;
+    
+    return block;
+}
+
+/*
+========================
+Z_CacheFree
+
+Puts a trashed slot in the thread cache, moving half of a full cache back to
+the slabs first
+========================
+*/
+static void Z_CacheFree( zoneThreadCache_t* tc, memblock_t* block )
+{
+    S32             c;
+    
+    c = ( ( zoneSlab_t* )block->prev )->cls;
+    block->tag = 0;
+    
+    if( tc->count[c] == ZONE_CACHE_SLOTS )
+    {
+        SDL_AtomicLock( &zoneLock );
+        while( tc->count[c] > ZONE_CACHE_SLOTS / 2 )
+        {
+            Z_SlabFree( tc->slots[c][--tc->count[c]] );
+        }
+        SDL_AtomicUnlock( &zoneLock );
+    }
+    
+    tc->slots[c][tc->count[c]++] = block;
+}
+
+/*
+========================
+Z_ClearZone
+========================
+*/
+void Z_ClearZone( memzone_t* zone, S32 size )
+{
+    memblock_t*     block;
+    
+    // set the entire zone to one free block
+    
+    zone->blocklist.next = zone->blocklist.prev = block = ( memblock_t* )( ( U8* ) zone + sizeof( memzone_t ) );
+    zone->blocklist.tag = 1;	// in use block
+    zone->blocklist.id = 0;
+    zone->blocklist.size = 0;
+    zone->rover = block;
+    zone->size = size;
+    zone->used = 0;
+    
+    block->prev = block->next = &zone->blocklist;
+    block->tag = 0;				// free block
+    block->id = ZONEID;
+    block->size = size - sizeof( memzone_t );
+}
+
+/*
+========================
+Z_ZoneFree
+
+Returns a block to its zone, zoneLock must be held
+========================
+*/
+static void Z_ZoneFree( memblock_t* block )
+{
+    memblock_t*     other;
+    memzone_t*      zone;
+    
+    if( block->tag == TAG_SMALL )
+    {
+        zone = smallzone;
+    }
+    else
+    {
+        zone = mainzone;
+    }
+    
+    zone->used -= block->size;
+    block->tag = 0;				// mark as free
+    
+    other = block->prev;
+    if( !other->tag )
+    {
+        // merge with previous free block
+        other->size += block->size;
+        other->next = block->next;
+        other->next->prev = other;
+        if( block == zone->rover )
+        {
+            zone->rover = other;
+        }
+        block = other;
+    }
+    
+    zone->rover = block;
+    
+    other = block->next;
+    if( !other->tag )
+    {
+        // merge the next free block onto the end
+        block->size += other->size;
+        block->next = other->next;
+        block->next->prev = block;
+        if( other == zone->rover )
+        {
+            zone->rover = block;
+        }
+    }
+}
+
+/*
+========================
+Z_Free
+========================
+*/
+void Z_Free( void* ptr )
+{
+    zoneThreadCache_t* tc;
+    memblock_t*     block;
+    
+    if( !ptr )
+    {
+        Com_Error( ERR_DROP, "Z_Free: NULL pointer" );
+    }
+    
+    block = ( memblock_t* )( ( U8* ) ptr - sizeof( memblock_t ) );
+    if( block->id == SLABID )
+    {
+        if( block->tag == 0 )
+        {
+            Com_Error( ERR_FATAL, "Z_Free: freed a freed pointer" );
+        }
+        if( *( S32* )( ( U8* ) block + block->size - 4 ) != ZONEID )
+        {
+            Com_Error( ERR_FATAL, "Z_Free: memory block wrote past end" );
+        }
+        if( block->profile )
+        {
+            Com_AllocProfileFree( block->profile, block->size, block->tag );
+        }
+        
+        // set the block to something that should cause problems
+        // if it is referenced...
+        ::memset( ptr, 0xaa, block->size - sizeof( *block ) );
+        
+        if( SDL_AtomicGet( &zoneCacheEnabled ) && ( tc = Z_GetThreadCache() ) != NULL )
+        {
+            Z_CacheFree( tc, block );
+            return;
+        }
+        
+        SDL_AtomicLock( &zoneLock );
+        if( zoneTraceFile )
+        {
+            Z_TraceEvent( ZONE_TRACE_FREE, ptr, 0, block->tag );
+        }
+        Z_SlabFree( block );
+        SDL_AtomicUnlock( &zoneLock );
+        return;
+    }
+    if( block->id != ZONEID )
+    {
+        Com_Error( ERR_FATAL, "Z_Free: freed a pointer without ZONEID" );
+    }
+    if( block->tag == 0 )
+    {
+        Com_Error( ERR_FATAL, "Z_Free: freed a freed pointer" );
+    }
+    // if static memory
+    if( block->tag == TAG_STATIC )
+    {
+        return;
+    }
+    
+    // check the memory trash tester
+    if( *( S32* )( ( U8* ) block + block->size - 4 ) != ZONEID )
+    {
+        Com_Error( ERR_FATAL, "Z_Free: memory block wrote past end" );
+    }
+    if( block->profile )
+    {
+        Com_AllocProfileFree( block->profile, block->size, block->tag );
+    }
+    
+    // set the block to something that should cause problems
+    // if it is referenced...
+    ::memset( ptr, 0xaa, block->size - sizeof( *block ) );
+    
+    SDL_AtomicLock( &zoneLock );
+    if( zoneTraceFile && block->tag != TAG_SLAB )
+    {
+        Z_TraceEvent( ZONE_TRACE_FREE, ptr, 0, block->tag );
+    }
+    Z_ZoneFree( block );
+    SDL_AtomicUnlock( &zoneLock );
+}
+
+
+/*
+================
+Z_FreeTags
+================
+*/
+void Z_FreeTags( S32 tag )
+{
+    S32             count;
+    memzone_t*      zone;
+    memblock_t*     block;
+    
+    SDL_AtomicLock( &zoneLock );
+    
+    Z_FreeSlabTags( tag );
+    
+    if( tag == TAG_SMALL )
+    {
+        zone = smallzone;
+    }
+    else
+    {
+        zone = mainzone;
+    }
+    count = 0;
+    // use the rover as our pointer, because
+    // Z_ZoneFree automatically adjusts it
+    zone->rover = zone->blocklist.next;
+    do
+    {
+        if( zone->rover->tag == tag )
+        {
+            count++;
+            block = zone->rover;
+            if( zoneTraceFile )
+            {
+                Z_TraceEvent( ZONE_TRACE_FREE, block + 1, 0, tag );
+            }
+            if( block->profile )
+            {
+                Com_AllocProfileFree( block->profile, block->size, tag );
+            }
+            ::memset( block + 1, 0xaa, block->size - sizeof( *block ) );
+            Z_ZoneFree( block );
+            continue;
+        }
+        zone->rover = zone->rover->next;
+    }
+    while( zone->rover != &zone->blocklist );
+    
+    SDL_AtomicUnlock( &zoneLock );
+}
+
+/*
+================
+Z_ZoneAlloc
+
+First fit from the block list, zoneLock must be held
+================
+*/
+static memblock_t* Z_ZoneAlloc( S32 size, S32 tag )
+{
+    S32             extra;
+    memblock_t*     start, *rover, *_new, *base;
+    memzone_t*      zone;
+    
+    if( tag == TAG_SMALL )
+    {
+        zone = smallzone;
+    }
+    else
+    {
         zone = mainzone;
     }
     
-    allocSize = size;
     //
     // scan through the block list looking for the first free block
     // of sufficient size
@@ -1202,6 +1796,8 @@ void*           Z_TagMalloc( S32 size, S32 tag )
 #ifdef ZONE_DEBUG
             Z_LogHeap();
 #endif
+            SDL_AtomicUnlock( &zoneLock );
+            
             // scaned all the way around the list
             Com_Error( ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes from the %s zone",
                        size, zone == smallzone ? "small" : "main" );
@@ -1242,17 +1838,78 @@ void*           Z_TagMalloc( S32 size, S32 tag )
     zone->used += base->size;	//
     
     base->id = ZONEID;
+    base->profile = 0;
+    
+    // marker for memory trash testing
+    *( S32* )( ( U8* ) base + base->size - 4 ) = ZONEID;
     
+    return base;
+}
+
+/*
+================
+Z_TagMalloc
+================
+*/
+
+memblock_t*     debugblock;		// RF, jusy so we can track a block to find out when it's getting trashed
+
+#ifdef ZONE_DEBUG
+void*           Z_TagMallocDebug( S32 size, S32 tag, UTF8* label, UTF8* file, S32 line )
+{
+#else
+void*           Z_TagMalloc( S32 size, S32 tag )
+{
+#endif
+    zoneThreadCache_t* tc;
+    memblock_t*     base;
+    
+    if( !tag )
+    {
+        Com_Error( ERR_FATAL, "Z_TagMalloc: tried to use a 0 tag" );
+    }
+    
+    if( size >= 0 && size <= ZONE_MAX_CLASS && SDL_AtomicGet( &zoneCacheEnabled ) && ( tc = Z_GetThreadCache() ) != NULL )
+    {
+        base = Z_CacheAlloc( tc, size, tag );
+    }
+    else
+    {
+        SDL_AtomicLock( &zoneLock );
+        
+        if( zoneSlabs->enabled && size >= 0 && size <= ZONE_MAX_CLASS )
+        {
+            base = Z_SlabAlloc( size, tag );
+            
+            // marker for memory trash testing
+            *( S32* )( ( U8* ) base + base->size - 4 ) = ZONEID;
+        }
+        else
+        {
+            base = Z_ZoneAlloc( size, tag );
+        }
+        
+        if( zoneTraceFile && tag != TAG_SLAB )
+        {
+            Z_TraceEvent( ZONE_TRACE_ALLOC, base + 1, size, tag );
+        }
+        
+        SDL_AtomicUnlock( &zoneLock );
+    }
+    
+    base->profile = 0;
+    if( SDL_AtomicGet( &com_allocProfileActive ) )
+    {
+        base->profile = Com_AllocProfileAlloc( base->size, tag );
+    }
+
 #ifdef ZONE_DEBUG
     base->d.label = label;
     base->d.file = file;
     base->d.line = line;
-    base->d.allocSize = allocSize;
+    base->d.allocSize = size;
 #endif
     
-    // marker for memory trash testing
-    *( S32* )( ( U8* ) base + base->size - 4 ) = ZONEID;
-    
     return ( void* )( ( U8* ) base + sizeof( memblock_t ) );
 }
 
@@ -1564,150 +2221,642 @@ typedef struct hunkblock_s
     S32             line;
 } hunkblock_t;
 
-static struct
+static struct
+{
+    hunkblock_t* blocks;
+    
+    U8*	mem, *original;
+    U64	memSize;
+    
+    U64	permTop, permMax;
+    U64	tempTop, tempMax;
+    
+    U64	maxEver;
+    
+    U64	mark;
+} s_hunk;
+
+static hunkblock_t* hunkblocks;
+
+// hunkLock guards the tops, hunkGeneration tells the worker threads their
+// hunk chunks are gone, see zoneThreadCache_t
+static SDL_SpinLock hunkLock;
+static SDL_atomic_t hunkGeneration;
+static SDL_threadID hunkMainThread;
+
+static void Hunk_FrameInit( void );
+static void Hunk_FrameInfo( void );
+static void Com_PrintMemoryPages( void );
+
+static hunkUsed_t hunk_low, hunk_high;
+static hunkUsed_t* hunk_permanent, *hunk_temp;
+
+static U8*    s_hunkData = NULL;
+static S32      s_hunkTotal;
+
+static S32      s_zoneTotal;
+static S32      s_smallZoneTotal;
+
+// how the hunk and the main zone are backed, see Sys_AllocMemory
+static cvar_t*      com_hugePages;
+static sysMemory_t  s_hunkMemory, s_zoneMemory;
+static S32          s_prefaultMsec = -1;
+static S64          s_tlbMissesStart;
+static S32          s_tlbFrameStart;
+
+/*
+=================
+Com_Meminfo_f
+=================
+*/
+void Com_Meminfo_f( void )
+{
+    memblock_t*	block;
+    zoneClass_t*	cls;
+    zoneSlab_t*	slab;
+    S32			zoneBytes, zoneBlocks;
+    S32			smallZoneBytes, smallZoneBlocks;
+    S32			botlibBytes, rendererBytes, otherBytes;
+    S32			cryptoBytes, staticBytes, generalBytes;
+    S32			slabBytes, slabFreeBytes, c, i;
+    
+    zoneBytes = 0;
+    slabBytes = 0;
+    botlibBytes = 0;
+    rendererBytes = 0;
+    otherBytes = 0;
+    cryptoBytes = 0;
+    staticBytes = 0;
+    generalBytes = 0;
+    zoneBlocks = 0;
+    
+    if( Cmd_Argc() != 1 )
+    {
+        for( block = mainzone->blocklist.next ; block != &mainzone->blocklist ; block = block->next )
+        {
+            Com_Printf( "block:%p    size:%7i    tag:%3i\n",
+                        block, block->size, block->tag );
+        }
+    }
+    
+    // count under the lock, the printing happens after
+    SDL_AtomicLock( &zoneLock );
+    for( block = mainzone->blocklist.next ; ; block = block->next )
+    {
+        if( block->tag )
+        {
+            zoneBytes += block->size;
+            zoneBlocks++;
+            if( block->tag == TAG_SLAB )
+            {
+                slabBytes += block->size; // split up by tag below
+            }
+            else if( block->tag == TAG_BOTLIB )
+            {
+                botlibBytes += block->size;
+            }
+            else if( block->tag == TAG_RENDERER )
+            {
+                rendererBytes += block->size;
+            }
+            else if( block->tag == TAG_CRYPTO )
+            {
+                cryptoBytes += block->size;
+            }
+            else if( block->tag == TAG_STATIC )
+            {
+                staticBytes += block->size;
+            }
+            else if( block->tag == TAG_GENERAL )
+            {
+                generalBytes += block->size;
+            }
+            else
+                otherBytes += block->size;
+        }
+        
+        if( block->next == &mainzone->blocklist )
+        {
+            break;			// all blocks have been hit
+        }
+        if( ( U8* )block + block->size != ( U8* )block->next )
+        {
+            Com_Printf( "ERROR: block size does not touch the next block\n" );
+        }
+        if( block->next->prev != block )
+        {
+            Com_Printf( "ERROR: next block doesn't have proper back link\n" );
+        }
+        if( !block->tag && !block->next->tag )
+        {
+            Com_Printf( "ERROR: two consecutive free blocks\n" );
+        }
+    }
+    
+    smallZoneBytes = 0;
+    smallZoneBlocks = 0;
+    for( block = smallzone->blocklist.next ; ; block = block->next )
+    {
+        if( block->tag )
+        {
+            smallZoneBytes += block->size;
+            smallZoneBlocks++;
+        }
+        
+        if( block->next == &smallzone->blocklist )
+        {
+            break;			// all blocks have been hit
+        }
+    }
+    
+    // the slots of the slabs count for their own tags
+    slabFreeBytes = slabBytes;
+    for( c = 0; c < ZONE_NUM_CLASSES; c++ )
+    {
+        cls = &zoneSlabs->classes[c];
+        for( slab = cls->slabs; slab; slab = slab->next )
+        {
+            for( i = 0; i < cls->slotsPerSlab; i++ )
+            {
+                block = ( memblock_t* )( ( U8* )( slab + 1 ) + i * cls->slotSize );
+                if( !block->tag )
+                {
+                    continue;
+                }
+                
+                slabFreeBytes -= block->size;
+                if( block->tag == TAG_BOTLIB )
+                {
+                    botlibBytes += block->size;
+                }
+                else if( block->tag == TAG_RENDERER )
+                {
+                    rendererBytes += block->size;
+                }
+                else if( block->tag == TAG_CRYPTO )
+                {
+                    cryptoBytes += block->size;
+                }
+                else if( block->tag == TAG_SMALL )
+                {
+                    smallZoneBytes += block->size;
+                }
+                else if( block->tag == TAG_GENERAL )
+                {
+                    generalBytes += block->size;
+                }
+                else
+                {
+                    otherBytes += block->size;
+                }
+            }
+        }
+    }
+    SDL_AtomicUnlock( &zoneLock );
+    
+    Com_Printf( "%8i K total hunk\n", s_hunk.memSize / 1024 );
+    Com_Printf( "%8i K total zone\n", s_zoneTotal / 1024 );
+    Com_Printf( "\n" );
+    
+    Com_PrintMemoryPages();
+    Com_Printf( "\n" );
+    
+    Com_Printf( "%8i K used hunk (permanent)\n", s_hunk.permTop / 1024 );
+    Com_Printf( "%8i K used hunk (temp)\n", s_hunk.tempTop / 1024 );
+    Com_Printf( "%8i K used hunk (TOTAL)\n", ( s_hunk.permTop + s_hunk.tempTop ) / 1024 );
+    Com_Printf( "\n" );
+    
+    Com_Printf( "%8i K max hunk (permanent)\n", s_hunk.permMax / 1024 );
+    Com_Printf( "%8i K max hunk (temp)\n", s_hunk.tempMax / 1024 );
+    Com_Printf( "%8i K max hunk (TOTAL)\n", ( s_hunk.permMax + s_hunk.tempMax ) / 1024 );
+    Com_Printf( "\n" );
+    
+    Com_Printf( "%8i K max hunk since last Hunk_Clear\n", s_hunk.maxEver / 1024 );
+    Com_Printf( "%8i K hunk mem never touched\n", ( s_hunk.memSize - s_hunk.maxEver ) / 1024 );
+    Com_Printf( "%8i hunk mark value\n", s_hunk.mark );
+    Com_Printf( "\n" );
+    
+    Hunk_FrameInfo();
+    Com_Printf( "\n" );
+    
+    Com_Printf( "\n" );
+    Com_Printf( "%8i bytes in %i zone blocks\n", zoneBytes, zoneBlocks	);
+    Com_Printf( "        %8i bytes in dynamic botlib\n", botlibBytes );
+    Com_Printf( "        %8i bytes in dynamic renderer\n", rendererBytes );
+    Com_Printf( "        %8i bytes in dynamic other\n", otherBytes );
+    Com_Printf( "        %8i bytes in small Zone memory\n", smallZoneBytes );
+    Com_Printf( "        %8i bytes in cryto client memory\n", cryptoBytes );
+    Com_Printf( "        %8i bytes in static server memory\n", staticBytes );
+    Com_Printf( "        %8i bytes in general common memory\n", generalBytes );
+    Com_Printf( "        %8i bytes unused in slabs\n", slabFreeBytes );
+    
+    if( zoneSlabs->enabled )
+    {
+        Com_Printf( "\n" );
+        Com_Printf( "    size  slabs     used     peak     free      allocs       frees\n" );
+        for( c = 0; c < ZONE_NUM_CLASSES; c++ )
+        {
+            cls = &zoneSlabs->classes[c];
+            if( cls->allocs )
+            {
+                Com_Printf( "%8i %6i %8i %8i %8i %11i %11i\n", zoneClassSizes[c], cls->numSlabs, cls->used, cls->peak,
+                            cls->numFree, cls->allocs, cls->frees );
+            }
+        }
+    }
+}
+
+/*
+=================
+Com_ZoneTrace_f
+
+Records every zone allocation and free to a file, for Com_ZoneBench_f
+=================
+*/
+void Com_ZoneTrace_f( void )
+{
+    fileHandle_t	f;
+    
+    if( zoneTraceFile )
+    {
+        SDL_AtomicLock( &zoneLock );
+        Z_FlushTrace();
+        f = zoneTraceFile;
+        zoneTraceFile = 0;
+        SDL_AtomicUnlock( &zoneLock );
+        
+        SDL_AtomicSet( &zoneCacheEnabled, zoneSlabs->enabled );
+        fileSystem->FCloseFile( f );
+        Com_Printf( "%i zone events traced\n", zoneTraceTotal );
+        return;
+    }
+    
+    if( Cmd_Argc() != 2 )
+    {
+        Com_Printf( "usage: zonetrace <file>, then zonetrace again to stop\n" );
+        return;
+    }
+    
+    f = fileSystem->FOpenFileWrite( Cmd_Argv( 1 ) );
+    if( !f )
+    {
+        Com_Printf( "couldn't write %s\n", Cmd_Argv( 1 ) );
+        return;
+    }
+    
+    // the thread caches bypass the lock the tracing relies on
+    SDL_AtomicSet( &zoneCacheEnabled, 0 );
+    
+    SDL_AtomicLock( &zoneLock );
+    zoneTraceCount = 0;
+    zoneTraceTotal = 0;
+    zoneTraceFile = f;
+    SDL_AtomicUnlock( &zoneLock );
+}
+
+/*
+=================
+Com_ZoneReplay
+
+Replays a trace on the current zones, events[i].size is the index of the
+allocation a free event frees, or -1 if it was made before the trace
+started.  Returns the time taken in microseconds.
+=================
+*/
+static S64 Com_ZoneReplay( zoneTraceEvent_t* events, S32 numEvents, void** live )
 {
-    hunkblock_t* blocks;
+    S64				start, usec;
+    S32				i;
     
-    U8*	mem, *original;
-    U64	memSize;
-    
-    U64	permTop, permMax;
-    U64	tempTop, tempMax;
+    start = Sys_Microseconds();
+    for( i = 0; i < numEvents; i++ )
+    {
+        if( events[i].op == ZONE_TRACE_ALLOC )
+        {
+            live[i] = Z_TagMalloc( events[i].size, events[i].tag );
+        }
+        else if( events[i].size >= 0 && live[events[i].size] )
+        {
+            Z_Free( live[events[i].size] );
+            live[events[i].size] = NULL;
+        }
+    }
+    usec = Sys_Microseconds() - start;
     
-    U64	maxEver;
+    // whatever was still allocated when the trace ended
+    for( i = 0; i < numEvents; i++ )
+    {
+        if( live[i] )
+        {
+            Z_Free( live[i] );
+            live[i] = NULL;
+        }
+    }
     
-    U64	mark;
-} s_hunk;
-
-static hunkblock_t* hunkblocks;
-
-static hunkUsed_t hunk_low, hunk_high;
-static hunkUsed_t* hunk_permanent, *hunk_temp;
-
-static U8*    s_hunkData = NULL;
-static S32      s_hunkTotal;
-
-static S32      s_zoneTotal;
-static S32      s_smallZoneTotal;
+    return usec;
+}
 
 /*
 =================
-Com_Meminfo_f
+Com_ZoneBench_f
+
+Replays a trace from Com_ZoneTrace_f on fresh zones of the configured size,
+once with the slabs and once with the first fit zone alone.  The zones are
+swapped out from under every thread, so nothing else may allocate meanwhile.
 =================
 */
-void Com_Meminfo_f( void )
+void Com_ZoneBench_f( void )
 {
-    memblock_t*	block;
-    S32			zoneBytes, zoneBlocks;
-    S32			smallZoneBytes, smallZoneBlocks;
-    S32			botlibBytes, rendererBytes, otherBytes;
-    S32			cryptoBytes, staticBytes, generalBytes;
+    zoneTraceEvent_t*	events;
+    zoneSlabs_t	benchSlabs, *savedSlabs;
+    memzone_t*	savedMain, *savedSmall;
+    fileHandle_t	savedTrace;
+    void**		live;
+    U64*		keys, key;
+    S32*		values;
+    S32			i, len, numEvents, numAllocs, numFrees, hashSize, h, pass;
+    S64			usec[2];
     
-    zoneBytes = 0;
-    botlibBytes = 0;
-    rendererBytes = 0;
-    otherBytes = 0;
-    cryptoBytes = 0;
-    staticBytes = 0;
-    generalBytes = 0;
-    zoneBlocks = 0;
-    for( block = mainzone->blocklist.next ; ; block = block->next )
+    if( Cmd_Argc() != 2 )
+    {
+        Com_Printf( "usage: zonebench <trace file>\n" );
+        return;
+    }
+    
+    len = fileSystem->ReadFile( Cmd_Argv( 1 ), ( void** )&events );
+    if( len < 0 )
+    {
+        Com_Printf( "couldn't read %s\n", Cmd_Argv( 1 ) );
+        return;
+    }
+    numEvents = len / sizeof( zoneTraceEvent_t );
+    
+    hashSize = 1;
+    while( hashSize < numEvents * 2 )
+    {
+        hashSize <<= 1;
+    }
+    keys = ( U64* )calloc( hashSize, sizeof( *keys ) );
+    values = ( S32* )calloc( hashSize, sizeof( *values ) );
+    live = ( void** )calloc( numEvents + 1, sizeof( *live ) );
+    if( !keys || !values || !live )
+    {
+        free( keys );
+        free( values );
+        free( live );
+        fileSystem->FreeFile( events );
+        Com_Printf( "not enough memory for %i events\n", numEvents );
+        return;
+    }
+    
+    // resolve the pointers up front, a free refers to the last allocation
+    // that returned its pointer
+    numAllocs = numFrees = 0;
+    for( i = 0; i < numEvents; i++ )
     {
-        if( Cmd_Argc() != 1 )
+        events[i].op = LittleLong( events[i].op );
+        events[i].tag = LittleLong( events[i].tag );
+        events[i].size = LittleLong( events[i].size );
+        key = ( ( U64 )( U32 )LittleLong( events[i].ptrHigh ) << 32 ) | ( U32 )LittleLong( events[i].ptrLow );
+        
+        h = ( S32 )( ( key >> 4 ) * 2654435761u ) & ( hashSize - 1 );
+        while( keys[h] && keys[h] != key )
         {
-            Com_Printf( "block:%p    size:%7i    tag:%3i\n",
-                        block, block->size, block->tag );
+            h = ( h + 1 ) & ( hashSize - 1 );
         }
-        if( block->tag )
+        
+        if( events[i].op == ZONE_TRACE_ALLOC )
         {
-            zoneBytes += block->size;
-            zoneBlocks++;
-            if( block->tag == TAG_BOTLIB )
-            {
-                botlibBytes += block->size;
-            }
-            else if( block->tag == TAG_RENDERER )
-            {
-                rendererBytes += block->size;
-            }
-            else if( block->tag == TAG_CRYPTO )
-            {
-                cryptoBytes += block->size;
-            }
-            else if( block->tag == TAG_STATIC )
+            // tags that were never meant for the zone would upset the replay
+            if( events[i].tag <= TAG_FREE || events[i].tag == TAG_STATIC || events[i].tag == TAG_SLAB || events[i].size < 0 )
             {
-                staticBytes += block->size;
+                events[i].tag = TAG_GENERAL;
+                events[i].size = events[i].size < 0 ? 0 : events[i].size;
             }
-            else if( block->tag == TAG_GENERAL )
+            keys[h] = key;
+            values[h] = i;
+            numAllocs++;
+        }
+        else
+        {
+            events[i].size = keys[h] ? values[h] : -1;
+            if( keys[h] )
             {
-                generalBytes += block->size;
+                values[h] = -1;
             }
-            else
-                otherBytes += block->size;
+            numFrees++;
+        }
+    }
+    
+    savedMain = mainzone;
+    savedSmall = smallzone;
+    savedSlabs = zoneSlabs;
+    savedTrace = zoneTraceFile;
+    zoneTraceFile = 0;
+    SDL_AtomicSet( &zoneCacheEnabled, 0 );
+    
+    for( pass = 0; pass < 2; pass++ )
+    {
+        // the small zone is as big as the main one, a trace taken with the
+        // slabs doesn't have to fit in the real small zone without them
+        mainzone = ( memzone_t* )calloc( s_zoneTotal, 1 );
+        smallzone = ( memzone_t* )calloc( s_zoneTotal, 1 );
+        if( !mainzone || !smallzone )
+        {
+            free( mainzone );
+            free( smallzone );
+            usec[pass] = -1;
+            continue;
         }
+        Z_ClearZone( mainzone, s_zoneTotal );
+        Z_ClearZone( smallzone, s_zoneTotal );
+        Z_InitSlabs( &benchSlabs, pass == 0 );
+        zoneSlabs = &benchSlabs;
         
-        if( block->next == &mainzone->blocklist )
+        usec[pass] = Com_ZoneReplay( events, numEvents, live );
+        
+        free( mainzone );
+        free( smallzone );
+    }
+    
+    mainzone = savedMain;
+    smallzone = savedSmall;
+    zoneSlabs = savedSlabs;
+    zoneTraceFile = savedTrace;
+    SDL_AtomicSet( &zoneCacheEnabled, zoneSlabs->enabled && !zoneTraceFile );
+    
+    free( keys );
+    free( values );
+    free( live );
+    fileSystem->FreeFile( events );
+    
+    Com_Printf( "%i allocations, %i frees\n", numAllocs, numFrees );
+    Com_Printf( "slabs:      %.2f ms\n", usec[0] / 1000.0f );
+    Com_Printf( "first fit:  %.2f ms\n", usec[1] / 1000.0f );
+}
+
+#define MAX_ZONE_STRESS_THREADS 16
+#define ZONE_STRESS_LIVE 256
+
+typedef struct
+{
+    S32             iterations;
+    SDL_atomic_t    seed;
+    SDL_atomic_t    errors;
+} zoneStress_t;
+
+/*
+=================
+Com_ZoneStressThread
+
+Random zone, temp and hunk allocations for zonestress, checking that no
+block was handed out twice or touched by another thread
+=================
+*/
+static S32 Com_ZoneStressThread( void* arg )
+{
+    zoneStress_t*	stress = ( zoneStress_t* )arg;
+    U8*			live[ZONE_STRESS_LIVE];
+    S32			sizes[ZONE_STRESS_LIVE];
+    U8			fills[ZONE_STRESS_LIVE];
+    U8*			temp;
+    U32			seed;
+    S32			i, j, slot, size, errors;
+    
+    seed = ( U32 )SDL_AtomicAdd( &stress->seed, 1 ) * 2654435761u + 1;
+    errors = 0;
+    ::memset( live, 0, sizeof( live ) );
+    
+    for( i = 0; i < stress->iterations; i++ )
+    {
+        seed = seed * 1664525 + 1013904223;
+        slot = ( seed >> 8 ) % ZONE_STRESS_LIVE;
+        
+        if( live[slot] )
         {
-            break;			// all blocks have been hit
+            for( j = 0; j < sizes[slot]; j++ )
+            {
+                if( live[slot][j] != fills[slot] )
+                {
+                    errors++;
+                    break;
+                }
+            }
+            Z_Free( live[slot] );
+            live[slot] = NULL;
         }
-        if( ( U8* )block + block->size != ( U8* )block->next )
+        else
         {
-            Com_Printf( "ERROR: block size does not touch the next block\n" );
+            // mostly slab sizes, now and then something for the block list
+            size = ( seed >> 16 ) & 15 ? ( seed >> 4 ) % 512 : ( seed >> 4 ) % 16384;
+            live[slot] = ( U8* )Z_TagMalloc( size, size <= 512 && ( seed & 1 ) ? TAG_SMALL : TAG_GENERAL );
+            sizes[slot] = size;
+            fills[slot] = ( U8 )( seed >> 24 );
+            ::memset( live[slot], fills[slot], size );
         }
-        if( block->next->prev != block )
+        
+        if( !( i & 63 ) )
         {
-            Com_Printf( "ERROR: next block doesn't have proper back link\n" );
+            size = ( ( seed >> 4 ) & 65535 ) + 1;
+            temp = ( U8* )Hunk_AllocateTempMemory( size );
+            ::memset( temp, slot, size );
+            for( j = 0; j < size; j++ )
+            {
+                if( temp[j] != ( U8 )slot )
+                {
+                    errors++;
+                    break;
+                }
+            }
+            Hunk_FreeTempMemory( temp );
         }
-        if( !block->tag && !block->next->tag )
+        
+        if( !( i & 4095 ) )
         {
-            Com_Printf( "ERROR: two consecutive free blocks\n" );
+            size = ( ( seed >> 4 ) & 255 ) + 1;
+            temp = ( U8* )Hunk_Alloc( size, h_low );
+            for( j = 0; j < size; j++ )
+            {
+                if( temp[j] )
+                {
+                    errors++;
+                    break;
+                }
+            }
+            ::memset( temp, 0xff, size );
         }
     }
     
-    smallZoneBytes = 0;
-    smallZoneBlocks = 0;
-    for( block = smallzone->blocklist.next ; ; block = block->next )
+    for( slot = 0; slot < ZONE_STRESS_LIVE; slot++ )
     {
-        if( block->tag )
+        if( live[slot] )
         {
-            smallZoneBytes += block->size;
-            smallZoneBlocks++;
+            Z_Free( live[slot] );
         }
-        
-        if( block->next == &smallzone->blocklist )
+    }
+    
+    SDL_AtomicAdd( &stress->errors, errors );
+    
+    return 0;
+}
+
+/*
+=================
+Com_ZoneStress_f
+
+Hammers the zone and the hunk from several threads at once, leaves a little
+permanent hunk memory behind
+=================
+*/
+void Com_ZoneStress_f( void )
+{
+    SDL_Thread*	threads[MAX_ZONE_STRESS_THREADS];
+    zoneStress_t	stress;
+    S32			i, numThreads, numStarted;
+    S64			start, usec;
+    
+    if( Cmd_Argc() > 3 )
+    {
+        Com_Printf( "usage: zonestress [threads] [iterations]\n" );
+        return;
+    }
+    
+    numThreads = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : SDL_GetCPUCount();
+    numThreads = numThreads < 1 ? 1 : numThreads > MAX_ZONE_STRESS_THREADS ? MAX_ZONE_STRESS_THREADS : numThreads;
+    
+    ::memset( &stress, 0, sizeof( stress ) );
+    stress.iterations = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 1000000;
+    if( stress.iterations < 1 )
+    {
+        stress.iterations = 1;
+    }
+    
+    start = Sys_Microseconds();
+    
+    for( numStarted = 0; numStarted < numThreads; numStarted++ )
+    {
+        threads[numStarted] = SDL_CreateThread( Com_ZoneStressThread, "zoneStress", &stress );
+        if( !threads[numStarted] )
         {
-            break;			// all blocks have been hit
+            Com_Printf( S_COLOR_YELLOW "WARNING: couldn't create thread: %s\n", SDL_GetError() );
+            break;
         }
     }
     
-    Com_Printf( "%8i K total hunk\n", s_hunk.memSize / 1024 );
-    Com_Printf( "%8i K total zone\n", s_zoneTotal / 1024 );
-    Com_Printf( "\n" );
+    // the main thread goes through the locked hunk path
+    Com_ZoneStressThread( &stress );
     
-    Com_Printf( "%8i K used hunk (permanent)\n", s_hunk.permTop / 1024 );
-    Com_Printf( "%8i K used hunk (temp)\n", s_hunk.tempTop / 1024 );
-    Com_Printf( "%8i K used hunk (TOTAL)\n", ( s_hunk.permTop + s_hunk.tempTop ) / 1024 );
-    Com_Printf( "\n" );
+    for( i = 0; i < numStarted; i++ )
+    {
+        SDL_WaitThread( threads[i], NULL );
+    }
     
-    Com_Printf( "%8i K max hunk (permanent)\n", s_hunk.permMax / 1024 );
-    Com_Printf( "%8i K max hunk (temp)\n", s_hunk.tempMax / 1024 );
-    Com_Printf( "%8i K max hunk (TOTAL)\n", ( s_hunk.permMax + s_hunk.tempMax ) / 1024 );
-    Com_Printf( "\n" );
+    usec = Sys_Microseconds() - start;
     
-    Com_Printf( "%8i K max hunk since last Hunk_Clear\n", s_hunk.maxEver / 1024 );
-    Com_Printf( "%8i K hunk mem never touched\n", ( s_hunk.memSize - s_hunk.maxEver ) / 1024 );
-    Com_Printf( "%8i hunk mark value\n", s_hunk.mark );
-    Com_Printf( "\n" );
+    Com_Printf( "%i iterations on %i threads in %.1f ms, %i errors\n", stress.iterations, numStarted + 1, usec / 1000.0f,
+                SDL_AtomicGet( &stress.errors ) );
     
-    Com_Printf( "\n" );
-    Com_Printf( "%8i bytes in %i zone blocks\n", zoneBytes, zoneBlocks	);
-    Com_Printf( "        %8i bytes in dynamic botlib\n", botlibBytes );
-    Com_Printf( "        %8i bytes in dynamic renderer\n", rendererBytes );
-    Com_Printf( "        %8i bytes in dynamic other\n", otherBytes );
-    Com_Printf( "        %8i bytes in small Zone memory\n", smallZoneBytes );
-    Com_Printf( "        %8i bytes in cryto client memory\n", cryptoBytes );
-    Com_Printf( "        %8i bytes in static server memory\n", staticBytes );
-    Com_Printf( "        %8i bytes in general common memory\n", generalBytes );
+    Z_CheckHeap();
 }
 
 /*
@@ -1746,9 +2895,128 @@ void Com_TouchMemory( void )
         }
     }
     
-    end = Sys_Milliseconds();
+    end = Sys_Milliseconds();
+    
+    Com_Printf( "Com_TouchMemory: %i msec\n", end - start );
+}
+
+/*
+===============
+Com_PageTypeName
+===============
+*/
+static StringEntry Com_PageTypeName( S32 hugePages )
+{
+    if( hugePages >= 2 )
+    {
+        return "huge pages";
+    }
+    if( hugePages == 1 )
+    {
+        return "transparent huge pages";
+    }
+    return "normal pages";
+}
+
+/*
+===============
+Com_PrintMemoryPages
+
+What backs the hunk and the zone and how the TLB has been doing since the hunk came up
+===============
+*/
+static void Com_PrintMemoryPages( void )
+{
+    S64		misses;
+    S32		frames;
+    
+    Com_Printf( "hunk on %s, zone on %s\n", Com_PageTypeName( s_hunkMemory.hugePages ), Com_PageTypeName( s_zoneMemory.hugePages ) );
+    if( s_prefaultMsec >= 0 )
+    {
+        Com_Printf( "pre-faulted in %i msec\n", s_prefaultMsec );
+    }
+    
+    misses = Sys_TLBMisses();
+    if( misses < 0 )
+    {
+        Com_Printf( "dTLB misses are not available\n" );
+        return;
+    }
+    
+    misses -= s_tlbMissesStart;
+    frames = com_frameNumber - s_tlbFrameStart;
+    Com_Printf( "%lli dTLB misses on the main thread, %lli per frame\n", ( long long )misses, ( long long )( misses / ( frames > 0 ? frames : 1 ) ) );
+}
+
+#define PREFAULT_CHUNK		( 4 * 1024 * 1024 )
+#define PREFAULT_STEP		4096
+
+typedef struct
+{
+    U8*		base[2];
+    size_t	size[2];
+    S32		chunks[2];
+} prefault_t;
+
+/*
+===============
+Com_PrefaultJob
+===============
+*/
+static void Com_PrefaultJob( void* data, S32 index )
+{
+    prefault_t*	p = ( prefault_t* )data;
+    U8*		page, *end;
+    S32		r;
+    
+    for( r = 0; index >= p->chunks[r]; r++ )
+    {
+        index -= p->chunks[r];
+    }
+    
+    page = p->base[r] + ( size_t )index * PREFAULT_CHUNK;
+    end = page + PREFAULT_CHUNK;
+    if( end > p->base[r] + p->size[r] )
+    {
+        end = p->base[r] + p->size[r];
+    }
+    
+    // the zone is in use already, an atomic add of nothing dirties the page
+    // without racing whoever else writes to it
+    for( ; page < end; page += PREFAULT_STEP )
+    {
+        SDL_AtomicAdd( ( SDL_atomic_t* )page, 0 );
+    }
+}
+
+/*
+===============
+Com_PrefaultMemory
+
+Faults the hunk and the main zone in on all the job workers, instead of one
+page fault at a time the first time each page is used
+===============
+*/
+static void Com_PrefaultMemory( void )
+{
+    prefault_t	p;
+    S32		start, r;
+    
+    p.base[0] = ( U8* )s_hunkMemory.base;
+    p.size[0] = s_hunkMemory.size;
+    p.base[1] = ( U8* )s_zoneMemory.base;
+    p.size[1] = s_zoneMemory.base ? s_zoneMemory.size : 0;
+    for( r = 0; r < 2; r++ )
+    {
+        p.chunks[r] = ( S32 )( ( p.size[r] + PREFAULT_CHUNK - 1 ) / PREFAULT_CHUNK );
+    }
     
-    Com_Printf( "Com_TouchMemory: %i msec\n", end - start );
+    start = Sys_Milliseconds();
+    Com_RunJobs( Com_PrefaultJob, &p, p.chunks[0] + p.chunks[1] );
+    s_prefaultMsec = Sys_Milliseconds() - start;
+    
+    Com_Printf( "Pre-faulted %i megs on %i threads in %i msec\n", ( S32 )( ( p.size[0] + p.size[1] ) >> 20 ),
+                Com_JobWorkers() + 1, s_prefaultMsec );
 }
 
 
@@ -1789,14 +3057,28 @@ void Com_InitZoneMemory( void )
         s_zoneTotal = cv->integer * 1024 * 1024;
     }
     
-    // bk001205 - was malloc
-    mainzone = ( memzone_t* )calloc( s_zoneTotal, 1 );
+    // only the command line counts for the zone, the hunk picks up the config too
+    Com_StartupVariable( "com_hugePages" );
+    com_hugePages = cvarSystem->Get( "com_hugePages", "0", CVAR_LATCH | CVAR_ARCHIVE );
+    
+    mainzone = ( memzone_t* )Sys_AllocMemory( s_zoneTotal, com_hugePages->integer, &s_zoneMemory );
     if( !mainzone )
     {
         Com_Error( ERR_FATAL, "Zone data failed to allocate %i megs", s_zoneTotal / ( 1024 * 1024 ) );
     }
     Z_ClearZone( mainzone, s_zoneTotal );
     
+    Com_StartupVariable( "com_zoneSlabs" );
+    cv = cvarSystem->Get( "com_zoneSlabs", "1", CVAR_INIT );
+    Z_InitSlabs( &s_zoneSlabs, cv->integer != 0 );
+    
+    // whatever the thread caches held belonged to the old zone
+    zoneGeneration++;
+    if( !zoneCacheTLS )
+    {
+        zoneCacheTLS = SDL_TLSCreate();
+    }
+    SDL_AtomicSet( &zoneCacheEnabled, s_zoneSlabs.enabled );
 }
 
 /*
@@ -1898,6 +3180,7 @@ void Com_InitHunkMemory( void )
     UTF8* pMsg = NULL;
     
     ::memset( &s_hunk, 0, sizeof( s_hunk ) );
+    hunkMainThread = SDL_ThreadID();
     
     // make sure the file system has allocated and "not" freed any temp blocks
     // this allows the config and product id files ( journal files too ) to be loaded
@@ -1934,18 +3217,34 @@ void Com_InitHunkMemory( void )
     }
     
     
-    // bk001205 - was malloc
-    s_hunk.original = ( U8* )calloc( s_hunk.memSize + 31, 1 );
+    // the latched value from the config applies now
+    com_hugePages = cvarSystem->Get( "com_hugePages", "0", CVAR_LATCH | CVAR_ARCHIVE );
+    cv = cvarSystem->Get( "com_prefaultMemory", "0", CVAR_LATCH | CVAR_ARCHIVE );
+    
+    // page aligned, which covers the cacheline
+    s_hunk.original = ( U8* )Sys_AllocMemory( s_hunk.memSize, com_hugePages->integer, &s_hunkMemory );
     if( !s_hunk.original )
     {
         Com_Error( ERR_FATAL, "Hunk data failed to allocate %i megs", s_hunk.memSize / ( 1024 * 1024 ) );
     }
-    // cacheline align
-    s_hunk.mem = ( U8* )( ( ( intptr_t )s_hunk.original + 31 ) & ~31 );
+    s_hunk.mem = s_hunk.original;
+    
+    Com_Printf( "Hunk: %i megs on %s\n", ( S32 )( s_hunk.memSize >> 20 ), Com_PageTypeName( s_hunkMemory.hugePages ) );
+    if( cv->integer )
+    {
+        Com_PrefaultMemory();
+    }
+    
+    // starts the counter
+    s_tlbMissesStart = Sys_TLBMisses();
+    s_tlbFrameStart = com_frameNumber;
     
     Hunk_Clear();
     
     Cmd_AddCommand( "meminfo", Com_Meminfo_f );
+    Cmd_AddCommand( "zonetrace", Com_ZoneTrace_f );
+    Cmd_AddCommand( "zonebench", Com_ZoneBench_f );
+    Cmd_AddCommand( "zonestress", Com_ZoneStress_f );
 #ifdef ZONE_DEBUG
     Cmd_AddCommand( "zonelog", Z_LogHeap );
 #endif
@@ -1957,8 +3256,7 @@ void Com_InitHunkMemory( void )
 
 void Com_ReleaseMemory( void )
 {
-    if( s_hunk.original )
-        free( s_hunk.original );
+    Sys_FreeMemory( &s_hunkMemory );
     memset( &s_hunk, 0, sizeof( s_hunk ) );
     
     if( smallzone )
@@ -1969,9 +3267,12 @@ void Com_ReleaseMemory( void )
     
     if( mainzone )
     {
-        free( mainzone );
+        Sys_FreeMemory( &s_zoneMemory );
         mainzone = 0;
     }
+    ::memset( &s_zoneSlabs, 0, sizeof( s_zoneSlabs ) );
+    SDL_AtomicSet( &zoneCacheEnabled, 0 );
+    zoneGeneration++;
 }
 
 /*
@@ -2005,10 +3306,21 @@ The client calls this before starting a vid_restart or snd_restart
 */
 void Hunk_ClearToMark( void )
 {
+    Com_AllocProfileHunkFree( s_hunk.permTop - s_hunk.mark );
+    
+    SDL_AtomicLock( &hunkLock );
     s_hunk.permTop = s_hunk.mark;
     s_hunk.permMax = s_hunk.permTop;
     
     s_hunk.tempMax = s_hunk.tempTop = 0;
+    SDL_AtomicIncRef( &hunkGeneration );
+    SDL_AtomicUnlock( &hunkLock );
+    
+    // without a mark the frame arena block went too
+    if( !s_hunk.mark )
+    {
+        Hunk_FrameInit();
+    }
 }
 
 /*
@@ -2029,8 +3341,6 @@ The server calls this before shutting down or loading a new map
 =================
 */
 
-static void Hunk_FrameInit( void );
-
 void Hunk_Clear( void )
 {
 
@@ -2042,12 +3352,17 @@ void Hunk_Clear( void )
 #ifndef DEDICATED
     CIN_CloseAllVideos();
 #endif
+    Com_AllocProfileHunkFree( s_hunk.permTop );
+    
+    SDL_AtomicLock( &hunkLock );
     s_hunk.permTop = 0;
     s_hunk.permMax = 0;
     s_hunk.tempTop = 0;
     s_hunk.tempMax = 0;
     s_hunk.maxEver = 0;
     s_hunk.mark = 0;
+    SDL_AtomicIncRef( &hunkGeneration );
+    SDL_AtomicUnlock( &hunkLock );
     
     Com_Printf( "Hunk_Clear: reset the hunk ok\n" );
     
@@ -2061,6 +3376,39 @@ void Hunk_Clear( void )
 
 static void Hunk_SwapBanks( void ) { }
 
+/*
+=================
+Hunk_AllocLocked
+
+Takes size bytes off the permanent side, hunkLock must be held
+=================
+*/
+static U8* Hunk_AllocLocked( S32 size )
+{
+    U8*		buf;
+    
+    if( s_hunk.permTop + s_hunk.tempTop + size > s_hunk.memSize )
+    {
+        SDL_AtomicUnlock( &hunkLock );
+#ifdef HUNK_DEBUG
+        Hunk_Log();
+        Hunk_SmallLog();
+#endif
+        Com_Error( ERR_DROP, "Hunk_Alloc failed on %i", size );
+    }
+    
+    buf = s_hunk.mem + s_hunk.permTop;
+    s_hunk.permTop += size;
+    
+    if( s_hunk.permTop > s_hunk.permMax )
+        s_hunk.permMax = s_hunk.permTop;
+    
+    if( s_hunk.permTop + s_hunk.tempTop > s_hunk.maxEver )
+        s_hunk.maxEver = s_hunk.permTop + s_hunk.tempTop;
+    
+    return buf;
+}
+
 /*
 =================
 Hunk_Alloc
@@ -2089,27 +3437,10 @@ void* Hunk_Alloc( S32 size, ha_pref preference )
     // round to cacheline
     size = ( size + 31 ) & ~31;
     
-    if( s_hunk.permTop + s_hunk.tempTop + size > s_hunk.memSize )
-    {
 #ifdef HUNK_DEBUG
-        Hunk_Log();
-        Hunk_SmallLog();
-#endif
-        Com_Error( ERR_DROP, "Hunk_Alloc failed on %i", size );
-    }
-    
-    buf = s_hunk.mem + s_hunk.permTop;
-    s_hunk.permTop += size;
-    
-    if( s_hunk.permTop > s_hunk.permMax )
-        s_hunk.permMax = s_hunk.permTop;
-        
-    if( s_hunk.permTop + s_hunk.tempTop > s_hunk.maxEver )
-        s_hunk.maxEver = s_hunk.permTop + s_hunk.tempTop;
-        
+    SDL_AtomicLock( &hunkLock );
+    buf = Hunk_AllocLocked( size );
     ::memset( buf, 0, size );
-    
-#ifdef HUNK_DEBUG
     {
         hunkblock_t* block;
         
@@ -2122,6 +3453,49 @@ void* Hunk_Alloc( S32 size, ha_pref preference )
         s_hunk.blocks = block;
         buf = ( ( U8* ) buf ) + sizeof( hunkblock_t );
     }
+    SDL_AtomicUnlock( &hunkLock );
+    
+    if( SDL_AtomicGet( &com_allocProfileActive ) )
+    {
+        Com_AllocProfileAlloc( size, TAG_HUNK );
+    }
+#else
+    // worker threads take small allocations from a chunk of their own
+    zoneThreadCache_t* tc = NULL;
+    
+    if( size <= HUNK_CACHE_MAX && SDL_ThreadID() != hunkMainThread )
+    {
+        tc = Z_GetThreadCache();
+    }
+    
+    if( tc )
+    {
+        if( tc->hunkGeneration != SDL_AtomicGet( &hunkGeneration ) || tc->hunkLeft < size )
+        {
+            SDL_AtomicLock( &hunkLock );
+            tc->hunkChunk = Hunk_AllocLocked( HUNK_CACHE_SIZE );
+            tc->hunkGeneration = SDL_AtomicGet( &hunkGeneration );
+            SDL_AtomicUnlock( &hunkLock );
+            tc->hunkLeft = HUNK_CACHE_SIZE;
+        }
+        
+        buf = tc->hunkChunk;
+        tc->hunkChunk += size;
+        tc->hunkLeft -= size;
+    }
+    else
+    {
+        SDL_AtomicLock( &hunkLock );
+        buf = Hunk_AllocLocked( size );
+        SDL_AtomicUnlock( &hunkLock );
+    }
+    
+    ::memset( buf, 0, size );
+    
+    if( SDL_AtomicGet( &com_allocProfileActive ) )
+    {
+        Com_AllocProfileAlloc( size, TAG_HUNK );
+    }
 #endif
     
     return buf;
@@ -2154,8 +3528,11 @@ void* Hunk_AllocateTempMemory( S32 size )
     
     size = PAD( size, sizeof( intptr_t ) ) + sizeof( hunkHeader_t );
     
+    SDL_AtomicLock( &hunkLock );
+    
     if( s_hunk.permTop + s_hunk.tempTop + size > s_hunk.memSize )
     {
+        SDL_AtomicUnlock( &hunkLock );
         Com_Error( ERR_DROP, "Hunk_AllocateTempMemory: failed on %i", size );
     }
     
@@ -2174,6 +3551,8 @@ void* Hunk_AllocateTempMemory( S32 size )
     hdr->magic = HUNK_MAGIC;
     hdr->size = size;
     
+    SDL_AtomicUnlock( &hunkLock );
+    
     // don't bother clearing, because we are going to load a file over it
     return buf;
 }
@@ -2205,14 +3584,21 @@ void Hunk_FreeTempMemory( void* buf )
         Com_Error( ERR_FATAL, "Hunk_FreeTempMemory: bad magic" );
     }
     
+    SDL_AtomicLock( &hunkLock );
     hdr->magic = HUNK_FREE_MAGIC;
     
-    // this only works if the files are freed in stack order,
-    // otherwise the memory will stay around until Hunk_ClearTempMemory
-    if( ( U8* )hdr == s_hunk.mem + s_hunk.memSize - s_hunk.tempTop )
+    // the memory comes back once everything above it is freed as well,
+    // whatever is left over stays around until Hunk_ClearTempMemory
+    while( s_hunk.tempTop )
     {
+        hdr = ( hunkHeader_t* )( s_hunk.mem + s_hunk.memSize - s_hunk.tempTop );
+        if( hdr->magic != HUNK_FREE_MAGIC )
+        {
+            break;
+        }
         s_hunk.tempTop -= hdr->size;
     }
+    SDL_AtomicUnlock( &hunkLock );
 }
 
 
@@ -2229,50 +3615,354 @@ void Hunk_ClearTempMemory( void )
 {
     if( s_hunk.mem )
     {
+        SDL_AtomicLock( &hunkLock );
         s_hunk.tempTop = 0;
         s_hunk.tempMax = 0;
+        SDL_AtomicUnlock( &hunkLock );
+    }
+}
+
+/*
+==============================================================================
+
+FRAME ARENAS
+
+Scratch memory that stays valid until the end of the frame.  Every thread
+bumps through an arena of its own, so there is no locking.  The main thread
+starts out in com_hunkFrameMegs staked out on the hunk, other threads in a
+block of the same size allocated the first time they ask.  When a frame
+needs more, further blocks are chained on and kept for the frames after.
+Hunk_FrameReset only bumps a frame number, each arena rewinds itself on its
+next allocation.
+
+==============================================================================
+*/
+
+typedef struct frameBlock_s
+{
+    struct frameBlock_s* next;
+    U8*             data;
+    U8*             end;
+    bool            onHunk;
+} frameBlock_t;
+
+typedef struct frameArena_s
+{
+    struct frameArena_s* next; // all arenas, for meminfo
+    frameBlock_t*   blocks;
+    frameBlock_t*   current;
+    U8*             loc;
+    U64             usedBefore; // bytes of this frame in the blocks before current
+    U64             highWater;
+    S32             frame;
+    S32             numBlocks;
+    SDL_threadID    thread;
+} frameArena_t;
+
+static frameArena_t s_mainFrameArena;
+static frameArena_t* frameArenas = &s_mainFrameArena;
+static SDL_SpinLock frameArenaLock; // guards frameArenas
+static SDL_TLSID frameArenaTLS;
+static SDL_atomic_t frameNumber;
+static U64 frameBlockSize;
+
+/*
+=================
+Hunk_FreeFrameArena
+
+Thread local storage destructor of the worker arenas
+=================
+*/
+static void SDLCALL Hunk_FreeFrameArena( void* data )
+{
+    frameArena_t*	arena, **prev;
+    frameBlock_t*	block, *next;
+    
+    arena = ( frameArena_t* )data;
+    
+    SDL_AtomicLock( &frameArenaLock );
+    for( prev = &frameArenas; *prev; prev = &( *prev )->next )
+    {
+        if( *prev == arena )
+        {
+            *prev = arena->next;
+            break;
+        }
+    }
+    SDL_AtomicUnlock( &frameArenaLock );
+    
+    for( block = arena->blocks; block; block = next )
+    {
+        next = block->next;
+        free( block );
+    }
+    free( arena );
+}
+
+/*
+=================
+Hunk_GetFrameArena
+=================
+*/
+static frameArena_t* Hunk_GetFrameArena( void )
+{
+    frameArena_t*	arena;
+    
+    if( !frameArenaTLS || SDL_ThreadID() == hunkMainThread )
+    {
+        return &s_mainFrameArena;
+    }
+    
+    arena = ( frameArena_t* )SDL_TLSGet( frameArenaTLS );
+    if( !arena )
+    {
+        arena = ( frameArena_t* )calloc( 1, sizeof( *arena ) );
+        if( !arena )
+        {
+            Com_Error( ERR_FATAL, "Hunk_FrameAlloc: couldn't allocate a frame arena" );
+        }
+        arena->thread = SDL_ThreadID();
+        arena->frame = SDL_AtomicGet( &frameNumber );
+        
+        SDL_AtomicLock( &frameArenaLock );
+        arena->next = frameArenas->next;
+        frameArenas->next = arena;
+        SDL_AtomicUnlock( &frameArenaLock );
+        
+        SDL_TLSSet( frameArenaTLS, arena, Hunk_FreeFrameArena );
+    }
+    
+    return arena;
+}
+
+/*
+=================
+Hunk_AddFrameBlock
+
+Chains a block of at least size bytes onto the end of the arena
+=================
+*/
+static frameBlock_t* Hunk_AddFrameBlock( frameArena_t* arena, U64 size )
+{
+    frameBlock_t*	block, **tail;
+    U64			blockSize;
+    
+    blockSize = size > frameBlockSize ? size : frameBlockSize;
+    
+    block = ( frameBlock_t* )malloc( sizeof( *block ) + blockSize + 15 );
+    if( !block )
+    {
+        Com_Error( ERR_FATAL, "Hunk_FrameAlloc: failed on %llu bytes", ( unsigned long long )size );
+    }
+    block->next = NULL;
+    block->data = ( U8* )( ( ( intptr_t )( block + 1 ) + 15 ) & ~15 );
+    block->end = block->data + blockSize;
+    block->onHunk = false;
+    
+    for( tail = &arena->blocks; *tail; tail = &( *tail )->next )
+    {
     }
+    *tail = block;
+    arena->numBlocks++;
+    
+    return block;
 }
 
-static U8* s_frameStackLoc = 0;
-static U8* s_frameStackBase = 0;
-static U8* s_frameStackEnd = 0;
+/*
+=================
+Hunk_FrameInit
 
+Stakes out the main thread's first block on the hunk, called whenever the
+hunk is cleared
+=================
+*/
 static void Hunk_FrameInit( void )
 {
     S32 megs = cvarSystem->Get( "com_hunkFrameMegs", "1", CVAR_LATCH | CVAR_ARCHIVE )->integer;
-    U64 cb;
+    frameBlock_t* block;
+    frameArena_t* arena = &s_mainFrameArena;
     
     if( megs < 1 )
         megs = 1;
         
-    cb = 1024 * 1024 * megs;
+    frameBlockSize = 1024 * 1024 * megs;
+    
+    if( !frameArenaTLS )
+    {
+        frameArenaTLS = SDL_TLSCreate();
+    }
+    arena->thread = hunkMainThread;
+    
+    // the old hunk block went with the hunk
+    if( arena->blocks && arena->blocks->onHunk )
+    {
+        arena->blocks = arena->blocks->next;
+        arena->numBlocks--;
+    }
     
-    s_frameStackBase = ( U8* )Hunk_Alloc( cb, h_low );
-    s_frameStackEnd = s_frameStackBase + cb;
+    block = ( frameBlock_t* )Hunk_Alloc( sizeof( *block ) + frameBlockSize, h_low );
+    block->data = ( U8* )( block + 1 );
+    block->end = block->data + frameBlockSize;
+    block->onHunk = true;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->numBlocks++;
     
-    s_frameStackLoc = s_frameStackBase;
+    // rewind on the next allocation
+    arena->current = NULL;
+    arena->frame = SDL_AtomicGet( &frameNumber ) - 1;
 }
 
+/*
+=================
+Hunk_FrameAlloc
 
+Returns 16 byte aligned memory that is NOT 0 filled and stays valid until
+the next Hunk_FrameReset, only to be used by the calling thread
+=================
+*/
 void* Hunk_FrameAlloc( U64 cb )
 {
-    void* ret;
+    frameArena_t*	arena;
+    frameBlock_t*	block;
+    void*		ret;
+    U64			used;
     
-    if( s_frameStackLoc + cb >= s_frameStackEnd )
-        //out of frame stack memory
-        return 0;
+    arena = Hunk_GetFrameArena();
+    cb = ( cb + 15 ) & ~( U64 )15;
+    
+    if( arena->frame != SDL_AtomicGet( &frameNumber ) || !arena->current )
+    {
+        arena->frame = SDL_AtomicGet( &frameNumber );
+        arena->current = arena->blocks;
+        arena->loc = arena->blocks ? arena->blocks->data : NULL;
+        arena->usedBefore = 0;
+    }
+    
+    block = arena->current;
+    while( !block || ( U64 )( block->end - arena->loc ) < cb )
+    {
+        if( block )
+        {
+            arena->usedBefore += block->end - block->data;
+        }
+        
+        // out of this block, move on to the next one or chain a new one on
+        block = block ? block->next : NULL;
+        if( !block )
+        {
+            block = Hunk_AddFrameBlock( arena, cb );
+        }
         
-    ret = s_frameStackLoc;
-    s_frameStackLoc += cb;
+        arena->current = block;
+        arena->loc = block->data;
+    }
+    
+    ret = arena->loc;
+    arena->loc += cb;
+    
+    used = arena->usedBefore + ( arena->loc - block->data );
+    if( used > arena->highWater )
+    {
+        arena->highWater = used;
+    }
     
-    //::memset( ret, 0, cb );
     return ret;
 }
 
+/*
+=================
+Hunk_FrameMark
+
+Remembers where the calling thread's arena is, for Hunk_FrameResetTo
+=================
+*/
+void* Hunk_FrameMark( void )
+{
+    frameArena_t*	arena;
+    
+    arena = Hunk_GetFrameArena();
+    if( arena->frame != SDL_AtomicGet( &frameNumber ) || !arena->current )
+    {
+        return NULL;
+    }
+    
+    return arena->loc;
+}
+
+/*
+=================
+Hunk_FrameResetTo
+
+Gives back everything the calling thread allocated since the mark
+=================
+*/
+void Hunk_FrameResetTo( void* mark )
+{
+    frameArena_t*	arena;
+    frameBlock_t*	block;
+    U64			usedBefore;
+    
+    arena = Hunk_GetFrameArena();
+    if( !mark || arena->frame != SDL_AtomicGet( &frameNumber ) )
+    {
+        // taken before the first allocation of the frame
+        arena->current = NULL;
+        return;
+    }
+    
+    usedBefore = 0;
+    for( block = arena->blocks; block; block = block->next )
+    {
+        if( ( U8* )mark >= block->data && ( U8* )mark <= block->end )
+        {
+            arena->current = block;
+            arena->loc = ( U8* )mark;
+            arena->usedBefore = usedBefore;
+            return;
+        }
+        usedBefore += block->end - block->data;
+        
+        if( block == arena->current )
+        {
+            break;
+        }
+    }
+    
+    Com_Error( ERR_FATAL, "Hunk_FrameResetTo: mark is not in the frame arena" );
+}
+
+/*
+=================
+Hunk_FrameReset
+
+Called at the start of every frame, all frame memory of every thread is
+given back
+=================
+*/
 void Hunk_FrameReset( void )
 {
-    s_frameStackLoc = s_frameStackBase;
+    SDL_AtomicIncRef( &frameNumber );
+}
+
+/*
+=================
+Hunk_FrameInfo
+
+Prints the high water mark of every thread's arena
+=================
+*/
+static void Hunk_FrameInfo( void )
+{
+    frameArena_t*	arena;
+    
+    SDL_AtomicLock( &frameArenaLock );
+    for( arena = frameArenas; arena; arena = arena->next )
+    {
+        Com_Printf( "%8i K frame arena high water of thread %lu, %i block%s\n", ( S32 )( arena->highWater / 1024 ),
+                    ( unsigned long )arena->thread, arena->numBlocks, arena->numBlocks == 1 ? "" : "s" );
+    }
+    SDL_AtomicUnlock( &frameArenaLock );
 }
 
 /*
@@ -3156,6 +4846,11 @@ void Com_Init( UTF8* commandLine )
     // done early so bind command exists
     CL_InitKeyCommands();
     
+    // the filesystem spreads pk3 loading over the workers
+    Com_InitJobs();
+    
+    Com_InitAllocProfile();
+    
     fileSystem->InitFilesystem();
     
     Sys_SteamInit();
@@ -3581,6 +5276,11 @@ void Com_Frame( void )
         return;					// an ERR_DROP was thrown
     }
     
+    // whatever the last frame allocated in the frame arenas is gone
+    Hunk_FrameReset();
+    
+    Com_AllocProfileFrame();
+    
     // bk001204 - init to zero.
     //  also:  might be clobbered by `longjmp' or `vfork'
     timeBeforeFirstEvents = 0;
@@ -3665,6 +5365,7 @@ void Com_Frame( void )
     
     Cbuf_Execute();
     Cdelay_Frame();
+    fileSystem->RunAsyncCallbacks();
     
     lastTime = com_frameTime;
     
@@ -3853,6 +5554,8 @@ void Com_Shutdown( bool badProfile )
     // Shut Down SQL
     databaseSystem->Shutdown();
     
+    Com_ShutdownJobs();
+    
     // Dushan
 #if defined(USE_HTTP)
     Net_HTTP_Kill();
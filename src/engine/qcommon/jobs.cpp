@@ -0,0 +1,299 @@
+////////////////////////////////////////////////////////////////////////////////////////
+// Copyright(C) 1999 - 2010 id Software LLC, a ZeniMax Media company.
+// Copyright(C) 2011 - 2018 Dusan Jocic <dusanjocic@msn.com>
+//
+// This file is part of the OpenWolf GPL Source Code.
+// OpenWolf Source Code is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenWolf Source Code is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenWolf Source Code.  If not, see <http://www.gnu.org/licenses/>.
+//
+// In addition, the OpenWolf Source Code is also subject to certain additional terms.
+// You should have received a copy of these additional terms immediately following the
+// terms and conditions of the GNU General Public License which accompanied the
+// OpenWolf Source Code. If not, please request a copy in writing from id Software
+// at the address below.
+//
+// If you have questions concerning this license or the applicable additional terms,
+// you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+// Suite 120, Rockville, Maryland 20850 USA.
+//
+// -------------------------------------------------------------------------------------
+// File name:   jobs.cpp
+// Version:     v1.01
+// Created:
+// Compilers:   Visual Studio 2017, gcc 7.3.0
+// Description: Worker threads for spreading independent work across cores
+// -------------------------------------------------------------------------------------
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef DEDICATED
+#include <null/null_precompiled.h>
+#else
+#include <OWLib/precompiled.h>
+#endif
+
+/*
+
+A batch is a function and a count.  Every worker, and the thread that posted
+the batch, keeps pulling the next index until all of them are handed out, so
+uneven items balance themselves.  Only one batch runs at a time and only the
+main thread posts them.
+
+The jobs must not touch the zone, the hunk, cvars or print, none of which
+are safe to use from the workers.
+
+*/
+
+typedef struct
+{
+    jobFunc_t       func;
+    void*           data;
+    S32             count;
+    SDL_atomic_t    next;       // next index to hand out
+    SDL_atomic_t    finished;   // indices done
+} jobBatch_t;
+
+static cvar_t*      com_jobWorkers;
+
+static SDL_Thread*  jobThreads[MAX_JOB_WORKERS];
+static S32          jobNumWorkers;
+static SDL_mutex*   jobLock;
+static SDL_cond*    jobWake;    // a batch was posted or the workers should quit
+static SDL_cond*    jobDone;    // the last index finished or a worker let go of the batch
+static jobBatch_t*  jobBatch;
+static S32          jobSequence;
+static S32          jobActive;  // workers still holding jobBatch
+static bool         jobQuit;
+
+/*
+=================
+Com_RunBatch
+=================
+*/
+static void Com_RunBatch( jobBatch_t* batch )
+{
+    S32             i;
+    
+    while( ( i = SDL_AtomicAdd( &batch->next, 1 ) ) < batch->count )
+    {
+        batch->func( batch->data, i );
+        
+        if( SDL_AtomicAdd( &batch->finished, 1 ) + 1 == batch->count )
+        {
+            SDL_LockMutex( jobLock );
+            SDL_CondBroadcast( jobDone );
+            SDL_UnlockMutex( jobLock );
+        }
+    }
+}
+
+/*
+=================
+Com_JobThread
+=================
+*/
+static S32 Com_JobThread( void* )
+{
+    jobBatch_t*     batch;
+    S32             sequence;
+    
+    sequence = 0;
+    
+    SDL_LockMutex( jobLock );
+    while( 1 )
+    {
+        while( !jobQuit && ( !jobBatch || jobSequence == sequence ) )
+        {
+            SDL_CondWait( jobWake, jobLock );
+        }
+        
+        if( jobQuit )
+        {
+            break;
+        }
+        
+        sequence = jobSequence;
+        batch = jobBatch;
+        jobActive++;
+        SDL_UnlockMutex( jobLock );
+        
+        Com_RunBatch( batch );
+        
+        SDL_LockMutex( jobLock );
+        if( !--jobActive )
+        {
+            SDL_CondBroadcast( jobDone );
+        }
+    }
+    SDL_UnlockMutex( jobLock );
+    
+    return 0;
+}
+
+/*
+=================
+Com_InitJobs
+=================
+*/
+void Com_InitJobs( void )
+{
+    S32             i, count;
+    
+    com_jobWorkers = cvarSystem->Get( "com_jobWorkers", "-1", CVAR_ARCHIVE | CVAR_LATCH );
+    
+    // one worker per core besides the main thread
+    count = com_jobWorkers->integer;
+    if( count < 0 )
+    {
+        count = SDL_GetCPUCount() - 1;
+    }
+    
+    if( count > MAX_JOB_WORKERS )
+    {
+        count = MAX_JOB_WORKERS;
+    }
+    
+    if( count <= 0 )
+    {
+        return;
+    }
+    
+    jobLock = SDL_CreateMutex();
+    jobWake = SDL_CreateCond();
+    jobDone = SDL_CreateCond();
+    if( !jobLock || !jobWake || !jobDone )
+    {
+        Com_Printf( S_COLOR_YELLOW "WARNING: couldn't create job worker locks: %s\n", SDL_GetError() );
+        Com_ShutdownJobs();
+        return;
+    }
+    
+    for( i = 0; i < count; i++ )
+    {
+        jobThreads[i] = SDL_CreateThread( Com_JobThread, "jobWorker", NULL );
+        if( !jobThreads[i] )
+        {
+            Com_Printf( S_COLOR_YELLOW "WARNING: couldn't create job worker: %s\n", SDL_GetError() );
+            break;
+        }
+        jobNumWorkers++;
+    }
+    
+    Com_Printf( "%i job workers\n", jobNumWorkers );
+}
+
+/*
+=================
+Com_ShutdownJobs
+=================
+*/
+void Com_ShutdownJobs( void )
+{
+    S32             i;
+    
+    if( jobNumWorkers )
+    {
+        SDL_LockMutex( jobLock );
+        jobQuit = true;
+        SDL_CondBroadcast( jobWake );
+        SDL_UnlockMutex( jobLock );
+        
+        for( i = 0; i < jobNumWorkers; i++ )
+        {
+            SDL_WaitThread( jobThreads[i], NULL );
+            jobThreads[i] = NULL;
+        }
+        jobNumWorkers = 0;
+    }
+    
+    if( jobDone )
+    {
+        SDL_DestroyCond( jobDone );
+        jobDone = NULL;
+    }
+    if( jobWake )
+    {
+        SDL_DestroyCond( jobWake );
+        jobWake = NULL;
+    }
+    if( jobLock )
+    {
+        SDL_DestroyMutex( jobLock );
+        jobLock = NULL;
+    }
+    
+    jobQuit = false;
+}
+
+/*
+=================
+Com_JobWorkers
+
+Number of threads besides the caller that share a batch
+=================
+*/
+S32 Com_JobWorkers( void )
+{
+    return jobNumWorkers;
+}
+
+/*
+=================
+Com_RunJobs
+
+Calls func( data, i ) for every i below count, spread over the workers, and
+returns once all of them are done.  The order of the calls is undefined.
+=================
+*/
+void Com_RunJobs( jobFunc_t func, void* data, S32 count )
+{
+    jobBatch_t      batch;
+    S32             i;
+    
+    if( count <= 0 )
+    {
+        return;
+    }
+    
+    if( !jobNumWorkers || count == 1 )
+    {
+        for( i = 0; i < count; i++ )
+        {
+            func( data, i );
+        }
+        return;
+    }
+    
+    batch.func = func;
+    batch.data = data;
+    batch.count = count;
+    SDL_AtomicSet( &batch.next, 0 );
+    SDL_AtomicSet( &batch.finished, 0 );
+    
+    SDL_LockMutex( jobLock );
+    jobBatch = &batch;
+    jobSequence++;
+    SDL_CondBroadcast( jobWake );
+    SDL_UnlockMutex( jobLock );
+    
+    // help out instead of just waiting
+    Com_RunBatch( &batch );
+    
+    // the batch lives on this stack, so wait for every worker to let go of it
+    SDL_LockMutex( jobLock );
+    while( SDL_AtomicGet( &batch.finished ) < count || jobActive )
+    {
+        SDL_CondWait( jobDone, jobLock );
+    }
+    jobBatch = NULL;
+    SDL_UnlockMutex( jobLock );
+}
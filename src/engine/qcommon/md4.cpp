@@ -59,8 +59,6 @@ struct mdfour
    It assumes that a S32 is at least 32 bits long
 */
 
-static struct mdfour* m;
-
 #define F(X,Y,Z) (((X)&(Y)) | ((~(X))&(Z)))
 #define G(X,Y,Z) (((X)&(Y)) | ((X)&(Z)) | ((Y)&(Z)))
 #define H(X,Y,Z) ((X)^(Y)^(Z))
@@ -71,7 +69,7 @@ static struct mdfour* m;
 #define ROUND3(a,b,c,d,k,s) a = lshift(a + H(b,c,d) + X[k] + 0x6ED9EBA1,s)
 
 /* this applies md4 to 64 U8 chunks */
-static void mdfour64( U32* M )
+static void mdfour64( struct mdfour* m, U32* M )
 {
     S32 j;
     U32 AA, BB, CC, DD;
@@ -181,7 +179,7 @@ void mdfour_begin( struct mdfour* md )
     md->totalN = 0;
 }
 
-static void mdfour_tail( U8* in, S32 n )
+static void mdfour_tail( struct mdfour* m, U8* in, S32 n )
 {
     U8 buf[128];
     U32 M[16];
@@ -199,15 +197,15 @@ static void mdfour_tail( U8* in, S32 n )
     {
         copy4( buf + 56, b );
         copy64( M, buf );
-        mdfour64( M );
+        mdfour64( m, M );
     }
     else
     {
         copy4( buf + 120, b );
         copy64( M, buf );
-        mdfour64( M );
+        mdfour64( m, M );
         copy64( M, buf + 64 );
-        mdfour64( M );
+        mdfour64( m, M );
     }
 }
 
@@ -215,30 +213,26 @@ static void mdfour_update( struct mdfour* md, U8* in, S32 n )
 {
     U32 M[16];
 
-    m = md;
-
-    if( n == 0 ) mdfour_tail( in, n );
+    if( n == 0 ) mdfour_tail( md, in, n );
 
     while( n >= 64 )
     {
         copy64( M, in );
-        mdfour64( M );
+        mdfour64( md, M );
         in += 64;
         n -= 64;
-        m->totalN += 64;
+        md->totalN += 64;
     }
 
-    mdfour_tail( in, n );
+    mdfour_tail( md, in, n );
 }
 
 static void mdfour_result( struct mdfour* md, U8* out )
 {
-    m = md;
-
-    copy4( out, m->A );
-    copy4( out + 4, m->B );
-    copy4( out + 8, m->C );
-    copy4( out + 12, m->D );
+    copy4( out, md->A );
+    copy4( out + 4, md->B );
+    copy4( out + 8, md->C );
+    copy4( out + 12, md->D );
 }
 
 void mdfour( U8* out, U8* in, S32 n )
@@ -498,6 +498,28 @@ void			Cmd_LiteralArgsBuffer( UTF8* buffer, S32 bufferLength );
 void 			Cmd_SaveCmdContext( void );
 void			Cmd_RestoreCmdContext( void );
 
+// A token as a view into the text it was split from, not 0 terminated.
+// Splitting into spans copies nothing and the caller owns the cmdTokens_t,
+// so unlike Cmd_TokenizeString it can be used from any thread and nested.
+typedef struct
+{
+    StringEntry     text;
+    S32             length;
+    bool            escaped;	// holds \" that Cmd_SpanCopy turns into "
+    bool            quoted;		// text is just past the opening quote
+} cmdSpan_t;
+
+typedef struct
+{
+    S32             argc;
+    cmdSpan_t       argv[MAX_STRING_TOKENS];
+} cmdTokens_t;
+
+S32             Cmd_TokenizeSpans( StringEntry text, cmdTokens_t* tokens, bool ignoreQuotes );
+S32             Cmd_SpanCopy( const cmdSpan_t* span, UTF8* buffer, S32 bufferLength );
+S32             Cmd_SpanCompare( const cmdSpan_t* span, StringEntry s );
+StringEntry     Cmd_SpanArgsFrom( const cmdTokens_t* tokens, S32 arg );
+
 // Takes a null terminated string.  Does not need to be /n terminated.
 // breaks the string up into arg tokens.
 
@@ -673,7 +695,9 @@ typedef enum
     TAG_RENDERER,
     TAG_SMALL,
     TAG_CRYPTO,
-    TAG_STATIC
+    TAG_STATIC,
+    TAG_SLAB, // zone blocks the small allocations are carved from
+    TAG_HUNK // only for reporting hunk allocations to the allocation profiler
 } memtag_t;
 
 /*
@@ -730,9 +754,36 @@ S32             Hunk_MemoryRemaining( void );
 void            Hunk_SmallLog( void );
 void            Hunk_Log( void );
 
+// per thread scratch memory that lives until the next Hunk_FrameReset
+void*           Hunk_FrameAlloc( U64 cb );	// NOT 0 filled, 16 byte aligned
+void*           Hunk_FrameMark( void );
+void            Hunk_FrameResetTo( void* mark );
+void            Hunk_FrameReset( void );
+
+template<typename T>
+T* Hunk_FrameAllocArray( U64 count )
+{
+    return static_cast<T*>( Hunk_FrameAlloc( sizeof( T ) * count ) );
+}
+
+template<typename T>
+T* Hunk_FrameAllocType( void )
+{
+    return Hunk_FrameAllocArray<T>( 1 );
+}
+
 void            Com_TouchMemory( void );
 void            Com_ReleaseMemory( void );
 
+// sampling allocation profiler, see allocprof.cpp
+extern SDL_atomic_t com_allocProfileActive;
+
+void            Com_InitAllocProfile( void );
+void            Com_AllocProfileFrame( void );
+S32             Com_AllocProfileAlloc( S32 size, S32 tag );
+void            Com_AllocProfileFree( S32 profile, S32 size, S32 tag );
+void            Com_AllocProfileHunkFree( S32 bytes );
+
 // commandLine should not include the executable name (argv[0])
 void            Com_Init( UTF8* commandLine );
 void            Com_Frame( void );
@@ -744,6 +795,23 @@ void			CL_ShutdownUI( void );
 /*
 ==============================================================
 
+JOBS
+
+==============================================================
+*/
+
+#define MAX_JOB_WORKERS 16
+
+typedef void ( *jobFunc_t )( void* data, S32 index );
+
+void            Com_InitJobs( void );
+void            Com_ShutdownJobs( void );
+S32             Com_JobWorkers( void );
+void            Com_RunJobs( jobFunc_t func, void* data, S32 count );
+
+/*
+==============================================================
+
 CLIENT / SERVER SYSTEMS
 
 ==============================================================
@@ -907,6 +975,13 @@ void            Sys_Print( StringEntry msg );
 // any game related timing information should come from event timestamps
 S32             Sys_Milliseconds( void );
 
+// high resolution monotonic timer, only meaningful as a difference
+S64             Sys_Microseconds( void );
+
+// return addresses of the calling stack, for the allocation profiler
+S32             Sys_Backtrace( void** frames, S32 maxFrames, S32 skip );
+void            Sys_BacktraceSymbol( void* address, UTF8* buf, S32 size );
+
 void            Sys_SnapVector( F32* v );
 
 bool		Sys_RandomBytes( U8* string, S32 len );
@@ -947,6 +1022,29 @@ UTF8*           Sys_ConsoleInput( void );
 UTF8**          Sys_ListFiles( StringEntry directory, StringEntry extension, UTF8* filter, S32* numfiles, bool wantsubs );
 void            Sys_FreeFileList( UTF8** list );
 
+// private copy on write view of part of a file
+typedef struct
+{
+    void*           base;
+    size_t          size;
+} sysMapping_t;
+
+void*           Sys_MapFile( FILE* f, S64 offset, S32 length, sysMapping_t* mapping );
+void            Sys_UnmapFile( sysMapping_t* mapping );
+
+// zeroed memory for the hunk and the zones, hugePages is 0 for normal pages,
+// 1 for transparent huge pages and 2 for explicit ones
+typedef struct
+{
+    void*           base;
+    size_t          size;
+    S32             hugePages;  // what the block actually got
+} sysMemory_t;
+
+void*           Sys_AllocMemory( size_t size, S32 hugePages, sysMemory_t* memory );
+void            Sys_FreeMemory( sysMemory_t* memory );
+S64             Sys_TLBMisses( void );
+
 void			Sys_Sleep( S32 msec );
 
 bool        Sys_OpenUrl( StringEntry url );
@@ -113,11 +113,12 @@ extern int errno;
 #define UNZ_MAXFILENAMEINZIP (256)
 #endif
 
+// not the zone, handles are opened and read on the file system's I/O threads too
 #ifndef ALLOC
-# define ALLOC(size) (Z_Malloc(size))
+# define ALLOC(size) (malloc(size))
 #endif
 #ifndef TRYFREE
-# define TRYFREE(p) {if (p) Z_Free(p);}
+# define TRYFREE(p) {if (p) free(p);}
 #endif
 
 #define SIZECENTRALDIRITEM (0x2e)
@@ -191,6 +192,8 @@ typedef struct
     
     int isZip64;
     
+    ZPOS64_T known_data_offset;    /* set by unzOpenCurrentFileAt, 0 if unknown */
+
 #    ifndef NOUNCRYPT
     unsigned long keys[3];     /* keys defining the pseudo-random sequence */
     const unsigned long* pcrc_32_tab;
@@ -755,6 +758,7 @@ local unzFile unzOpenInternal( const void* path,
     us.central_pos = central_pos;
     us.pfile_in_zip_read = NULL;
     us.encrypted = 0;
+    us.known_data_offset = 0;
     
     
     s = ( unz64_s* )ALLOC( sizeof( unz64_s ) );
@@ -1504,8 +1508,21 @@ extern int ZEXPORT unzOpenCurrentFile3( unzFile file, int* method,
     if( s->pfile_in_zip_read != NULL )
         unzCloseCurrentFile( file );
         
-    if( unz64local_CheckCurrentFileCoherencyHeader( s, &iSizeVar, &offset_local_extrafield, &size_local_extrafield ) != UNZ_OK )
-        return UNZ_BADZIPFILE;
+    if( s->known_data_offset >= s->cur_file_info_internal.offset_curfile + SIZEZIPLOCALHEADER + s->cur_file_info.size_filename )
+    {
+        /* the caller remembered where the data starts from an earlier open,
+           so the local header doesn't have to be read and checked again */
+        iSizeVar = ( uInt )( s->known_data_offset - s->cur_file_info_internal.offset_curfile - SIZEZIPLOCALHEADER );
+        offset_local_extrafield = s->cur_file_info_internal.offset_curfile + SIZEZIPLOCALHEADER + s->cur_file_info.size_filename;
+        size_local_extrafield = iSizeVar - ( uInt )s->cur_file_info.size_filename;
+        s->known_data_offset = 0;
+    }
+    else
+    {
+        s->known_data_offset = 0;
+        if( unz64local_CheckCurrentFileCoherencyHeader( s, &iSizeVar, &offset_local_extrafield, &size_local_extrafield ) != UNZ_OK )
+            return UNZ_BADZIPFILE;
+    }
         
     pfile_in_zip_read_info = ( file_in_zip64_read_info_s* )ALLOC( sizeof( file_in_zip64_read_info_s ) );
     if( pfile_in_zip_read_info == NULL )
@@ -1654,6 +1671,29 @@ extern int ZEXPORT unzOpenCurrentFile3( unzFile file, int* method,
     return UNZ_OK;
 }
 
+extern int ZEXPORT unzOpenCurrentFileAt( unzFile file, ZPOS64_T dataOffset )
+{
+    unz64_s* s;
+    
+    if( file == NULL )
+        return UNZ_PARAMERROR;
+    s = ( unz64_s* )file;
+    s->known_data_offset = dataOffset;
+    return unzOpenCurrentFile3( file, NULL, NULL, 0, NULL );
+}
+
+extern ZPOS64_T ZEXPORT unzGetCurrentFileDataOffset( unzFile file )
+{
+    unz64_s* s;
+    
+    if( file == NULL )
+        return 0;
+    s = ( unz64_s* )file;
+    if( s->pfile_in_zip_read == NULL )
+        return 0;
+    return s->pfile_in_zip_read->offset_local_extrafield + s->pfile_in_zip_read->size_local_extrafield;
+}
+
 extern int ZEXPORT unzOpenCurrentFile( unzFile file )
 {
     return unzOpenCurrentFile3( file, NULL, NULL, 0, NULL );
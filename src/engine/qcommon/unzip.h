@@ -333,6 +333,20 @@ extern int ZEXPORT unzOpenCurrentFile OF( ( unzFile file ) );
   If there is no error, the return value is UNZ_OK.
 */
 
+extern int ZEXPORT unzOpenCurrentFileAt OF( ( unzFile file, ZPOS64_T dataOffset ) );
+/*
+  Same as unzOpenCurrentFile, but trusts dataOffset as the position of the
+  file data instead of reading and checking the local header again.
+  dataOffset must come from unzGetCurrentFileDataOffset on the same entry,
+  0 behaves like unzOpenCurrentFile.
+*/
+
+extern ZPOS64_T ZEXPORT unzGetCurrentFileDataOffset OF( ( unzFile file ) );
+/*
+  Position of the data of the currently opened file in the zipfile,
+  0 if no file is open.
+*/
+
 extern int ZEXPORT unzOpenCurrentFilePassword OF( ( unzFile file,
         const char* password ) );
 /*
@@ -424,6 +424,7 @@ extern cvar_t*  sv_fullmsg;
 extern cvar_t*  sv_IPmaxGetstatusPerSecond;
 
 extern cvar_t*  sv_hibernateTime;
+extern cvar_t*  sv_traceCache;
 
 //bani - cl->downloadnotify
 #define DLNOTIFY_REDIRECT   0x00000001	// "Redirecting client ..."
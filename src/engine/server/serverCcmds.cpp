@@ -204,7 +204,7 @@ void idServerCcmdsSystemLocal::Map_f( void )
                 csize = fileSystem->ReadFile( va( "%scurrent.sav", savedir ), NULL );
                 if( csize != size )
                 {
-                    Hunk_FreeTempMemory( buffer );
+                    fileSystem->FreeFile( buffer );
                     fileSystem->Delete( va( "%scurrent.sav", savedir ) );
 // TTimo
 #ifdef __linux__
@@ -234,7 +234,7 @@ void idServerCcmdsSystemLocal::Map_f( void )
                 svs.time = savegameTime;
             }
             
-            Hunk_FreeTempMemory( buffer );
+            fileSystem->FreeFile( buffer );
         }
         else
         {
@@ -523,7 +523,7 @@ void idServerCcmdsSystemLocal::MapRestart_f( void )
             svs.time = savegameTime;
         }
         
-        Hunk_FreeTempMemory( buffer );
+        fileSystem->FreeFile( buffer );
     }
     // done.
     
@@ -699,7 +699,7 @@ void idServerCcmdsSystemLocal::LoadGame_f( void )
                 fileSystem->WriteFile( va( "%scurrent.sav", savedir ), buffer, size );
             }
             
-            Hunk_FreeTempMemory( buffer );
+            fileSystem->FreeFile( buffer );
             
             cvarSystem->Set( "savegame_loading", "2" );	// 2 means it's a restart, so stop rendering until we are loaded
             
@@ -713,7 +713,7 @@ void idServerCcmdsSystemLocal::LoadGame_f( void )
         }
     }
     
-    Hunk_FreeTempMemory( buffer );
+    fileSystem->FreeFile( buffer );
     
     // otherwise, do a slow load
     if( cvarSystem->VariableIntegerValue( "sv_cheats" ) )
@@ -1050,6 +1050,11 @@ void idServerCcmdsSystemLocal::AddOperatorCommands( void )
     Cmd_AddCommand( "map_restart", &idServerCcmdsSystemLocal::MapRestart_f );
     Cmd_AddCommand( "fieldinfo", &idServerCcmdsSystemLocal::FieldInfo_f );
     Cmd_AddCommand( "sectorlist", &idServerWorldSystemLocal::SectorList_f );
+    Cmd_AddCommand( "cm_record", CM_Record_f );
+    Cmd_AddCommand( "cm_stoprecord", CM_StopRecord_f );
+    Cmd_AddCommand( "cm_benchmark", CM_Benchmark_f );
+    Cmd_AddCommand( "cm_areaportaltest", CM_AreaPortalTest_f );
+    Cmd_AddCommand( "tracecachestats", &idServerWorldSystemLocal::TraceCacheStats_f );
     Cmd_AddCommand( "map", &idServerCcmdsSystemLocal::Map_f );
     Cmd_SetCommandCompletionFunc( "map", &idServerCcmdsSystemLocal::CompleteMapName );
     Cmd_AddCommand( "gameCompleteStatus", &idServerCcmdsSystemLocal::GameCompleteStatus_f ); // NERVE - SMF
@@ -1181,6 +1181,8 @@ void idServerInitSystemLocal::Init( void )
     sv_fullmsg = cvarSystem->Get( "sv_fullmsg", "Server is full.", CVAR_ARCHIVE );
     
     sv_hibernateTime = cvarSystem->Get( "sv_hibernateTime", "0", CVAR_ARCHIVE );
+    
+    sv_traceCache = cvarSystem->Get( "sv_traceCache", "0", CVAR_ARCHIVE );
     svs.hibernation.sv_fps = sv_fps->value;
     
     // initialize bot cvars so they arelisted and can be set before loading the botlib
@@ -115,6 +115,8 @@ cvar_t*         sv_fullmsg;
 
 cvar_t*         sv_hibernateTime;
 
+cvar_t*         sv_traceCache;
+
 #define LL( x ) x = LittleLong( x )
 
 /*
@@ -1652,6 +1654,9 @@ void idServerMainSystemLocal::Frame( S32 msec )
         sv.timeResidual -= frameMsec;
         svs.time += frameMsec;
         
+        // memoized traces only live for a single game frame
+        serverWorldSystemLocal.ClearTraceCache();
+        
         // let everything in the world think and move
 #if !defined (UPDATE_SERVER)
         game->RunFrame( svs.time );
@@ -645,7 +645,7 @@ void idServerSnapshotSystemLocal::BuildClientSnapshot( client_t* client )
     S32 i, clientNum;
     vec3_t org;
     clientSnapshot_t* frame;
-    snapshotEntityNumbers_t entityNumbers;
+    snapshotEntityNumbers_t* entityNumbers;
     sharedEntity_t* ent, *clent;
     entityState_t* state;
     svEntity_t* svEnt;
@@ -658,7 +658,8 @@ void idServerSnapshotSystemLocal::BuildClientSnapshot( client_t* client )
     frame = &client->frames[client->netchan.outgoingSequence & PACKET_MASK];
     
     // clear everything in this snapshot
-    entityNumbers.numSnapshotEntities = 0;
+    entityNumbers = Hunk_FrameAllocType<snapshotEntityNumbers_t>();
+    entityNumbers->numSnapshotEntities = 0;
     ::memset( frame->areabits, 0, sizeof( frame->areabits ) );
     
     // show_bug.cgi?id=62
@@ -715,13 +716,13 @@ void idServerSnapshotSystemLocal::BuildClientSnapshot( client_t* client )
 
     // add all the entities directly visible to the eye, which
     // may include portal entities that merge other viewpoints
-    AddEntitiesVisibleFromPoint( org, frame, &entityNumbers /*, false, client->netchan.remoteAddress.type == NA_LOOPBACK */ );
+    AddEntitiesVisibleFromPoint( org, frame, entityNumbers /*, false, client->netchan.remoteAddress.type == NA_LOOPBACK */ );
     
     // if there were portals visible, there may be out of order entities
     // in the list which will need to be resorted for the delta compression
     // to work correctly.  This also catches the error condition
     // of an entity being included twice.
-    qsort( entityNumbers.snapshotEntities, entityNumbers.numSnapshotEntities, sizeof( entityNumbers.snapshotEntities[0] ), QsortEntityNumbers );
+    qsort( entityNumbers->snapshotEntities, entityNumbers->numSnapshotEntities, sizeof( entityNumbers->snapshotEntities[0] ), QsortEntityNumbers );
     
     // now that all viewpoint's areabits have been OR'd together, invert
     // all of them to make it a mask vector, which is what the renderer wants
@@ -734,9 +735,9 @@ void idServerSnapshotSystemLocal::BuildClientSnapshot( client_t* client )
     frame->num_entities = 0;
     frame->first_entity = svs.nextSnapshotEntities;
     
-    for( i = 0; i < entityNumbers.numSnapshotEntities; i++ )
+    for( i = 0; i < entityNumbers->numSnapshotEntities; i++ )
     {
-        ent = serverGameSystem->GentityNum( entityNumbers.snapshotEntities[i] );
+        ent = serverGameSystem->GentityNum( entityNumbers->snapshotEntities[i] );
         state = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
         *state = ent->s;
         svs.nextSnapshotEntities++;
@@ -876,10 +877,13 @@ So we send them "idle" packets with the bare minimum required to keep them on th
 */
 void idServerSnapshotSystemLocal::SendClientIdle( client_t* client )
 {
-    U8 msg_buf[MAX_MSGLEN];
+    U8* msg_buf;
     msg_t msg;
+    void* mark;
     
-    MSG_Init( &msg, msg_buf, sizeof( msg_buf ) );
+    mark = Hunk_FrameMark();
+    msg_buf = Hunk_FrameAllocArray<U8>( MAX_MSGLEN );
+    MSG_Init( &msg, msg_buf, MAX_MSGLEN );
     msg.allowoverflow = true;
     
     // NOTE, MRE: all server->client messages now acknowledge
@@ -903,6 +907,7 @@ void idServerSnapshotSystemLocal::SendClientIdle( client_t* client )
         MSG_Clear( &msg );
         
         serverClientSystem->DropClient( client, "idServerSnapshotSystemLocal::SendClientIdle - Msg overflowed" );
+        Hunk_FrameResetTo( mark );
         return;
     }
     
@@ -910,6 +915,8 @@ void idServerSnapshotSystemLocal::SendClientIdle( client_t* client )
     
     sv.bpsTotalBytes += msg.cursize;			// NERVE - SMF - net debugging
     sv.ubpsTotalBytes += msg.uncompsize / 8;	// NERVE - SMF - net debugging
+    
+    Hunk_FrameResetTo( mark );
 }
 
 /*
@@ -921,8 +928,9 @@ Also called by idServerInitSystemLocal::FinalCommand
 */
 void idServerSnapshotSystemLocal::SendClientSnapshot( client_t* client )
 {
-    U8 msg_buf[MAX_MSGLEN];
+    U8* msg_buf;
     msg_t msg;
+    void* mark;
     
     //bots dont need snapshots
     if( client->gentity && client->gentity->r.svFlags & SVF_BOT )
@@ -942,6 +950,9 @@ void idServerSnapshotSystemLocal::SendClientSnapshot( client_t* client )
         }
     }
     
+    // the snapshot and the message only live until it is sent
+    mark = Hunk_FrameMark();
+    
     // build the snapshot
     BuildClientSnapshot( client );
     
@@ -949,10 +960,12 @@ void idServerSnapshotSystemLocal::SendClientSnapshot( client_t* client )
     // the query them directly without needing to be sent
     if( client->gentity && client->gentity->r.svFlags & SVF_BOT )
     {
+        Hunk_FrameResetTo( mark );
         return;
     }
     
-    MSG_Init( &msg, msg_buf, sizeof( msg_buf ) );
+    msg_buf = Hunk_FrameAllocArray<U8>( MAX_MSGLEN );
+    MSG_Init( &msg, msg_buf, MAX_MSGLEN );
     msg.allowoverflow = true;
     
     // NOTE, MRE: all server->client messages now acknowledge
@@ -976,6 +989,7 @@ void idServerSnapshotSystemLocal::SendClientSnapshot( client_t* client )
         MSG_Clear( &msg );
         
         serverClientSystem->DropClient( client, "idServerSnapshotSystemLocal::SendClientSnapshot : Msg overflowed" );
+        Hunk_FrameResetTo( mark );
         return;
     }
     
@@ -983,6 +997,8 @@ void idServerSnapshotSystemLocal::SendClientSnapshot( client_t* client )
     
     sv.bpsTotalBytes += msg.cursize;			// NERVE - SMF - net debugging
     sv.ubpsTotalBytes += msg.uncompsize / 8;	// NERVE - SMF - net debugging
+    
+    Hunk_FrameResetTo( mark );
 }
 
 /*
@@ -44,6 +44,9 @@
 idServerWorldSystemLocal serverWorldSystemLocal;
 idServerWorldSystem* serverWorldSystem = &serverWorldSystemLocal;
 
+// per-frame memoization of identical Trace queries, see sv_traceCache
+static traceCache_t svTraceCache;
+
 /*
 ===============
 idServerWorldSystemLocal::idServerWorldSystemLocal
@@ -113,6 +116,30 @@ void idServerWorldSystemLocal::SectorList_f( void )
     }
 }
 
+/*
+===============
+idServerWorldSystemLocal::TraceCacheStats_f
+===============
+*/
+void idServerWorldSystemLocal::TraceCacheStats_f( void )
+{
+    CM_TraceCachePrint( &svTraceCache, "server traces" );
+    CM_TraceCachePrint( &cm_worldTraceCache, "world traces" );
+}
+
+/*
+===============
+idServerWorldSystemLocal::ClearTraceCache
+
+Drops every memoized trace, entities may have changed in ways
+that don't go through LinkEntity between frames
+===============
+*/
+void idServerWorldSystemLocal::ClearTraceCache( void )
+{
+    CM_TraceCacheClear( &svTraceCache );
+}
+
 /*
 ===============
 idServerWorldSystemLocal::CreateworldSector
@@ -173,6 +200,8 @@ void idServerWorldSystemLocal::ClearWorld( void )
     memset( sv_worldSectors, 0, sizeof( sv_worldSectors ) );
     sv_numworldSectors = 0;
     
+    ClearTraceCache();
+    
     // get world map bounds
     h = collisionModelManager->InlineModel( 0 );
     collisionModelManager->ModelBounds( h, mins, maxs );
@@ -202,6 +231,9 @@ void idServerWorldSystemLocal::UnlinkEntity( sharedEntity_t* gEnt )
     
     ent->worldSector = NULL;
     
+    // traces through the old position are no longer valid
+    CM_TraceCacheInvalidateBounds( &svTraceCache, gEnt->r.absmin, gEnt->r.absmax );
+    
     if( ws->entities == ent )
     {
         ws->entities = ent->nextEntityInWorldSector;
@@ -336,6 +368,9 @@ void idServerWorldSystemLocal::LinkEntity( sharedEntity_t* gEnt )
     gEnt->r.absmax[1] += 1;
     gEnt->r.absmax[2] += 1;
     
+    // traces through the new position are no longer valid
+    CM_TraceCacheInvalidateBounds( &svTraceCache, gEnt->r.absmin, gEnt->r.absmax );
+    
     // link to PVS leafs
     ent->numClusters = 0;
     ent->lastCluster = 0;
@@ -556,13 +591,19 @@ idServerWorldSystemLocal::ClipMoveToEntities
 */
 void idServerWorldSystemLocal::ClipMoveToEntities( moveclip_t* clip )
 {
-    S32 i, num, touchlist[MAX_GENTITIES], passOwnerNum;
+    S32 i, num, touchlist[MAX_GENTITIES], passOwnerNum, numCapsules, hitNum, clipOrder;
     sharedEntity_t* touch;
     trace_t trace;
     clipHandle_t clipHandle;
     F32* origin, *angles;
+    static vec3_t capsuleMins[MAX_GENTITIES], capsuleMaxs[MAX_GENTITIES];
+    static S32 capsuleNums[MAX_GENTITIES], capsuleOrder[MAX_GENTITIES];
     
     num = serverWorldSystemLocal.AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES );
+    numCapsules = 0;
+    
+    // touchlist index of the entity clip->trace came from, -1 for the world
+    clipOrder = -1;
     
     if( clip->passEntityNum != ENTITYNUM_NONE )
     {
@@ -615,6 +656,16 @@ void idServerWorldSystemLocal::ClipMoveToEntities( moveclip_t* clip )
             continue;
         }
         
+        // capsule against capsule is swept for all of them at once below
+        if( clip->collisionType == TT_CAPSULE && !touch->r.bmodel && ( touch->r.svFlags & SVF_CAPSULE ) )
+        {
+            VectorAdd( touch->r.currentOrigin, touch->r.mins, capsuleMins[numCapsules] );
+            VectorAdd( touch->r.currentOrigin, touch->r.maxs, capsuleMaxs[numCapsules] );
+            capsuleNums[numCapsules] = touchlist[i];
+            capsuleOrder[numCapsules++] = i;
+            continue;
+        }
+        
         // might intersect, so do an exact clip
         clipHandle = ClipHandleForEntity( touch );
         
@@ -661,6 +712,7 @@ void idServerWorldSystemLocal::ClipMoveToEntities( moveclip_t* clip )
             trace.entityNum = touch->s.number;
             clip->trace = trace;
             clip->trace.startsolid = ( bool )( ( ( S32 )clip->trace.startsolid | ( S32 )oldStart ) != 0 );
+            clipOrder = i;
         }
         
         // Reset contents to default
@@ -669,6 +721,42 @@ void idServerWorldSystemLocal::ClipMoveToEntities( moveclip_t* clip )
             collisionModelManager->SetTempBoxModelContents( CONTENTS_BODY );
         }
     }
+    
+    if( !numCapsules || clip->trace.allsolid )
+    {
+        return;
+    }
+    
+    collisionModelManager->CapsuleTraceBatch( &trace, clip->start, clip->end, clip->mins, clip->maxs, capsuleMins, capsuleMaxs, numCapsules, &hitNum );
+    
+    // hitNum is also set for a capsule the trace only started in
+    if( hitNum < 0 )
+    {
+        return;
+    }
+    
+    trace.entityNum = capsuleNums[hitNum];
+    
+    if( trace.allsolid )
+    {
+        clip->trace.allsolid = true;
+    }
+    else if( trace.startsolid )
+    {
+        clip->trace.startsolid = true;
+    }
+    
+    // on a tie the entity earlier in the touchlist wins, as if it were traced in order
+    if( trace.fraction < clip->trace.fraction || ( trace.fraction == clip->trace.fraction && capsuleOrder[hitNum] < clipOrder ) )
+    {
+        bool oldStart;
+        
+        // make sure we keep a startsolid from a previous trace
+        oldStart = clip->trace.startsolid;
+        
+        clip->trace = trace;
+        clip->trace.startsolid = ( bool )( ( ( S32 )clip->trace.startsolid | ( S32 )oldStart ) != 0 );
+    }
 }
 
 
@@ -694,6 +782,11 @@ void idServerWorldSystemLocal::Trace( trace_t* results, const vec3_t start, cons
         maxs = vec3_origin;
     }
     
+    if( sv_traceCache->integer && CM_TraceCacheLookup( &svTraceCache, results, start, end, mins, maxs, passEntityNum, contentmask, type ) )
+    {
+        return;
+    }
+    
     ::memset( &clip, 0, sizeof( moveclip_t ) );
     
     // clip to world
@@ -737,6 +830,11 @@ void idServerWorldSystemLocal::Trace( trace_t* results, const vec3_t start, cons
     // clip to other solid entities
     ClipMoveToEntities( &clip );
     
+    if( sv_traceCache->integer )
+    {
+        CM_TraceCacheStore( &svTraceCache, &clip.trace, start, end, mins, maxs, passEntityNum, contentmask, type, clip.boxmins, clip.boxmaxs );
+    }
+    
     *results = clip.trace;
 }
 
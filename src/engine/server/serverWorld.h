@@ -125,6 +125,8 @@ public:
     static void AreaEntities_r( worldSector_t* node, areaParms_t* ap );
     static void ClipToEntity( trace_t* trace, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, S32 entityNum, S32 contentmask, traceType_t type );
     static void ClipMoveToEntities( moveclip_t* clip );
+    static void ClearTraceCache( void );
+    static void TraceCacheStats_f( void );
 };
 
 extern idServerWorldSystemLocal serverWorldSystemLocal;